@@ -0,0 +1,397 @@
+/*
+ * Presi: end-to-end throughput benchmark
+ *
+ * Generates a synthetic configuration (types, conversion chains, printers) and
+ * a stream of print commands, drives bin/presi against the util/printer daemons
+ * and reports throughput, submit-to-finish latency and spooler CPU as JSON.
+ * Jobs beyond the job table wait in the overflow queue (overflow.h).  Time
+ * spent with nothing to print only because finished jobs still fill the table
+ * (they leave it JOB_RETAIN seconds after finishing) is reported apart, with a
+ * rate that leaves it out.
+ * The converters are "cat" commands, or with -P a converter plugin
+ * (presi_plugin.h), to compare exec and plugin stages.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define BENCH_DIR  "spool/bench"
+#define N_FILES    16
+#define IDLE_LIMIT 60000          /* Give up after this many ms without an event. */
+#define WINDOW     8              /* Print commands in flight before their acknowledgements. */
+
+struct bench_cfg {
+	int n_types;
+	int chain;
+	int n_printers;
+	int n_jobs;
+	int file_size;
+	char *presi;
+	char *out;
+	char *label;
+	int verbose;
+	char *plugin;                 /* <lib.so>:<symbol> converters instead of "cat" */
+};
+
+struct bench_run {
+	double *created;              /* Per job id: JOB_CREATED timestamp. */
+	double *finished;             /* Per job id: JOB_FINISHED/ABORTED timestamp. */
+	int submitted, completed, aborted, rejected;
+	double first_submit, last_finish;
+	double stall_sec;             /* Nothing in the table but finished jobs, and submitted jobs held out of it. */
+	double cpu_sec;
+};
+
+static void usage(char *prog) {
+	fprintf(stderr, "Usage: %s [-T types] [-c chain] [-p printers] [-n jobs] [-s size]"
+		" [-x presi] [-o out.json] [-l label] [-P lib.so:symbol] [-v]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+// Generating the command files and input files for one run
+
+static int write_inputs(struct bench_cfg *cfg) {
+	char *buf = malloc(cfg->file_size);
+	if (!buf) return -1;
+	for (int i=0; i<cfg->file_size; i++) buf[i] = 'a' + i%26;
+
+	for (int k=0; k<N_FILES; k++) {
+		char name[64];
+		snprintf(name, sizeof(name), BENCH_DIR "/in%d.b0", k);
+		FILE *f = fopen(name, "w");
+		if (!f) {
+			free(buf);
+			return -1;
+		}
+		fwrite(buf, 1, cfg->file_size, f);
+		fclose(f);
+	}
+	free(buf);
+	return 0;
+}
+
+static int write_defs(struct bench_cfg *cfg, char *name) {   // Returns the number of commands written
+	FILE *f = fopen(name, "w");
+	if (!f) return -1;
+	int n = 0;
+
+	for (int t=0; t<cfg->n_types; t++, n++)
+		fprintf(f, "type b%d\n", t);
+	for (int t=0; t+1<cfg->n_types; t++, n++)    // A single chain: b0 -> b1 -> ... , trivial converters
+		fprintf(f, "conversion b%d b%d %s%s\n", t, t+1, cfg->plugin ? "plugin:" : "cat", cfg->plugin ? cfg->plugin : "");
+	for (int p=0; p<cfg->n_printers; p++, n+=2)
+		fprintf(f, "printer benchp%d b%d\nenable benchp%d\n", p, cfg->chain, p);
+	fprintf(f, "overflow on " BENCH_DIR "/overflow\n");      // Submissions beyond the job table wait on disk
+	n++;
+
+	fclose(f);
+	return n;
+}
+
+static int write_jobs(struct bench_cfg *cfg, char *name) {
+	FILE *f = fopen(name, "w");
+	if (!f) return -1;
+	for (int i=0; i<cfg->n_jobs; i++)
+		fprintf(f, "print " BENCH_DIR "/in%d.b0\n", i % N_FILES);
+	fclose(f);
+	return 0;
+}
+
+// Parsing the event chatter printed by presi on stderr
+
+static int parse_event(char *line, double *ts, char **name, int *arg) {
+	char *r = line, *w = line;
+	while (*r) {                   // Strip color escape sequences
+		if (*r == '\033') {
+			while (*r && *r != 'm') r++;
+			if (*r) r++;
+			continue;
+		}
+		*w++ = *r++;
+	}
+	*w = '\0';
+
+	char *p = strstr(line, ": ");
+	if (!p || sscanf(line, "%lf", ts) != 1) return -1;
+	*name = p + 2;
+	char *br = strchr(*name, ' ');
+	if (br) {
+		*br = '\0';
+		if (sscanf(br + 1, "[%d", arg) != 1) *arg = -1;
+	} else {
+		*arg = -1;
+	}
+	return 0;
+}
+
+struct line_reader {
+	int fd;
+	char buf[8192];
+	size_t len;
+	char line[8192];
+};
+
+static char *next_line(struct line_reader *r, int timeout) {   // NULL on EOF or timeout
+	for (;;) {
+		char *nl = memchr(r->buf, '\n', r->len);
+		if (nl) {
+			size_t n = nl - r->buf;
+			memcpy(r->line, r->buf, n);
+			r->line[n] = '\0';
+			r->len -= n + 1;
+			memmove(r->buf, nl + 1, r->len);
+			return r->line;
+		}
+		if (r->len == sizeof(r->buf)) r->len = 0;    // Overlong line, drop it
+
+		struct pollfd pfd = { .fd = r->fd, .events = POLLIN };
+		if (poll(&pfd, 1, timeout) <= 0) return NULL;
+		ssize_t n = read(r->fd, r->buf + r->len, sizeof(r->buf) - r->len);
+		if (n <= 0) return NULL;
+		r->len += n;
+	}
+}
+
+static double read_cpu(pid_t pid) {         // CPU time of the spooler itself, in seconds
+	char name[64], buf[1024];
+	unsigned long long ns;
+	snprintf(name, sizeof(name), "/proc/%d/schedstat", (int)pid);
+	FILE *f = fopen(name, "r");
+	if (f) {                                   // Nanosecond resolution where the kernel has it
+		int ok = fscanf(f, "%llu", &ns) == 1;
+		fclose(f);
+		if (ok) return ns / 1e9;
+	}
+
+	snprintf(name, sizeof(name), "/proc/%d/stat", (int)pid);
+	f = fopen(name, "r");
+	if (!f) return -1;
+	size_t n = fread(buf, 1, sizeof(buf)-1, f);
+	fclose(f);
+	buf[n] = '\0';
+
+	char *p = strrchr(buf, ')');
+	unsigned long ut, st;
+	if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &ut, &st) != 2)
+		return -1;
+	return (double)(ut + st) / sysconf(_SC_CLK_TCK);
+}
+
+// Driving the spooler: definitions come from the -i file, print commands are
+// streamed over stdin, up to WINDOW ahead of their acknowledgements, and
+// rejected prints (the overflow queue busy) are retried once a job is deleted.
+// Job ids count from 0 in submission order, so an acknowledgement dates the
+// job it created, even one that went to disk.
+
+static int drive(struct bench_cfg *cfg, char *defs, int n_defs, char *jobsf, struct bench_run *run) {
+	int in[2], err[2];
+	if (pipe(in) < 0 || pipe(err) < 0) return -1;
+
+	pid_t pid = fork();
+	if (pid < 0) return -1;
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		dup2(in[0], STDIN_FILENO);
+		dup2(null, STDOUT_FILENO);
+		dup2(err[1], STDERR_FILENO);
+		close(in[0]); close(in[1]); close(err[0]); close(err[1]); close(null);
+		execl(cfg->presi, cfg->presi, "-i", defs, (char *)NULL);
+		_exit(127);
+	}
+	close(in[0]);
+	close(err[1]);
+
+	FILE *jf = fopen(jobsf, "r");
+	FILE *to = fdopen(in[1], "w");
+	static struct line_reader from;
+	from.fd = err[0];
+	if (!jf || !to) return -1;
+
+	char sent[WINDOW][256], retry[WINDOW][256], *line;     // Commands awaiting their acknowledgement, oldest first
+	int acks = 0, pending = 0, n_retry = 0, blocked = 0, read_all = 0, in_table = 0, live = 0, rc = 0;
+	double stall_start = -1;
+	run->first_submit = -1;
+
+	while (run->completed + run->aborted < cfg->n_jobs) {
+		while (acks >= n_defs && pending < WINDOW && !blocked) {
+			char *cmd = sent[pending];
+			if (n_retry) strcpy(cmd, retry[--n_retry]);
+			else if (read_all || !fgets(cmd, sizeof(sent[0]), jf)) {
+				read_all = 1;
+				break;
+			}
+			fputs(cmd, to);
+			pending++;
+		}
+		fflush(to);
+
+		if (!(line = next_line(&from, IDLE_LIMIT))) {
+			fprintf(stderr, "bench: spooler stalled or exited early\n");
+			rc = -1;
+			break;
+		}
+
+		if (cfg->verbose) fprintf(stderr, "%s\n", line);
+		double ts;
+		char *name;
+		int arg;
+		if (parse_event(line, &ts, &name, &arg) < 0) continue;
+
+		if (!strcmp(name, "CMD_OK") || !strcmp(name, "CMD_ERROR")) {
+			if (acks < n_defs) {
+				acks++;
+			} else if (pending) {
+				if (!strcmp(name, "CMD_OK")) {
+					if (run->submitted < cfg->n_jobs) run->created[run->submitted] = ts;
+					if (run->first_submit < 0) run->first_submit = ts;
+					run->submitted++;
+				} else {
+					run->rejected++;
+					strcpy(retry[n_retry++], sent[0]);
+					blocked = 1;
+				}
+				memmove(sent[0], sent[1], --pending * sizeof(sent[0]));
+			}
+		} else if (!strcmp(name, "JOB_CREATED") && arg >= 0 && arg < cfg->n_jobs) {
+			in_table++;              // Submitted, or paged in
+			live++;
+			if (stall_start >= 0) run->stall_sec += ts - stall_start;
+			stall_start = -1;
+		} else if ((!strcmp(name, "JOB_FINISHED") || !strcmp(name, "JOB_ABORTED"))
+			   && arg >= 0 && arg < cfg->n_jobs) {
+			run->finished[arg] = ts;
+			run->last_finish = ts;
+			live--;
+			if (name[4] == 'F') run->completed++;
+			else run->aborted++;
+		} else if (!strcmp(name, "JOB_DELETED")) {
+			blocked = 0;
+		}
+		if ((blocked || in_table < run->submitted) && !live && stall_start < 0) stall_start = ts;     // Only retention holds the next job back
+	}
+
+	run->cpu_sec = read_cpu(pid);
+	fputs("quit\n", to);
+	fclose(to);
+	while ((line = next_line(&from, IDLE_LIMIT)) && !strstr(line, "FINI"))    // The printer daemons keep
+		;                                                                  // the pipe open, so no EOF
+	close(err[0]);
+	fclose(jf);
+	waitpid(pid, NULL, 0);
+	return rc;
+}
+
+// Reporting
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile(double *v, int n, double q) {
+	if (n == 0) return 0;
+	int i = (int)(q * (n - 1) + 0.5);
+	return v[i];
+}
+
+static int report(struct bench_cfg *cfg, struct bench_run *run) {
+	double *lat = malloc(cfg->n_jobs * sizeof(double));
+	int n = 0;
+	for (int i=0; i<cfg->n_jobs; i++)
+		if (run->created[i] > 0 && run->finished[i] > 0)
+			lat[n++] = (run->finished[i] - run->created[i]) * 1e3;
+	qsort(lat, n, sizeof(double), cmp_double);
+
+	int done = run->completed + run->aborted;
+	double elapsed = run->last_finish - run->first_submit, busy = elapsed - run->stall_sec;
+
+	FILE *f = fopen(cfg->out, "w");
+	if (!f) {
+		free(lat);
+		return -1;
+	}
+	fprintf(f, "{\n");
+	fprintf(f, "  \"label\": \"%s\",\n", cfg->label ? cfg->label : "");
+	fprintf(f, "  \"config\": { \"types\": %d, \"chain\": %d, \"printers\": %d, \"jobs\": %d, \"file_size\": %d, \"converter\": \"%s\" },\n",
+		cfg->n_types, cfg->chain, cfg->n_printers, cfg->n_jobs, cfg->file_size, cfg->plugin ? cfg->plugin : "cat");
+	fprintf(f, "  \"completed\": %d,\n  \"aborted\": %d,\n  \"rejected_submits\": %d,\n",
+		run->completed, run->aborted, run->rejected);
+	fprintf(f, "  \"elapsed_sec\": %.6f,\n", elapsed);
+	fprintf(f, "  \"jobs_per_sec\": %.3f,\n", elapsed > 0 ? done / elapsed : 0);
+	fprintf(f, "  \"retention_bound\": %s,\n  \"retention_stall_sec\": %.6f,\n", run->stall_sec > 0 ? "true" : "false", run->stall_sec);
+	fprintf(f, "  \"jobs_per_sec_excl_stalls\": %.3f,\n", busy > 0 ? done / busy : 0);
+	fprintf(f, "  \"latency_ms\": { \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n",
+		percentile(lat, n, 0.50), percentile(lat, n, 0.99), n ? lat[n-1] : 0);
+	fprintf(f, "  \"spooler_cpu_us_per_job\": %.3f\n", done ? run->cpu_sec * 1e6 / done : 0);
+	fprintf(f, "}\n");
+	fclose(f);
+
+	printf("%d jobs in %.3fs: %.1f jobs/s, p50 %.1fms, p99 %.1fms, %.1fus spooler CPU/job -> %s\n",
+		done, elapsed, elapsed > 0 ? done / elapsed : 0,
+		percentile(lat, n, 0.50), percentile(lat, n, 0.99),
+		done ? run->cpu_sec * 1e6 / done : 0, cfg->out);
+	if (run->stall_sec > 0)
+		printf("retention-bound: %.3fs waiting for finished jobs to leave the table, %.1f jobs/s without it\n",
+			run->stall_sec, busy > 0 ? done / busy : 0);
+	free(lat);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_cfg cfg = { 4, 2, 8, 64, 4096, "bin/presi", "bench_results.json", NULL, 0, NULL };
+	int opt;
+
+	while ((opt = getopt(argc, argv, "T:c:p:n:s:x:o:l:P:v")) != -1) {
+		switch (opt) {
+		case 'T': cfg.n_types = atoi(optarg); break;
+		case 'c': cfg.chain = atoi(optarg); break;
+		case 'p': cfg.n_printers = atoi(optarg); break;
+		case 'n': cfg.n_jobs = atoi(optarg); break;
+		case 's': cfg.file_size = atoi(optarg); break;
+		case 'x': cfg.presi = optarg; break;
+		case 'o': cfg.out = optarg; break;
+		case 'l': cfg.label = optarg; break;
+		case 'P': cfg.plugin = optarg; break;
+		case 'v': cfg.verbose = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (cfg.n_types < 1 || cfg.chain < 0 || cfg.chain >= cfg.n_types || cfg.n_printers < 1
+	    || cfg.n_jobs < 1 || cfg.file_size < 0)
+		usage(argv[0]);
+
+	signal(SIGPIPE, SIG_IGN);
+	mkdir("spool", 0777);
+	mkdir(BENCH_DIR, 0777);
+	unlink(BENCH_DIR "/overflow/overflow.q");      // Left by an interrupted run
+
+	char *defs = BENCH_DIR "/defs.cmd", *jobsf = BENCH_DIR "/jobs.cmd";
+	int n_defs = write_defs(&cfg, defs);
+	if (n_defs < 0 || write_jobs(&cfg, jobsf) < 0 || write_inputs(&cfg) < 0) {
+		perror("bench setup");
+		exit(EXIT_FAILURE);
+	}
+
+	struct bench_run run = {0};
+	run.created = calloc(cfg.n_jobs, sizeof(double));
+	run.finished = calloc(cfg.n_jobs, sizeof(double));
+
+	int rc = drive(&cfg, defs, n_defs, jobsf, &run);
+	if (report(&cfg, &run) < 0) {
+		perror("bench report");
+		rc = -1;
+	}
+	free(run.created);
+	free(run.finished);
+	exit(rc ? EXIT_FAILURE : EXIT_SUCCESS);
+}
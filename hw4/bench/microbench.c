@@ -0,0 +1,372 @@
+/*
+ * Presi: in-process microbenchmarks for the scheduler and lookup paths
+ *
+ * Links build/state.o against presi_stubs.c, fills the type, printer and job
+ * tables and the conversion graph with synthetic state, and times the hot
+ * functions in isolation.  Each benchmark is warmed up, then run for a number
+ * of repetitions whose batch size is calibrated to a minimum duration.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "state.h"
+#include "journal.h"
+#include "mover.h"
+#include "launcher.h"
+#include "plugins.h"
+#include "workers.h"
+#include "presi_stubs.h"
+
+#define CHAIN_LEN   16            /* Types t0..t15 form a conversion chain. */
+#define MIN_REP_NS  5000000.0     /* Calibrate batches to at least 5ms. */
+#define REPLAY_RECS 100000        /* Journal records replayed by journal_recover. */
+#define STAGE_BYTES 4096          /* A small job, through one conversion stage. */
+#define STAGE_PLUGIN "plugin:bin/presi_copy.so:presi_copy"
+#define STAGE_WORKER "worker:bin/presi_wcat"
+
+struct microbench {
+	char *name;
+	void (*setup)(void);
+	void (*op)(void);
+};
+
+struct result {
+	double median, min, mean, stddev;
+	double allocs;
+};
+
+static char *type_name[MAX_TYPES];
+static char *no_path_type;
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Synthetic state: MAX_TYPES types, a chain of conversions over the first
+// CHAIN_LEN of them, MAX_PRINTERS printers and a full job table.
+
+static void build_universe(void) {
+	char buf[16];
+	state_init();
+	for (int t=0; t<MAX_TYPES; t++) {
+		snprintf(buf, sizeof(buf), "t%d", t);
+		add_type(buf);
+		type_name[t] = types[t]->name;
+	}
+	for (int t=0; t+1<CHAIN_LEN; t++) {
+		char *cmd[] = { "cat", NULL };
+		define_conversion(type_name[t], type_name[t+1], cmd);
+	}
+	no_path_type = type_name[MAX_TYPES-1];
+
+	for (int p=0; p<MAX_PRINTERS; p++) {
+		snprintf(buf, sizeof(buf), "p%d", p);
+		add_printer(buf, type_name[0]);
+	}
+	for (int i=0; i<MAX_JOBS; i++)
+		add_job("/dev/null", type_name[0], UINT32_MAX, NULL);
+}
+
+static void set_printers(PRINTER_STATUS st, char *type) {
+	for (size_t i=0; i<n_printers; i++) {
+		printers[i].status = st;
+		printers[i].busy = st == PRINTER_BUSY ? printers[i].slots : 0;      // Every slot taken
+		printers[i].type = type;
+	}
+}
+
+static void set_jobs(JOB_STATUS st, time_t finish) {
+	for (size_t i=0; i<n_jobs; i++) {
+		job_set_status(&jobs[i], st);
+		jobs[i].finish_time = finish;
+	}
+}
+
+// Benchmarks
+
+static volatile void *sink;
+
+static void lookup_type_op(void) { sink = lookup_type(type_name[MAX_TYPES-1]); }
+static void lookup_printer_op(void) { sink = lookup_printer("p31"); }
+static void lookup_job_op(void) { sink = lookup_job(MAX_JOBS-1); }
+static void setup_lookup(void) {
+	set_printers(PRINTER_DISABLED, type_name[0]);
+	set_jobs(JOB_CREATED, 0);
+}
+
+static void find_path_op(void) {
+	CONVERSION **path = find_conversion_path(type_name[0], type_name[CHAIN_LEN-1]);
+	free(path);
+}
+
+static void cached_path_op(void) { sink = conversion_path(types[0], types[CHAIN_LEN-1]); }
+
+static void setup_add_job(void) {
+	set_printers(PRINTER_DISABLED, type_name[0]);
+	set_jobs(JOB_CREATED, 0);
+	job_set_status(&jobs[MAX_JOBS-1], JOB_DELETED);
+}
+static void add_job_op(void) {
+	JOB *j = &jobs[MAX_JOBS-1];
+	free(j->file_name);
+	free(j->file_type);
+	j->file_name = j->file_type = NULL;
+	add_job("/dev/null", type_name[0], UINT32_MAX, NULL);
+	job_set_status(j, JOB_DELETED);
+}
+
+static void setup_delete_scan(void) {           // Terminated, but too recent to delete
+	set_printers(PRINTER_DISABLED, type_name[0]);
+	set_jobs(JOB_FINISHED, time(NULL) + 3600);
+}
+static void delete_scan_op(void) { delete_old_jobs(); }
+
+static void setup_delete_all(void) {
+	set_printers(PRINTER_DISABLED, type_name[0]);
+	set_jobs(JOB_FINISHED, 0);
+}
+static void delete_all_op(void) {
+	delete_old_jobs();
+	set_jobs(JOB_FINISHED, 0);
+}
+
+static void setup_dispatch_busy(void) {         // Every job waiting, every printer busy
+	set_printers(PRINTER_BUSY, type_name[0]);
+	set_jobs(JOB_CREATED, 0);
+}
+static void setup_dispatch_nopath(void) {       // Every printer idle, but unreachable
+	set_printers(PRINTER_IDLE, no_path_type);
+	set_jobs(JOB_CREATED, 0);
+}
+static void dispatch_op(void) { try_dispatch(); }
+
+static void dispatch_direct_op(void) {
+	job_set_status(&jobs[MAX_JOBS-1], JOB_CREATED);
+	printers[MAX_PRINTERS-1].status = PRINTER_IDLE;
+	try_dispatch();
+	printers[MAX_PRINTERS-1].status = PRINTER_DISABLED;
+}
+static void setup_dispatch_direct(void) {       // One job, one idle printer of the same type
+	set_printers(PRINTER_DISABLED, type_name[0]);
+	set_jobs(JOB_FINISHED, time(NULL) + 3600);
+	dispatch_direct_op();
+	if (jobs[MAX_JOBS-1].status != JOB_FINISHED) {      // Timing a refusal or a skip instead would tell nothing
+		fprintf(stderr, "try_dispatch/passthrough: the job did not print\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+// Journal: append cost on the main thread, and recovery from a long log
+// (every job in it already deleted, so this is the scan alone)
+
+static char journal_dir[] = "/tmp/presi_microbench.XXXXXX";
+static char replay_dir[sizeof(journal_dir) + 8];
+
+static void setup_journal_recover(void) {
+	if (replay_dir[0]) return;
+	if (!mkdtemp(journal_dir)) exit(EXIT_FAILURE);
+	snprintf(replay_dir, sizeof(replay_dir), "%s/replay", journal_dir);
+	mkdir(replay_dir, 0755);
+
+	JOB j = { .file_name = "/dev/null", .file_type = type_name[0], .eligible = UINT32_MAX };
+	journal_compact_bytes = SIZE_MAX;
+	journal_open(replay_dir);
+	for (int i=0; i<REPLAY_RECS/3; i++) {
+		j.id = 1000000 + i;
+		journal_job(JR_CREATE, &j, JOB_CREATED);
+		journal_job(JR_STATUS, &j, JOB_FINISHED);
+		journal_job(JR_DELETE, &j, JOB_DELETED);
+	}
+	journal_close();
+	journal_compact_bytes = JOURNAL_COMPACT_BYTES;
+}
+static void journal_recover_op(void) { journal_recover(replay_dir); }
+
+static void setup_journal_append(void) {
+	setup_journal_recover();
+	set_printers(PRINTER_DISABLED, type_name[0]);
+	set_jobs(JOB_CREATED, 0);
+	journal_open(journal_dir);
+}
+static void journal_append_op(void) { journal_job(JR_STATUS, &jobs[0], JOB_CREATED); }
+
+// One conversion stage of a small job, as a pipeline master runs it: a
+// forked and exec'd "cat", the presi_copy plugin on a thread, or a warm
+// presi_wcat worker leased once
+
+static char stage_file[] = "/tmp/presi_stage.XXXXXX";
+static CONVERSION stage_conv;
+static int stage_wfd[MAX_TYPES];
+
+static void setup_stage(char **cmd) {
+	if (stage_file[sizeof(stage_file) - 2] == 'X') {
+		char buf[STAGE_BYTES];
+		memset(buf, 'a', sizeof(buf));
+		int fd = mkstemp(stage_file);
+		if (fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)) exit(EXIT_FAILURE);
+		close(fd);
+		if (plugin_load(STAGE_PLUGIN) < 0) {
+			fprintf(stderr, "cannot load %s (make bin/presi_copy.so)\n", STAGE_PLUGIN);
+			exit(EXIT_FAILURE);
+		}
+	}
+	stage_conv = (CONVERSION){ types[0], types[1], cmd };
+}
+static char *stage_cat[] = { "cat", NULL }, *stage_copy[] = { STAGE_PLUGIN, NULL }, *stage_wcat[] = { STAGE_WORKER, NULL };
+static void setup_stage_exec(void) { setup_stage(stage_cat); }
+static void setup_stage_plugin(void) { setup_stage(stage_copy); }
+static void setup_stage_worker(void) {
+	setup_stage(stage_wcat);
+	CONVERSION *path[] = { &stage_conv, NULL };
+	if (worker_define(stage_wcat) < 0 || worker_lease(&jobs[0], path, stage_wfd) != 1) {
+		fprintf(stderr, "cannot start %s (make bin/presi_wcat)\n", STAGE_WORKER);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void stage_op(void) {
+	int in = open(stage_file, O_RDONLY), out = open("/dev/null", O_WRONLY);
+	if (plugin_stage(&stage_conv)) {
+		plugin_stage_start(&stage_conv, in, out);
+		plugin_stages_wait();
+	} else if (worker_stage(&stage_conv)) {
+		worker_stage_start(&stage_conv, stage_wfd[0], in, out);
+		worker_stages_wait();
+	} else if (fork() == 0) {
+		dup2(in, STDIN_FILENO);
+		dup2(out, STDOUT_FILENO);
+		execvp(stage_conv.cmd_and_args[0], stage_conv.cmd_and_args);
+		_exit(127);
+	} else {
+		wait(NULL);
+	}
+	close(in);
+	close(out);
+}
+
+static struct microbench benches[] = {
+	{ "lookup_type",               setup_lookup,          lookup_type_op },
+	{ "lookup_printer",            setup_lookup,          lookup_printer_op },
+	{ "lookup_job",                setup_lookup,          lookup_job_op },
+	{ "find_conversion_path",      setup_lookup,          find_path_op },
+	{ "conversion_path/cached",    setup_lookup,          cached_path_op },
+	{ "add_job",                   setup_add_job,         add_job_op },
+	{ "delete_old_jobs/scan",      setup_delete_scan,     delete_scan_op },
+	{ "delete_old_jobs/all",       setup_delete_all,      delete_all_op },
+	{ "try_dispatch/busy",         setup_dispatch_busy,   dispatch_op },
+	{ "try_dispatch/nopath",       setup_dispatch_nopath, dispatch_op },
+	{ "try_dispatch/passthrough",  setup_dispatch_direct, dispatch_direct_op },
+	{ "journal_recover/100k",      setup_journal_recover, journal_recover_op },
+	{ "journal_append",            setup_journal_append,  journal_append_op },
+	{ "stage/exec",                setup_stage_exec,      stage_op },
+	{ "stage/plugin",              setup_stage_plugin,    stage_op },
+	{ "stage/worker",              setup_stage_worker,    stage_op },
+};
+
+// Measurement
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void run_bench(struct microbench *b, int warmup, int reps, struct result *r) {
+	b->setup();
+	double w0 = now_ns();
+	for (int i=0; i<warmup && now_ns() - w0 < 10 * MIN_REP_NS; i++) b->op();    // Bounded for slow ops
+
+	long batch = 1;
+	for (;;) {                                  // Calibrate the batch size
+		double t = now_ns();
+		for (long i=0; i<batch; i++) b->op();
+		if (now_ns() - t >= MIN_REP_NS || batch >= (1L << 30)) break;
+		batch *= 2;
+	}
+
+	double *ns = malloc(reps * sizeof(double));
+	unsigned long a0 = stub_allocs;
+	for (int rep=0; rep<reps; rep++) {
+		double t = now_ns();
+		for (long i=0; i<batch; i++) b->op();
+		ns[rep] = (now_ns() - t) / batch;
+	}
+	r->allocs = (double)(stub_allocs - a0) / ((double)batch * reps);
+
+	qsort(ns, reps, sizeof(double), cmp_double);
+	r->median = ns[reps/2];
+	r->min = ns[0];
+	r->mean = 0;
+	for (int i=0; i<reps; i++) r->mean += ns[i];
+	r->mean /= reps;
+	r->stddev = 0;
+	for (int i=0; i<reps; i++) r->stddev += (ns[i] - r->mean) * (ns[i] - r->mean);
+	r->stddev = reps > 1 ? sqrt(r->stddev / (reps - 1)) : 0;
+	free(ns);
+}
+
+int main(int argc, char *argv[])
+{
+	int warmup = 1000, reps = 15, opt;
+	char *filter = NULL, *out = NULL;
+
+	while ((opt = getopt(argc, argv, "w:r:f:o:")) != -1) {
+		switch (opt) {
+		case 'w': warmup = atoi(optarg); break;
+		case 'r': reps = atoi(optarg); break;
+		case 'f': filter = optarg; break;
+		case 'o': out = optarg; break;
+		default:
+			fprintf(stderr, "Usage: %s [-w warmup] [-r reps] [-f filter] [-o out.json]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (reps < 1) reps = 1;
+
+	mover_set_mode(MOVER_OFF);      // Time the dispatch decision, not a thread handoff
+	launcher_set_threads(0);
+	build_universe();
+
+	FILE *json = out ? fopen(out, "w") : NULL;
+	if (json) fprintf(json, "{\n");
+	printf("%-26s %12s %12s %10s %10s\n", "benchmark", "ns/op", "min", "stddev", "allocs/op");
+
+	int first = 1;
+	for (size_t i=0; i<sizeof(benches)/sizeof(benches[0]); i++) {
+		struct microbench *b = &benches[i];
+		if (filter && !strstr(b->name, filter)) continue;
+
+		struct result r;
+		run_bench(b, warmup, reps, &r);
+		printf("%-26s %12.1f %12.1f %10.1f %10.2f\n", b->name, r.median, r.min, r.stddev, r.allocs);
+		if (json) {
+			fprintf(json, "%s  \"%s\": { \"ns_per_op\": %.3f, \"min\": %.3f, \"stddev\": %.3f, \"allocs_per_op\": %.3f }",
+				first ? "" : ",\n", b->name, r.median, r.min, r.stddev, r.allocs);
+			first = 0;
+		}
+	}
+
+	journal_close();
+	if (stage_file[sizeof(stage_file) - 2] != 'X') unlink(stage_file);
+	if (replay_dir[0]) {        // Scratch journals
+		char cmd[sizeof(journal_dir) + 16];
+		snprintf(cmd, sizeof(cmd), "rm -rf %s", journal_dir);
+		if (system(cmd) != 0) fprintf(stderr, "could not remove %s\n", journal_dir);
+	}
+
+	if (json) {
+		fprintf(json, "\n}\n");
+		fclose(json);
+	}
+	exit(EXIT_SUCCESS);
+}
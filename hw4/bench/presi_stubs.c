@@ -0,0 +1,63 @@
+/*
+ * Presi: stand-ins for the event and printer functions of lib/presi.a
+ *
+ * Linked into the microbenchmark in place of sf_event.o and presi_util.o from
+ * the library and of build/connect.o, so that state.o can be timed without
+ * tracing output or printer daemons.  Also interposes the allocator to count
+ * allocations.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+
+#include "presi.h"
+#include "launcher.h"
+#include "presi_stubs.h"
+
+unsigned long stub_allocs;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size) {
+	stub_allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+	stub_allocs++;
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	if (!ptr) stub_allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+	__libc_free(ptr);
+}
+
+char *job_status_names[] = { "created", "running", "paused", "finished", "aborted", "deleted" };
+char *printer_status_names[] = { "disabled", "idle", "busy" };
+
+int printer_connect(const char *name, const char *type, int flags, int wait_ms) {      // A printer that takes anything at once
+	(void)name; (void)type; (void)flags; (void)wait_ms;
+	return open("/dev/null", O_WRONLY | O_CLOEXEC);
+}
+
+void sf_cmd_ok(void) { }
+void sf_cmd_error(char *msg) { (void)msg; }
+void sf_printer_defined(char *name, char *type) { (void)name; (void)type; }
+void sf_printer_status(char *name, PRINTER_STATUS status) { (void)name; (void)status; }
+void sf_job_created(int id, char *file_name, char *file_type) { (void)id; (void)file_name; (void)file_type; }
+void sf_job_started(int id, char *printer, int pgid, char **path) { (void)id; (void)printer; (void)pgid; (void)path; }
+void sf_job_finished(int id, int status) { (void)id; (void)status; }
+void sf_job_aborted(int id, int status) { (void)id; (void)status; }
+void sf_job_deleted(int id) { (void)id; }
+void sf_job_status(int id, JOB_STATUS status) { (void)id; (void)status; }
+void sf_type_defined(char *name) { (void)name; }
+void sf_conversion_defined(char *from, char *to, char **cmd_and_args) { (void)from; (void)to; (void)cmd_and_args; }
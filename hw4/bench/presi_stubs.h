@@ -0,0 +1,7 @@
+#ifndef PRESI_STUBS_H
+#define PRESI_STUBS_H
+
+/* Number of allocations made through malloc/calloc/realloc(NULL) so far. */
+extern unsigned long stub_allocs;
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef CLASSES_H
+#define CLASSES_H
+
+#include <stdint.h>
+#include "state.h"
+
+/*
+ * Printer classes.  "class <name> <printer>... [--policy <policy>]" names a
+ * pool of printers (a printer may be in several), and "print <file> @<name>"
+ * submits a job to it.  Instead of the first free printer in id order, a
+ * class job goes to the one its class's policy picks among the members that
+ * have a free slot and can take the file:
+ *
+ *   least-loaded   the fewest busy slots for its number of slots (default)
+ *   round-robin    the next member after the one picked last
+ *   fastest        the highest measured throughput (bytes per second of its
+ *                  finished jobs, a moving average); members not measured
+ *                  yet are tried first
+ *
+ * Each class keeps its own queue, the set of its jobs still waiting.  A
+ * dispatch pass takes class jobs and other jobs together, in submission
+ * order, passing over a job of a class none of whose members has a free
+ * slot with a single test.  Redefining a class changes its members and policy
+ * for the jobs already queued as well.  A job submitted to a class has the
+ * class's members as its eligible printers.  The journal and the overflow
+ * queue keep its class by name; if the class is gone when the job is taken
+ * up again, the job keeps those printers only.
+ */
+
+#define MAX_CLASSES 32
+
+typedef enum { CLASS_LEAST_LOADED, CLASS_ROUND_ROBIN, CLASS_FASTEST, CLASS_POLICIES } CLASS_POLICY;
+
+extern char *class_policy_names[CLASS_POLICIES];
+
+typedef struct printer_class {
+	char *name;
+	uint32_t members;       /* Printer ids */
+	CLASS_POLICY policy;
+	JOB_SET waiting;        /* Its jobs still JOB_CREATED */
+	int next;               /* Round robin: first printer id to try */
+	uint64_t dispatched;
+} PRINTER_CLASS;
+
+extern PRINTER_CLASS classes[MAX_CLASSES];
+extern size_t n_classes;
+extern JOB_SET class_waiting;      /* Union of the classes' queues */
+
+int define_class(const char *name, uint32_t members, CLASS_POLICY policy);
+PRINTER_CLASS *lookup_class(const char *name);
+
+/* From add_job() and restore_job(): queue the job on its class. */
+void class_add_job(PRINTER_CLASS *c, JOB *j);
+/* From job_set_status(), when a class job stops waiting. */
+void class_job_left(JOB *j);
+
+/* The printer, out of the nonempty candidates mask, that the class's policy picks. */
+int class_pick(PRINTER_CLASS *c, uint32_t candidates);
+
+/* Throughput measurement, for CLASS_FASTEST. */
+void class_job_started(JOB *j, PRINTER *p);
+void class_job_finished(JOB *j);
+double class_printer_rate(PRINTER *p);     /* Bytes per second; 0 if not measured */
+
+#endif
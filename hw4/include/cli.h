@@ -0,0 +1,14 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include <stdio.h>
+
+/*
+ * Execute a single command line, as typed at the "presi>" prompt, reporting
+ * the outcome with sf_cmd_ok()/sf_cmd_error().  The line is modified.
+ *
+ * @return 1 if the command was "quit", otherwise 0.
+ */
+int cli_exec(char *line, FILE *out);
+
+#endif
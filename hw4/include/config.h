@@ -0,0 +1,70 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdint.h>
+
+/*
+ * Binary configuration snapshot: the types, conversions (with their argv),
+ * printers and printer classes currently defined, plus the conversion path from every type
+ * to every printer type, so that a spooler can be set up from a single
+ * mmap() instead of replaying a command file and searching the conversion
+ * graph again.
+ *
+ * Layout, in host byte order: a config_hdr, then
+ *
+ *   uint32_t           type names          [n_types]       (string offsets)
+ *   struct config_conv conversions         [n_convs]
+ *   struct config_prn  printers            [n_printers]
+ *   struct config_path paths               [n_paths]
+ *   struct config_class printer classes    [n_classes]
+ *   uint32_t           conversion argv     [n_args]        (string offsets)
+ *   uint16_t           path steps          [n_steps]       (conversion indices)
+ *   char               strings             [strings_len]   (NUL-terminated)
+ *
+ * The CRC covers everything after the header.
+ */
+
+#define CONFIG_MAGIC    0x47464350u   /* "PCFG" */
+#define CONFIG_VERSION  3
+
+struct config_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;          /* Whole file */
+	uint32_t crc;
+	uint16_t n_types, n_convs, n_printers, n_paths;
+	uint16_t n_classes, pad;
+	uint32_t n_args, n_steps, strings_len;
+};
+
+struct config_conv {
+	uint16_t from, to;      /* Type indices */
+	uint16_t argc, pad;
+	uint32_t arg0;          /* First entry in the argv array */
+};
+
+struct config_prn {
+	uint32_t name, type;    /* String offsets */
+	uint16_t slots, pad;
+};
+
+struct config_path {
+	uint16_t from, to;      /* Type indices */
+	uint16_t len;           /* Steps; 0 if there is no path */
+	uint16_t pad;
+	uint32_t step0;         /* First entry in the steps array */
+};
+
+struct config_class {
+	uint32_t name;          /* String offset */
+	uint32_t members;       /* Printer ids */
+	uint16_t policy, pad;   /* CLASS_POLICY */
+};
+
+int save_config(const char *path);
+
+/* Only into a spooler with no types or printers defined yet.  Nothing is
+   defined unless the whole file is consistent. */
+int load_config(const char *path);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC-32 (IEEE), used to validate the journal and configuration snapshots. */
+uint32_t crc32(const void *buf, size_t n);
+
+#endif
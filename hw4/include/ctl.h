@@ -0,0 +1,31 @@
+#ifndef CTL_H
+#define CTL_H
+
+#include <stdio.h>
+#include <signal.h>
+#include "presi_ctl.h"
+
+/*
+ * Control socket server.  Sockets are non-blocking and signal-driven
+ * (O_ASYNC): SIGIO sets sigio_flag and the work is done in ctl_poll(),
+ * called from sig_hook() like the SIGCHLD processing, so it is served from
+ * the spooler's own event loop and never blocks dispatch.
+ *
+ * Event subscribers are held to CTL_SUB_BUFFER bytes of unsent output; past
+ * that, their events are dropped and replaced by a CTL_RESYNC marker, and
+ * their requests are not read until the backlog drains.
+ */
+
+#define CTL_SUB_BUFFER  65536
+
+extern volatile sig_atomic_t sigio_flag;
+
+int ctl_open(const char *path);
+void ctl_close(void);
+void ctl_poll(void);
+void ctl_publish(int type, int id, int status, int arg, int aux, int printer, uint32_t eligible);
+
+/* "watch": print matching events on out as they happen; out NULL stops. */
+void ctl_watch(FILE *out, const struct ctl_filter *f);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <stdint.h>
+#include <time.h>
+#include "state.h"
+
+/*
+ * Deadlines.  "print --deadline <time> <file> ..." gives a job a completion
+ * deadline: +<seconds> from now, <hh:mm[:ss]> (the next such time of day), or
+ * seconds since the epoch.  Other jobs are best effort.
+ *
+ * "deadline edf" makes try_dispatch() start waiting deadline jobs earliest
+ * deadline first, each on the printer expected to finish it soonest, before
+ * any best-effort job; "deadline fifo" (the default) leaves them in slot
+ * order with the rest.  A job's expected service time on a printer is
+ * DL_STAGE_SEC per conversion stage plus its size over the printer's measured
+ * throughput (DL_DEFAULT_RATE until it has finished a job).  A waiting job
+ * that cannot finish in time even if started now is flagged at once with an
+ * EVR_JOB_LATE event (arg: the seconds it is expected to be late) and, under
+ * EDF, goes after the best-effort jobs instead of taking a slot from a job
+ * that can still make it.
+ *
+ * Every deadline job that finishes counts as met or missed; "deadline"
+ * reports the counts, and "jobs" shows each job's time left and whether it
+ * has been flagged.  The journal and the overflow queue keep deadlines; the
+ * control socket submits best-effort jobs only.
+ */
+
+#define DL_STAGE_SEC    0.05
+#define DL_DEFAULT_RATE (1 << 20)
+
+struct deadline_stats {
+	uint64_t jobs, met, missed, aborted, flagged;
+	int waiting, at_risk;
+};
+
+extern int deadline_edf;
+extern JOB_SET deadline_waiting;        /* Deadline jobs still JOB_CREATED */
+
+int deadline_parse(const char *s, time_t *when);
+/* From add_job() and restore_job(). */
+void deadline_set(JOB *j, time_t when);
+/* From job_set_status(), for a job with a deadline. */
+void deadline_job_status(JOB *j, JOB_STATUS status);
+
+/* Expected seconds to run j on p by path. */
+double deadline_estimate(JOB *j, PRINTER *p, CONVERSION **path);
+/*
+ * For try_dispatch() under EDF: the waiting deadline jobs by slot, earliest
+ * deadline first, those that can still make it (returns how many) and then
+ * the late ones (*late of them).  Flags jobs newly late.
+ */
+int deadline_order(int order[MAX_JOBS], int *late);
+int deadline_pick(JOB *j, uint32_t candidates, FILE_TYPE *from, FILE_TYPE *to[]);
+
+int deadline_late(JOB *j);              /* Flagged as unable to make it */
+void deadline_stats(struct deadline_stats *s);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "state.h"
+
+/*
+ * Duplicate-job coalescing.  With "dedup merge" or "dedup reject", a new job
+ * whose file has the size of a job still waiting (JOB_CREATED), submitted
+ * less than <window> seconds ago (DEDUP_WINDOW by default) with the same type,
+ * eligible printers, class, deadline and tenant, is held: queued as usual but
+ * not dispatched while a background thread hashes the two files and, if the
+ * hashes match, compares them byte for byte.  Submission never waits for it.
+ * The thread reports with SIGIO, and dedup_poll() collects the verdicts from
+ * sig_hook(): "merge" folds an identical job into the earlier one, whose copy
+ * count goes up (and is journaled) while the new job is aborted; "reject"
+ * only aborts it.  If the earlier job was itself held and has since been
+ * merged (or rejected) as a duplicate, the verdict follows it to the job that
+ * survived.  Otherwise the job is released.
+ *
+ * Each file is hashed at most once, read in DEDUP_CHUNK blocks or, with
+ * "mmap", mapped whole; only files that were read whole count in
+ * hashed_bytes.  Only jobs submitted while dedup is on are candidates, and
+ * jobs waiting in the overflow queue are not.
+ */
+
+#define DEDUP_WINDOW 60
+#define DEDUP_CHUNK  (64 * 1024)
+
+enum { DEDUP_OFF, DEDUP_MERGE, DEDUP_REJECT };
+
+struct dedup_stats {
+	uint64_t checked;       /* Submissions looked up */
+	int held;               /* Jobs waiting for a verdict */
+	uint64_t hashed, hashed_bytes;
+	uint64_t merged, rejected;
+};
+
+extern int dedup_mode, dedup_window, dedup_mmap;
+
+/* From add_job(), once the job is in the table: hold it if it may be a duplicate. */
+void dedup_job_added(JOB *j);
+void dedup_poll(void);
+void dedup_close(void);
+
+void dedup_stats(struct dedup_stats *s);
+
+#endif
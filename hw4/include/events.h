@@ -0,0 +1,26 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include "state.h"
+
+/*
+ * State-change events.  Each of these reports the change through the
+ * corresponding sf_* function and, when enabled, records it in the binary
+ * event ring (evring.h), sends it to control socket subscribers (ctl.h) and,
+ * for job creation, status changes and deletion, logs it in the job journal
+ * (journal.h).
+ * In exclusive ring mode the sf_* report is skipped.
+ */
+
+void ev_printer_defined(PRINTER *p);
+void ev_printer_status(PRINTER *p, PRINTER_STATUS status);
+
+void ev_job_created(JOB *j);
+void ev_job_started(JOB *j, PRINTER *p, char **path);
+void ev_job_status(JOB *j, JOB_STATUS status);
+void ev_job_finished(JOB *j, int status);
+void ev_job_aborted(JOB *j, int status);
+void ev_job_deleted(JOB *j);
+void ev_job_late(JOB *j, int seconds);
+
+#endif
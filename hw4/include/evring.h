@@ -0,0 +1,72 @@
+#ifndef EVRING_H
+#define EVRING_H
+
+#include <stdint.h>
+
+/*
+ * Single-producer ring of compact binary event records, mapped from a file so
+ * that an external tool (bin/presi_ringdump) can drain it while the spooler
+ * runs.  The spooler's main thread is the only producer; emitting a record is
+ * a handful of stores and never blocks.  When the ring is full new records are
+ * dropped and counted.
+ */
+
+#define EVRING_MAGIC   0x47525645u   /* "EVRG": live ring */
+#define EVDUMP_MAGIC   0x504d5645u   /* "EVMP": dump file */
+#define EVRING_VERSION 1
+#define EVRING_SLOTS   4096          /* Default capacity, rounded to a power of two. */
+
+typedef enum {
+	EVR_PRINTER_DEFINED = 1,
+	EVR_PRINTER_STATUS,
+	EVR_JOB_CREATED,
+	EVR_JOB_STARTED,
+	EVR_JOB_STATUS,
+	EVR_JOB_FINISHED,
+	EVR_JOB_ABORTED,
+	EVR_JOB_DELETED,
+	EVR_JOB_LATE            /* Cannot make its deadline (deadline.h); arg: expected seconds late */
+} EVR_TYPE;
+
+struct evring_rec {
+	uint64_t time_ns;       /* CLOCK_REALTIME */
+	uint16_t type;          /* EVR_TYPE */
+	uint16_t status;        /* JOB_STATUS or PRINTER_STATUS */
+	int32_t  id;            /* Job id, or printer id for printer events */
+	int32_t  arg;           /* pgid, or wait status */
+	int32_t  aux;           /* Printer id for JOB_STARTED */
+};
+
+/*
+ * Header at the start of the ring file.  head is written only by the
+ * producer and tail only by the consumer; each sits on its own cache line.
+ */
+struct evring_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slots;
+	uint32_t rec_size;
+	char pad0[48];
+	uint64_t head;          /* Next sequence number to be written. */
+	uint64_t dropped;       /* Records lost because the ring was full. */
+	char pad1[48];
+	uint64_t tail;          /* Next sequence number to be read. */
+	char pad2[56];
+};
+
+#define EVRING_RECS(h) ((struct evring_rec *)((char *)(h) + sizeof(struct evring_hdr)))
+
+extern int evring_active;
+extern int evring_exclusive;
+
+int evring_open(const char *path, uint32_t slots, int exclusive, const char *drain_path);
+void evring_close(void);
+void evring_put(EVR_TYPE type, int id, int status, int arg, int aux);
+int evring_dump(const char *path);
+void evring_stats(uint64_t *head, uint64_t *tail, uint64_t *dropped, uint32_t *slots);
+
+/* Consumer side, shared with the ringdump tool. */
+uint64_t evring_drain(struct evring_hdr *h, int fd);
+char *evring_type_name(int type);
+
+#endif
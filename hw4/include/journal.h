@@ -0,0 +1,88 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "state.h"
+
+/*
+ * Write-ahead job journal.  "journal <dir>" keeps two files in <dir>:
+ *
+ *   journal.snap   the live jobs as of the last compaction
+ *   journal.log    every job creation, status change and deletion since
+ *
+ * Records are appended to a memory buffer by the main thread and written out
+ * by a background thread, which fdatasync()s each batch: everything that
+ * accumulates during one sync goes out in the next (group commit), so
+ * submissions never wait for the disk.  Once the log passes
+ * JOURNAL_COMPACT_BYTES it is folded into a new snapshot and truncated.
+ *
+ * Opening a journal first recovers from whatever it holds, in one sequential
+ * pass over the snapshot and the log: jobs that were waiting are queued
+ * again, and jobs that were running or paused when the spooler died are
+ * requeued, with their class, deadline, tenant and copy count (struct
+ * job_attrs).  Finished and deleted jobs are dropped.  Types, printers and
+ * classes are not journaled, so define them before opening the journal.  The directory
+ * is created if it does not exist.
+ *
+ * Recovered jobs the job table has no slot for are carried: they stay in
+ * every snapshot, and journal_refill() requeues them, oldest first, as slots
+ * free up.  If a batch cannot be written or synced, nothing after it is
+ * counted durable, and the next record compacts instead: the new snapshot
+ * holds every live job, whatever the log lost.
+ */
+
+#define JOURNAL_SNAP_MAGIC    0x4e534a50u   /* "PJSN" */
+#define JOURNAL_LOG_MAGIC     0x4c574a50u   /* "PJWL" */
+#define JOURNAL_VERSION       2
+#define JOURNAL_COMPACT_BYTES (1 << 20)
+
+typedef enum {
+	JR_CREATE = 1,          /* Followed by the file name, type, class and tenant, NUL-terminated */
+	JR_STATUS,
+	JR_DELETE
+} JR_KIND;
+
+struct journal_file_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t gen;           /* A log only applies on top of the snapshot of the same generation. */
+};
+
+struct journal_rec {
+	uint32_t crc;           /* CRC-32 of the rest of the record; a torn tail ends replay */
+	uint16_t len;           /* Whole record, names included */
+	uint8_t kind;           /* JR_KIND */
+	uint8_t status;         /* JOB_STATUS */
+	int32_t id;
+	uint32_t eligible;
+	int64_t time;           /* Creation time, for JR_CREATE */
+	int64_t deadline;       /* For JR_CREATE */
+	int32_t copies;
+	uint32_t pad;
+};
+
+extern int journal_active;
+extern size_t journal_compact_bytes;     /* JOURNAL_COMPACT_BYTES unless tuned */
+
+/* Returns the number of jobs recovered, or -1. */
+int journal_open(const char *dir);
+void journal_close(void);
+int journal_compact(void);
+/* -1 if a write failed since the last compaction. */
+int journal_sync(void);
+void journal_stats(uint64_t *records, uint64_t *bytes, uint64_t *syncs, uint64_t *gen, uint64_t *failures);
+
+/* From delete_old_jobs(): requeue carried jobs while there are free slots. */
+void journal_refill(void);
+int journal_carried(void);
+
+void journal_job(JR_KIND kind, JOB *j, int status);
+
+/*
+ * Recover jobs from the journal in dir into the job table without opening
+ * it, skipping ids already present.  Returns the number restored, or -1.
+ */
+int journal_recover(const char *dir);
+
+#endif
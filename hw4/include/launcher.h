@@ -0,0 +1,55 @@
+#ifndef LAUNCHER_H
+#define LAUNCHER_H
+
+#include <stdint.h>
+#include "state.h"
+
+/*
+ * Launcher pool.  Opening a job's file and connecting to its printer can block
+ * for seconds (a printer that is not running yet is started, and waited for),
+ * so try_dispatch() hands them to a pool of LAUNCHERS threads and moves on to
+ * the next job.  The job and printer are marked launching, so that nothing
+ * else is dispatched to either, but the job stays JOB_CREATED until it starts:
+ * cancelling it in the meantime needs nothing from the launcher.
+ *
+ * Launchers hand their results back through a lock-free stack (any number of
+ * launchers push, the main thread takes the whole stack at once) and a SIGIO;
+ * launcher_poll(), from sig_hook(), forks the pipelines on the main thread,
+ * which alone owns the job and printer tables.
+ *
+ * Connecting never blocks: a printer whose backlog is full is retried every
+ * CONNECT_RETRY_MS for up to PRINTER_CONNECT_MS, so every launch, and with it
+ * launcher_close(), ends in bounded time.  If it still takes no connection
+ * the job goes back to waiting and the printer is skipped for
+ * PRINTER_RETRY_SEC.  The launchers start printers that are not running with
+ * system(), and reap_children() waits only for the processes it knows, never
+ * for theirs.
+ *
+ * "launchers 0" opens and connects inline, as before, but never waits there:
+ * a printer that is not running is started and reported as refusing, so the
+ * job is retried PRINTER_RETRY_SEC later, once it listens.
+ */
+
+#define LAUNCHERS     4
+#define MAX_LAUNCHERS 32
+#define PRINTER_CONNECT_MS 250
+#define CONNECT_RETRY_MS   10
+#define PRINTER_REFUSED    (-2)     /* From printer_connect(): its backlog stayed full */
+
+extern int launcher_threads;       /* Pool size; 0 launches inline */
+
+int launcher_set_threads(int n);   /* Only while nothing is launching */
+void launcher_close(void);
+
+/* 0 if the launch was queued; -1 to open and connect inline. */
+int launch_job(JOB *j, PRINTER *p);
+void launcher_poll(void);
+void launcher_stats(uint64_t *launched, int *pending, int *max_pending);
+
+/* presi_connect_to_printer(), without its static buffers, for use off the main thread: -1 on error, PRINTER_REFUSED if not connected within wait_ms.
+   In connect.c, which the microbenchmark replaces with a stub. */
+int printer_connect(const char *name, const char *type, int flags, int wait_ms);
+/* Set by launcher_close(): a launcher waiting to connect gives up. */
+int launcher_stopping(void);
+
+#endif
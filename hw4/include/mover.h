@@ -0,0 +1,47 @@
+#ifndef MOVER_H
+#define MOVER_H
+
+#include <stdint.h>
+#include "state.h"
+
+/*
+ * Data mover for jobs that need no conversion.  Instead of copying the file
+ * to the printer on the main thread, or forking a process per transfer, one
+ * background thread moves the data for every such job at once:
+ *
+ *   io_uring   one ring, a registered MOVER_CHUNK buffer per transfer, and a
+ *              linked read->write pair in flight for each active transfer
+ *   splice     where io_uring is unavailable: poll() on the printer
+ *              connections (made non-blocking) and sendfile() to each one
+ *              that can take data, or read()/write() if sendfile() cannot
+ *
+ * A job being moved is RUNNING with no process behind it: job_signal() hands
+ * pause, resume and cancel to mover_signal().  Finished transfers are reported
+ * with SIGIO and completed by mover_poll() from sig_hook(), exactly as if a
+ * pipeline master had exited.
+ */
+
+#define MOVER_CHUNK (64 * 1024)
+
+typedef enum { MOVER_AUTO, MOVER_URING, MOVER_SPLICE, MOVER_OFF } MOVER_MODE;
+
+struct mover_stats {
+	MOVER_MODE backend;     /* The one in use; MOVER_AUTO before the first transfer */
+	uint64_t transfers;
+	uint64_t bytes;
+	int active, max_active;
+};
+
+int mover_set_mode(MOVER_MODE mode);     /* Only while nothing is being moved */
+void mover_close(void);
+
+/* Takes over both descriptors; -1 if the job should be copied in place. */
+int mover_start(JOB *j, int in, int out, uint64_t dispatched_ns);
+int mover_signal(JOB *j, int sig);
+
+/* In a child that will not exec: let go of the files and printers being moved. */
+void mover_forked(void);
+void mover_poll(void);
+void mover_stats(struct mover_stats *s);
+
+#endif
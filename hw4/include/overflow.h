@@ -0,0 +1,65 @@
+#ifndef OVERFLOW_H
+#define OVERFLOW_H
+
+#include <stdint.h>
+#include "state.h"
+
+/*
+ * Overflow queue.  With "overflow on [<dir> [<high> <low>]]", a job submitted
+ * while the job table is full is not refused: it gets its id as usual and is
+ * appended to <dir>/overflow.q, and so is every job after it until the queue
+ * has drained, so that jobs keep their order, with its class, deadline and
+ * tenant (struct job_attrs).  Jobs are paged back into the table, oldest
+ * first, as slots free up.  The file survives the spooler: on
+ * "overflow on" the jobs still in it are taken up again.
+ *
+ * Once <high> jobs (OVERFLOW_HIGH by default) are waiting on disk, new
+ * submissions are refused with an explicit "busy" (CTL_EBUSY on the control
+ * socket) until the queue is back down to <low> (OVERFLOW_LOW), instead of
+ * growing without bound.
+ *
+ * Records carry a CRC-32, and the job's four names must end within their
+ * record; a scan stops at the first record that fails either check.  Spills
+ * and cancellations are written by the main thread and fdatasync()ed by a
+ * background thread in batches, as the journal does: submissions never wait
+ * for the disk, and a crash loses at most the records written since the last
+ * sync completed.  With the journal on as well, a spilled job lost that way
+ * is not recovered from it: the journal only holds jobs in the table.
+ *
+ * Finished jobs leave the table JOB_RETAIN seconds after they finish;
+ * while jobs wait on disk, a timer raises SIGIO when that is next due, and
+ * overflow_poll(), from sig_hook(), deletes them and pages the next jobs in.
+ */
+
+#define OVERFLOW_DIR    "spool/overflow"
+#define OVERFLOW_HIGH   100000
+#define OVERFLOW_LOW    90000
+
+struct overflow_stats {
+	int queued;             /* Jobs waiting on disk */
+	int busy;               /* Refusing submissions until queued <= low */
+	int high, low;
+	uint64_t spilled, paged, cancelled, refused;
+	uint64_t file_bytes;
+	uint64_t syncs;         /* fdatasync() batches */
+};
+
+extern int overflow_active;
+
+int overflow_open(const char *dir, int high, int low);
+void overflow_close(void);      /* Jobs on disk stay there for the next "overflow on" */
+
+/* From add_job(): nonzero if new jobs must queue behind those on disk. */
+int overflow_pending(void);
+/* Returns the new job's id, or -1 (overflow_busy() says whether that is backpressure). */
+int overflow_spill(const char *file, const char *type, uint32_t eligible, const struct job_attrs *a);
+int overflow_busy(void);
+/* Cancel the jobs on disk with ids in [first, last]; -1 if there were none. */
+int overflow_cancel(int first, int last);
+
+/* After jobs have been deleted: page jobs in while there are free slots. */
+void overflow_refill(void);
+void overflow_poll(void);
+void overflow_stats(struct overflow_stats *s);
+
+#endif
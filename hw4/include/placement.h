@@ -0,0 +1,55 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stdint.h>
+#include "state.h"
+
+/*
+ * CPU placement.  "placement on <spooler-cpus> [<pool-cpus>]" binds every
+ * spooler thread (those already running, and the ones it starts from then on)
+ * to the first set of CPUs, and each conversion pipeline to cores chosen from the pool,
+ * which by default is every other CPU we may run on.  A pipeline's cores are
+ * the least busy ones of the least busy last-level-cache domain, preferring
+ * cores that share a level 2 cache, so that data handed from stage to stage
+ * stays in cache; the master and every stage are bound to that set.
+ *
+ * Per printer, "placement printer <name> [cores <n>] [batch|normal]" sets how
+ * many cores a pipeline gets (default: one per stage, up to a domain) and
+ * whether its processes run as SCHED_BATCH at nice PLACE_BATCH_NICE, for bulk
+ * work that should yield to everything else.
+ *
+ * CPU sets are bit masks, so only CPUs 0 to PLACE_MAX_CPUS-1 can be placed.
+ */
+
+#define PLACE_MAX_CPUS   64
+#define PLACE_BATCH_NICE 10
+
+typedef enum { CPU_UNUSED, CPU_SPOOLER, CPU_POOL, CPU_SHARED } CPU_ROLE;
+
+struct cpu_stats {
+	CPU_ROLE role;
+	int domain;             /* First CPU sharing its last-level cache */
+	int running;            /* Pipelines of running jobs bound to it */
+	uint64_t placed;        /* Pipelines ever bound to it */
+	double util;            /* Busy share since the previous report, 0 to 1 */
+};
+
+extern int placement_active;
+
+int placement_open(uint64_t spooler, uint64_t pool);     /* pool 0: every other CPU */
+void placement_close(void);
+int placement_set_printer(PRINTER *p, int cores, int batch);
+void placement_printer(PRINTER *p, int *cores, int *batch);
+
+/* On the main thread, before forking the pipeline: choose the job's cores (j->cpus). */
+void placement_choose(JOB *j, PRINTER *p, int stages);
+/* In the pipeline's master process; its stages inherit the binding and class. */
+void placement_apply(JOB *j, PRINTER *p);
+
+/* Returns the number of CPUs described. */
+int placement_stats(struct cpu_stats cpus[PLACE_MAX_CPUS], uint64_t *spooler, uint64_t *pool);
+
+int cpu_list_parse(const char *s, uint64_t *mask);      /* "0-3,6" */
+char *cpu_list_format(uint64_t mask, char *buf, size_t n);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef PLUGINS_H
+#define PLUGINS_H
+
+#include "state.h"
+#include "presi_plugin.h"
+
+/*
+ * Converter plugins (presi_plugin.h), spooler side.  add_conversion() loads
+ * the library and resolves the symbol of a "plugin:<lib.so>:<symbol>" command
+ * once, in the spooler, so that a pipeline master never calls dlopen() after
+ * fork().  The master starts each plugin stage on a thread with its own
+ * close-on-exec copies of the stage's descriptors, which it closes as soon as
+ * the function returns so that the next stage sees end of file, and the
+ * command stages it forks do not hold them.
+ */
+
+#define MAX_PLUGINS 32
+
+/* 0 if spec is no plugin or was loaded; -1 if the library or symbol cannot be. */
+int plugin_load(const char *spec);
+int plugin_stage(CONVERSION *c);          /* Nonzero if c runs as a plugin */
+
+/* In a pipeline master: run plugin stage c from in to out on a thread. */
+int plugin_stage_start(CONVERSION *c, int in, int out);
+/* Once the command stages are reaped: 0 if every plugin stage succeeded. */
+int plugin_stages_wait(void);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "state.h"
+
+/*
+ * Dispatch-ahead readahead.  With "prefetch on [<depth> [<budget-MB>]]" the
+ * <depth> oldest waiting jobs (PREFETCH_DEPTH by default) not hinted yet have
+ * their input files hinted into the page cache with posix_fadvise(WILLNEED)
+ * after a dispatch pass, so that the first stage of a pipeline does not stall on a
+ * cold file while its printer sits busy.  The hints in flight, counted as the
+ * sizes of waiting jobs already prefetched, are kept under <budget-MB>
+ * (PREFETCH_BUDGET by default) so that a long queue cannot evict itself.
+ * The files are opened and hinted by a background thread, one batch at a
+ * time; it reports with SIGIO, and prefetch_poll(), from sig_hook(), marks
+ * the jobs and queues the next batch.
+ *
+ * While prefetching is on, each job's time to first byte (dispatch to the
+ * first block of its input being read) is measured by the process that runs
+ * the pipeline, or by the data mover for its first read (mover.h), and
+ * accumulated separately for prefetched and cold jobs.
+ * Depth 0 measures without prefetching, for a baseline.
+ */
+
+#define PREFETCH_DEPTH  4
+#define PREFETCH_BUDGET (64u << 20)
+
+typedef enum { TTFB_COLD, TTFB_PREFETCHED, TTFB_KINDS } TTFB_KIND;
+
+struct ttfb_stats {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+extern int prefetch_active;
+
+int prefetch_open(int depth, size_t budget);
+void prefetch_close(void);
+
+/* After a dispatch pass: hint the files of the jobs next in line. */
+void prefetch_scan(void);
+void prefetch_poll(void);
+
+/* In the pipeline's master process: read the first block of fd and record how long it took since dispatched_ns. */
+void prefetch_first_byte(JOB *j, int fd, uint64_t dispatched_ns);
+/* For the data mover: the TTFB_KIND to record the job under, or -1 if not measuring; then its first read's time. */
+int prefetch_ttfb_kind(JOB *j);
+void prefetch_ttfb(int kind, uint64_t ns);
+
+void prefetch_stats(struct ttfb_stats ttfb[TTFB_KINDS], uint64_t *hinted, uint64_t *hinted_bytes, size_t *in_flight);
+
+#endif
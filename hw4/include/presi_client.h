@@ -0,0 +1,57 @@
+#ifndef PRESI_CLIENT_H
+#define PRESI_CLIENT_H
+
+#include <stdint.h>
+#include "presi_ctl.h"
+#include "evring.h"
+
+/*
+ * Client side of the control socket (presi_ctl.h).  The blocking calls send a
+ * request and wait for its reply; presi_send()/presi_recv() expose the
+ * framing directly so that callers can pipeline many requests before
+ * collecting the replies.  Events received while waiting for a reply are
+ * kept and handed out by presi_next_event().
+ *
+ * Unless noted, functions return a CTL_STATUS, or -1 if the connection
+ * failed.
+ */
+
+typedef struct presi_client PRESI_CLIENT;
+
+PRESI_CLIENT *presi_client_open(const char *path);
+void presi_client_close(PRESI_CLIENT *c);
+int presi_client_fd(PRESI_CLIENT *c);
+
+int presi_send(PRESI_CLIENT *c, int op, uint32_t tag, const void *payload, size_t n);
+int presi_send_submit(PRESI_CLIENT *c, uint32_t tag, const char *file, uint32_t eligible);
+
+/*
+ * Receive the next frame, blocking.  The payload (at most cap bytes are
+ * copied) is stored in buf.  Returns the payload length, or -1.
+ */
+int presi_recv(PRESI_CLIENT *c, struct ctl_hdr *h, void *buf, size_t cap);
+
+/* Returns the job id, or -1 with *status set (if not NULL). */
+int presi_submit(PRESI_CLIENT *c, const char *file, uint32_t eligible, int *status);
+int presi_cancel(PRESI_CLIENT *c, int id);
+int presi_pause(PRESI_CLIENT *c, int id);
+int presi_resume(PRESI_CLIENT *c, int id);
+/* Submitter of the jobs this connection submits from now on; "" for "default". */
+int presi_tenant(PRESI_CLIENT *c, const char *name);
+
+/* Returns the number of records stored, or -1. */
+int presi_query(PRESI_CLIENT *c, int id, struct ctl_job_info *out, int max);
+int presi_printers(PRESI_CLIENT *c, struct ctl_printer_info *out, int max);
+
+/* Filter NULL subscribes to everything; subscribing again replaces the filter. */
+int presi_subscribe(PRESI_CLIENT *c, const struct ctl_filter *f);
+int presi_unsubscribe(PRESI_CLIENT *c);
+
+/*
+ * Next event, blocking.  Returns 0, or 1 for a resync marker (ev->type is 0
+ * and ev->time_ns holds the number of events dropped), or -1 if the
+ * connection failed.
+ */
+int presi_next_event(PRESI_CLIENT *c, struct evring_rec *ev);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef PRESI_CTL_H
+#define PRESI_CTL_H
+
+#include <stdint.h>
+
+/*
+ * Binary control protocol, spoken over a Unix-domain stream socket (see the
+ * "control" command).  Every message is a frame: a ctl_hdr followed by
+ * hdr.len - sizeof(struct ctl_hdr) bytes of payload, in host byte order.
+ * Requests may be pipelined; each gets exactly one reply carrying the same
+ * tag, in order.  Subscribed clients additionally receive CTL_EVENT frames.
+ *
+ * Events pass through the subscriber's filter on the server.  Each subscriber
+ * has a bounded buffer: if it falls behind, events are dropped until the
+ * backlog drains, then a single CTL_RESYNC frame reports how many were lost,
+ * and the client should re-query the state it tracks.
+ */
+
+#define CTL_SOCKET     "spool/presi.ctl"
+#define CTL_FRAME_MAX  8192
+
+struct ctl_hdr {
+	uint32_t len;           /* Total frame length, header included. */
+	uint16_t op;            /* CTL_OP */
+	uint16_t status;        /* CTL_STATUS, in replies */
+	uint32_t tag;           /* Chosen by the client, echoed in the reply. */
+};
+
+typedef enum {
+	CTL_SUBMIT = 1,         /* uint32_t eligible (0: any printer), NUL-terminated file[, NUL-terminated tenant] -> int32_t job id */
+	CTL_CANCEL,             /* int32_t job id */
+	CTL_PAUSE,              /* int32_t job id */
+	CTL_RESUME,             /* int32_t job id */
+	CTL_QUERY,              /* int32_t job id, or -1 for all -> struct ctl_job_info[] */
+	CTL_PRINTERS,           /* -> struct ctl_printer_info[] */
+	CTL_SUBSCRIBE,          /* Optional struct ctl_filter; start (or refilter) CTL_EVENT frames */
+	CTL_EVENT,              /* Server push: struct evring_rec (evring.h) */
+	CTL_UNSUBSCRIBE,
+	CTL_RESYNC,             /* Server push: uint64_t number of events dropped */
+	CTL_TENANT              /* NUL-terminated tenant name ("" for "default"): submitter of this connection's jobs */
+} CTL_OP;
+
+typedef enum {
+	CTL_OK = 0,
+	CTL_EBADREQ,            /* Malformed or unknown request */
+	CTL_ENOENT,             /* No such job */
+	CTL_ESTATE,             /* Job not in a state that allows the operation */
+	CTL_ETYPE,              /* File type cannot be inferred */
+	CTL_EFULL,              /* No room for another job */
+	CTL_EDOWN,              /* The shard holding the job is down (presi_router) */
+	CTL_EBUSY               /* Overflow queue above its high watermark, or tenant at its queue limit: retry later */
+} CTL_STATUS;
+
+/*
+ * Subscription filter; an empty CTL_SUBSCRIBE payload receives everything.
+ * The job id and status mask select job events; the printer selects its own
+ * printer events and the events of jobs on it (or, while waiting, eligible
+ * for it).  Without explicit kinds, a job or status filter implies jobs only.
+ */
+#define CTL_WATCH_JOBS      0x1
+#define CTL_WATCH_PRINTERS  0x2
+
+struct ctl_filter {
+	int32_t job;            /* -1: any */
+	int32_t printer;        /* -1: any */
+	uint32_t status_mask;   /* 1 << JOB_STATUS, 0: any */
+	uint32_t kinds;         /* CTL_WATCH_*, 0: both */
+};
+
+struct ctl_job_info {
+	int32_t id;
+	uint16_t status;        /* JOB_STATUS */
+	int16_t printer;        /* Printer id, -1 if not started */
+	uint32_t eligible;
+	int32_t pgid;
+};
+
+struct ctl_printer_info {
+	int16_t id;
+	uint16_t status;        /* PRINTER_STATUS */
+	char name[32];
+	char type[32];
+	uint16_t slots;         /* Jobs it runs at once */
+	uint16_t busy;          /* Of those, running now */
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef PRESI_PLUGIN_H
+#define PRESI_PLUGIN_H
+
+/*
+ * Converter plugin interface.  A shared object exporting a presi_convert_fn
+ * can stand in for a conversion command:
+ *
+ *   conversion <from> <to> plugin:<lib.so>:<symbol> [args...]
+ *
+ * The library is loaded when the conversion is defined.  Each job through the
+ * conversion then runs the function on a thread of its pipeline master, in
+ * the job's process group, instead of a process of its own; plugin and
+ * command stages mix freely in one path, joined by pipes as usual.
+ *
+ * The function reads its input from in until end of file and writes the
+ * converted data to out, returning 0 on success and nonzero on failure (the
+ * job is then aborted, as if a command had exited nonzero).  It must not close
+ * either descriptor, nor call exit(), nor change signal dispositions: several
+ * stages of one job may run at once in the same process.  Pausing and
+ * cancelling the job stop and kill the whole master, plugin threads included.
+ */
+
+#define PRESI_PLUGIN_PREFIX "plugin:"
+
+struct presi_convert_state {
+	const char *from, *to;      /* Type names */
+	char **args;                /* Arguments after the plugin spec, NULL-terminated */
+	void *user;                 /* NULL on entry; the function's own for the run */
+};
+
+typedef int presi_convert_fn(int in, int out, struct presi_convert_state *state);
+
+#endif
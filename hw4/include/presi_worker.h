@@ -0,0 +1,32 @@
+#ifndef PRESI_WORKER_H
+#define PRESI_WORKER_H
+
+#include <stdint.h>
+
+/*
+ * Converter worker protocol.  "conversion <from> <to> worker:<command> [args...]"
+ * runs <command> as a persistent co-process instead of once per job: the
+ * spooler keeps warm instances and lends one to each job that goes through
+ * the conversion.  Its standard input and output are both ends of one stream
+ * socket, over which every message is a frame: a presi_wframe followed by
+ * len bytes of payload (at most PRESI_WF_MAX), in host byte order.
+ *
+ * For each job the worker receives the input as PRESI_WF_DATA frames, then a
+ * PRESI_WF_END frame.  It sends the output as PRESI_WF_DATA frames as it goes,
+ * and, only once it has read the request's PRESI_WF_END, a PRESI_WF_END frame
+ * for success or a PRESI_WF_ERROR frame (payload: a message, possibly empty)
+ * for failure.  Then it waits for the next job.  End of file on its input
+ * means that it is no longer needed and should exit.
+ */
+
+#define PRESI_WORKER_PREFIX "worker:"
+#define PRESI_WF_MAX        65536
+
+enum { PRESI_WF_DATA = 1, PRESI_WF_END, PRESI_WF_ERROR };
+
+struct presi_wframe {
+	uint32_t type;
+	uint32_t len;
+};
+
+#endif
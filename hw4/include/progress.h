@@ -0,0 +1,57 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdint.h>
+#include "state.h"
+
+/*
+ * Per-job progress.  When a job starts, the spooler keeps a close-on-exec
+ * duplicate of its input descriptor: the shared file offset says how far the
+ * first stage has read.  With "progress on" (off by default: it adds a copy
+ * through a pipe to every converted job) the last stage of a conversion
+ * pipeline writes into a pipe that its master relays to the printer with
+ * splice(), counting the bytes into a page shared with the spooler; the data
+ * mover counts the jobs it moves in the same page.
+ *
+ * progress_sample() turns the counts into bytes read of the file's size,
+ * bytes sent to the printer, the rates since the previous sample at least
+ * PROGRESS_RATE_SEC old, an ETA from the input rate, and how long no byte has
+ * moved; a running job idle for "progress stall <secs>" (PROGRESS_STALL) is
+ * stalled.  "jobs -v" shows them, "progress" counts stalled jobs.  With
+ * "progress off" pipelines write straight to the printer, and only input
+ * bytes are known for them; stalls are then judged from the input side and
+ * the mover alone.
+ */
+
+#define PROGRESS_STALL    30
+#define PROGRESS_RATE_SEC 1.0
+#define PROGRESS_CHUNK    (64 * 1024)
+
+struct job_progress {
+	uint64_t in, total;     /* Bytes read of the file, and its size */
+	uint64_t out;           /* Bytes sent to the printer */
+	int out_known;          /* 0: no relay and no mover behind the job */
+	double in_rate, out_rate;       /* Bytes/s */
+	double eta;             /* Seconds until the input is read, or -1 if unknown */
+	double idle;            /* Seconds since a byte last moved */
+	double elapsed;         /* Seconds since it started, or that it ran */
+	int stalled;
+};
+
+extern int progress_relay_on, progress_stall;
+
+/* From start_pipeline(), in the spooler: before the job's input is handed on. */
+void progress_start(JOB *j, int fd_file);
+/* From job_set_status(), when a started job finishes or aborts: keeps its totals. */
+void progress_job_done(JOB *j);
+
+/* In a pipeline master: copy in to out until end of file, counting.  -1 on error. */
+int progress_relay(JOB *j, int in, int out);
+/* From the data mover's thread: bytes read from the file and written to the printer. */
+void progress_moved(int slot, uint64_t in, uint64_t out);
+
+/* -1 if j has not started. */
+int progress_sample(JOB *j, struct job_progress *p);
+int progress_stalled_jobs(void);
+
+#endif
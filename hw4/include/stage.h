@@ -0,0 +1,38 @@
+#ifndef STAGE_H
+#define STAGE_H
+
+#include <stdint.h>
+#include "state.h"
+
+/*
+ * Spool staging.  With "stage on [<dir>]" every submitted file is snapshotted
+ * into <dir> (spool/stage by default) so that later changes to the original
+ * cannot affect the job, and the pipeline reads the snapshot.  In order of
+ * preference the snapshot is:
+ *
+ *   a reflink (FICLONE)         copy-on-write, O(1), same filesystem
+ *   a hard link (linkat)        O(1), survives deletion or replacement of the
+ *                               original, but not rewriting it in place
+ *   a copy (copy_file_range)    into an O_TMPFILE, linked in when complete
+ *
+ * Snapshots are taken by a background thread, so submission returns at once;
+ * a job is not dispatched until its snapshot is in place.  The thread reports
+ * completions with SIGIO, and stage_poll() collects them from sig_hook().  If
+ * a snapshot fails the job reads the original.  Snapshots are removed when
+ * their jobs are deleted.
+ */
+
+#define STAGE_DIR "spool/stage"
+
+typedef enum { STAGE_CLONE, STAGE_LINK, STAGE_COPY, STAGE_FAILED, STAGE_METHODS } STAGE_METHOD;
+
+extern int stage_active;
+
+int stage_open(const char *dir);
+void stage_close(void);
+void stage_job(JOB *j);
+void stage_poll(void);
+void stage_release(JOB *j);
+void stage_stats(uint64_t count[STAGE_METHODS], uint64_t *bytes_copied, int *pending);
+
+#endif
@@ -6,15 +6,35 @@
 #include <time.h>
 #include <sys/types.h>
 #include <signal.h>
+#include <pthread.h>
 #include "presi.h"
 #include "conversions.h"
 
+/*
+ * A printer runs up to <slots> jobs at once ("printer <name> <type> --slots
+ * <n>"), one per connection to it.  It is PRINTER_BUSY while any slot is, and
+ * takes jobs while it is enabled and has a slot that is neither running a job
+ * nor being connected for one.  A printer that refuses a connection while it
+ * has others open is cut down to those (launcher.h).
+ */
+#define PRINTER_MAX_SLOTS 16
+#define PRINTER_RETRY_SEC 1
+
+struct printer_slot {
+	struct job *job;            /* NULL if free */
+	pid_t pgid;
+};
+
 struct printer {
 	int id;
 	char *name;
 	char *type;
 	PRINTER_STATUS status;
-	pid_t pgid;
+	int slots;
+	int busy;                   /* Slots running a job */
+	struct printer_slot slot[PRINTER_MAX_SLOTS];
+	int launching;              /* Slots being connected for a job (launcher.h) */
+	int refused;                /* Took no connection: skipped until printers_retry() */
 	void *other;
 };
 
@@ -29,36 +49,125 @@ struct job {
 	time_t start_time;
 	time_t finish_time;
 	struct printer *printer;
+	char *spool_file;           /* Staged snapshot, read instead of file_name (stage.h) */
+	int staging;                /* Snapshot in progress: not dispatchable yet */
+	int prefetched;             /* Input hinted into the page cache (prefetch.h) */
+	size_t prefetch_bytes;
+	int moving;                 /* Copied by the data mover, with no process behind it (mover.h) */
+	int launching;              /* Waiting for a launcher to open it and connect its printer */
+	int deduping;               /* Being compared with the waiting jobs: not dispatchable yet (dedup.h) */
+	uint64_t cpus;              /* Cores its pipeline is bound to (placement.h) */
+	struct printer_class *klass;     /* Submitted to a class (classes.h), or NULL */
+	time_t deadline;            /* 0: best effort (deadline.h) */
+	struct tenant *tenant;      /* Submitter (tenants.h); NULL: "default" */
+	int copies;                 /* Submissions merged into it, itself included (dedup.h) */
 	void *other;
 };
 
 #define MAX_TYPES     32
+#define MAX_CONVERSIONS (MAX_TYPES * MAX_TYPES)
+
+/*
+ * The job table is indexed by status: one bit per slot of jobs[] in the set of
+ * its status, kept in step by job_set_status(), so that a scan visits only the
+ * jobs in the states it cares about instead of testing every entry.  Free
+ * slots are in no set.
+ */
+#define JOB_SET_WORDS ((MAX_JOBS + 63) / 64)
+#define JOB_STATUSES  (JOB_DELETED + 1)
+#define JOB_LIVE      ((1u << JOB_DELETED) - 1)     /* Status mask of every job not deleted */
+
+typedef struct { uint64_t w[JOB_SET_WORDS]; } JOB_SET;
+
+#define FOR_EACH_JOB(i, set) for (int i = job_set_next(set, 0); i >= 0; i = job_set_next(set, i + 1))
 
-extern sig_atomic_t sigchld_flag;
+extern sig_atomic_t sigchld_flag, sigalrm_flag;
+
+extern int sim_mode;          /* Nonzero while replaying a trace (trace.h). */
+extern time_t sim_time;
 
 extern size_t n_types;
 extern FILE_TYPE *types [MAX_TYPES];
+extern CONVERSION *conversions[MAX_CONVERSIONS];
+extern size_t n_conversions;
 extern PRINTER printers[MAX_PRINTERS];
 extern size_t n_printers;
 extern JOB jobs[MAX_JOBS];
 extern size_t n_jobs;
+extern JOB_SET jobs_in[JOB_STATUSES];
 extern int next_job_id;
 
 void state_init(void);
+time_t state_now(void);
+uint64_t state_clock_ns(void);       /* CLOCK_MONOTONIC, for intervals */
+/* pthread_create() with every signal blocked, so SIGCHLD and SIGIO reach the main thread. */
+int state_thread(pthread_t *t, void *(*fn)(void *), void *arg);
 
 FILE_TYPE *lookup_type(const char *name);
 PRINTER *lookup_printer(const char *name);
 JOB *lookup_job(int id);
 
+void job_set_status(JOB *j, JOB_STATUS status);
+JOB_SET job_set_of(unsigned status_mask);           /* Union of the sets of the statuses in the mask */
+
+static inline int job_set_next(const JOB_SET *s, int from) {      /* First slot >= from in s, or -1 */
+	for (int w=from / 64; w<JOB_SET_WORDS && from < MAX_JOBS; w++, from = w * 64) {
+		uint64_t bits = s->w[w] & (~0ull << (from % 64));
+		if (bits) return w * 64 + __builtin_ctzll(bits);
+	}
+	return -1;
+}
+
 void install_sig_handlers(void);
 
 int add_type(const char *name);
+int add_conversion(const char *from, const char *to, char **cmd_and_args);
 int add_printer(const char *name, const char *type);
-int add_job(const char *file, const char *type, uint32_t eligible);
+int set_printer_slots(PRINTER *p, int slots);
+int printer_free_slots(PRINTER *p);
+void printer_release(PRINTER *p, JOB *j);      /* The job's slot, once it is no longer running */
+void printers_retry(void);                     /* PRINTER_RETRY_SEC after a printer refused a connection */
+
+/*
+ * Conversion paths are cached per pair of types until the next conversion is
+ * defined.  The result belongs to the cache; NULL means there is no path.
+ */
+CONVERSION **conversion_path(FILE_TYPE *from, FILE_TYPE *to);
+void set_conversion_path(FILE_TYPE *from, FILE_TYPE *to, CONVERSION **path);
 
+/*
+ * What a submission asks for besides its file, type and printers: a class
+ * (classes.h), a deadline (deadline.h), a tenant (tenants.h), and how many
+ * submissions were merged into it (dedup.h).  By name, so that the journal and
+ * the overflow queue can keep them for the jobs they take up again; a class
+ * no longer defined by then is dropped, a tenant is created again.
+ */
+struct job_attrs {
+	const char *klass;          /* NULL or "": none */
+	const char *tenant;         /* NULL or "": "default" */
+	time_t deadline;            /* 0: best effort */
+	int copies;                 /* 0 counts as 1 */
+};
+
+/* a may be NULL for a plain submission. */
+int add_job(const char *file, const char *type, uint32_t eligible, const struct job_attrs *a);
+int restore_job(int id, const char *file, const char *type, uint32_t eligible, time_t created, const struct job_attrs *a);
+void job_attrs_of(JOB *j, struct job_attrs *a);
+int free_job_slots(void);
+
+#define JOB_RETAIN 10         /* Seconds a finished job stays in the table */
 void delete_old_jobs(void);
 
 void try_dispatch(void);
+void start_job(JOB *j, PRINTER *p, int fd_file, int fd_prn);     /* Once its file is open and its printer connected */
+int job_signal(JOB *j, int sig);
+int job_pause(JOB *j);
+int job_resume(JOB *j);
+int job_cancel(JOB *j);
+
+void job_stopped(JOB *j);
+void job_continued(JOB *j);
+void job_exited(JOB *j, int status);
 
 void sig_hook(void);
 
@@ -0,0 +1,82 @@
+#ifndef TENANTS_H
+#define TENANTS_H
+
+#include <stdint.h>
+#include "state.h"
+
+/*
+ * Tenants.  Every job belongs to a submitter: the tenant the command line
+ * session has chosen with "tenant use <name>", or the one a control
+ * connection has named with CTL_TENANT (or in its CTL_SUBMIT payload).
+ * Tenants are created on first use; "tenant <name> [--weight <w>] [--cap <n>]
+ * [--queue <n>]" sets their parameters.  Jobs submitted by no one in
+ * particular belong to "default", tenants[0].
+ *
+ * Once a tenant exists, try_dispatch() shares the printers between the
+ * tenants' queues by deficit round robin instead of taking the waiting jobs
+ * in slot order: a tenant whose turn it is starts up to <weight> jobs (1 by
+ * default), then the turn passes on, so a tenant with a single job waiting
+ * gets a printer after at most one round however many jobs another has
+ * queued.  The turn is kept across passes.  A tenant never has more than
+ * <cap> jobs started and not finished, nor more than <queue> jobs in the
+ * job table; submissions past that are refused with "busy" (CTL_EBUSY), so
+ * that a bulk submitter cannot fill the table.  0 means no limit.
+ *
+ * The time each job waited to be started is sampled per tenant (the last
+ * TENANT_SAMPLES jobs) for the percentiles "tenant" reports.  The journal
+ * and the overflow queue keep each job's tenant by name: one that does not
+ * exist when the job is taken up again is created with the defaults.
+ * Tenants are not kept in configuration snapshots.
+ */
+
+#define MAX_TENANTS     32
+#define TENANT_NAME_MAX 31
+#define TENANT_WEIGHT_MAX 1000
+#define TENANT_SAMPLES  1024
+
+typedef struct tenant {
+	char *name;
+	int weight;
+	int cap;                /* Jobs started and not finished; 0: any */
+	int queue;              /* Jobs in the table; 0: any */
+	JOB_SET waiting;        /* Its jobs still JOB_CREATED, except for "default" */
+	int deficit;            /* Jobs it may still start in its current turn */
+	uint64_t submitted, started, refused;
+} TENANT;
+
+struct tenant_stats {
+	int waiting, in_flight;
+	double wait_p50, wait_p99, wait_max;       /* Milliseconds */
+};
+
+extern TENANT tenants[MAX_TENANTS];
+extern size_t n_tenants;
+extern JOB_SET tenant_waiting;         /* Union of the queues of the tenants other than "default" */
+
+/* Created (with "default") on first use; NULL if the table is full or the name is bad. */
+TENANT *tenant_get(const char *name);
+TENANT *lookup_tenant(const char *name);
+int set_tenant(TENANT *t, int weight, int cap, int queue);
+
+/* Before add_job(): nonzero if t (NULL: "default") may not have another job. */
+int tenant_full(TENANT *t);
+/* After add_job(): count a submission by t (NULL: "default"), one spilled to disk too. */
+void tenant_submitted(TENANT *t);
+/* From add_job() and restore_job(): queue the job on its tenant. */
+void tenant_queue_job(TENANT *t, JOB *j);
+/* From add_job() and job_launched(), while tenants exist. */
+void tenant_job_queued(JOB *j);
+void tenant_job_started(JOB *j);
+/* From job_set_status(), when a tenant's job stops waiting. */
+void tenant_job_left(JOB *j);
+
+/*
+ * For try_dispatch(): each tenant's waiting jobs, less those in skip, and
+ * how many it has in flight.
+ */
+void tenant_queues(JOB_SET queue[MAX_TENANTS], int in_flight[MAX_TENANTS], const JOB_SET *skip);
+extern size_t tenant_turn;             /* Index of the tenant whose turn it is */
+
+void tenant_stats(TENANT *t, struct tenant_stats *s);
+
+#endif
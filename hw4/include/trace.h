@@ -0,0 +1,38 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include "state.h"
+
+/*
+ * Trace capture and replay.
+ *
+ * "trace <file>" records every command line read by run_cli() (and control
+ * socket requests, as the equivalent commands), each dispatch decision, and
+ * the stops, continues and exits of job masters, with their offsets in
+ * microseconds from the start of the trace:
+ *
+ *   C <us> <command line>
+ *   D <us> <job id> <printer>
+ *   S <us> <job id>  /  R <us> <job id>  /  X <us> <job id> <wait status>
+ *
+ * "replay <file>" feeds the commands back through cli_exec() on a virtual
+ * clock, with simulated children whose run times come from the trace, and
+ * reports the dispatch decisions and latencies the current scheduler makes.
+ * Replay into a fresh spooler: the trace carries its own type, conversion
+ * and printer definitions.
+ */
+
+int trace_open(const char *path);
+void trace_close(void);
+void trace_command(const char *line);
+void trace_dispatch(JOB *j, PRINTER *p);
+void trace_child(char kind, JOB *j, int status);
+
+int replay_trace(const char *path, int realtime, const char *report, FILE *out);
+
+/* Simulated children, used by state.c while sim_mode is set. */
+void sim_launched(JOB *j);
+int sim_signal(JOB *j, int sig);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "state.h"
+#include "presi_worker.h"
+
+/*
+ * Converter worker pools (presi_worker.h), one per distinct "worker:" command.
+ * Defining the conversion starts one instance.  start_pipeline() leases an
+ * idle instance to each worker stage of a job before forking its master, which
+ * keeps the leased sockets and pumps the stage's data through them on a
+ * thread.  When the job ends the instances go back to their pool, or, if the
+ * job failed or an instance has served WORKER_RECYCLE jobs ("workers <max>
+ * <recycle>"), they are stopped and replaced on demand.
+ *
+ * A pool grows when a job finds no idle instance, up to WORKER_MAX ("workers
+ * <max>") instances, and starts a spare while jobs are waiting; it shrinks
+ * back, down to one, when more instances are idle than there are jobs
+ * waiting.  A stage that finds its pool at the maximum starts an instance of
+ * its own in the master, used for that job only.
+ */
+
+#define WORKER_MAX        4
+#define WORKER_MAX_LIMIT  16
+#define WORKER_RECYCLE    1000
+
+struct worker_pool_stats {
+	char *command;
+	int size, idle;
+	uint64_t spawned, leases, cold, recycled, failed;
+};
+
+extern int worker_max, worker_recycle;
+
+/* From add_conversion(): a pool for cmd_and_args if it runs as a worker. */
+int worker_define(char **cmd_and_args);
+int worker_stage(CONVERSION *c);           /* Nonzero if c runs on a worker */
+
+/*
+ * Before forking j's master: fd[i] is the socket of the instance leased to
+ * stage i of path, or -1.  Returns how many were leased.
+ */
+int worker_lease(JOB *j, CONVERSION **path, int fd[]);
+/* When j ends (ok: it finished), or its master could not be started. */
+void worker_job_done(JOB *j, int ok);
+/* From reap_children(): wait for the instances that have exited. */
+void workers_reap(void);
+void workers_close(void);
+
+/* In a pipeline master: run worker stage c from in to out, over fd (-1: an instance of its own). */
+int worker_stage_start(CONVERSION *c, int fd, int in, int out);
+/* Once the command stages are reaped: 0 if every worker stage succeeded. */
+int worker_stages_wait(void);
+
+/* Returns the number of pools, filling at most max. */
+int worker_stats(struct worker_pool_stats *s, int max);
+
+#endif
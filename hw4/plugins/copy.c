@@ -0,0 +1,32 @@
+/*
+ * Presi: sample converter plugin (presi_plugin.h)
+ *
+ * presi_copy passes its input through unchanged, like the "cat" converters
+ * of the benchmarks, so that plugin and command stages can be compared:
+ *
+ *   conversion b0 b1 plugin:bin/presi_copy.so:presi_copy
+ */
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "presi_plugin.h"
+
+int presi_copy(int in, int out, struct presi_convert_state *state) {
+	char buf[65536];
+	ssize_t n;
+	(void)state;
+
+	while ((n = read(in, buf, sizeof(buf))) != 0) {
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return 1;
+		}
+		for (ssize_t off = 0; off < n; ) {
+			ssize_t w = write(out, buf + off, n - off);
+			if (w < 0 && errno != EINTR) return 1;
+			if (w > 0) off += w;
+		}
+	}
+	return 0;
+}
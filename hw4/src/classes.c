@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "classes.h"
+#include "deadline.h"
+
+#define RATE_WEIGHT 0.25        // Of the latest job in the moving average
+
+char *class_policy_names[CLASS_POLICIES] = { "least-loaded", "round-robin", "fastest" };
+
+PRINTER_CLASS classes[MAX_CLASSES];
+size_t n_classes = 0;
+JOB_SET class_waiting;
+
+static uint32_t measured;                // Printers in a "fastest" class: their jobs are timed
+static double rate[MAX_PRINTERS];
+static uint64_t started_ns[MAX_JOBS];    // By job slot; 0 if not timed
+static off_t job_bytes[MAX_JOBS];
+
+int define_class(const char *name, uint32_t members, CLASS_POLICY policy) {
+	if (!members || policy >= CLASS_POLICIES) return -1;
+	PRINTER_CLASS *c = lookup_class(name);
+	if (!c) {
+		if (n_classes == MAX_CLASSES || !(name = strdup(name))) return -1;
+		c = &classes[n_classes++];
+		memset(c, 0, sizeof(*c));
+		c->name = (char *)name;
+	}
+	c->members = members;
+	c->policy = policy;
+
+	measured = 0;
+	for (size_t i=0; i<n_classes; i++)
+		if (classes[i].policy == CLASS_FASTEST) measured |= classes[i].members;
+	try_dispatch();          // Queued jobs may have new members to go to
+	return 0;
+}
+
+PRINTER_CLASS *lookup_class(const char *name) {
+	for (size_t i=0; i<n_classes; i++)
+		if (!strcmp(classes[i].name, name)) return &classes[i];
+	return NULL;
+}
+
+// Queues
+
+void class_add_job(PRINTER_CLASS *c, JOB *j) {
+	if (!j || j->status != JOB_CREATED) return;
+	int slot = j - jobs;
+	j->klass = c;
+	c->waiting.w[slot / 64] |= 1ull << (slot % 64);
+	class_waiting.w[slot / 64] |= 1ull << (slot % 64);
+}
+
+void class_job_left(JOB *j) {
+	int slot = j - jobs;
+	uint64_t bit = 1ull << (slot % 64);
+	j->klass->waiting.w[slot / 64] &= ~bit;
+	class_waiting.w[slot / 64] &= ~bit;
+}
+
+// Policies
+
+static int least_loaded(uint32_t can) {
+	int best = -1;
+	for (; can; can &= can - 1) {
+		PRINTER *p = &printers[__builtin_ctz(can)];
+		if (best < 0 || (p->busy + p->launching) * printers[best].slots < (printers[best].busy + printers[best].launching) * p->slots)
+			best = p->id;
+	}
+	return best;
+}
+
+int class_pick(PRINTER_CLASS *c, uint32_t can) {
+	int pick;
+	switch (c->policy) {
+	case CLASS_ROUND_ROBIN: {
+		uint32_t after = c->next < 32 ? can & (~0u << c->next) : 0;
+		pick = __builtin_ctz(after ? after : can);
+		c->next = pick + 1;
+		break;
+	}
+	case CLASS_FASTEST: {
+		uint32_t unmeasured = 0;
+		for (uint32_t m = can; m; m &= m - 1)
+			if (rate[__builtin_ctz(m)] == 0) unmeasured |= m & -m;
+		if (unmeasured) {
+			pick = least_loaded(unmeasured);
+			break;
+		}
+		pick = __builtin_ctz(can);
+		for (uint32_t m = can; m; m &= m - 1)
+			if (rate[__builtin_ctz(m)] > rate[pick]) pick = __builtin_ctz(m);
+		break;
+	}
+	default:
+		pick = least_loaded(can);
+	}
+	c->dispatched++;
+	return pick;
+}
+
+// Throughput
+
+void class_job_started(JOB *j, PRINTER *p) {
+	int slot = j - jobs;
+	struct stat sb;
+	started_ns[slot] = 0;
+	if (!(measured & (1u << p->id) || deadline_edf) || sim_mode || stat(j->spool_file ? j->spool_file : j->file_name, &sb) < 0) return;
+	job_bytes[slot] = sb.st_size;
+	started_ns[slot] = state_clock_ns();
+}
+
+void class_job_finished(JOB *j) {
+	int slot = j - jobs;
+	if (!started_ns[slot] || !j->printer) return;
+	uint64_t ns = state_clock_ns() - started_ns[slot];
+	started_ns[slot] = 0;
+	if (!ns || !job_bytes[slot]) return;
+
+	double r = job_bytes[slot] * 1e9 / ns, *avg = &rate[j->printer->id];
+	*avg = *avg ? *avg + RATE_WEIGHT * (r - *avg) : r;
+}
+
+double class_printer_rate(PRINTER *p) {
+	return rate[p->id];
+}
@@ -10,9 +10,31 @@
 #include <stdint.h>
 #include <signal.h>
 #include <unistd.h>
+#include <glob.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include "presi.h"
 #include "state.h"
+#include "events.h"
+#include "evring.h"
+#include "trace.h"
+#include "ctl.h"
+#include "journal.h"
+#include "config.h"
+#include "stage.h"
+#include "prefetch.h"
+#include "mover.h"
+#include "launcher.h"
+#include "placement.h"
+#include "overflow.h"
+#include "classes.h"
+#include "deadline.h"
+#include "tenants.h"
+#include "workers.h"
+#include "dedup.h"
+#include "progress.h"
+#include "cli.h"
 #include "sf_readline.h"
 
 static void cli_init_once(void) {
@@ -29,20 +51,37 @@ static void show_printers(FILE *out) {     // Function to show all available pri
     for (size_t i=0; i<n_printers; i++) {
         PRINTER *p = &printers[i];
         if (!p->name) continue;
-        fprintf(out, "PRINTER %2d %-10s type=%-4s %s\n",
+        fprintf(out, "PRINTER %2d %-10s type=%-4s %-8s slots=%d/%d\n",
             p->id, p->name, p->type,
             (p->status == PRINTER_DISABLED ? "disabled" :
-                p->status == PRINTER_IDLE ? "idle" : "busy"));
+                p->status == PRINTER_IDLE ? "idle" : "busy"), p->busy, p->slots);
     }
 }
 
-static void show_jobs(FILE *out) {          // Function to show all the jobs
-    for (size_t i=0; i<n_jobs; i++) {
+static void show_progress(FILE *out, JOB *j) {      // jobs -v: bytes, rates and ETA of a job that has started
+    struct job_progress p;
+    if (progress_sample(j, &p) < 0) return;
+    fprintf(out, " in=%llu/%llu", (unsigned long long)p.in, (unsigned long long)p.total);
+    if (p.out_known) fprintf(out, " out=%llu rate=%.1fKB/s", (unsigned long long)p.out, p.out_rate / 1024);
+    else fprintf(out, " rate=%.1fKB/s", p.in_rate / 1024);
+    if (p.eta >= 0) fprintf(out, " eta=%.0fs", p.eta);
+    fprintf(out, " elapsed=%.1fs idle=%.1fs%s", p.elapsed, p.idle, p.stalled ? " stalled" : "");
+}
+
+static void show_jobs(FILE *out, int verbose) {          // Function to show all the jobs
+    JOB_SET live = job_set_of(JOB_LIVE);
+    FOR_EACH_JOB(i, &live) {
         JOB *j = &jobs[i];
-        if (!j->file_name || j->status == JOB_DELETED) continue;
-        fprintf(out, "JOB[%2d] %-10s %s\n",
+        fprintf(out, "JOB[%2d] %-10s %s",
             j->id, job_status_names[j->status], j->file_name);
+        if (j->copies > 1) fprintf(out, " copies=%d", j->copies);
+        if (j->deadline) fprintf(out, " deadline=%+llds%s", (long long)(j->deadline - state_now()), deadline_late(j) ? " late" : "");
+        if (verbose) show_progress(out, j);
+        fputc('\n', out);
     }
+    struct overflow_stats o;
+    overflow_stats(&o);
+    if (o.queued) fprintf(out, "OVERFLOW %d jobs queued on disk\n", o.queued);
 }
 
 static int type_cmd(int argc, char **argv) {        // Function to define a new filetype
@@ -50,21 +89,51 @@ static int type_cmd(int argc, char **argv) {        // Function to define a new
     return 0;
 }
 
-static int printer_cmd(int argc, char **argv) {      // Function to define a new printer
-    if (argc != 3 || add_printer(argv[1], argv[2]) < 0) return -1;
-    return 0;
+static int printer_cmd(int argc, char **argv) {      // Function to define a new printer: printer <name> <type> [--slots <n>]
+    char *end = "";
+    long slots = 1;
+    if (argc == 5 && !strcmp(argv[3], "--slots")) slots = strtol(argv[4], &end, 10);
+    else if (argc != 3) return -1;
+    if (*end || slots < 1 || slots > PRINTER_MAX_SLOTS || add_printer(argv[1], argv[2]) < 0) return -1;
+    return set_printer_slots(lookup_printer(argv[1]), slots);
 }
 
-static int conversion_cmd(int argc, char **argv) {    // Function for defining a new file conversion
+static int class_cmd(int argc, char **argv, FILE *out) {      // class [<name> <printer>... [--policy least-loaded|round-robin|fastest]]
+    if (argc == 1) {
+        for (size_t k=0; k<n_classes; k++) {
+            PRINTER_CLASS *c = &classes[k];
+            int queued = 0;
+            for (int w=0; w<JOB_SET_WORDS; w++) queued += __builtin_popcountll(c->waiting.w[w]);
+            fprintf(out, "CLASS %s policy=%s queued=%d dispatched=%llu printers=", c->name, class_policy_names[c->policy],
+                queued, (unsigned long long)c->dispatched);
+            for (uint32_t m = c->members; m; m &= m - 1) {
+                PRINTER *p = &printers[__builtin_ctz(m)];
+                fprintf(out, "%s%s:%d/%d", m == c->members ? "" : ",", p->name, p->busy, p->slots);
+                if (c->policy == CLASS_FASTEST) fprintf(out, "@%.0fB/s", class_printer_rate(p));
+            }
+            fprintf(out, "\n");
+        }
+        return 0;
+    }
 
-    if (argc < 4) return -1;
-    FILE_TYPE *from = lookup_type(argv[1]);
-    FILE_TYPE *to = lookup_type(argv[2]);
-    if (!from || !to) return -1;
+    CLASS_POLICY policy = CLASS_LEAST_LOADED;
+    if (argc >= 4 && !strcmp(argv[argc-2], "--policy")) {
+        for (policy = 0; policy < CLASS_POLICIES && strcmp(argv[argc-1], class_policy_names[policy]); policy++) ;
+        argc -= 2;
+    }
+    uint32_t members = 0;
+    for (int i=2; i<argc; i++) {
+        PRINTER *p = lookup_printer(argv[i]);
+        if (!p) return -1;
+        members |= 1u << p->id;
+    }
+    return define_class(argv[1], members, policy);
+}
 
-    CONVERSION *c = define_conversion(argv[1], argv[2], &argv[3]);
+static int conversion_cmd(int argc, char **argv) {    // Function for defining a new file conversion
 
-    return c ? 0 : -1;
+    if (argc < 4) return -1;
+    return add_conversion(argv[1], argv[2], &argv[3]);
 }
 
 static int enable_disable_cmd(int enable, int argc, char **argv) {     // Function to enable/disable printer
@@ -72,71 +141,677 @@ static int enable_disable_cmd(int enable, int argc, char **argv) {     // Functi
     PRINTER *p = lookup_printer(argv[1]);
     if (!p) return -1;
 
-    PRINTER_STATUS target = enable ? PRINTER_IDLE : PRINTER_DISABLED;
+    PRINTER_STATUS target = !enable ? PRINTER_DISABLED : p->busy ? PRINTER_BUSY : PRINTER_IDLE;
     if (p->status != target) {
         p->status = target;
-        sf_printer_status(p->name, target);
+        ev_printer_status(p, target);
         if (enable) try_dispatch();
     }
 
     return 0;
 }
 
+struct print_opts {      // Where the jobs of a print command go, by when, and for whom
+    uint32_t eligible;
+    PRINTER_CLASS *cls;
+    time_t deadline;
+    TENANT *tenant;
+};
+
+static TENANT *session_tenant = NULL;       // "tenant use": NULL for "default"
+
+static int printer_mask(int argc, char **argv, struct print_opts *o) {     // Eligible printers named in argv[0..argc), or a single @class
+    o->eligible = (argc == 0) ? UINT32_MAX : 0;
+    o->cls = NULL;
+
+    if (argc == 1 && argv[0][0] == '@') {
+        if (!(o->cls = lookup_class(argv[0] + 1))) return -1;
+        o->eligible = o->cls->members;
+        return 0;
+    }
+    for (int i=0; i<argc; i++) {
+        PRINTER *p = lookup_printer(argv[i]);
+        if (!p) return -1;
+        o->eligible |= (1u << p->id);
+    }
+    return 0;
+}
+
+static int submit_job(const char *file, const char *type, const struct print_opts *o) {     // add_job() with its class, deadline and tenant
+    if (tenant_full(o->tenant)) return -2;
+    struct job_attrs a = { o->cls ? o->cls->name : NULL, o->tenant ? o->tenant->name : NULL, o->deadline, 1 };
+    int id = add_job(file, type, o->eligible, &a);
+    if (id < 0) return overflow_busy() ? -2 : -1;
+    tenant_submitted(o->tenant);
+    return 0;
+}
+
+static int queue_file(const char *file, const struct print_opts *o, int *queued) {     // Returns -1 only if the queue is full, -2 if busy (overflow queue or tenant limit)
+    FILE_TYPE *ft = infer_file_type((char *)file);
+    if (!ft) return 0;
+    int rc = submit_job(file, ft->name, o);
+    if (rc < 0) return rc;
+    (*queued)++;
+    return 0;
+}
+
+static int print_bulk(char *spec, int from_list, const struct print_opts *o) {     // Queue a list file, a directory or a glob
+    int queued = 0, full = 0;      // full: -1 table full, -2 busy
+
+    if (from_list) {
+        FILE *f = fopen(spec, "r");
+        if (!f) return -1;
+        char *line = NULL;
+        size_t cap = 0;
+        ssize_t n;
+        while (!full && (n = getline(&line, &cap, f)) >= 0) {
+            if (n > 0 && line[n-1] == '\n') line[n-1] = '\0';
+            if (line[0]) full = queue_file(line, o, &queued);
+        }
+        free(line);
+        fclose(f);
+
+    } else if (strpbrk(spec, "*?[")) {
+        glob_t g;
+        if (glob(spec, 0, NULL, &g) != 0) return -1;
+        for (size_t i=0; i<g.gl_pathc && !full; i++)
+            full = queue_file(g.gl_pathv[i], o, &queued);
+        globfree(&g);
+
+    } else {
+        struct dirent **ents;
+        int n = scandir(spec, &ents, NULL, alphasort);
+        if (n < 0) return -1;
+        for (int i=0; i<n; i++) {
+            char path[4096];
+            struct stat sb;
+            snprintf(path, sizeof(path), "%s/%s", spec, ents[i]->d_name);
+            if (!full && stat(path, &sb) == 0 && S_ISREG(sb.st_mode))
+                full = queue_file(path, o, &queued);
+            free(ents[i]);
+        }
+        free(ents);
+    }
+
+    try_dispatch();       // A single dispatch pass for the whole batch
+    if (full == -2) return -2;
+    return (queued == 0 || full) ? -1 : 0;
+}
+
 static int print_cmd(int argc, char **argv) {       // Function for assigning a print job
 
+    struct print_opts o = { 0, NULL, 0, session_tenant };
+    struct stat sb;
+
+    if (argc >= 2 && !strcmp(argv[1], "--deadline")) {       // print --deadline <time> ...
+        if (argc < 3 || deadline_parse(argv[2], &o.deadline) < 0) return -1;
+        argc -= 2;
+        argv += 2;
+    }
     if (argc < 2) return -1;
 
+    if (!strcmp(argv[1], "-f")) {
+        if (argc < 3 || printer_mask(argc-3, argv+3, &o) < 0) return -1;
+        return print_bulk(argv[2], 1, &o);
+    }
+
+    if (printer_mask(argc-2, argv+2, &o) < 0) return -1;
+
+    if (strpbrk(argv[1], "*?[") || (stat(argv[1], &sb) == 0 && S_ISDIR(sb.st_mode)))
+        return print_bulk(argv[1], 0, &o);
+
     FILE_TYPE *ft = infer_file_type(argv[1]);
     if (!ft) return -1;
 
-    uint32_t eligible = (argc == 2) ? UINT32_MAX : 0;
+    int rc = submit_job(argv[1], ft->name, &o);
+    if (rc < 0) return rc;
+    try_dispatch();
+    return 0;
+}
+
+static int cancel_many(int argc, char **argv) {     // cancel all | <first>-<last> | --printer <name>
+    int lo = 0, hi = INT32_MAX;
+    PRINTER *p = NULL;
 
-    for (int i=2; i<argc; i++) {
-        PRINTER *p = lookup_printer(argv[i]);
-        if (!p) return -1;
-        eligible |= (1u << p->id);
+    if (argc == 3 && !strcmp(argv[1], "--printer")) {
+        if (!(p = lookup_printer(argv[2]))) return -1;
+    } else if (argc != 2 || (strcmp(argv[1], "all") && sscanf(argv[1], "%d-%d", &lo, &hi) != 2)) {
+        return -1;
     }
 
-    if (add_job(argv[1], ft->name, eligible) < 0) return -1;
-    try_dispatch();
+    uint32_t defined = n_printers >= 32 ? UINT32_MAX : (1u << n_printers) - 1;
+    JOB_SET cancellable = job_set_of(1u << JOB_CREATED | 1u << JOB_RUNNING | 1u << JOB_PAUSED);
+    FOR_EACH_JOB(i, &cancellable) {
+        JOB *j = &jobs[i];
+        if (j->id < lo || j->id > hi) continue;
+        if (p) {        // Jobs on that printer, or waiting for it and no other
+            int on_it = (j->status == JOB_RUNNING || j->status == JOB_PAUSED) && j->printer == p;
+            int only_it = j->status == JOB_CREATED && (j->eligible & defined) == (1u << p->id);
+            if (!on_it && !only_it) continue;
+        }
+        job_cancel(j);
+    }
+    if (!p) overflow_cancel(lo, hi);       // Jobs waiting on disk have no printer yet
     return 0;
 }
 
 static int pause_resume_cancel_cmd(int kind, int argc, char **argv) {      // Function for pause/resume/cancel a job, (kind argument corresponds to the type of action)
 
+    if (kind == 2 && argc >= 2 && (argc == 3 || !strcmp(argv[1], "all") || strchr(argv[1], '-')))
+        return cancel_many(argc, argv);
+
     if (argc != 2) return -1;
     int id = atoi(argv[1]);
     JOB *j = lookup_job(id);
-    if (!j) return -1;
+    if (!j) return kind == 2 ? overflow_cancel(id, id) : -1;
+
+    if (kind == 0) return job_pause(j) < 0 ? -1 : 0;
+    if (kind == 1) return job_resume(j) < 0 ? -1 : 0;
+    return job_cancel(j);
+}
+
+static int ring_cmd(int argc, char **argv, FILE *out) {      // Function to control the binary event ring
 
-    if (kind == 0 && j->status == JOB_RUNNING) {
-        killpg(j->pgid, SIGSTOP);
+    if (argc == 1) {
+        uint64_t head, tail, dropped;
+        uint32_t slots;
+        evring_stats(&head, &tail, &dropped, &slots);
+        fprintf(out, "RING %s slots=%u written=%llu read=%llu pending=%llu dropped=%llu%s\n",
+            evring_active ? "on" : "off", slots, (unsigned long long)head, (unsigned long long)tail,
+            (unsigned long long)(head - tail), (unsigned long long)dropped,
+            evring_exclusive ? " exclusive" : "");
         return 0;
     }
 
-    if (kind == 1 && j->status == JOB_PAUSED) {
-        killpg(j->pgid, SIGCONT);
+    if (!strcmp(argv[1], "off") && argc == 2) {
+        evring_close();
         return 0;
     }
 
-    if (kind == 2) {
-        if (j->status == JOB_CREATED) {
-            j->status = JOB_ABORTED;
-            j->finish_time = time(NULL);
-            sf_job_status(j->id, JOB_ABORTED);
-            sf_job_aborted(j->id, 0);
-            return 0;
+    if (!strcmp(argv[1], "dump") && argc == 3)
+        return evring_dump(argv[2]);
+
+    if (!strcmp(argv[1], "on") && argc >= 3) {      // ring on <file> [<slots>] [exclusive] [drain <file>]
+        uint32_t slots = EVRING_SLOTS;
+        int exclusive = 0;
+        char *drain = NULL;
+        for (int i=3; i<argc; i++) {
+            if (!strcmp(argv[i], "exclusive")) exclusive = 1;
+            else if (!strcmp(argv[i], "drain") && i+1 < argc) drain = argv[++i];
+            else if (atoi(argv[i]) > 0) slots = atoi(argv[i]);
+            else return -1;
         }
+        return evring_open(argv[2], slots, exclusive, drain);
+    }
+    return -1;
+}
+
+static int trace_cmd(int argc, char **argv) {      // Function to start/stop recording a trace
+    if (argc != 2) return -1;
+    if (!strcmp(argv[1], "off")) {
+        trace_close();
+        return 0;
+    }
+    return trace_open(argv[1]);
+}
+
+static int replay_cmd(int argc, char **argv, FILE *out) {       // Function to replay a recorded trace
+    if (argc < 2) return -1;
+    int realtime = 0;
+    char *report = NULL;
+    for (int i=2; i<argc; i++) {
+        if (!strcmp(argv[i], "real")) realtime = 1;
+        else if (!strcmp(argv[i], "fast")) realtime = 0;
+        else if (!strcmp(argv[i], "report") && i+1 < argc) report = argv[++i];
+        else return -1;
+    }
+    return replay_trace(argv[1], realtime, report, out);
+}
+
+static int control_cmd(int argc, char **argv) {      // Function to open/close the binary control socket
+    if (argc > 2) return -1;
+    if (argc == 2 && !strcmp(argv[1], "off")) {
+        ctl_close();
+        return 0;
+    }
+    return ctl_open(argc == 2 ? argv[1] : CTL_SOCKET);
+}
+
+static int journal_cmd(int argc, char **argv, FILE *out) {      // Function to open/close/compact the job journal
+    if (argc == 1) {
+        uint64_t records, bytes, syncs, gen, failures;
+        journal_stats(&records, &bytes, &syncs, &gen, &failures);
+        fprintf(out, "JOURNAL %s records=%llu bytes=%llu syncs=%llu gen=%llu carried=%d failures=%llu\n",
+            journal_active ? "on" : "off", (unsigned long long)records, (unsigned long long)bytes,
+            (unsigned long long)syncs, (unsigned long long)gen, journal_carried(), (unsigned long long)failures);
+        return 0;
+    }
+    if (argc != 2) return -1;
+    if (!strcmp(argv[1], "off")) {
+        journal_close();
+        return 0;
+    }
+    if (!strcmp(argv[1], "compact")) return journal_compact();
+    if (!strcmp(argv[1], "sync")) return journal_sync();
+
+    int restored = journal_open(argv[1]);
+    if (restored < 0) return -1;
+    fprintf(out, "JOURNAL recovered %d jobs\n", restored);
+    if (journal_carried()) fprintf(out, "JOURNAL %d more waiting for a free slot\n", journal_carried());
+    try_dispatch();
+    return 0;
+}
+
+static int stage_cmd(int argc, char **argv, FILE *out) {      // Function to control spool staging
+    if (argc == 1) {
+        uint64_t count[STAGE_METHODS], bytes;
+        int queued;
+        stage_stats(count, &bytes, &queued);
+        fprintf(out, "STAGE %s cloned=%llu linked=%llu copied=%llu failed=%llu bytes_copied=%llu pending=%d\n",
+            stage_active ? "on" : "off", (unsigned long long)count[STAGE_CLONE], (unsigned long long)count[STAGE_LINK],
+            (unsigned long long)count[STAGE_COPY], (unsigned long long)count[STAGE_FAILED],
+            (unsigned long long)bytes, queued);
+        return 0;
+    }
+    if (argc == 2 && !strcmp(argv[1], "off")) {
+        stage_close();
+        return 0;
+    }
+    if (!strcmp(argv[1], "on") && argc <= 3) return stage_open(argc == 3 ? argv[2] : STAGE_DIR);
+    return -1;
+}
+
+static int prefetch_cmd(int argc, char **argv, FILE *out) {      // prefetch [on [<depth> [<budget-MB>]], off]
+    if (argc == 1) {
+        struct ttfb_stats t[TTFB_KINDS];
+        uint64_t hinted, bytes;
+        size_t flight;
+        prefetch_stats(t, &hinted, &bytes, &flight);
+        fprintf(out, "PREFETCH %s hinted=%llu bytes=%llu in_flight=%zu\n", prefetch_active ? "on" : "off",
+            (unsigned long long)hinted, (unsigned long long)bytes, flight);
+        static const char *kind[TTFB_KINDS] = { "cold", "prefetched" };
+        for (int k=0; k<TTFB_KINDS; k++)
+            fprintf(out, "TTFB %-10s jobs=%llu mean_us=%.1f max_us=%.1f\n", kind[k], (unsigned long long)t[k].count,
+                t[k].count ? t[k].total_ns / 1e3 / t[k].count : 0.0, t[k].max_ns / 1e3);
+        return 0;
+    }
+    if (argc == 2 && !strcmp(argv[1], "off")) {
+        prefetch_close();
+        return 0;
+    }
+    if (strcmp(argv[1], "on") || argc > 4) return -1;
+
+    char *end;
+    long depth = PREFETCH_DEPTH, mb = PREFETCH_BUDGET >> 20;
+    if (argc >= 3 && ((depth = strtol(argv[2], &end, 10)) < 0 || depth > MAX_JOBS || *end)) return -1;
+    if (argc == 4 && ((mb = strtol(argv[3], &end, 10)) <= 0 || *end)) return -1;
+    return prefetch_open(depth, (size_t)mb << 20);
+}
+
+static int mover_cmd(int argc, char **argv, FILE *out) {      // mover [auto, uring, splice, off]
+    static const char *modes[] = { "auto", "uring", "splice", "off" };
+    if (argc == 1) {
+        struct mover_stats s;
+        mover_stats(&s);
+        fprintf(out, "MOVER %s transfers=%llu bytes=%llu active=%d max_active=%d\n", s.backend == MOVER_AUTO ? "idle" : modes[s.backend],
+            (unsigned long long)s.transfers, (unsigned long long)s.bytes, s.active, s.max_active);
+        return 0;
+    }
+    if (argc != 2) return -1;
+    for (int m=MOVER_AUTO; m<=MOVER_OFF; m++)
+        if (!strcmp(argv[1], modes[m])) return mover_set_mode(m);
+    return -1;
+}
+
+static int launchers_cmd(int argc, char **argv, FILE *out) {      // launchers [<threads>]
+    if (argc == 1) {
+        uint64_t launched;
+        int pending, max_pending;
+        launcher_stats(&launched, &pending, &max_pending);
+        fprintf(out, "LAUNCHERS threads=%d launched=%llu pending=%d max_pending=%d\n", launcher_threads,
+            (unsigned long long)launched, pending, max_pending);
+        return 0;
+    }
+    char *end;
+    long n = strtol(argv[1], &end, 10);
+    if (argc != 2 || *end) return -1;
+    return launcher_set_threads(n);
+}
 
-        if (j->status == JOB_RUNNING || j->status == JOB_PAUSED) {
-            killpg(j->pgid, SIGTERM);
-            if (j->status == JOB_PAUSED) killpg(j->pgid, SIGCONT);
-            return 0;
+static int placement_cmd(int argc, char **argv, FILE *out) {      // placement [on <spooler-cpus> [<pool-cpus>], off, printer <name> [cores <n>] [batch|normal]]
+    char a[256], b[256];
+    if (argc == 1) {
+        static const char *roles[] = { "unused", "spooler", "pool", "shared" };
+        struct cpu_stats cpus[PLACE_MAX_CPUS];
+        uint64_t spooler, pool;
+        int n = placement_stats(cpus, &spooler, &pool);
+        fprintf(out, "PLACEMENT %s spooler=%s pool=%s\n", placement_active ? "on" : "off",
+            cpu_list_format(spooler, a, sizeof(a)), cpu_list_format(pool, b, sizeof(b)));
+        for (int c=0; c<n; c++)
+            fprintf(out, "CPU %d role=%s domain=%d util=%.1f%% running=%d placed=%llu\n", c, roles[cpus[c].role],
+                cpus[c].domain, 100 * cpus[c].util, cpus[c].running, (unsigned long long)cpus[c].placed);
+        for (size_t i=0; i<n_printers; i++) {
+            int cores, batch;
+            placement_printer(&printers[i], &cores, &batch);
+            if (cores || batch) fprintf(out, "PRINTER %s cores=%d class=%s\n", printers[i].name, cores, batch ? "batch" : "normal");
         }
+        JOB_SET running = job_set_of(1u << JOB_RUNNING | 1u << JOB_PAUSED);
+        FOR_EACH_JOB(i, &running)
+            if (jobs[i].cpus) fprintf(out, "JOB[%d] printer=%s cpus=%s\n", jobs[i].id, jobs[i].printer->name,
+                cpu_list_format(jobs[i].cpus, a, sizeof(a)));
+        return 0;
+    }
+    if (argc == 2 && !strcmp(argv[1], "off")) {
+        placement_close();
+        return 0;
+    }
+    if (!strcmp(argv[1], "on") && (argc == 3 || argc == 4)) {
+        uint64_t spooler, pool = 0;
+        if (cpu_list_parse(argv[2], &spooler) < 0 || (argc == 4 && cpu_list_parse(argv[3], &pool) < 0)) return -1;
+        return placement_open(spooler, pool);
+    }
+    if (!strcmp(argv[1], "printer") && argc >= 3) {
+        PRINTER *p = lookup_printer(argv[2]);
+        if (!p) return -1;
+        int cores, batch;
+        placement_printer(p, &cores, &batch);
+        for (int i=3; i<argc; i++) {
+            if (!strcmp(argv[i], "cores") && i+1 < argc) cores = atoi(argv[++i]);
+            else if (!strcmp(argv[i], "batch")) batch = 1;
+            else if (!strcmp(argv[i], "normal")) batch = 0;
+            else return -1;
+        }
+        return placement_set_printer(p, cores, batch);
     }
     return -1;
 }
 
+static int deadline_cmd(int argc, char **argv, FILE *out) {      // deadline [edf, fifo]
+    if (argc == 1) {
+        struct deadline_stats s;
+        deadline_stats(&s);
+        fprintf(out, "DEADLINE %s jobs=%llu met=%llu missed=%llu aborted=%llu flagged=%llu waiting=%d at_risk=%d\n",
+            deadline_edf ? "edf" : "fifo", (unsigned long long)s.jobs, (unsigned long long)s.met, (unsigned long long)s.missed,
+            (unsigned long long)s.aborted, (unsigned long long)s.flagged, s.waiting, s.at_risk);
+        return 0;
+    }
+    if (argc != 2 || (strcmp(argv[1], "edf") && strcmp(argv[1], "fifo"))) return -1;
+    deadline_edf = !strcmp(argv[1], "edf");
+    try_dispatch();
+    return 0;
+}
+
+static int tenant_cmd(int argc, char **argv, FILE *out) {      // tenant [use <name>, <name> [--weight <w>] [--cap <n>] [--queue <n>]]
+    if (argc == 1) {
+        for (size_t k=0; k<n_tenants; k++) {
+            TENANT *t = &tenants[k];
+            struct tenant_stats s;
+            tenant_stats(t, &s);
+            fprintf(out, "TENANT %s%s weight=%d cap=%d queue=%d waiting=%d in_flight=%d submitted=%llu started=%llu refused=%llu"
+                " wait_p50=%.1fms wait_p99=%.1fms wait_max=%.1fms\n", t->name, t == session_tenant || (!session_tenant && k == 0) ? "*" : "",
+                t->weight, t->cap, t->queue, s.waiting, s.in_flight, (unsigned long long)t->submitted, (unsigned long long)t->started,
+                (unsigned long long)t->refused, s.wait_p50, s.wait_p99, s.wait_max);
+        }
+        return 0;
+    }
+    if (argc == 3 && !strcmp(argv[1], "use")) {
+        TENANT *t = tenant_get(argv[2]);
+        if (!t) return -1;
+        session_tenant = t == &tenants[0] ? NULL : t;
+        return 0;
+    }
+
+    TENANT *t = lookup_tenant(argv[1]);
+    int weight = t ? t->weight : 1, cap = t ? t->cap : 0, queue = t ? t->queue : 0;
+    for (int i=2; i<argc; i+=2) {
+        char *end;
+        if (i + 1 == argc) return -1;
+        long v = strtol(argv[i+1], &end, 10);
+        if (*end || v < 0 || v > INT32_MAX) return -1;
+        if (!strcmp(argv[i], "--weight")) weight = v;
+        else if (!strcmp(argv[i], "--cap")) cap = v;
+        else if (!strcmp(argv[i], "--queue")) queue = v;
+        else return -1;
+    }
+    if (weight < 1 || weight > TENANT_WEIGHT_MAX || !(t = tenant_get(argv[1]))) return -1;
+    return set_tenant(t, weight, cap, queue);
+}
+
+static int progress_cmd(int argc, char **argv, FILE *out) {      // progress [on, off, stall <secs>]
+    if (argc == 1) {
+        JOB_SET running = jobs_in[JOB_RUNNING];
+        int n = 0;
+        FOR_EACH_JOB(i, &running) n++;
+        fprintf(out, "PROGRESS relay=%s stall=%ds running=%d stalled=%d\n", progress_relay_on ? "on" : "off", progress_stall,
+            n, progress_stalled_jobs());
+        return 0;
+    }
+    if (argc == 2 && (!strcmp(argv[1], "on") || !strcmp(argv[1], "off"))) {
+        progress_relay_on = !strcmp(argv[1], "on");
+        return 0;
+    }
+    char *end;
+    long secs = argc == 3 && !strcmp(argv[1], "stall") ? strtol(argv[2], &end, 10) : 0;
+    if (secs < 1 || *end || secs > INT32_MAX) return -1;
+    progress_stall = secs;
+    return 0;
+}
+
+static int dedup_cmd(int argc, char **argv, FILE *out) {      // dedup [merge, reject [<window-secs>] [mmap], off]
+    static const char *modes[] = { "off", "merge", "reject" };
+    if (argc == 1) {
+        struct dedup_stats s;
+        dedup_stats(&s);
+        fprintf(out, "DEDUP %s window=%ds mmap=%s checked=%llu held=%d hashed=%llu hashed_bytes=%llu merged=%llu rejected=%llu\n",
+            modes[dedup_mode], dedup_window, dedup_mmap ? "on" : "off", (unsigned long long)s.checked, s.held, (unsigned long long)s.hashed,
+            (unsigned long long)s.hashed_bytes, (unsigned long long)s.merged, (unsigned long long)s.rejected);
+        return 0;
+    }
+    int mode = DEDUP_OFF;
+    while (mode <= DEDUP_REJECT && strcmp(argv[1], modes[mode])) mode++;
+    if (mode > DEDUP_REJECT || (mode == DEDUP_OFF && argc != 2) || argc > 4) return -1;
+
+    int window = DEDUP_WINDOW, map = 0;
+    for (int i=2; i<argc; i++) {
+        char *end;
+        long v = strtol(argv[i], &end, 10);
+        if (!strcmp(argv[i], "mmap")) map = 1;
+        else if (i == 2 && !*end && v > 0 && v <= INT32_MAX) window = v;
+        else return -1;
+    }
+    dedup_mode = mode;
+    dedup_window = window;
+    dedup_mmap = map;
+    return 0;
+}
+
+static int workers_cmd(int argc, char **argv, FILE *out) {      // workers [<max> [<recycle>]]
+    if (argc == 1) {
+        struct worker_pool_stats s[32];
+        int n = worker_stats(s, 32);
+        fprintf(out, "WORKERS max=%d recycle=%d pools=%d\n", worker_max, worker_recycle, n);
+        for (int i=0; i<n && i<32; i++)
+            fprintf(out, "WORKER %s size=%d idle=%d spawned=%llu leases=%llu cold=%llu recycled=%llu failed=%llu\n", s[i].command,
+                s[i].size, s[i].idle, (unsigned long long)s[i].spawned, (unsigned long long)s[i].leases, (unsigned long long)s[i].cold,
+                (unsigned long long)s[i].recycled, (unsigned long long)s[i].failed);
+        return 0;
+    }
+    char *end;
+    long max = strtol(argv[1], &end, 10), recycle = worker_recycle;
+    if (argc > 3 || *end || max < 1 || max > WORKER_MAX_LIMIT) return -1;
+    if (argc == 3 && ((recycle = strtol(argv[2], &end, 10)) < 1 || *end)) return -1;
+    worker_max = max;
+    worker_recycle = recycle > INT32_MAX ? INT32_MAX : recycle;
+    return 0;
+}
+
+static int overflow_cmd(int argc, char **argv, FILE *out) {      // overflow [on [<dir> [<high> <low>]], off]
+    if (argc == 1) {
+        struct overflow_stats s;
+        overflow_stats(&s);
+        fprintf(out, "OVERFLOW %s queued=%d state=%s high=%d low=%d spilled=%llu paged=%llu cancelled=%llu refused=%llu bytes=%llu syncs=%llu\n",
+            overflow_active ? "on" : "off", s.queued, s.busy ? "busy" : "accepting", s.high, s.low, (unsigned long long)s.spilled,
+            (unsigned long long)s.paged, (unsigned long long)s.cancelled, (unsigned long long)s.refused, (unsigned long long)s.file_bytes,
+            (unsigned long long)s.syncs);
+        return 0;
+    }
+    if (argc == 2 && !strcmp(argv[1], "off")) {
+        overflow_close();
+        return 0;
+    }
+    if (strcmp(argv[1], "on") || argc == 4 || argc > 5) return -1;
+
+    char *end;
+    long high = OVERFLOW_HIGH, low = OVERFLOW_LOW;
+    if (argc == 5 && ((high = strtol(argv[3], &end, 10)) <= 0 || *end || (low = strtol(argv[4], &end, 10)) < 0 || *end)) return -1;
+    return overflow_open(argc >= 3 ? argv[2] : OVERFLOW_DIR, high, low);
+}
+
+static int watch_cmd(int argc, char **argv, FILE *out) {     // watch [job <id>] [printer <name>] [status <s>...] [jobs|printers] | off
+    struct ctl_filter f = { -1, -1, 0, 0 };
+
+    if (argc == 2 && !strcmp(argv[1], "off")) {
+        ctl_watch(NULL, NULL);
+        return 0;
+    }
+
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "job") && i+1 < argc) {
+            f.job = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "printer") && i+1 < argc) {
+            PRINTER *p = lookup_printer(argv[++i]);
+            if (!p) return -1;
+            f.printer = p->id;
+        } else if (!strcmp(argv[i], "jobs")) {
+            f.kinds |= CTL_WATCH_JOBS;
+        } else if (!strcmp(argv[i], "printers")) {
+            f.kinds |= CTL_WATCH_PRINTERS;
+        } else if (!strcmp(argv[i], "status") && i+1 < argc) {
+            while (i+1 < argc) {      // One or more job status names
+                int st = JOB_CREATED;
+                while (st <= JOB_DELETED && strcmp(argv[i+1], job_status_names[st])) st++;
+                if (st > JOB_DELETED) break;
+                f.status_mask |= 1u << st;
+                i++;
+            }
+            if (!f.status_mask) return -1;
+        } else {
+            return -1;
+        }
+    }
+    ctl_watch(out, &f);
+    return 0;
+}
+
+static char *read_cmd_line(FILE *in, int interactive) {    // Read one command, from the terminal or from a command file
+
+    if (interactive) return sf_readline("presi> ");
+
+    sig_hook();    // sf_readline() is not in the loop here, so handle pending signals ourselves
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n = getline(&line, &cap, in);
+    if (n < 0) {
+        free(line);
+        return NULL;
+    }
+    if (n > 0 && line[n-1] == '\n') line[n-1] = '\0';
+    return line;
+}
+
+int cli_exec(char *line, FILE *out)       // Run one command line; returns 1 if it was "quit"
+{
+    char *argv[33];
+    int argc = 0;
+    for (char *tok = strtok(line, " \t\n"); tok && argc < 32; tok = strtok(NULL, " \t\n"))
+        argv[argc++] = tok;
+    argv[argc] = NULL;     // Conversion commands are passed on as a NULL-terminated argv
+    int rc = 0;
+    if (argc == 0) {
+        return 0;
+
+    } else if (!strcmp(argv[0], "help")) {
+        fprintf(out,
+            "Commands:\n"
+            "help quit\n"
+            "type printer conversion\n"
+            "printer <name> <type> [--slots <n>]\n"
+            "class [<name> <printer>... [--policy least-loaded, round-robin, fastest]]\n"
+            "printers jobs [-v]\n"
+            "print [pause, resume, cancel] [enable, disable]\n"
+            "print [--deadline <+secs|hh:mm|epoch>] <file|dir|glob> [printers...|@class]  print -f <listfile> [printers...|@class]\n"
+            "deadline [edf, fifo]\n"
+            "tenant [use <name>, <name> [--weight <w>] [--cap <n>] [--queue <n>]]\n"
+            "cancel <id|all|first-last> cancel --printer <name>\n"
+            "ring [on <file> [slots] [exclusive] [drain <file>], off, dump <file>]\n"
+            "trace [<file>, off] replay <file> [fast, real] [report <file>]\n"
+            "control [<socket>, off]\n"
+            "journal [<dir>, off, compact, sync]\n"
+            "save-config <file> load-config <file>\n"
+            "stage [on [<dir>], off]\n"
+            "prefetch [on [<depth> [<budget-MB>]], off]\n"
+            "mover [auto, uring, splice, off]\n"
+            "launchers [<threads>]\n"
+            "placement [on <spooler-cpus> [<pool-cpus>], off, printer <name> [cores <n>] [batch, normal]]\n"
+            "overflow [on [<dir> [<high> <low>]], off]\n"
+            "workers [<max> [<recycle>]]\n"
+            "dedup [merge, reject [<window-secs>] [mmap], off]\n"
+            "progress [on, off (default), stall <secs>]\n"
+            "watch [job <id>] [printer <name>] [status <status>...] [jobs, printers], watch off\n");
+    } else if (!strcmp(argv[0], "quit")) {
+        trace_close();
+        ctl_watch(NULL, NULL);
+        ctl_close();
+        stage_close();
+        dedup_close();
+        launcher_close();
+        mover_close();
+        overflow_close();
+        journal_close();
+        evring_close();
+        workers_close();
+        sf_cmd_ok();
+        return 1;
+    }
+    else if (!strcmp(argv[0], "type")) rc = type_cmd(argc, argv);
+    else if (!strcmp(argv[0], "printer")) rc = printer_cmd(argc, argv);
+    else if (!strcmp(argv[0], "conversion")) rc = conversion_cmd(argc, argv);
+    else if (!strcmp(argv[0], "class")) rc = class_cmd(argc, argv, out);
+    else if (!strcmp(argv[0], "printers")) show_printers(out);
+    else if (!strcmp(argv[0], "jobs") && (argc == 1 || (argc == 2 && !strcmp(argv[1], "-v")))) show_jobs(out, argc == 2);
+    else if (!strcmp(argv[0], "print")) rc = print_cmd(argc, argv);
+    else if (!strcmp(argv[0], "pause")) rc = pause_resume_cancel_cmd(0, argc, argv);
+    else if (!strcmp(argv[0], "resume")) rc = pause_resume_cancel_cmd(1, argc, argv);
+    else if (!strcmp(argv[0], "cancel")) rc = pause_resume_cancel_cmd(2, argc, argv);
+    else if (!strcmp(argv[0], "enable")) rc = enable_disable_cmd(1, argc, argv);
+    else if (!strcmp(argv[0], "disable")) rc = enable_disable_cmd(0, argc, argv);
+    else if (!strcmp(argv[0], "ring")) rc = ring_cmd(argc, argv, out);
+    else if (!strcmp(argv[0], "trace")) rc = trace_cmd(argc, argv);
+    else if (!strcmp(argv[0], "replay")) rc = replay_cmd(argc, argv, out);
+    else if (!strcmp(argv[0], "control")) rc = control_cmd(argc, argv);
+    else if (!strcmp(argv[0], "watch")) rc = watch_cmd(argc, argv, out);
+    else if (!strcmp(argv[0], "journal")) rc = journal_cmd(argc, argv, out);
+    else if (!strcmp(argv[0], "launchers")) rc = launchers_cmd(argc, argv, out);
+    else if (!strcmp(argv[0], "placement")) rc = placement_cmd(argc, argv, out);
+    else if (!strcmp(argv[0], "overflow")) rc = overflow_cmd(argc, argv, out);
+    else if (!strcmp(argv[0], "workers")) rc = workers_cmd(argc, argv, out);
+    else if (!strcmp(argv[0], "dedup")) rc = dedup_cmd(argc, argv, out);
+    else if (!strcmp(argv[0], "progress")) rc = progress_cmd(argc, argv, out);
+    else if (!strcmp(argv[0], "deadline")) rc = deadline_cmd(argc, argv, out);
+    else if (!strcmp(argv[0], "tenant")) rc = tenant_cmd(argc, argv, out);
+    else if (!strcmp(argv[0], "mover")) rc = mover_cmd(argc, argv, out);
+    else if (!strcmp(argv[0], "prefetch")) rc = prefetch_cmd(argc, argv, out);
+    else if (!strcmp(argv[0], "stage")) rc = stage_cmd(argc, argv, out);
+    else if (!strcmp(argv[0], "save-config")) rc = argc == 2 ? save_config(argv[1]) : -1;
+    else if (!strcmp(argv[0], "load-config")) rc = argc == 2 ? load_config(argv[1]) : -1;
+    else rc = -1;
+
+    if (rc == 0) sf_cmd_ok();
+    else if (rc == -2) sf_cmd_error("busy: overflow queue or tenant queue is full, retry later");
+    else sf_cmd_error("bad command");
+    return 0;
+}
+
 int run_cli(FILE *in, FILE *out)
 {
     cli_init_once();
@@ -144,46 +819,11 @@ int run_cli(FILE *in, FILE *out)
     int interactive = (in == stdin);
     char *line;
 
-    while ((line = sf_readline(interactive ? "presi> " : ""))) {
-        char *argv[32];
-        int argc = 0;
-        for (char *tok = strtok(line, " \t\n"); tok && argc < 32; tok = strtok(NULL, " \t\n"))
-            argv[argc++] = tok;
-        int rc = 0;
-        if (argc == 0) {
-            free(line);
-            continue;
-
-        } else if (!strcmp(argv[0], "help")) {
-            fprintf(out,
-                "Commands:\n"
-                "help quit\n"
-                "type printer conversion\n"
-                "printers jobs\n"
-                "print [pause, resume, cancel] [enable, disable]\n");
-        } else if (!strcmp(argv[0], "quit")) {
-            free(line);
-            sf_cmd_ok();
-            return -1;
-        }
-        else if (!strcmp(argv[0], "type")) rc = type_cmd(argc, argv);
-        else if (!strcmp(argv[0], "printer")) rc = printer_cmd(argc, argv);
-        else if (!strcmp(argv[0], "conversion")) rc = conversion_cmd(argc, argv);
-        else if (!strcmp(argv[0], "printers")) show_printers(out);
-        else if (!strcmp(argv[0], "jobs")) show_jobs(out);
-        else if (!strcmp(argv[0], "print")) rc = print_cmd(argc, argv);
-        else if (!strcmp(argv[0], "pause")) rc = pause_resume_cancel_cmd(0, argc, argv);
-        else if (!strcmp(argv[0], "resume")) rc = pause_resume_cancel_cmd(1, argc, argv);
-        else if (!strcmp(argv[0], "cancel")) rc = pause_resume_cancel_cmd(2, argc, argv);
-        else if (!strcmp(argv[0], "enable")) rc = enable_disable_cmd(1, argc, argv);
-        else if (!strcmp(argv[0], "disable")) rc = enable_disable_cmd(0, argc, argv);
-        else rc = -1;
-
-        if (rc == 0) sf_cmd_ok();
-        else sf_cmd_error("bad command");
-
+    while ((line = read_cmd_line(in, interactive))) {
+        trace_command(line);
+        int quit = cli_exec(line, out);
         free(line);
-
+        if (quit) return -1;
     }
     return (in == stdin) ? -1 : 0;
 }
@@ -0,0 +1,269 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "state.h"
+#include "crc32.h"
+#include "config.h"
+#include "classes.h"
+#include "plugins.h"
+#include "workers.h"
+
+// Saving: the sections are built in memory, then written in one go
+
+struct buf {
+	char *data;
+	size_t len, cap;
+};
+
+static uint32_t put(struct buf *b, const void *p, size_t n) {     // Returns the offset, or UINT32_MAX if out of memory
+	if (b->len + n > b->cap) {
+		size_t cap = b->cap ? b->cap : 1024;
+		while (cap < b->len + n) cap *= 2;
+		char *d = realloc(b->data, cap);
+		if (!d) return UINT32_MAX;
+		b->data = d;
+		b->cap = cap;
+	}
+	memcpy(b->data + b->len, p, n);
+	b->len += n;
+	return b->len - n;
+}
+
+static uint32_t put_str(struct buf *strs, const char *s) {
+	return put(strs, s, strlen(s) + 1);
+}
+
+static int type_index(const char *name) {
+	for (size_t i=0; i<n_types; i++)
+		if (!strcmp(types[i]->name, name)) return i;
+	return -1;
+}
+
+static int conv_index(CONVERSION *c) {
+	for (size_t i=0; i<n_conversions; i++)
+		if (conversions[i] == c) return i;
+	return -1;
+}
+
+static void sync_dir(const char *path) {       // So that the rename itself survives a crash
+	char dir[4200];
+	const char *slash = strrchr(path, '/');
+	snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - path) + 1 : 1, slash ? path : ".");
+	int dfd = open(dir, O_RDONLY);
+	if (dfd >= 0) {
+		fsync(dfd);
+		close(dfd);
+	}
+}
+
+int save_config(const char *path) {
+	struct buf sec[8] = {{0}};        // types, convs, printers, paths, classes, args, steps, strings
+	struct buf *tys = &sec[0], *cvs = &sec[1], *prs = &sec[2], *pts = &sec[3], *cls = &sec[4], *args = &sec[5], *steps = &sec[6], *strs = &sec[7];
+	struct config_hdr h = { CONFIG_MAGIC, CONFIG_VERSION };
+	int rc = -1;
+
+	for (size_t i=0; i<n_types; i++) {
+		uint32_t off = put_str(strs, types[i]->name);
+		put(tys, &off, sizeof(off));
+	}
+
+	for (size_t i=0; i<n_conversions; i++) {
+		CONVERSION *c = conversions[i];
+		struct config_conv cc = { type_index(c->from->name), type_index(c->to->name), 0, 0, args->len / sizeof(uint32_t) };
+		for (char **a = c->cmd_and_args; *a; a++, cc.argc++) {
+			uint32_t off = put_str(strs, *a);
+			put(args, &off, sizeof(off));
+		}
+		put(cvs, &cc, sizeof(cc));
+	}
+
+	for (size_t i=0; i<n_printers; i++) {
+		if (type_index(printers[i].type) < 0) goto end;      // load_config() would refuse the file
+		struct config_prn cp = { put_str(strs, printers[i].name), put_str(strs, printers[i].type), printers[i].slots, 0 };
+		put(prs, &cp, sizeof(cp));
+	}
+
+	// Paths from every type to every type a printer takes
+	char done[MAX_TYPES] = {0};
+	for (size_t pi=0; pi<n_printers; pi++) {
+		FILE_TYPE *to = lookup_type(printers[pi].type);
+		if (!to || done[type_index(to->name)]++) continue;
+
+		for (size_t f=0; f<n_types; f++) {
+			if (types[f] == to) continue;
+			CONVERSION **cp = conversion_path(types[f], to);
+			struct config_path p = { f, type_index(to->name), 0, 0, steps->len / sizeof(uint16_t) };
+			for (; cp && cp[p.len]; p.len++) {
+				int k = conv_index(cp[p.len]);
+				if (k < 0) break;
+				uint16_t step = k;
+				put(steps, &step, sizeof(step));
+			}
+			if (cp && cp[p.len]) continue;    // Through a conversion we have no record of; leave it to the search
+			put(pts, &p, sizeof(p));
+		}
+	}
+
+	for (size_t i=0; i<n_classes; i++) {
+		struct config_class cc = { put_str(strs, classes[i].name), classes[i].members, classes[i].policy, 0 };
+		put(cls, &cc, sizeof(cc));
+	}
+
+	h.n_types = n_types;
+	h.n_convs = cvs->len / sizeof(struct config_conv);
+	h.n_printers = n_printers;
+	h.n_paths = pts->len / sizeof(struct config_path);
+	h.n_classes = n_classes;
+	h.n_args = args->len / sizeof(uint32_t);
+	h.n_steps = steps->len / sizeof(uint16_t);
+	h.strings_len = strs->len;
+
+	struct buf out = {0};
+	put(&out, &h, sizeof(h));
+	for (int i=0; i<8; i++)
+		if (sec[i].len) put(&out, sec[i].data, sec[i].len);
+
+	if (out.len == sizeof(h) + tys->len + cvs->len + prs->len + pts->len + cls->len + args->len + steps->len + strs->len) {
+		struct config_hdr *oh = (struct config_hdr *)out.data;
+		oh->size = out.len;
+		oh->crc = crc32(out.data + sizeof(h), out.len - sizeof(h));
+
+		char tmp[4200];
+		snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+		int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd >= 0) {
+			rc = (write(fd, out.data, out.len) == (ssize_t)out.len && fsync(fd) == 0) ? 0 : -1;
+			if (close(fd) < 0) rc = -1;
+			if (rc == 0) rc = rename(tmp, path);
+			else unlink(tmp);
+			if (rc == 0) sync_dir(path);
+		}
+	}
+
+	free(out.data);
+end:
+	for (int i=0; i<8; i++) free(sec[i].data);
+	return rc;
+}
+
+// Loading: validate everything first, so that a bad file changes nothing
+
+static const char *str_at(const struct config_hdr *h, const char *strs, uint32_t off) {
+	return off < h->strings_len ? strs + off : NULL;
+}
+
+static int type_named(const char *strs, const uint32_t *ty, int n, const char *name) {
+	for (int k=0; k<n; k++)
+		if (!strcmp(strs + ty[k], name)) return k;
+	return -1;
+}
+
+int load_config(const char *path) {
+	if (n_types || n_printers || n_classes) return -1;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return -1;
+	struct stat sb;
+	char *map = MAP_FAILED;
+	if (fstat(fd, &sb) == 0 && (size_t)sb.st_size >= sizeof(struct config_hdr))
+		map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return -1;
+
+	const struct config_hdr *h = (const struct config_hdr *)map;
+	size_t size = sb.st_size;
+	int rc = -1;
+
+	size_t expect = sizeof(*h) + h->n_types * sizeof(uint32_t) + h->n_convs * sizeof(struct config_conv)
+		+ h->n_printers * sizeof(struct config_prn) + h->n_paths * sizeof(struct config_path) + h->n_classes * sizeof(struct config_class)
+		+ (size_t)h->n_args * sizeof(uint32_t) + (size_t)h->n_steps * sizeof(uint16_t) + h->strings_len;
+	if (h->magic != CONFIG_MAGIC || h->version != CONFIG_VERSION || h->size != size || expect != size
+	    || h->n_types > MAX_TYPES || h->n_printers > MAX_PRINTERS || h->n_convs > MAX_CONVERSIONS || h->n_classes > MAX_CLASSES
+	    || crc32(map + sizeof(*h), size - sizeof(*h)) != h->crc)
+		goto out;
+
+	const uint32_t *ty = (const uint32_t *)(map + sizeof(*h));
+	const struct config_conv *cv = (const struct config_conv *)(ty + h->n_types);
+	const struct config_prn *pr = (const struct config_prn *)(cv + h->n_convs);
+	const struct config_path *pt = (const struct config_path *)(pr + h->n_printers);
+	const struct config_class *cl = (const struct config_class *)(pt + h->n_paths);
+	const uint32_t *args = (const uint32_t *)(cl + h->n_classes);
+	const uint16_t *steps = (const uint16_t *)(args + h->n_args);
+	const char *strs = (const char *)(steps + h->n_steps);
+
+	if (h->strings_len && strs[h->strings_len - 1] != '\0') goto out;     // Every offset below it is then terminated
+	for (int i=0; i<h->n_types; i++)       // Names are unique in every table, as the commands that defined them insist
+		if (!str_at(h, strs, ty[i]) || type_named(strs, ty, i, strs + ty[i]) >= 0) goto out;
+	char edge[MAX_TYPES][MAX_TYPES] = {{0}};
+	for (int i=0; i<h->n_convs; i++) {
+		if (cv[i].from >= h->n_types || cv[i].to >= h->n_types || cv[i].argc == 0
+		    || (size_t)cv[i].arg0 + cv[i].argc > h->n_args || edge[cv[i].from][cv[i].to]++)      // A second one would replace the first
+			goto out;
+		for (int a=0; a<cv[i].argc; a++)
+			if (!str_at(h, strs, args[cv[i].arg0 + a])) goto out;
+	}
+	for (int i=0; i<h->n_printers; i++) {
+		if (!str_at(h, strs, pr[i].name) || !str_at(h, strs, pr[i].type) || pr[i].slots < 1 || pr[i].slots > PRINTER_MAX_SLOTS
+		    || type_named(strs, ty, h->n_types, strs + pr[i].type) < 0)
+			goto out;
+		for (int k=0; k<i; k++)
+			if (!strcmp(strs + pr[k].name, strs + pr[i].name)) goto out;
+	}
+	uint32_t defined = h->n_printers >= 32 ? UINT32_MAX : (1u << h->n_printers) - 1;
+	for (int i=0; i<h->n_classes; i++) {
+		if (!str_at(h, strs, cl[i].name) || !cl[i].members || (cl[i].members & ~defined) || cl[i].policy >= CLASS_POLICIES)
+			goto out;
+		for (int k=0; k<i; k++)
+			if (!strcmp(strs + cl[k].name, strs + cl[i].name)) goto out;
+	}
+	for (int i=0; i<h->n_paths; i++) {
+		if (pt[i].from >= h->n_types || pt[i].to >= h->n_types || (size_t)pt[i].step0 + pt[i].len > h->n_steps)
+			goto out;
+		for (int s=0; s<pt[i].len; s++)
+			if (steps[pt[i].step0 + s] >= h->n_convs) goto out;
+	}
+
+	// Plugins and worker pools are what can still fail: set them up before any table changes
+	for (int i=0; i<h->n_convs; i++) {
+		char *argv[cv[i].argc + 1];
+		for (int a=0; a<cv[i].argc; a++) argv[a] = (char *)strs + args[cv[i].arg0 + a];
+		argv[cv[i].argc] = NULL;
+		if (plugin_load(argv[0]) < 0 || worker_define(argv) < 0) goto out;
+	}
+
+	// Valid: define everything, then seed the path cache
+	for (int i=0; i<h->n_types; i++)
+		if (add_type(strs + ty[i]) < 0) goto out;
+
+	for (int i=0; i<h->n_convs; i++) {
+		char *argv[cv[i].argc + 1];
+		for (int a=0; a<cv[i].argc; a++) argv[a] = (char *)strs + args[cv[i].arg0 + a];
+		argv[cv[i].argc] = NULL;
+		if (add_conversion(strs + ty[cv[i].from], strs + ty[cv[i].to], argv) < 0) goto out;
+	}
+	for (int i=0; i<h->n_printers; i++)
+		if (add_printer(strs + pr[i].name, strs + pr[i].type) < 0
+		    || set_printer_slots(lookup_printer(strs + pr[i].name), pr[i].slots) < 0)
+			goto out;
+
+	for (int i=0; i<h->n_paths; i++) {
+		CONVERSION **p = NULL;
+		if (pt[i].len) {
+			if (!(p = malloc((pt[i].len + 1) * sizeof(*p)))) goto out;
+			for (int s=0; s<pt[i].len; s++) p[s] = conversions[steps[pt[i].step0 + s]];     // Fresh tables: same order
+			p[pt[i].len] = NULL;
+		}
+		set_conversion_path(types[pt[i].from], types[pt[i].to], p);
+	}
+	for (int i=0; i<h->n_classes; i++)
+		if (define_class(strs + cl[i].name, cl[i].members, cl[i].policy) < 0) goto out;     // Printer ids: same order
+	rc = 0;
+
+out:
+	munmap(map, size);
+	return rc;
+}
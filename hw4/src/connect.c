@@ -0,0 +1,51 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "launcher.h"
+
+// The library's connect, with its path and command on the stack instead of in
+// static buffers.  On its own so that the microbenchmark can stub it.
+
+int printer_connect(const char *name, const char *type, int flags, int wait_ms) {
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	snprintf(sa.sun_path, sizeof(sa.sun_path), "spool/%s.sock", name);
+
+	struct stat sb;
+	int tries = 0;
+	for (; tries < 10 && stat(sa.sun_path, &sb) < 0; tries++) {      // Start the printer, and give it time to listen
+		char cmd[256];
+		snprintf(cmd, sizeof(cmd), "util/printer %s %s %s %s",
+			(flags & PRINTER_DELAYS) ? "-d" : "", (flags & PRINTER_FLAKY) ? "-f" : "", name, type);
+		if (system(cmd) < 0) break;
+		if (!wait_ms) return PRINTER_REFUSED;      // Inline, on the main thread: come back once it listens
+		sleep(1);
+	}
+	if (tries == 10) return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0) return -1;
+	int rc, waited = 0;
+	while ((rc = connect(fd, (struct sockaddr *)&sa, sizeof(sa))) < 0 && errno == EAGAIN && waited < wait_ms
+	       && !launcher_stopping()) {
+		nanosleep(&(struct timespec){ 0, CONNECT_RETRY_MS * 1000000 }, NULL);      // Its backlog is full: it has not accepted the last one yet
+		waited += CONNECT_RETRY_MS;
+	}
+	if (rc < 0 && errno == EAGAIN) {
+		close(fd);
+		return PRINTER_REFUSED;
+	}
+	size_t n = strlen(type);
+	if (rc < 0 || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK) < 0
+	    || write(fd, type, n) != (ssize_t)n || write(fd, "\n", 1) != 1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
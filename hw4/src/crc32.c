@@ -0,0 +1,15 @@
+#include "crc32.h"
+
+uint32_t crc32(const void *buf, size_t n) {
+	static uint32_t table[256];
+	if (!table[1]) {
+		for (uint32_t i=0; i<256; i++) {
+			uint32_t c = i;
+			for (int k=0; k<8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+	uint32_t c = 0xffffffffu;
+	for (const uint8_t *p = buf; n--; p++) c = table[(c ^ *p) & 0xff] ^ (c >> 8);
+	return c ^ 0xffffffffu;
+}
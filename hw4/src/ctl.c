@@ -0,0 +1,403 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "state.h"
+#include "evring.h"
+#include "trace.h"
+#include "ctl.h"
+#include "overflow.h"
+#include "tenants.h"
+
+#define MAX_CTL_CLIENTS 64
+
+struct ctl_client {
+	int fd;                 // -1 when the slot is free
+	int subscribed;
+	struct ctl_filter filter;
+	TENANT *tenant;         // CTL_TENANT; NULL: "default"
+	uint64_t dropped;       // Events lost since the buffer filled; reported by CTL_RESYNC
+	char in[CTL_FRAME_MAX];
+	size_t in_len;
+	char *out;              // Pending replies and events, written as the socket drains
+	size_t out_off, out_len, out_cap;
+};
+
+volatile sig_atomic_t sigio_flag = 0;
+
+static int listen_fd = -1;
+static char sock_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static struct ctl_client clients[MAX_CTL_CLIENTS];
+static int n_subscribers = 0;
+static int need_dispatch = 0;
+
+static FILE *watch_out = NULL;       // "watch" command, printing to the terminal
+static struct ctl_filter watch_filter;
+
+static int set_async(int fd) {      // Non-blocking, with SIGIO to us when it becomes ready
+	int fl = fcntl(fd, F_GETFL);
+	if (fl < 0 || fcntl(fd, F_SETOWN, getpid()) < 0) return -1;
+	return fcntl(fd, F_SETFL, fl | O_NONBLOCK | O_ASYNC);
+}
+
+int ctl_open(const char *path) {
+	struct sockaddr_un sa = {0};
+
+	if (listen_fd >= 0 || strlen(path) >= sizeof(sa.sun_path)) return -1;
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(fd, 64) < 0 || set_async(fd) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	for (int i=0; i<MAX_CTL_CLIENTS; i++) clients[i].fd = -1;
+	listen_fd = fd;
+	strcpy(sock_path, path);
+	return 0;
+}
+
+static void drop_client(struct ctl_client *c) {
+	close(c->fd);
+	c->fd = -1;
+	if (c->subscribed) n_subscribers--;
+	c->subscribed = 0;
+	c->dropped = 0;
+	c->tenant = NULL;
+	free(c->out);
+	c->out = NULL;
+	c->in_len = c->out_off = c->out_len = c->out_cap = 0;
+}
+
+void ctl_close(void) {
+	if (listen_fd < 0) return;
+	for (int i=0; i<MAX_CTL_CLIENTS; i++)
+		if (clients[i].fd >= 0) drop_client(&clients[i]);
+	close(listen_fd);
+	unlink(sock_path);
+	listen_fd = -1;
+}
+
+// Output: frames are appended to the client's buffer and flushed as far as the socket allows
+
+static int write_out(struct ctl_client *c) {
+	while (c->out_off < c->out_len) {
+		ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);      // A client gone meanwhile must not take the spooler with it
+		if (n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+		c->out_off += n;
+	}
+	c->out_off = c->out_len = 0;
+	return 0;
+}
+
+static size_t backlog(struct ctl_client *c) {
+	return c->out_len - c->out_off;
+}
+
+static void send_frame(struct ctl_client *c, int op, int status, uint32_t tag, const void *payload, size_t n) {
+	struct ctl_hdr h = { sizeof(h) + n, op, status, tag };
+
+	if (c->out_len + h.len > c->out_cap) {
+		size_t cap = c->out_cap ? c->out_cap : 4096;
+		while (cap < c->out_len + h.len) cap *= 2;
+		char *out = realloc(c->out, cap);
+		if (!out) return;
+		c->out = out;
+		c->out_cap = cap;
+	}
+	memcpy(c->out + c->out_len, &h, sizeof(h));
+	if (n) memcpy(c->out + c->out_len + sizeof(h), payload, n);
+	c->out_len += h.len;
+}
+
+static int flush_client(struct ctl_client *c) {
+	if (write_out(c) < 0) return -1;
+	if (c->dropped && backlog(c) == 0) {      // Caught up: tell the subscriber what it missed
+		send_frame(c, CTL_RESYNC, CTL_OK, 0, &c->dropped, sizeof(c->dropped));
+		c->dropped = 0;
+		return write_out(c);
+	}
+	return 0;
+}
+
+// Events: filtered per subscriber on the way out
+
+static int filter_match(const struct ctl_filter *f, int type, int id, int status, int printer, uint32_t eligible) {
+	int printer_ev = type == EVR_PRINTER_DEFINED || type == EVR_PRINTER_STATUS;
+
+	uint32_t kinds = f->kinds;
+	if (!kinds) kinds = (f->job >= 0 || f->status_mask) ? CTL_WATCH_JOBS : CTL_WATCH_JOBS | CTL_WATCH_PRINTERS;
+	if (!(kinds & (printer_ev ? CTL_WATCH_PRINTERS : CTL_WATCH_JOBS))) return 0;
+	if (printer_ev) return f->printer < 0 || f->printer == id;
+
+	if (f->job >= 0 && f->job != id) return 0;
+	if (f->status_mask && !(f->status_mask & (1u << status))) return 0;
+	if (f->printer >= 0) {
+		if (printer >= 0) return printer == f->printer;
+		return (eligible & (1u << f->printer)) != 0;
+	}
+	return 1;
+}
+
+static void watch_print(struct evring_rec *r) {
+	int printer_ev = r->type == EVR_PRINTER_DEFINED || r->type == EVR_PRINTER_STATUS;
+
+	fprintf(watch_out, "WATCH %llu.%06llu %-13s %d %s",
+		(unsigned long long)(r->time_ns / 1000000000u), (unsigned long long)(r->time_ns % 1000000000u / 1000),
+		evring_type_name(r->type), r->id,
+		printer_ev ? printer_status_names[r->status] : job_status_names[r->status]);
+	if (r->type == EVR_JOB_STARTED) fprintf(watch_out, " printer=%d pgid=%d", r->aux, r->arg);
+	else if (r->type == EVR_JOB_FINISHED || r->type == EVR_JOB_ABORTED) fprintf(watch_out, " status=0x%x", r->arg);
+	else if (r->type == EVR_JOB_LATE) fprintf(watch_out, " late_by=%ds", r->arg);
+	fprintf(watch_out, "\n");
+	fflush(watch_out);
+}
+
+void ctl_publish(int type, int id, int status, int arg, int aux, int printer, uint32_t eligible) {
+	if (!n_subscribers && !watch_out) return;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	struct evring_rec r = { (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec, type, status, id, arg, aux };
+
+	if (watch_out && filter_match(&watch_filter, type, id, status, printer, eligible))
+		watch_print(&r);
+
+	for (int i=0; i<MAX_CTL_CLIENTS; i++) {
+		struct ctl_client *c = &clients[i];
+		if (c->fd < 0 || !c->subscribed || !filter_match(&c->filter, type, id, status, printer, eligible)) continue;
+
+		// A slow subscriber loses events rather than growing without bound or stalling us
+		if (c->dropped || backlog(c) + sizeof(struct ctl_hdr) + sizeof(r) > CTL_SUB_BUFFER) {
+			c->dropped++;
+			continue;
+		}
+		send_frame(c, CTL_EVENT, CTL_OK, 0, &r, sizeof(r));
+	}
+}
+
+void ctl_watch(FILE *out, const struct ctl_filter *f) {
+	watch_out = out;
+	if (f) watch_filter = *f;
+}
+
+// Requests
+
+static void trace_request(const char *verb, JOB *j) {     // Keep traces replayable: record the equivalent command
+	char line[4200];
+
+	if (strcmp(verb, "print")) {
+		snprintf(line, sizeof(line), "%s %d", verb, j->id);
+	} else {
+		int n = snprintf(line, sizeof(line), "print %s", j->file_name);
+		for (size_t i=0; i<n_printers && j->eligible != UINT32_MAX && n < (int)sizeof(line) - 40; i++)
+			if (j->eligible & (1u << printers[i].id))
+				n += snprintf(line + n, sizeof(line) - n, " %s", printers[i].name);
+	}
+	trace_command(line);
+}
+
+static int submit(struct ctl_client *c, char *payload, size_t n, int32_t *id) {
+	uint32_t eligible;
+	if (n < sizeof(eligible) + 2 || payload[n-1] != '\0') return CTL_EBADREQ;
+	memcpy(&eligible, payload, sizeof(eligible));
+	char *file = payload + sizeof(eligible), *name = file + strlen(file) + 1;
+
+	TENANT *t = c->tenant;
+	if (name < payload + n && *name && !(t = tenant_get(name))) return CTL_EBADREQ;
+	FILE_TYPE *ft = infer_file_type(file);
+	if (!ft) return CTL_ETYPE;
+	if (tenant_full(t)) return CTL_EBUSY;
+	struct job_attrs a = { NULL, t ? t->name : NULL, 0, 1 };
+	if ((*id = add_job(file, ft->name, eligible ? eligible : UINT32_MAX, &a)) < 0) return overflow_busy() ? CTL_EBUSY : CTL_EFULL;
+
+	JOB spilled = { .id = *id, .file_name = file, .eligible = eligible ? eligible : UINT32_MAX };
+	JOB *j = lookup_job(*id);
+	tenant_submitted(t);
+	trace_request("print", j ? j : &spilled);      // Not in the table yet if it went to the overflow queue
+	need_dispatch = 1;        // One dispatch pass per batch of requests
+	return CTL_OK;
+}
+
+static int job_request(int op, char *payload, size_t n) {
+	int32_t id;
+	if (n != sizeof(id)) return CTL_EBADREQ;
+	memcpy(&id, payload, sizeof(id));
+	JOB *j = lookup_job(id);
+	if ((!j || j->status == JOB_DELETED) && op == CTL_CANCEL && overflow_cancel(id, id) == 0) {
+		trace_request("cancel", &(JOB){ .id = id });
+		return CTL_OK;
+	}
+	if (!j || j->status == JOB_DELETED) return CTL_ENOENT;
+
+	int rc = op == CTL_CANCEL ? job_cancel(j) : op == CTL_PAUSE ? job_pause(j) : job_resume(j);
+	if (rc < 0) return CTL_ESTATE;
+	trace_request(op == CTL_CANCEL ? "cancel" : op == CTL_PAUSE ? "pause" : "resume", j);
+	return CTL_OK;
+}
+
+static void query(struct ctl_client *c, struct ctl_hdr *h, char *payload, size_t n) {
+	int32_t id;
+	struct ctl_job_info info[MAX_JOBS];
+	size_t k = 0;
+
+	if (n != sizeof(id)) {
+		send_frame(c, h->op, CTL_EBADREQ, h->tag, NULL, 0);
+		return;
+	}
+	memcpy(&id, payload, sizeof(id));
+
+	JOB_SET live = job_set_of(JOB_LIVE);
+	FOR_EACH_JOB(i, &live) {
+		JOB *j = &jobs[i];
+		if (id >= 0 && j->id != id) continue;
+		info[k].id = j->id;
+		info[k].status = j->status;
+		info[k].printer = j->printer && j->status != JOB_CREATED ? j->printer->id : -1;
+		info[k].eligible = j->eligible;
+		info[k].pgid = j->pgid;
+		k++;
+	}
+
+	int status = (id >= 0 && k == 0) ? CTL_ENOENT : CTL_OK;
+	send_frame(c, h->op, status, h->tag, info, k * sizeof(info[0]));
+}
+
+static void list_printers(struct ctl_client *c, struct ctl_hdr *h) {
+	struct ctl_printer_info info[MAX_PRINTERS];
+	size_t k = 0;
+
+	for (size_t i=0; i<n_printers; i++) {
+		PRINTER *p = &printers[i];
+		if (!p->name) continue;
+		memset(&info[k], 0, sizeof(info[k]));
+		info[k].id = p->id;
+		info[k].status = p->status;
+		info[k].slots = p->slots;
+		info[k].busy = p->busy;
+		strncpy(info[k].name, p->name, sizeof(info[k].name) - 1);
+		strncpy(info[k].type, p->type, sizeof(info[k].type) - 1);
+		k++;
+	}
+	send_frame(c, h->op, CTL_OK, h->tag, info, k * sizeof(info[0]));
+}
+
+static void request(struct ctl_client *c, struct ctl_hdr *h, char *payload, size_t n) {
+	int32_t id = -1;
+	int status;
+
+	switch (h->op) {
+	case CTL_SUBMIT:
+		status = submit(c, payload, n, &id);
+		send_frame(c, h->op, status, h->tag, status == CTL_OK ? &id : NULL, status == CTL_OK ? sizeof(id) : 0);
+		break;
+	case CTL_CANCEL:
+	case CTL_PAUSE:
+	case CTL_RESUME:
+		send_frame(c, h->op, job_request(h->op, payload, n), h->tag, NULL, 0);
+		break;
+	case CTL_QUERY:
+		query(c, h, payload, n);
+		break;
+	case CTL_PRINTERS:
+		list_printers(c, h);
+		break;
+	case CTL_SUBSCRIBE:
+		if (n != 0 && n != sizeof(c->filter)) {
+			send_frame(c, h->op, CTL_EBADREQ, h->tag, NULL, 0);
+			break;
+		}
+		if (n) memcpy(&c->filter, payload, n);
+		else c->filter = (struct ctl_filter){ -1, -1, 0, 0 };
+		if (!c->subscribed) n_subscribers++;
+		c->subscribed = 1;
+		send_frame(c, h->op, CTL_OK, h->tag, NULL, 0);
+		break;
+	case CTL_UNSUBSCRIBE:
+		if (c->subscribed) n_subscribers--;
+		c->subscribed = 0;
+		send_frame(c, h->op, CTL_OK, h->tag, NULL, 0);
+		break;
+	case CTL_TENANT:
+		status = CTL_OK;
+		if (n == 0 || payload[n-1] != '\0') status = CTL_EBADREQ;
+		else if (!*payload) c->tenant = NULL;
+		else if (!(c->tenant = tenant_get(payload))) status = CTL_EBADREQ;
+		send_frame(c, h->op, status, h->tag, NULL, 0);
+		break;
+	default:
+		send_frame(c, h->op, CTL_EBADREQ, h->tag, NULL, 0);
+	}
+}
+
+static int read_client(struct ctl_client *c) {     // Returns -1 if the client is gone or misbehaving, 1 if throttled
+	for (;;) {
+		if (backlog(c) >= CTL_SUB_BUFFER) return 1;
+		ssize_t n = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+		if (n == 0) return -1;
+		if (n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+		c->in_len += n;
+
+		size_t off = 0;
+		while (c->in_len - off >= sizeof(struct ctl_hdr)) {
+			struct ctl_hdr h;
+			memcpy(&h, c->in + off, sizeof(h));
+			if (h.len < sizeof(h) || h.len > CTL_FRAME_MAX) return -1;
+			if (c->in_len - off < h.len) break;
+			request(c, &h, c->in + off + sizeof(h), h.len - sizeof(h));
+			off += h.len;
+		}
+		memmove(c->in, c->in + off, c->in_len - off);
+		c->in_len -= off;
+	}
+}
+
+void ctl_poll(void) {        // Accept, serve and flush everything that is ready, without blocking
+	if (listen_fd < 0) return;
+
+	int fd;
+	while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+		int i = 0;
+		while (i < MAX_CTL_CLIENTS && clients[i].fd >= 0) i++;
+		if (i == MAX_CTL_CLIENTS || set_async(fd) < 0) {
+			close(fd);
+			continue;
+		}
+		clients[i].fd = fd;
+	}
+
+	// A client with a full backlog is not read until it drains.  If it drains right
+	// here we go round again; otherwise its SIGIO for output space brings us back.
+	int again;
+	do {
+		int throttled[MAX_CTL_CLIENTS] = {0};
+
+		for (int i=0; i<MAX_CTL_CLIENTS; i++) {
+			if (clients[i].fd < 0) continue;
+			int rc = read_client(&clients[i]);
+			if (rc < 0) drop_client(&clients[i]);
+			else throttled[i] = rc;
+		}
+
+		if (need_dispatch) {
+			need_dispatch = 0;
+			try_dispatch();
+		}
+
+		again = 0;
+		for (int i=0; i<MAX_CTL_CLIENTS; i++) {
+			if (clients[i].fd < 0) continue;
+			if (flush_client(&clients[i]) < 0) drop_client(&clients[i]);
+			else if (throttled[i] && backlog(&clients[i]) < CTL_SUB_BUFFER) again = 1;
+		}
+	} while (again);
+}
@@ -0,0 +1,159 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include "deadline.h"
+#include "classes.h"
+#include "events.h"
+
+int deadline_edf = 0;
+JOB_SET deadline_waiting;
+
+static off_t bytes[MAX_JOBS];          // By job slot, at submission
+static char late[MAX_JOBS];
+static uint64_t n_timed, n_met, n_missed, n_aborted, n_flagged;
+
+int deadline_parse(const char *s, time_t *when) {
+	time_t now = state_now();
+	char *end, c;
+	int h, m, sec = 0;
+
+	if (*s == '+') {
+		long n = strtol(s + 1, &end, 10);
+		if (end == s + 1 || *end || n < 0) return -1;
+		*when = now + n;
+		return 0;
+	}
+	if (sscanf(s, "%d:%d%c", &h, &m, &c) == 2 || sscanf(s, "%d:%d:%d%c", &h, &m, &sec, &c) == 3) {
+		if (h < 0 || h > 23 || m < 0 || m > 59 || sec < 0 || sec > 59) return -1;
+		struct tm tm;
+		localtime_r(&now, &tm);
+		tm.tm_hour = h;
+		tm.tm_min = m;
+		tm.tm_sec = sec;
+		tm.tm_isdst = -1;
+		if ((*when = mktime(&tm)) <= now) {      // Already past today: tomorrow
+			tm.tm_mday++;
+			tm.tm_isdst = -1;
+			*when = mktime(&tm);
+		}
+		return 0;
+	}
+	long long n = strtoll(s, &end, 10);
+	if (end == s || *end || n <= 0) return -1;
+	*when = n;
+	return 0;
+}
+
+void deadline_set(JOB *j, time_t when) {
+	if (!j || j->status != JOB_CREATED) return;
+	int slot = j - jobs;
+	struct stat sb;
+	j->deadline = when;
+	bytes[slot] = stat(j->file_name, &sb) == 0 ? sb.st_size : 0;
+	late[slot] = 0;
+	deadline_waiting.w[slot / 64] |= 1ull << (slot % 64);
+	n_timed++;
+}
+
+void deadline_job_status(JOB *j, JOB_STATUS status) {
+	int slot = j - jobs;
+	if (status != JOB_CREATED) deadline_waiting.w[slot / 64] &= ~(1ull << (slot % 64));
+	if (status == j->status) return;
+
+	if (status == JOB_FINISHED) {
+		if (state_now() <= j->deadline) n_met++;
+		else n_missed++;
+	} else if (status == JOB_ABORTED) {
+		n_aborted++;
+	}
+}
+
+// Prediction
+
+double deadline_estimate(JOB *j, PRINTER *p, CONVERSION **path) {
+	int stages = 0;
+	while (path && path[stages]) stages++;
+	double rate = class_printer_rate(p);
+	return DL_STAGE_SEC * stages + bytes[j - jobs] / (rate > 0 ? rate : DL_DEFAULT_RATE);
+}
+
+static double best_estimate(JOB *j, uint32_t candidates, FILE_TYPE *from, FILE_TYPE *to[], int *best) {     // -1 if no candidate can take it
+	double est = -1;
+	for (; candidates; candidates &= candidates - 1) {
+		int pi = __builtin_ctz(candidates);
+		CONVERSION **path = NULL;
+		if (!to[pi] || (from != to[pi] && !(path = conversion_path(from, to[pi])))) continue;
+		double e = deadline_estimate(j, &printers[pi], path);
+		if (est < 0 || e < est) {
+			est = e;
+			*best = pi;
+		}
+	}
+	return est;
+}
+
+int deadline_pick(JOB *j, uint32_t candidates, FILE_TYPE *from, FILE_TYPE *to[]) {
+	int best = __builtin_ctz(candidates);
+	best_estimate(j, candidates, from, to, &best);
+	return best;
+}
+
+static void sort_by_deadline(int *v, int n) {
+	for (int i=1; i<n; i++) {
+		int x = v[i], k = i;
+		for (; k > 0 && jobs[v[k-1]].deadline > jobs[x].deadline; k--) v[k] = v[k-1];
+		v[k] = x;
+	}
+}
+
+int deadline_order(int order[MAX_JOBS], int *n_late) {
+	uint32_t enabled = 0;
+	FILE_TYPE *to[MAX_PRINTERS];
+	for (size_t pi=0; pi<n_printers; pi++) {
+		to[pi] = lookup_type(printers[pi].type);
+		if (printers[pi].status != PRINTER_DISABLED) enabled |= 1u << pi;
+	}
+
+	int n = 0, k = 0, behind[MAX_JOBS];
+	time_t now = state_now();
+	FOR_EACH_JOB(i, &deadline_waiting) {
+		JOB *j = &jobs[i];
+		FILE_TYPE *from = lookup_type(j->file_type);
+		int best;
+		double est = from ? best_estimate(j, (j->klass ? j->klass->members : j->eligible) & enabled, from, to, &best) : -1;
+
+		if (est >= 0 && now + est > j->deadline) {      // Cannot make it even if started now
+			if (!late[i]) {
+				late[i] = 1;
+				n_flagged++;
+				ev_job_late(j, (int)(now + est - j->deadline + 1));
+			}
+			behind[k++] = i;
+		} else {
+			order[n++] = i;
+		}
+	}
+	sort_by_deadline(order, n);
+	sort_by_deadline(behind, k);
+	memcpy(order + n, behind, k * sizeof(int));
+	*n_late = k;
+	return n;
+}
+
+int deadline_late(JOB *j) {
+	return j->deadline && late[j - jobs];
+}
+
+void deadline_stats(struct deadline_stats *s) {
+	s->jobs = n_timed;
+	s->met = n_met;
+	s->missed = n_missed;
+	s->aborted = n_aborted;
+	s->flagged = n_flagged;
+	s->waiting = s->at_risk = 0;
+	FOR_EACH_JOB(i, &deadline_waiting) {
+		s->waiting++;
+		s->at_risk += late[i];
+	}
+}
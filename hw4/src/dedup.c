@@ -0,0 +1,360 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dedup.h"
+#include "journal.h"
+
+int dedup_mode = DEDUP_OFF, dedup_window = DEDUP_WINDOW, dedup_mmap = 0;
+
+static struct entry {           // What is known of a waiting job's file (main thread only)
+	int known;
+	int id;                 // Job it was recorded for
+	off_t size;
+	int hashed;
+	uint64_t hash;
+	int gone;               // Cancelled as a duplicate: of dup_of, which has its copies
+	int dup_of;
+} entries[MAX_JOBS];
+
+struct cand {
+	int id;
+	char *file;
+	int hashed;             // Known before, or computed by the hasher
+	uint64_t hash;
+};
+
+struct dedup_req {
+	struct dedup_req *next;
+	int id;                 // The held job
+	char *file;
+	off_t size;
+	int map;                // dedup_mmap when it was queued
+	int hashed;             // Set by the hasher: hash is the file's
+	uint64_t hash;
+	int dup;                // Set by the hasher: the candidate whose file is identical, or -1
+	int n;
+	struct cand cand[];     // Compared in order, oldest first
+};
+
+static pthread_t hasher;
+static int hasher_running;
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cv = PTHREAD_COND_INITIALIZER;
+static struct dedup_req *todo, **todo_tail = &todo, *done;     // done is in reverse order
+static int hasher_stop;
+static struct dedup_stats stats;        // hashed and hashed_bytes under mu, the rest main thread only
+
+// xxHash64-style: four independent 64-bit lanes over 32-byte stripes, which
+// keep the multipliers busy in parallel, then a merge and an avalanche
+
+#define P1 0x9E3779B185EBCA87ull
+#define P2 0xC2B2AE3D27D4EB4Full
+#define P3 0x165667B19E3779F9ull
+#define P4 0x85EBCA77C2B2AE63ull
+#define P5 0x27D4EB2F165667C5ull
+
+struct hasher {
+	uint64_t v[4];
+	uint64_t len;
+};
+
+static inline uint64_t rotl(uint64_t x, int r) { return x << r | x >> (64 - r); }
+static inline uint64_t mix(uint64_t acc, uint64_t in) { return rotl(acc + in * P2, 31) * P1; }
+
+static void hash_init(struct hasher *h) {
+	*h = (struct hasher){ { P1 + P2, P2, 0, -P1 }, 0 };
+}
+
+static void hash_stripes(struct hasher *h, const unsigned char *p, size_t n) {     // n: a multiple of 32
+	uint64_t v0 = h->v[0], v1 = h->v[1], v2 = h->v[2], v3 = h->v[3], w[4];
+	for (size_t off = 0; off < n; off += 32) {
+		memcpy(w, p + off, sizeof(w));
+		v0 = mix(v0, w[0]);
+		v1 = mix(v1, w[1]);
+		v2 = mix(v2, w[2]);
+		v3 = mix(v3, w[3]);
+	}
+	h->v[0] = v0, h->v[1] = v1, h->v[2] = v2, h->v[3] = v3;
+	h->len += n;
+}
+
+static uint64_t hash_final(struct hasher *h, const unsigned char *p, size_t n) {      // The last n bytes, any length
+	hash_stripes(h, p, n & ~(size_t)31);
+	p += n & ~(size_t)31;
+	n &= 31;
+	h->len += n;
+
+	uint64_t acc = rotl(h->v[0], 1) + rotl(h->v[1], 7) + rotl(h->v[2], 12) + rotl(h->v[3], 18);
+	for (int k=0; k<4; k++) acc = (acc ^ mix(0, h->v[k])) * P1 + P4;
+	acc += h->len;
+	for (; n >= 8; p += 8, n -= 8) {
+		uint64_t w;
+		memcpy(&w, p, sizeof(w));
+		acc = rotl(acc ^ mix(0, w), 27) * P1 + P4;
+	}
+	for (; n; p++, n--) acc = rotl(acc ^ *p * P5, 11) * P1;
+
+	acc ^= acc >> 33;
+	acc *= P2;
+	acc ^= acc >> 29;
+	acc *= P3;
+	return acc ^ acc >> 32;
+}
+
+// On the hasher thread
+
+static int hash_file(const char *path, off_t size, int map, uint64_t *out) {      // -1 if it cannot be read whole
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return -1;
+
+	struct hasher h;
+	hash_init(&h);
+	int rc = 0;
+	void *m = map && size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	if (m != MAP_FAILED) {
+		madvise(m, size, MADV_SEQUENTIAL);
+		*out = hash_final(&h, m, size);
+		munmap(m, size);
+	} else {
+		static unsigned char buf[DEDUP_CHUNK];
+		size_t have = 0;
+		off_t total = 0;
+		for (;;) {       // Whole chunks, so that only the last one has a partial stripe
+			ssize_t n = read(fd, buf + have, sizeof(buf) - have);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) {
+				rc = n < 0 ? -1 : 0;
+				break;
+			}
+			have += n;
+			total += n;
+			if (have == sizeof(buf)) {
+				hash_stripes(&h, buf, have);
+				have = 0;
+			}
+		}
+		*out = hash_final(&h, buf, have);
+		if (total != size) rc = -1;      // Changed under us
+	}
+	close(fd);
+	if (rc == 0) {
+		pthread_mutex_lock(&mu);
+		stats.hashed++;
+		stats.hashed_bytes += size;
+		pthread_mutex_unlock(&mu);
+	}
+	return rc;
+}
+
+static ssize_t read_full(int fd, unsigned char *buf, size_t n) {
+	size_t have = 0;
+	while (have < n) {
+		ssize_t k = read(fd, buf + have, n - have);
+		if (k < 0 && errno == EINTR) continue;
+		if (k < 0) return -1;
+		if (k == 0) break;
+		have += k;
+	}
+	return have;
+}
+
+static int same_content(const char *a, const char *b, off_t size) {      // A hash match is only a hint
+	static unsigned char x[DEDUP_CHUNK], y[DEDUP_CHUNK];
+	int fa = open(a, O_RDONLY), fb = open(b, O_RDONLY), same = fa >= 0 && fb >= 0;
+	off_t total = 0;
+	while (same) {
+		ssize_t n = read_full(fa, x, sizeof(x)), m = read_full(fb, y, sizeof(y));
+		if (n < 0 || n != m || memcmp(x, y, n)) same = 0;
+		else if (n == 0) break;
+		else total += n;
+	}
+	if (fa >= 0) close(fa);
+	if (fb >= 0) close(fb);
+	return same && total == size;
+}
+
+static void compare(struct dedup_req *r) {
+	r->dup = -1;
+	if (hash_file(r->file, r->size, r->map, &r->hash) < 0) return;
+	r->hashed = 1;
+	for (int i=0; i<r->n; i++) {
+		struct cand *c = &r->cand[i];
+		if (!c->hashed) {
+			if (hash_file(c->file, r->size, r->map, &c->hash) < 0) continue;
+			c->hashed = 1;
+		}
+		if (c->hash == r->hash && same_content(r->file, c->file, r->size)) {
+			r->dup = c->id;
+			return;
+		}
+	}
+}
+
+static void *hash_loop(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&mu);
+	for (;;) {
+		while (!todo && !hasher_stop) pthread_cond_wait(&work_cv, &mu);
+		if (!todo) break;                // Stopping, with the queue drained
+
+		struct dedup_req *r = todo;
+		if (!(todo = r->next)) todo_tail = &todo;
+		pthread_mutex_unlock(&mu);
+
+		compare(r);
+
+		pthread_mutex_lock(&mu);
+		r->next = done;
+		done = r;
+		kill(getpid(), SIGIO);           // Picked up by dedup_poll() from sig_hook()
+	}
+	pthread_mutex_unlock(&mu);
+	return NULL;
+}
+
+// Main thread side
+
+static int compatible(JOB *a, JOB *b) {          // Would print the same way, for the same submitter
+	return a->eligible == b->eligible && a->deadline == b->deadline && a->klass == b->klass && a->tenant == b->tenant
+		&& !strcmp(a->file_type, b->file_type);
+}
+
+static JOB *surviving(JOB *dup) {       // The job an earlier duplicate was merged into (or rejected for), if any
+	for (int n=0; dup && dup->status != JOB_CREATED && n < MAX_JOBS; n++) {
+		struct entry *de = &entries[dup - jobs];
+		if (!de->gone || de->id != dup->id) return NULL;      // Aborted, or finished, on its own
+		dup = lookup_job(de->dup_of);
+	}
+	return dup && dup->status == JOB_CREATED ? dup : NULL;
+}
+
+static void free_req(struct dedup_req *r) {
+	for (int i=0; i<r->n; i++) free(r->cand[i].file);
+	free(r->file);
+	free(r);
+}
+
+void dedup_job_added(JOB *j) {
+	struct entry *e = &entries[j - jobs];
+	struct stat sb;
+	*e = (struct entry){0};
+	if (dedup_mode == DEDUP_OFF || sim_mode || stat(j->file_name, &sb) < 0 || !S_ISREG(sb.st_mode)) return;
+	*e = (struct entry){ 1, j->id, sb.st_size, 0, 0, 0, 0 };
+	stats.checked++;
+
+	struct dedup_req *r = calloc(1, sizeof(*r) + MAX_JOBS * sizeof(struct cand));
+	if (!r || !(r->file = strdup(j->file_name))) {
+		free(r);
+		return;
+	}
+	time_t now = state_now();
+	JOB_SET waiting = jobs_in[JOB_CREATED];
+	FOR_EACH_JOB(i, &waiting) {       // Slot order; the hasher takes the first identical one
+		JOB *w = &jobs[i];
+		struct entry *we = &entries[i];
+		if (w == j || !we->known || we->id != w->id || we->size != e->size || now - w->creation_time >= dedup_window
+			|| !compatible(w, j)) continue;
+		const char *f = w->spool_file && !w->staging ? w->spool_file : w->file_name;      // The snapshot, if there is one
+		struct cand *c = &r->cand[r->n];
+		if (!(c->file = strdup(f))) continue;
+		c->id = w->id;
+		c->hashed = we->hashed;
+		c->hash = we->hash;
+		r->n++;
+	}
+	if (!r->n) {                     // No waiting job of that size: nothing to hash
+		free_req(r);
+		return;
+	}
+	if (!hasher_running) {
+		hasher_stop = 0;
+		if (state_thread(&hasher, hash_loop, NULL) != 0) {
+			free_req(r);
+			return;
+		}
+		hasher_running = 1;
+	}
+	r->id = j->id;
+	r->size = e->size;
+	r->map = dedup_mmap;
+	j->deduping = 1;
+	stats.held++;
+
+	pthread_mutex_lock(&mu);
+	*todo_tail = r;
+	todo_tail = &r->next;
+	pthread_cond_signal(&work_cv);
+	pthread_mutex_unlock(&mu);
+}
+
+void dedup_poll(void) {
+	if (!hasher_running) return;
+
+	pthread_mutex_lock(&mu);
+	struct dedup_req *r = done;
+	done = NULL;
+	pthread_mutex_unlock(&mu);
+	if (!r) return;
+
+	while (r) {
+		struct dedup_req *next = r->next;
+		for (int i=0; i<r->n; i++) {      // Keep what was hashed, for the jobs still waiting
+			JOB *w = lookup_job(r->cand[i].id);
+			struct entry *we = w ? &entries[w - jobs] : NULL;
+			if (we && we->known && we->id == w->id && r->cand[i].hashed) {
+				we->hashed = 1;
+				we->hash = r->cand[i].hash;
+			}
+		}
+		JOB *j = lookup_job(r->id), *dup = r->dup >= 0 ? surviving(lookup_job(r->dup)) : NULL;
+		stats.held--;
+		if (j && j->deduping) {
+			struct entry *e = &entries[j - jobs];
+			j->deduping = 0;
+			if (r->hashed && e->known && e->id == j->id) {
+				e->hashed = 1;
+				e->hash = r->hash;
+			}
+			if (dup && j->status == JOB_CREATED && compatible(dup, j) && dedup_mode != DEDUP_OFF) {
+				if (dedup_mode == DEDUP_MERGE) {
+					dup->copies += j->copies;
+					journal_job(JR_STATUS, dup, dup->status);      // The copy count, for recovery
+					stats.merged++;
+				} else {
+					stats.rejected++;
+				}
+				e->known = 0;
+				e->gone = 1;
+				e->dup_of = dup->id;
+				job_cancel(j);
+			}
+		}
+		free_req(r);
+		r = next;
+	}
+	try_dispatch();
+}
+
+void dedup_close(void) {        // Finishes the comparisons already queued
+	if (!hasher_running) return;
+	pthread_mutex_lock(&mu);
+	hasher_stop = 1;
+	pthread_cond_signal(&work_cv);
+	pthread_mutex_unlock(&mu);
+	pthread_join(hasher, NULL);
+
+	dedup_poll();
+	hasher_running = 0;
+}
+
+void dedup_stats(struct dedup_stats *s) {
+	pthread_mutex_lock(&mu);
+	*s = stats;
+	pthread_mutex_unlock(&mu);
+}
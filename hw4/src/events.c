@@ -0,0 +1,61 @@
+#include "events.h"
+#include "evring.h"
+#include "ctl.h"
+#include "journal.h"
+
+static void record_printer(EVR_TYPE type, PRINTER *p, int status) {    // Ring and control socket subscribers
+	evring_put(type, p->id, status, 0, 0);
+	ctl_publish(type, p->id, status, 0, 0, p->id, 0);
+}
+
+static void record_job(EVR_TYPE type, JOB *j, int status, int arg, int aux) {
+	evring_put(type, j->id, status, arg, aux);
+	ctl_publish(type, j->id, status, arg, aux, j->printer ? j->printer->id : -1, j->eligible);
+}
+
+void ev_printer_defined(PRINTER *p) {
+	record_printer(EVR_PRINTER_DEFINED, p, p->status);
+	if (!evring_exclusive) sf_printer_defined(p->name, p->type);
+}
+
+void ev_printer_status(PRINTER *p, PRINTER_STATUS status) {
+	record_printer(EVR_PRINTER_STATUS, p, status);
+	if (!evring_exclusive) sf_printer_status(p->name, status);
+}
+
+void ev_job_created(JOB *j) {
+	record_job(EVR_JOB_CREATED, j, JOB_CREATED, 0, 0);
+	journal_job(JR_CREATE, j, JOB_CREATED);
+	if (!evring_exclusive) sf_job_created(j->id, j->file_name, j->file_type);
+}
+
+void ev_job_started(JOB *j, PRINTER *p, char **path) {
+	record_job(EVR_JOB_STARTED, j, JOB_RUNNING, j->pgid, p->id);
+	if (!evring_exclusive) sf_job_started(j->id, p->name, j->pgid, path);
+}
+
+void ev_job_status(JOB *j, JOB_STATUS status) {
+	record_job(EVR_JOB_STATUS, j, status, 0, 0);
+	journal_job(JR_STATUS, j, status);
+	if (!evring_exclusive) sf_job_status(j->id, status);
+}
+
+void ev_job_finished(JOB *j, int status) {
+	record_job(EVR_JOB_FINISHED, j, JOB_FINISHED, status, 0);
+	if (!evring_exclusive) sf_job_finished(j->id, status);
+}
+
+void ev_job_aborted(JOB *j, int status) {
+	record_job(EVR_JOB_ABORTED, j, JOB_ABORTED, status, 0);
+	if (!evring_exclusive) sf_job_aborted(j->id, status);
+}
+
+void ev_job_late(JOB *j, int seconds) {      // Ring and control socket only: the event functions have no such event
+	record_job(EVR_JOB_LATE, j, j->status, seconds, 0);
+}
+
+void ev_job_deleted(JOB *j) {
+	record_job(EVR_JOB_DELETED, j, JOB_DELETED, 0, 0);
+	journal_job(JR_DELETE, j, JOB_DELETED);
+	if (!evring_exclusive) sf_job_deleted(j->id);
+}
@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include "evring.h"
+
+int evring_active = 0;
+int evring_exclusive = 0;
+
+static struct evring_hdr *ring;
+static size_t ring_len;
+static uint32_t ring_mask;
+
+static pthread_t drainer;
+static int drainer_fd = -1;
+static volatile int drainer_stop;
+
+// Producer side: called from the main thread only
+
+void evring_put(EVR_TYPE type, int id, int status, int arg, int aux) {
+	if (!evring_active) return;
+
+	uint64_t h = ring->head;
+	if (h - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= ring->slots) {
+		ring->dropped++;
+		return;
+	}
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);    // vDSO, no system call
+
+	struct evring_rec *r = &EVRING_RECS(ring)[h & ring_mask];
+	r->time_ns = (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+	r->type = type;
+	r->status = status;
+	r->id = id;
+	r->arg = arg;
+	r->aux = aux;
+	__atomic_store_n(&ring->head, h + 1, __ATOMIC_RELEASE);
+}
+
+// Consumer side: copies everything between tail and head to fd
+
+uint64_t evring_drain(struct evring_hdr *h, int fd) {
+	uint64_t head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+	uint64_t tail = h->tail, n = 0;
+	uint32_t mask = h->slots - 1;
+
+	while (tail != head) {    // Write out contiguous runs
+		uint64_t run = head - tail;
+		uint64_t to_end = h->slots - (tail & mask);
+		if (run > to_end) run = to_end;
+		if (write(fd, &EVRING_RECS(h)[tail & mask], run * sizeof(struct evring_rec)) < 0) break;
+		tail += run;
+		n += run;
+	}
+	__atomic_store_n(&h->tail, tail, __ATOMIC_RELEASE);
+	return n;
+}
+
+static int write_dump_header(int fd) {
+	struct evring_hdr d;
+	memset(&d, 0, sizeof(d));
+	d.magic = EVDUMP_MAGIC;
+	d.version = EVRING_VERSION;
+	d.rec_size = sizeof(struct evring_rec);
+	return write(fd, &d, sizeof(d)) == sizeof(d) ? 0 : -1;
+}
+
+static void *drain_loop(void *arg) {       // Optional in-process reader thread
+	(void)arg;
+	struct timespec nap = { 0, 1000000 };
+	while (!drainer_stop) {
+		if (!evring_drain(ring, drainer_fd)) nanosleep(&nap, NULL);
+	}
+	evring_drain(ring, drainer_fd);
+	return NULL;
+}
+
+int evring_open(const char *path, uint32_t slots, int exclusive, const char *drain_path) {
+	if (evring_active) evring_close();
+
+	uint32_t n = 1;
+	while (n < slots) n <<= 1;
+	size_t len = sizeof(struct evring_hdr) + (size_t)n * sizeof(struct evring_rec);
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return -1;
+	if (ftruncate(fd, len) < 0) {
+		close(fd);
+		return -1;
+	}
+	void *m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) return -1;
+
+	ring = m;
+	ring_len = len;
+	ring_mask = n - 1;
+	memset(ring, 0, sizeof(*ring));
+	ring->version = EVRING_VERSION;
+	ring->slots = n;
+	ring->rec_size = sizeof(struct evring_rec);
+	__atomic_store_n(&ring->magic, EVRING_MAGIC, __ATOMIC_RELEASE);    // Readers wait for this
+
+	if (drain_path) {
+		drainer_fd = open(drain_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		drainer_stop = 0;
+
+		// The drainer starts with every signal blocked, so SIGCHLD and SIGIO reach the main thread
+		sigset_t all, old;
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+		int rc = (drainer_fd < 0 || write_dump_header(drainer_fd) < 0) ? -1
+			: pthread_create(&drainer, NULL, drain_loop, NULL);
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+		if (rc != 0) {
+			if (drainer_fd >= 0) close(drainer_fd);
+			drainer_fd = -1;
+			munmap(ring, ring_len);
+			ring = NULL;
+			return -1;
+		}
+	}
+
+	evring_exclusive = exclusive;
+	evring_active = 1;
+	return 0;
+}
+
+void evring_close(void) {
+	if (!evring_active) return;
+	evring_active = 0;
+	evring_exclusive = 0;
+
+	if (drainer_fd >= 0) {
+		drainer_stop = 1;
+		pthread_join(drainer, NULL);
+		close(drainer_fd);
+		drainer_fd = -1;
+	}
+	__atomic_store_n(&ring->magic, 0, __ATOMIC_RELEASE);    // Tells followers to stop
+	munmap(ring, ring_len);
+	ring = NULL;
+}
+
+int evring_dump(const char *path) {        // Drain whatever is pending into a dump file
+	if (!evring_active || drainer_fd >= 0) return -1;
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return -1;
+	if (write_dump_header(fd) < 0) {
+		close(fd);
+		return -1;
+	}
+	evring_drain(ring, fd);
+	close(fd);
+	return 0;
+}
+
+void evring_stats(uint64_t *head, uint64_t *tail, uint64_t *dropped, uint32_t *slots) {
+	*head = *tail = *dropped = 0;
+	*slots = 0;
+	if (!evring_active) return;
+	*head = ring->head;
+	*tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	*dropped = ring->dropped;
+	*slots = ring->slots;
+}
+
+char *evring_type_name(int type) {
+	static char *names[] = { "?", "PRTR_DEFINED", "PRTR_STATUS", "JOB_CREATED", "JOB_STARTED",
+		"JOB_STATUS", "JOB_FINISHED", "JOB_ABORTED", "JOB_DELETED", "JOB_LATE" };
+	return (type > 0 && type <= EVR_JOB_LATE) ? names[type] : names[0];
+}
@@ -0,0 +1,492 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "journal.h"
+#include "crc32.h"
+
+int journal_active = 0;
+size_t journal_compact_bytes = JOURNAL_COMPACT_BYTES;
+
+static char snap_path[4096], log_path[4096], dir_path[4096];
+static int log_fd = -1;
+static uint64_t gen;
+static size_t log_bytes;                 // Current log size, for compaction
+static uint64_t n_records, n_bytes, n_syncs;
+
+// Group commit: the main thread appends to pending, the writer thread swaps
+// it out and writes and syncs it while the next batch accumulates
+
+static pthread_t writer;
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cv = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cv = PTHREAD_COND_INITIALIZER;
+static char *pending;
+static size_t pending_len, pending_cap;
+static uint64_t appended, durable;       // Bytes handed to the writer, and synced
+static int writer_stop;
+static int failed;                       // A batch was not written: records are dropped until a compaction
+static uint64_t n_failures;
+
+static int write_all(int fd, const char *buf, size_t n) {
+	while (n) {
+		ssize_t w = write(fd, buf, n);
+		if (w < 0 && errno == EINTR) continue;
+		if (w < 0) return -1;
+		buf += w;
+		n -= w;
+	}
+	return 0;
+}
+
+static void *write_loop(void *arg) {
+	(void)arg;
+	char *batch = NULL;
+	size_t batch_cap = 0;
+
+	pthread_mutex_lock(&mu);
+	for (;;) {
+		while (!pending_len && !writer_stop) pthread_cond_wait(&work_cv, &mu);
+		if (!pending_len) break;
+
+		char *b = pending;
+		size_t n = pending_len, cap = pending_cap;
+		uint64_t upto = appended;
+		int drop = failed;       // After a torn write nothing more goes on the log until it is compacted
+		pending = batch;
+		pending_cap = batch_cap;
+		pending_len = 0;
+		batch = b;
+		batch_cap = cap;
+		pthread_mutex_unlock(&mu);
+
+		int ok = !drop && write_all(log_fd, batch, n) == 0 && fdatasync(log_fd) == 0;
+
+		pthread_mutex_lock(&mu);
+		if (ok) {
+			durable = upto;
+			n_syncs++;
+		} else if (!drop) {
+			failed = 1;
+			n_failures++;
+		}
+		pthread_cond_broadcast(&done_cv);
+	}
+	pthread_mutex_unlock(&mu);
+	free(batch);
+	return NULL;
+}
+
+int journal_sync(void) {      // Wait until everything appended so far is on disk, or a write failed
+	if (!journal_active) return 0;
+	pthread_mutex_lock(&mu);
+	while (durable < appended && !failed) pthread_cond_wait(&done_cv, &mu);
+	int rc = failed ? -1 : 0;
+	pthread_mutex_unlock(&mu);
+	return rc;
+}
+
+static int journal_failed(void) {
+	pthread_mutex_lock(&mu);
+	int f = failed;
+	pthread_mutex_unlock(&mu);
+	return f;
+}
+
+static void journal_fail(void) {
+	pthread_mutex_lock(&mu);
+	failed = 1;
+	n_failures++;
+	pthread_mutex_unlock(&mu);
+}
+
+struct rjob {
+	int32_t id;             // -1: empty slot
+	uint8_t status;
+	uint32_t eligible;
+	int64_t created;
+	const char *file, *type;
+	struct job_attrs a;
+};
+
+static struct rjob *carried;     // Recovered jobs there was no slot for, oldest first
+static size_t n_carried;
+
+static void refill_alarm(void) {      // Carried jobs wait for a slot: come back when a finished job leaves the table
+	if (!n_carried) return;
+	time_t due = 0;
+	JOB_SET done = job_set_of(1u << JOB_FINISHED | 1u << JOB_ABORTED);
+	FOR_EACH_JOB(i, &done)
+		if (!due || jobs[i].finish_time + JOB_RETAIN < due) due = jobs[i].finish_time + JOB_RETAIN;
+	if (!due) return;        // Only live jobs: when they finish, journal_job() calls us again
+	time_t now = state_now();
+	unsigned wait = due > now ? due - now : 1;
+	unsigned left = alarm(wait);
+	if (left && left < wait) alarm(left);       // A printer retry is due first; SIGALRM refills then too
+}
+
+static size_t make_rec(char *buf, JR_KIND kind, JOB *j, int status, const struct job_attrs *a) {
+	struct journal_rec r = { 0, sizeof(r), kind, status, j->id, j->eligible, j->creation_time, a->deadline, a->copies, 0 };
+	char *names = buf + sizeof(r);
+
+	if (kind == JR_CREATE) {
+		const char *s[4] = { j->file_name, j->file_type, a->klass ? a->klass : "", a->tenant ? a->tenant : "" };
+		for (int k=0; k<4; k++) {
+			size_t n = strlen(s[k]) + 1;
+			if (r.len + n > UINT16_MAX) return 0;
+			memcpy(names, s[k], n);
+			names += n;
+			r.len += n;
+		}
+	}
+	memcpy(buf, &r, sizeof(r));
+	r.crc = crc32(buf + sizeof(r.crc), r.len - sizeof(r.crc));
+	memcpy(buf, &r.crc, sizeof(r.crc));
+	return r.len;
+}
+
+void journal_job(JR_KIND kind, JOB *j, int status) {
+	if (!journal_active || sim_mode) return;
+	if (journal_failed()) {         // Records were lost: a new snapshot, which has this change too, replaces the log
+		journal_compact();
+		return;
+	}
+	if (kind == JR_STATUS && (status == JOB_FINISHED || status == JOB_ABORTED)) refill_alarm();
+
+	char rec[UINT16_MAX];
+	struct job_attrs a;
+	job_attrs_of(j, &a);
+	size_t n = make_rec(rec, kind, j, status, &a);
+	if (!n) return;
+
+	pthread_mutex_lock(&mu);
+	if (pending_len + n > pending_cap) {
+		size_t cap = pending_cap ? pending_cap : 65536;
+		while (cap < pending_len + n) cap *= 2;
+		char *p = realloc(pending, cap);
+		if (!p) {
+			pthread_mutex_unlock(&mu);
+			return;
+		}
+		pending = p;
+		pending_cap = cap;
+	}
+	memcpy(pending + pending_len, rec, n);
+	pending_len += n;
+	appended += n;
+	pthread_cond_signal(&work_cv);
+	pthread_mutex_unlock(&mu);
+
+	n_records++;
+	n_bytes += n;
+	log_bytes += n;
+	if (log_bytes > journal_compact_bytes) journal_compact();
+}
+
+// Compaction: the live jobs go into a new snapshot, and the log starts over
+
+int journal_compact(void) {
+	if (!journal_active) return -1;
+	journal_sync();          // The writer is idle from here on: we are the only producer
+
+	char tmp[4200];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", snap_path);
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return -1;
+
+	struct journal_file_hdr h = { JOURNAL_SNAP_MAGIC, JOURNAL_VERSION, gen + 1 };
+	int rc = write_all(fd, (char *)&h, sizeof(h));
+	JOB_SET pending = job_set_of(1u << JOB_CREATED | 1u << JOB_RUNNING | 1u << JOB_PAUSED);
+	FOR_EACH_JOB(i, &pending) {
+		if (rc < 0) break;
+		JOB *j = &jobs[i];
+		char rec[UINT16_MAX];
+		struct job_attrs a;
+		job_attrs_of(j, &a);
+		size_t n = make_rec(rec, JR_CREATE, j, j->status, &a);
+		if (n) rc = write_all(fd, rec, n);
+	}
+	for (size_t i=0; i<n_carried && rc == 0; i++) {      // Until they are requeued, every snapshot keeps them
+		JOB c = { .id = carried[i].id, .file_name = (char *)carried[i].file, .file_type = (char *)carried[i].type,
+			.eligible = carried[i].eligible, .creation_time = carried[i].created };
+		char rec[UINT16_MAX];
+		size_t n = make_rec(rec, JR_CREATE, &c, JOB_CREATED, &carried[i].a);
+		if (n) rc = write_all(fd, rec, n);
+	}
+	if (rc < 0 || fsync(fd) < 0 || close(fd) < 0 || rename(tmp, snap_path) < 0) {
+		if (rc < 0) close(fd);
+		unlink(tmp);
+		return -1;
+	}
+	int dfd = open(dir_path, O_RDONLY);
+	if (dfd >= 0) {
+		fsync(dfd);
+		close(dfd);
+	}
+
+	// A crash before this point leaves a log of the old generation, which recovery ignores
+	gen++;
+	pthread_mutex_lock(&mu);
+	pending_len = 0;         // Anything a failed write dropped is in the snapshot
+	durable = appended;
+	failed = 0;
+	pthread_mutex_unlock(&mu);
+	struct journal_file_hdr lh = { JOURNAL_LOG_MAGIC, JOURNAL_VERSION, gen };
+	if (ftruncate(log_fd, 0) < 0 || write_all(log_fd, (char *)&lh, sizeof(lh)) < 0 || fdatasync(log_fd) < 0) {
+		journal_fail();
+		return -1;
+	}
+	log_bytes = sizeof(lh);
+	return 0;
+}
+
+// Recovery: one sequential pass over the snapshot and then the log
+
+struct rtab {
+	struct rjob *slot;
+	size_t cap, used;
+};
+
+static struct rjob *rtab_find(struct rtab *t, int32_t id, int insert) {
+	if (insert && 2 * (t->used + 1) > t->cap) {
+		struct rtab n = { malloc((t->cap ? 2 * t->cap : 1024) * sizeof(struct rjob)), t->cap ? 2 * t->cap : 1024, 0 };
+		if (!n.slot) return NULL;
+		for (size_t i=0; i<n.cap; i++) n.slot[i].id = -1;
+		for (size_t i=0; i<t->cap; i++)
+			if (t->slot[i].id >= 0) *rtab_find(&n, t->slot[i].id, 1) = t->slot[i];
+		free(t->slot);
+		*t = n;
+	}
+	if (!t->cap) return NULL;
+
+	size_t i = ((uint32_t)id * 2654435761u) & (t->cap - 1);
+	while (t->slot[i].id >= 0 && t->slot[i].id != id) i = (i + 1) & (t->cap - 1);
+	if (t->slot[i].id < 0) {
+		if (!insert) return NULL;
+		t->slot[i].id = id;
+		t->used++;
+	}
+	return &t->slot[i];
+}
+
+static void scan(const char *buf, size_t size, struct rtab *t) {
+	size_t off = sizeof(struct journal_file_hdr);
+
+	while (off + sizeof(struct journal_rec) <= size) {
+		struct journal_rec r;
+		memcpy(&r, buf + off, sizeof(r));
+		if (r.len < sizeof(r) || off + r.len > size || crc32(buf + off + sizeof(r.crc), r.len - sizeof(r.crc)) != r.crc)
+			break;         // Torn or corrupt tail: everything before it stands
+
+		const char *names = buf + off + sizeof(r);
+		size_t nlen = r.len - sizeof(r);
+		struct rjob *j;
+
+		if (r.kind == JR_CREATE) {
+			const char *s[4], *p = names, *end = names + nlen;
+			int k;
+			for (k=0; k<4; k++) {           // File name, type, class and tenant
+				const char *z = p < end ? memchr(p, '\0', end - p) : NULL;
+				if (!z) break;
+				s[k] = p;
+				p = z + 1;
+			}
+			if (k == 4 && (j = rtab_find(t, r.id, 1))) {
+				j->status = r.status;
+				j->eligible = r.eligible;
+				j->created = r.time;
+				j->file = s[0];
+				j->type = s[1];
+				j->a = (struct job_attrs){ s[2], s[3], r.deadline, r.copies };
+			}
+		} else if ((j = rtab_find(t, r.id, 0))) {
+			j->status = r.kind == JR_DELETE ? JOB_DELETED : r.status;
+			if (r.copies > 0) j->a.copies = r.copies;
+		}
+		off += r.len;
+	}
+}
+
+static char *map_file(const char *path, uint32_t magic, size_t *size, uint64_t *file_gen) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat sb;
+	char *buf = MAP_FAILED;
+	if (fstat(fd, &sb) == 0 && (size_t)sb.st_size >= sizeof(struct journal_file_hdr))
+		buf = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED) return NULL;
+
+	struct journal_file_hdr h;
+	memcpy(&h, buf, sizeof(h));
+	if (h.magic != magic || h.version != JOURNAL_VERSION) {
+		munmap(buf, sb.st_size);
+		return NULL;
+	}
+	madvise(buf, sb.st_size, MADV_SEQUENTIAL);
+	*size = sb.st_size;
+	*file_gen = h.gen;
+	return buf;
+}
+
+static int cmp_rjob(const void *a, const void *b) {
+	const struct rjob *x = *(const struct rjob **)a, *y = *(const struct rjob **)b;
+	return (x->id > y->id) - (x->id < y->id);
+}
+
+static void uncarry_one(struct rjob *c) {
+	free((char *)c->file);
+	free((char *)c->type);
+	free((char *)c->a.klass);
+	free((char *)c->a.tenant);
+}
+
+static void carry(const struct rjob *j) {      // Keep a recovered job the table has no slot for
+	struct rjob *c = realloc(carried, (n_carried + 1) * sizeof(*c));
+	if (!c) return;
+	carried = c;
+	c = &carried[n_carried];
+	*c = *j;
+	c->status = JOB_CREATED;
+	c->file = strdup(j->file);
+	c->type = strdup(j->type);
+	c->a.klass = strdup(j->a.klass);
+	c->a.tenant = strdup(j->a.tenant);
+	if (c->file && c->type && c->a.klass && c->a.tenant) n_carried++;
+	else uncarry_one(c);
+}
+
+static void uncarry(size_t n) {      // The first n have been requeued
+	for (size_t i=0; i<n; i++) uncarry_one(&carried[i]);
+	memmove(carried, carried + n, (n_carried - n) * sizeof(*carried));
+	n_carried -= n;
+	if (!n_carried) {
+		free(carried);
+		carried = NULL;
+	}
+}
+
+static int recover(const char *dir, uint64_t *last_gen, int keep) {
+	struct rtab t = { NULL, 0, 0 };
+	size_t snap_size = 0, log_size = 0;
+	uint64_t snap_gen = 0, log_gen = 0;
+	char path[4200];
+
+	snprintf(path, sizeof(path), "%s/journal.snap", dir);
+	char *snap = map_file(path, JOURNAL_SNAP_MAGIC, &snap_size, &snap_gen);
+	snprintf(path, sizeof(path), "%s/journal.log", dir);
+	char *log = map_file(path, JOURNAL_LOG_MAGIC, &log_size, &log_gen);
+
+	if (snap) scan(snap, snap_size, &t);
+	if (log && log_gen == snap_gen) scan(log, log_size, &t);
+	*last_gen = snap_gen > log_gen ? snap_gen : log_gen;
+
+	int restored = -1;
+	struct rjob **live = malloc((t.used + 1) * sizeof(*live));
+	if (!live) goto out;
+
+	// Requeue whatever had not finished, in submission order
+	size_t n = 0;
+	for (size_t i=0; i<t.cap; i++) {
+		struct rjob *j = &t.slot[i];
+		if (j->id >= 0 && j->file && (j->status == JOB_CREATED || j->status == JOB_RUNNING || j->status == JOB_PAUSED))
+			live[n++] = j;
+	}
+	qsort(live, n, sizeof(*live), cmp_rjob);
+
+	restored = 0;
+	for (size_t i=0; i<n; i++) {
+		if (restore_job(live[i]->id, live[i]->file, live[i]->type, live[i]->eligible, live[i]->created, &live[i]->a) >= 0)
+			restored++;
+		else if (keep && !lookup_job(live[i]->id))
+			carry(live[i]);         // No free slot: journal_refill() requeues it later
+	}
+
+	free(live);
+out:
+	free(t.slot);
+	if (snap) munmap(snap, snap_size);
+	if (log) munmap(log, log_size);
+	return restored;
+}
+
+int journal_recover(const char *dir) {
+	uint64_t g;
+	return recover(dir, &g, 0);
+}
+
+int journal_open(const char *dir) {
+	if (journal_active) return -1;
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) return -1;
+	int restored = recover(dir, &gen, 1);
+	if (restored < 0) return -1;
+
+	snprintf(dir_path, sizeof(dir_path), "%s", dir);
+	snprintf(snap_path, sizeof(snap_path), "%s/journal.snap", dir);
+	snprintf(log_path, sizeof(log_path), "%s/journal.log", dir);
+
+	if ((log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0) return -1;
+	writer_stop = 0;
+
+	if (state_thread(&writer, write_loop, NULL) != 0) {
+		close(log_fd);
+		log_fd = -1;
+		return -1;
+	}
+	journal_active = 1;
+	n_records = n_bytes = n_syncs = 0;
+
+	// Start from a snapshot of exactly what we recovered, carried jobs included
+	if (journal_compact() < 0) {
+		journal_close();
+		return -1;
+	}
+	return restored;
+}
+
+void journal_refill(void) {
+	if (!journal_active) return;
+	size_t n = 0;
+	while (n < n_carried && free_job_slots() > 0) {
+		struct rjob *c = &carried[n];
+		if (restore_job(c->id, c->file, c->type, c->eligible, c->created, &c->a) < 0 && !lookup_job(c->id)) break;
+		n++;
+	}
+	if (n) uncarry(n);
+	refill_alarm();
+}
+
+int journal_carried(void) {
+	return n_carried;
+}
+
+void journal_close(void) {
+	if (!journal_active) return;
+	journal_sync();
+	pthread_mutex_lock(&mu);
+	writer_stop = 1;
+	pthread_cond_signal(&work_cv);
+	pthread_mutex_unlock(&mu);
+	pthread_join(writer, NULL);
+
+	close(log_fd);
+	log_fd = -1;
+	journal_active = 0;
+	uncarry(n_carried);      // They are in the snapshot, for the next journal_open()
+}
+
+void journal_stats(uint64_t *records, uint64_t *bytes, uint64_t *syncs, uint64_t *g, uint64_t *failures) {
+	pthread_mutex_lock(&mu);
+	*syncs = n_syncs;
+	*failures = n_failures;
+	pthread_mutex_unlock(&mu);
+	*records = n_records;
+	*bytes = n_bytes;
+	*g = gen;
+}
@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include "launcher.h"
+
+struct launch {
+	struct launch *next;
+	int job, printer;
+	char *file, *name, *type;
+	int fd_file, fd_prn;
+};
+
+int launcher_threads = LAUNCHERS;
+
+static pthread_t pool[MAX_LAUNCHERS];
+static int n_pool, pool_stop;
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cv = PTHREAD_COND_INITIALIZER;
+static struct launch *todo, **todo_tail = &todo;      // Under mu
+static struct launch *done;        // Lock-free: pushed by the launchers, taken whole by the main thread
+static int pending, max_pending;   // Main thread only
+static uint64_t launched;
+
+static void *launch_loop(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&mu);
+	for (;;) {
+		while (!todo && !pool_stop) pthread_cond_wait(&work_cv, &mu);
+		if (pool_stop) break;            // What is still queued is dropped by launcher_close()
+
+		struct launch *l = todo;
+		if (!(todo = l->next)) todo_tail = &todo;
+		pthread_mutex_unlock(&mu);
+
+		l->fd_file = open(l->file, O_RDONLY | O_CLOEXEC);
+		l->fd_prn = l->fd_file < 0 ? -1 : printer_connect(l->name, l->type, PRINTER_NORMAL, PRINTER_CONNECT_MS);
+
+		l->next = __atomic_load_n(&done, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&done, &l->next, l, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+		kill(getpid(), SIGIO);           // Picked up by launcher_poll() from sig_hook()
+
+		pthread_mutex_lock(&mu);
+	}
+	pthread_mutex_unlock(&mu);
+	return NULL;
+}
+
+int launcher_stopping(void) {
+	return __atomic_load_n(&pool_stop, __ATOMIC_RELAXED);
+}
+
+// Main thread side
+
+static int pool_start(int n) {
+	pool_stop = 0;
+	while (n_pool < n && state_thread(&pool[n_pool], launch_loop, NULL) == 0) n_pool++;
+	return n_pool ? 0 : -1;     // A smaller pool still works
+}
+
+static void launch_free(struct launch *l) {
+	free(l->file);
+	free(l->name);
+	free(l->type);
+	free(l);
+}
+
+void launcher_close(void) {     // Waits for the launches in progress, each bounded, and drops the queued ones
+	if (!n_pool) return;
+	pthread_mutex_lock(&mu);
+	__atomic_store_n(&pool_stop, 1, __ATOMIC_RELAXED);      // Also cuts short a launcher waiting to connect
+	pthread_cond_broadcast(&work_cv);
+	struct launch *queued = todo;
+	todo = NULL;
+	todo_tail = &todo;
+	pthread_mutex_unlock(&mu);
+	for (int i=0; i<n_pool; i++) pthread_join(pool[i], NULL);
+	n_pool = 0;
+
+	while (queued) {                // Their jobs wait to be dispatched again
+		struct launch *next = queued->next;
+		JOB *j = lookup_job(queued->job);
+		if (j) j->launching = 0;
+		printers[queued->printer].launching--;
+		pending--;
+		launch_free(queued);
+		queued = next;
+	}
+	launcher_poll();
+}
+
+int launcher_set_threads(int n) {
+	if (n < 0 || n > MAX_LAUNCHERS || pending) return -1;
+	launcher_close();
+	launcher_threads = n;
+	return 0;
+}
+
+int launch_job(JOB *j, PRINTER *p) {
+	if (!launcher_threads || sim_mode) return -1;
+	if (!n_pool && pool_start(launcher_threads) < 0) return -1;
+
+	struct launch *l = calloc(1, sizeof(*l));
+	if (!l || !(l->file = strdup(j->spool_file ? j->spool_file : j->file_name))
+	    || !(l->name = strdup(p->name)) || !(l->type = strdup(p->type))) {
+		if (l) {
+			free(l->file);
+			free(l->name);
+		}
+		free(l);
+		return -1;
+	}
+	l->job = j->id;
+	l->printer = p->id;
+	j->launching = 1;
+	p->launching++;
+	if (++pending > max_pending) max_pending = pending;
+
+	pthread_mutex_lock(&mu);
+	*todo_tail = l;
+	todo_tail = &l->next;
+	pthread_cond_signal(&work_cv);
+	pthread_mutex_unlock(&mu);
+	return 0;
+}
+
+void launcher_poll(void) {
+	struct launch *l = __atomic_exchange_n(&done, NULL, __ATOMIC_ACQUIRE);
+	if (!l) return;
+
+	struct launch *fifo = NULL;         // The stack is newest first
+	while (l) {
+		struct launch *next = l->next;
+		l->next = fifo;
+		fifo = l;
+		l = next;
+	}
+
+	for (l = fifo; l; ) {
+		struct launch *next = l->next;
+		PRINTER *p = &printers[l->printer];
+		JOB *j = lookup_job(l->job);
+
+		p->launching--;
+		pending--;
+		launched++;
+		if (j && j->launching) {
+			j->launching = 0;
+			start_job(j, p, l->fd_file, l->fd_prn);     // Closes both if the job was cancelled meanwhile
+		} else {
+			if (l->fd_file >= 0) close(l->fd_file);
+			if (l->fd_prn >= 0) close(l->fd_prn);
+		}
+		launch_free(l);
+		l = next;
+	}
+	try_dispatch();
+}
+
+void launcher_stats(uint64_t *n_launched, int *n_pending, int *n_max) {
+	*n_launched = launched;
+	*n_pending = pending;
+	*n_max = max_pending;
+}
@@ -0,0 +1,512 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "trace.h"
+#include "mover.h"
+#include "progress.h"
+#include "prefetch.h"
+
+#define RING_ENTRIES 512          // Two per transfer, a cancel pair each, and the wakeup read
+#define MAX_TRANSFERS MAX_JOBS    // Every job could be running, on printers of up to PRINTER_MAX_SLOTS slots
+#define WAKE_DATA    UINT64_MAX
+#define OP_READ      1
+#define OP_WRITE     2
+
+struct transfer {
+	int job;                  // Job id, -1 if the slot is free
+	int slot;                 // Its slot in jobs[]
+	int in, out;
+	off_t size;
+	int paused, cancel;       // Set by the main thread (atomic)
+	int started, finished, status;      // Under mu
+	int ttfb_kind;            // prefetch_ttfb_kind(), -1 once recorded
+	uint64_t dispatched;
+
+	// Mover thread only
+	int inflight, eof, error, cancel_sent, use_rw;
+	off_t off;                // Next read offset
+	size_t len, written;      // Bytes in the buffer, and how many of them have gone out
+	char *buf;
+};
+
+static MOVER_MODE mode = MOVER_AUTO, backend = MOVER_AUTO;
+static int running, stopping;
+static pthread_t mover;
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static struct transfer slots[MAX_TRANSFERS];
+static char *buffers;              // MOVER_CHUNK per slot
+static int wake_fd = -1;
+static uint64_t n_transfers, n_bytes;     // n_bytes is atomic
+static int n_active, max_active;          // Under mu
+
+// io_uring, set up by hand: the library is not available everywhere
+
+static int ring_fd = -1, fixed;
+static struct io_uring_params params;
+static void *sq_map, *cq_map;
+static size_t sq_map_len, cq_map_len;
+static struct io_uring_sqe *sqes;
+static unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask;
+static struct io_uring_cqe *cqes;
+static unsigned sq_local, to_submit;
+static uint64_t wake_buf;
+static int wake_armed;
+
+static void uring_close(void) {
+	if (sqes) munmap(sqes, params.sq_entries * sizeof(*sqes));
+	if (cq_map && cq_map != sq_map) munmap(cq_map, cq_map_len);
+	if (sq_map) munmap(sq_map, sq_map_len);
+	if (ring_fd >= 0) close(ring_fd);
+	sqes = NULL;
+	sq_map = cq_map = NULL;
+	ring_fd = -1;
+}
+
+static int uring_open(void) {
+	memset(&params, 0, sizeof(params));
+	if ((ring_fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params)) < 0) return -1;
+
+	sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_map_len > sq_map_len) sq_map_len = cq_map_len;
+		cq_map_len = sq_map_len;
+	}
+	sq_map = mmap(NULL, sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (sq_map == MAP_FAILED) {
+		sq_map = NULL;
+		uring_close();
+		return -1;
+	}
+	cq_map = sq_map;
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+		cq_map = mmap(NULL, cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		if (cq_map == MAP_FAILED) {
+			cq_map = NULL;
+			uring_close();
+			return -1;
+		}
+	}
+	sqes = mmap(NULL, params.sq_entries * sizeof(*sqes), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		sqes = NULL;
+		uring_close();
+		return -1;
+	}
+
+	char *sq = sq_map, *cq = cq_map;
+	sq_head = (unsigned *)(sq + params.sq_off.head);
+	sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	sq_array = (unsigned *)(sq + params.sq_off.array);
+	cq_head = (unsigned *)(cq + params.cq_off.head);
+	cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	sq_local = *sq_tail;
+	to_submit = 0;
+	wake_armed = 0;
+
+	struct iovec iov[MAX_TRANSFERS];          // Registered once, so no page pinning per request
+	for (int i=0; i<MAX_TRANSFERS; i++) iov[i] = (struct iovec){ buffers + (size_t)i * MOVER_CHUNK, MOVER_CHUNK };
+	fixed = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, iov, MAX_TRANSFERS) == 0;
+	return 0;
+}
+
+static struct io_uring_sqe *get_sqe(void) {
+	if (sq_local - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= params.sq_entries) return NULL;
+	unsigned i = sq_local & *sq_mask;
+	struct io_uring_sqe *s = &sqes[i];
+	memset(s, 0, sizeof(*s));
+	sq_array[i] = i;
+	sq_local++;
+	to_submit++;
+	return s;
+}
+
+static void prep_rw(struct io_uring_sqe *s, int write, int slot, int fd, char *buf, size_t len, off_t off) {
+	s->opcode = fixed ? (write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED) : (write ? IORING_OP_WRITE : IORING_OP_READ);
+	s->fd = fd;
+	s->addr = (uintptr_t)buf;
+	s->len = len;
+	s->off = off;
+	s->buf_index = fixed ? slot : 0;
+	s->user_data = (uint64_t)slot << 2 | (write ? OP_WRITE : OP_READ);
+}
+
+static int uring_enter(unsigned wait) {
+	__atomic_store_n(sq_tail, sq_local, __ATOMIC_RELEASE);
+	int n = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait, IORING_ENTER_GETEVENTS, NULL, 0);
+	if (n >= 0) to_submit -= n;
+	return n < 0 && errno != EINTR ? -1 : 0;
+}
+
+// Transfers, on the mover thread
+
+static void finish(struct transfer *t, int status) {
+	int in = t->in, out = t->out;
+	__atomic_store_n(&t->in, -1, __ATOMIC_SEQ_CST);     // Before the numbers can be reused: see mover_forked()
+	__atomic_store_n(&t->out, -1, __ATOMIC_SEQ_CST);
+	close(in);
+	close(out);
+	pthread_mutex_lock(&mu);
+	t->finished = 1;
+	t->status = status;
+	n_transfers++;
+	pthread_mutex_unlock(&mu);
+	kill(getpid(), SIGIO);           // Picked up by mover_poll() from sig_hook()
+}
+
+static void first_byte(struct transfer *t) {      // Its time to first byte, as a pipeline master records it
+	if (t->ttfb_kind < 0) return;
+	prefetch_ttfb(t->ttfb_kind, state_clock_ns() - t->dispatched);
+	t->ttfb_kind = -1;
+}
+
+// Decides what an idle transfer does next: 1 if it wants data moved
+static int next_step(struct transfer *t) {
+	if (t->error) finish(t, W_EXITCODE(1, 0));
+	else if (__atomic_load_n(&t->cancel, __ATOMIC_RELAXED) || stopping) finish(t, SIGTERM);
+	else if (t->written == t->len && t->eof) finish(t, 0);
+	else return !__atomic_load_n(&t->paused, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static void uring_step(void) {
+	for (int i=0; i<MAX_TRANSFERS; i++) {
+		struct transfer *t = &slots[i];
+		if (!t->started || t->finished) continue;
+
+		if (t->inflight) {       // A blocked printer would hold a cancelled transfer forever
+			if ((__atomic_load_n(&t->cancel, __ATOMIC_RELAXED) || stopping) && !t->cancel_sent) {
+				for (int op=OP_READ; op<=OP_WRITE; op++) {
+					struct io_uring_sqe *s = get_sqe();
+					if (!s) break;
+					s->opcode = IORING_OP_ASYNC_CANCEL;
+					s->fd = -1;
+					s->addr = (uint64_t)i << 2 | op;
+					s->user_data = WAKE_DATA - 1;
+				}
+				t->cancel_sent = 1;
+			}
+			continue;
+		}
+		if (!next_step(t)) continue;
+
+		if (t->written < t->len) {         // The rest of a short write
+			struct io_uring_sqe *s = get_sqe();
+			if (!s) continue;
+			prep_rw(s, 1, i, t->out, t->buf + t->written, t->len - t->written, -1);
+			t->inflight = 1;
+			continue;
+		}
+
+		// Read the next chunk and write it out once it is in, in one submission;
+		// a short read fails the linked write, which is then resubmitted for what was read
+		size_t n = t->size > t->off && t->size - t->off < MOVER_CHUNK ? t->size - t->off : MOVER_CHUNK;
+		if (params.sq_entries - (sq_local - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE)) < 2) continue;
+		struct io_uring_sqe *r = get_sqe(), *w = get_sqe();
+		prep_rw(r, 0, i, t->in, t->buf, n, t->off);
+		r->flags |= IOSQE_IO_LINK;
+		prep_rw(w, 1, i, t->out, t->buf, n, -1);
+		t->len = t->written = 0;
+		t->inflight = 2;
+	}
+
+	if (!wake_armed) {
+		struct io_uring_sqe *s = get_sqe();
+		if (s) {
+			s->opcode = IORING_OP_READ;
+			s->fd = wake_fd;
+			s->addr = (uintptr_t)&wake_buf;
+			s->len = sizeof(wake_buf);
+			s->user_data = WAKE_DATA;
+			wake_armed = 1;
+		}
+	}
+
+	if (uring_enter(1) < 0) return;
+
+	unsigned head = *cq_head, tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		struct io_uring_cqe *c = &cqes[head & *cq_mask];
+		if (c->user_data == WAKE_DATA) {
+			wake_armed = 0;
+			continue;
+		}
+		if (c->user_data == WAKE_DATA - 1) continue;       // Cancel results
+
+		struct transfer *t = &slots[c->user_data >> 2];
+		int res = c->res;
+		t->inflight--;
+		if ((c->user_data & 3) == OP_READ) {
+			if (res < 0) {
+				if (res != -ECANCELED) t->error = -res;
+			} else {
+				first_byte(t);
+				t->len = res;
+				t->off += res;
+				progress_moved(t->slot, res, 0);
+				if (res == 0) t->eof = 1;
+			}
+		} else if (res >= 0) {
+			t->written += res;
+			__atomic_fetch_add(&n_bytes, res, __ATOMIC_RELAXED);
+			progress_moved(t->slot, 0, res);
+		} else if (res != -ECANCELED) {
+			t->error = -res;
+		}
+	}
+	__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void move_some(struct transfer *t) {        // The printer can take data
+	if (!t->use_rw) {
+		ssize_t n = sendfile(t->out, t->in, &t->off, MOVER_CHUNK);
+		if (n > 0) {
+			first_byte(t);
+			__atomic_fetch_add(&n_bytes, n, __ATOMIC_RELAXED);
+			progress_moved(t->slot, n, n);
+		} else if (n == 0) t->eof = 1;
+		else if (errno == EINVAL || errno == ENOSYS) t->use_rw = 1;
+		else if (errno != EAGAIN && errno != EINTR) t->error = errno;
+		return;
+	}
+
+	if (t->written == t->len && !t->eof) {
+		ssize_t n = pread(t->in, t->buf, MOVER_CHUNK, t->off);
+		if (n < 0) t->error = errno;
+		else if (n == 0) t->eof = 1;
+		else {
+			first_byte(t);
+			t->off += n;
+			t->len = n;
+			t->written = 0;
+			progress_moved(t->slot, n, 0);
+		}
+	}
+	if (t->written < t->len) {
+		ssize_t w = write(t->out, t->buf + t->written, t->len - t->written);
+		if (w > 0) {
+			t->written += w;
+			__atomic_fetch_add(&n_bytes, w, __ATOMIC_RELAXED);
+			progress_moved(t->slot, 0, w);
+		} else if (w < 0 && errno != EAGAIN && errno != EINTR) {
+			t->error = errno;
+		}
+	}
+}
+
+static void poll_step(void) {
+	struct pollfd pf[MAX_TRANSFERS + 1] = {{ wake_fd, POLLIN, 0 }};
+	struct transfer *on[MAX_TRANSFERS + 1];
+	int n = 1;
+
+	for (int i=0; i<MAX_TRANSFERS; i++) {
+		struct transfer *t = &slots[i];
+		if (!t->started || t->finished || !next_step(t)) continue;
+		pf[n] = (struct pollfd){ t->out, POLLOUT, 0 };
+		on[n++] = t;
+	}
+
+	if (poll(pf, n, -1) < 0) return;
+	if (pf[0].revents & POLLIN) {
+		uint64_t v;
+		if (read(wake_fd, &v, sizeof(v)) < 0) return;
+	}
+	for (int k=1; k<n; k++)
+		if (pf[k].revents) move_some(on[k]);
+}
+
+static void *mover_loop(void *arg) {
+	(void)arg;
+	for (;;) {
+		int busy = 0;
+		pthread_mutex_lock(&mu);
+		for (int i=0; i<MAX_TRANSFERS; i++) {
+			struct transfer *t = &slots[i];
+			if (t->job >= 0 && !t->started) t->started = 1;      // Handed over by mover_start()
+			if (t->started && !t->finished) busy = 1;
+		}
+		pthread_mutex_unlock(&mu);
+		if (stopping && !busy) break;
+
+		if (backend == MOVER_URING) uring_step();
+		else poll_step();
+	}
+	return NULL;
+}
+
+// Main thread side
+
+static void wake(void) {
+	uint64_t one = 1;
+	if (write(wake_fd, &one, sizeof(one)) < 0) return;       // Already pending
+}
+
+static int mover_open(void) {
+	if (!buffers && (buffers = malloc((size_t)MAX_TRANSFERS * MOVER_CHUNK)) == NULL) return -1;
+	for (int i=0; i<MAX_TRANSFERS; i++) {
+		memset(&slots[i], 0, sizeof(slots[i]));
+		slots[i].job = -1;
+		slots[i].buf = buffers + (size_t)i * MOVER_CHUNK;
+	}
+	if ((wake_fd = eventfd(0, EFD_CLOEXEC)) < 0) return -1;
+
+	backend = MOVER_SPLICE;
+	if (mode != MOVER_SPLICE && uring_open() == 0) backend = MOVER_URING;
+	else if (mode == MOVER_URING) {
+		close(wake_fd);
+		wake_fd = -1;
+		backend = MOVER_AUTO;
+		return -1;
+	}
+
+	stopping = 0;
+	if (state_thread(&mover, mover_loop, NULL) != 0) {
+		uring_close();
+		close(wake_fd);
+		wake_fd = -1;
+		backend = MOVER_AUTO;
+		return -1;
+	}
+	running = 1;
+	return 0;
+}
+
+void mover_close(void) {        // Transfers still going are cancelled
+	if (!running) return;
+	stopping = 1;
+	wake();
+	pthread_join(mover, NULL);
+	uring_close();
+	close(wake_fd);
+	wake_fd = -1;
+	running = 0;
+	backend = MOVER_AUTO;
+	mover_poll();
+}
+
+int mover_set_mode(MOVER_MODE m) {
+	if (n_active) return -1;
+	mover_close();
+	mode = m;
+	if (m == MOVER_URING || m == MOVER_SPLICE) return mover_open();     // Fail now, not at the first job
+	return 0;
+}
+
+int mover_start(JOB *j, int in, int out, uint64_t dispatched_ns) {
+	if (mode == MOVER_OFF || sim_mode) return -1;
+	if (!running && mover_open() < 0) return -1;
+
+	struct stat sb;
+	if (fstat(in, &sb) < 0) return -1;
+	fcntl(in, F_SETFD, FD_CLOEXEC);         // Printers started later must not hold the connection open
+	fcntl(out, F_SETFD, FD_CLOEXEC);
+	if (backend == MOVER_SPLICE && fcntl(out, F_SETFL, fcntl(out, F_GETFL) | O_NONBLOCK) < 0) return -1;
+
+	pthread_mutex_lock(&mu);
+	struct transfer *t = NULL;
+	for (int i=0; i<MAX_TRANSFERS && !t; i++)
+		if (slots[i].job < 0) t = &slots[i];
+	if (t) {
+		char *buf = t->buf;
+		memset(t, 0, sizeof(*t));
+		t->buf = buf;
+		t->job = j->id;
+		t->slot = j - jobs;
+		t->in = in;
+		t->out = out;
+		t->size = sb.st_size;
+		t->ttfb_kind = prefetch_ttfb_kind(j);
+		t->dispatched = dispatched_ns;
+		if (++n_active > max_active) max_active = n_active;
+	}
+	pthread_mutex_unlock(&mu);
+	if (!t) return -1;
+
+	j->moving = 1;
+	wake();
+	return 0;
+}
+
+void mover_forked(void) {
+	if (!running) return;
+	for (int i=0; i<MAX_TRANSFERS; i++) {
+		int in = __atomic_load_n(&slots[i].in, __ATOMIC_SEQ_CST), out = __atomic_load_n(&slots[i].out, __ATOMIC_SEQ_CST);
+		if (slots[i].job < 0 || in < 0) continue;
+		close(in);
+		close(out);
+	}
+}
+
+int mover_signal(JOB *j, int sig) {
+	struct transfer *t = NULL;
+	for (int i=0; i<MAX_TRANSFERS && !t; i++)
+		if (slots[i].job == j->id) t = &slots[i];
+	if (!t) return -1;
+
+	if (sig == SIGSTOP && j->status == JOB_RUNNING) {
+		__atomic_store_n(&t->paused, 1, __ATOMIC_RELAXED);
+		trace_child('S', j, 0);
+		job_stopped(j);
+	} else if (sig == SIGCONT && j->status == JOB_PAUSED) {
+		__atomic_store_n(&t->paused, 0, __ATOMIC_RELAXED);
+		trace_child('R', j, 0);
+		job_continued(j);
+	} else if (sig == SIGTERM) {
+		__atomic_store_n(&t->cancel, 1, __ATOMIC_RELAXED);
+	} else {
+		return 0;
+	}
+	wake();
+	return 0;
+}
+
+void mover_poll(void) {
+	struct { int job, status; } done[MAX_TRANSFERS];
+	int n = 0;
+
+	pthread_mutex_lock(&mu);
+	for (int i=0; i<MAX_TRANSFERS; i++) {
+		struct transfer *t = &slots[i];
+		if (t->job < 0 || !t->finished) continue;
+		done[n].job = t->job;
+		done[n++].status = t->status;
+		t->job = -1;
+		n_active--;
+	}
+	pthread_mutex_unlock(&mu);
+
+	for (int k=0; k<n; k++) {
+		JOB *j = lookup_job(done[k].job);
+		if (!j || !j->moving) continue;
+		j->moving = 0;
+		trace_child('X', j, done[k].status);
+		job_exited(j, done[k].status);
+	}
+	if (n) try_dispatch();
+}
+
+void mover_stats(struct mover_stats *s) {
+	pthread_mutex_lock(&mu);
+	s->backend = backend;
+	s->transfers = n_transfers;
+	s->active = n_active;
+	s->max_active = max_active;
+	pthread_mutex_unlock(&mu);
+	s->bytes = __atomic_load_n(&n_bytes, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,357 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "overflow.h"
+#include "crc32.h"
+
+#define OVF_MAGIC   0x51465650u     // "PVFQ"
+#define OVF_VERSION 3
+
+struct ovf_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t head;          // Offset of the first record not yet paged in
+};
+
+typedef enum { OVF_JOB = 1, OVF_CANCEL } OVF_KIND;
+
+#define OVF_REC_MAX (sizeof(struct ovf_rec) + 64 + 4096 + 2 * 64)      // Type, file name, class and tenant
+
+struct ovf_rec {
+	uint32_t crc;           // CRC-32 of the rest of the record
+	uint32_t len;           // Whole record; a job's type, file name, class and tenant follow, NUL-terminated
+	uint16_t kind;          // OVF_KIND
+	uint16_t pad;
+	int32_t id;             // Cancel: the first id
+	int32_t last;           // Cancel: the last id
+	uint32_t eligible;
+	int64_t created;
+	int64_t deadline;
+	int32_t copies;
+	uint32_t pad2;
+};
+
+struct range {
+	int first, last;
+};
+
+int overflow_active = 0;
+
+static int fd = -1;
+static char q_path[4096];
+static uint64_t head, tail;             // File offsets
+static int paged_id = -1, tail_id = -1;    // Jobs on disk have ids in (paged_id, tail_id]
+static int queued, high, low, busy;
+static struct range *cancelled;       // Ids on disk that are not to be paged in
+static int n_cancelled;
+static uint64_t n_spilled, n_paged, n_cancels, n_refused;
+static timer_t timer;
+static int have_timer;
+
+// Group commit, as in the journal: the main thread writes records, the
+// syncer thread fdatasync()s whatever was written while it last synced
+
+static pthread_t syncer;
+static int syncer_running, syncer_stop;
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cv = PTHREAD_COND_INITIALIZER;
+static uint64_t written, synced, n_syncs;      // Records; synced and n_syncs under mu
+
+static void *sync_loop(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&mu);
+	for (;;) {
+		while (synced == written && !syncer_stop) pthread_cond_wait(&work_cv, &mu);
+		if (synced == written) break;
+
+		uint64_t upto = written;
+		pthread_mutex_unlock(&mu);
+		int ok = fdatasync(fd) == 0;
+		pthread_mutex_lock(&mu);
+		synced = upto;           // If it failed, the records are still in the page cache; only a crash loses them
+		n_syncs += ok;
+	}
+	pthread_mutex_unlock(&mu);
+	return NULL;
+}
+
+static void record_written(void) {
+	pthread_mutex_lock(&mu);
+	written++;
+	pthread_cond_signal(&work_cv);
+	pthread_mutex_unlock(&mu);
+}
+
+static size_t seal(char *buf, size_t len) {      // Fills in the CRC of a record
+	uint32_t crc = crc32(buf + sizeof(crc), len - sizeof(crc));
+	memcpy(buf, &crc, sizeof(crc));
+	return len;
+}
+
+static int intact(const char *buf, const struct ovf_rec *r) {      // buf holds the whole record
+	if (crc32(buf + sizeof(r->crc), r->len - sizeof(r->crc)) != r->crc) return 0;
+	if (r->kind != OVF_JOB) return 1;
+	int names = 0;           // Type, file name, class and tenant, each NUL-terminated within the record
+	for (size_t k=sizeof(*r); k<r->len; k++) names += !buf[k];
+	return names == 4 && !buf[r->len - 1];
+}
+
+static int is_cancelled(int id) {
+	for (int i=0; i<n_cancelled; i++)
+		if (id >= cancelled[i].first && id <= cancelled[i].last) return 1;
+	return 0;
+}
+
+static int add_cancelled(int first, int last) {      // Returns how many queued jobs that covers
+	int n = 0;
+	if (first <= paged_id) first = paged_id + 1;
+	if (last > tail_id) last = tail_id;
+	for (int id=first; id<=last; id++) n += !is_cancelled(id);
+	if (!n) return 0;
+
+	struct range *r = realloc(cancelled, (n_cancelled + 1) * sizeof(*r));
+	if (!r) return 0;
+	cancelled = r;
+	cancelled[n_cancelled++] = (struct range){ first, last };
+	return n;
+}
+
+static void forget_cancelled(void) {      // Ranges entirely paged past
+	int k = 0;
+	for (int i=0; i<n_cancelled; i++)
+		if (cancelled[i].last > paged_id) cancelled[k++] = cancelled[i];
+	n_cancelled = k;
+}
+
+static int put_head(void) {
+	struct ovf_hdr h = { OVF_MAGIC, OVF_VERSION, head };
+	return pwrite(fd, &h, sizeof(h), 0) == sizeof(h) ? 0 : -1;
+}
+
+// Opening: take up whatever an earlier run left on disk
+
+static int scan(void) {
+	struct ovf_hdr h;
+	struct stat sb;
+	if (fstat(fd, &sb) < 0) return -1;
+	if (sb.st_size < (off_t)sizeof(h)) {
+		head = tail = sizeof(h);
+		return ftruncate(fd, 0) == 0 ? put_head() : -1;
+	}
+	if (pread(fd, &h, sizeof(h), 0) != sizeof(h) || h.magic != OVF_MAGIC || h.version != OVF_VERSION
+	    || h.head < sizeof(h) || h.head > (uint64_t)sb.st_size)
+		return -1;
+
+	head = tail = h.head;
+	while (tail + sizeof(struct ovf_rec) <= (uint64_t)sb.st_size) {
+		char buf[OVF_REC_MAX];
+		struct ovf_rec r;
+		if (pread(fd, &r, sizeof(r), tail) != sizeof(r) || r.len < sizeof(r) || r.len > sizeof(buf)
+		    || tail + r.len > (uint64_t)sb.st_size || pread(fd, buf, r.len, tail) != (ssize_t)r.len || !intact(buf, &r))
+			break;
+		if (r.kind == OVF_JOB) {
+			if (paged_id < 0) paged_id = r.id - 1;
+			tail_id = r.id;
+			queued++;
+		} else if (r.kind == OVF_CANCEL) {
+			queued -= add_cancelled(r.id, r.last);
+		}
+		tail += r.len;
+	}
+	if (tail < (uint64_t)sb.st_size && ftruncate(fd, tail) < 0) return -1;     // A record torn or lost by a crash, and all after it
+	if (tail_id >= next_job_id) next_job_id = tail_id + 1;
+	return 0;
+}
+
+int overflow_open(const char *dir, int hi, int lo) {
+	if (overflow_active || hi <= 0 || lo < 0 || lo >= hi) return -1;
+	if (snprintf(q_path, sizeof(q_path), "%s/overflow.q", dir) >= (int)sizeof(q_path)) return -1;
+	mkdir(dir, 0755);
+	if ((fd = open(q_path, O_RDWR | O_CREAT, 0644)) < 0) return -1;
+
+	paged_id = tail_id = -1;
+	queued = busy = 0;
+	n_cancelled = 0;
+	if (scan() < 0) {
+		close(fd);
+		fd = -1;
+		return -1;
+	}
+
+	if (!syncer_running) {
+		syncer_stop = 0;
+		if (state_thread(&syncer, sync_loop, NULL) != 0) {
+			close(fd);
+			fd = -1;
+			return -1;
+		}
+		syncer_running = 1;
+	}
+	if (!have_timer) {
+		struct sigevent ev = { .sigev_notify = SIGEV_SIGNAL, .sigev_signo = SIGIO };
+		have_timer = timer_create(CLOCK_MONOTONIC, &ev, &timer) == 0;
+	}
+	high = hi;
+	low = lo;
+	overflow_active = 1;
+	overflow_refill();
+	try_dispatch();
+	return 0;
+}
+
+void overflow_close(void) {
+	if (!overflow_active) return;
+	if (have_timer) timer_settime(timer, 0, &(struct itimerspec){{0}}, NULL);
+	put_head();
+	pthread_mutex_lock(&mu);      // The syncer syncs what is left, head included, and exits
+	syncer_stop = 1;
+	written++;
+	pthread_cond_signal(&work_cv);
+	pthread_mutex_unlock(&mu);
+	pthread_join(syncer, NULL);
+	syncer_running = 0;
+	close(fd);
+	fd = -1;
+	overflow_active = 0;
+}
+
+// Spilling
+
+int overflow_pending(void) {
+	return overflow_active && head < tail;
+}
+
+int overflow_busy(void) {
+	return overflow_active && busy;
+}
+
+int overflow_spill(const char *file, const char *type, uint32_t eligible, const struct job_attrs *a) {
+	if (!overflow_active || sim_mode) return -1;
+	if (busy || queued >= high) {        // Backpressure until the queue is down to the low watermark
+		busy = 1;
+		n_refused++;
+		return -1;
+	}
+
+	const char *klass = a && a->klass ? a->klass : "", *tenant = a && a->tenant ? a->tenant : "";
+	size_t tlen = strlen(type) + 1, flen = strlen(file) + 1, clen = strlen(klass) + 1, nlen = strlen(tenant) + 1;
+	struct ovf_rec r = { 0, sizeof(r) + tlen + flen + clen + nlen, OVF_JOB, 0, next_job_id, 0, eligible, state_now(),
+		a ? a->deadline : 0, a ? a->copies : 1, 0 };
+	char buf[OVF_REC_MAX];
+	if (r.len > sizeof(buf)) return -1;
+	char *p = buf + sizeof(r);
+	memcpy(buf, &r, sizeof(r));
+	memcpy(p, type, tlen);
+	memcpy(p += tlen, file, flen);
+	memcpy(p += flen, klass, clen);
+	memcpy(p + clen, tenant, nlen);
+	if (pwrite(fd, buf, seal(buf, r.len), tail) != (ssize_t)r.len) {
+		if (ftruncate(fd, tail) < 0) { /* The next scan drops the torn record */ }
+		return -1;
+	}
+	record_written();
+
+	if (head == tail) paged_id = r.id - 1;
+	tail += r.len;
+	tail_id = r.id;
+	queued++;
+	n_spilled++;
+	return next_job_id++;
+}
+
+int overflow_cancel(int first, int last) {
+	if (!overflow_active || head == tail) return -1;
+	int n = add_cancelled(first, last);
+	if (!n) return -1;
+
+	struct ovf_rec r = { 0, sizeof(r), OVF_CANCEL, 0, first, last, 0, 0 };
+	char buf[sizeof(r)];
+	memcpy(buf, &r, sizeof(r));
+	if (pwrite(fd, buf, seal(buf, r.len), tail) == sizeof(r)) {      // Else it is forgotten at the next start
+		tail += r.len;
+		record_written();
+	}
+	queued -= n;
+	n_cancels += n;
+	if (busy && queued <= low) busy = 0;
+	return 0;
+}
+
+// Paging in
+
+void overflow_refill(void) {
+	if (!overflow_active) return;
+
+	int n = 0;
+	while (head < tail && free_job_slots() > 0) {
+		char buf[OVF_REC_MAX];
+		struct ovf_rec r;
+		if (pread(fd, &r, sizeof(r), head) != sizeof(r) || r.len < sizeof(r) || r.len > sizeof(buf)
+		    || pread(fd, buf, r.len, head) != (ssize_t)r.len || !intact(buf, &r))
+			break;
+
+		if (r.kind == OVF_JOB) {
+			char *type = buf + sizeof(r);
+			char *file = type + strlen(type) + 1;
+			char *klass = file + strlen(file) + 1;
+			struct job_attrs a = { klass, klass + strlen(klass) + 1, r.deadline, r.copies };
+			if (!is_cancelled(r.id)) {
+				if (restore_job(r.id, file, type, r.eligible, r.created, &a) < 0 && !lookup_job(r.id)) break;
+				queued--;          // Or already recovered from the journal
+				n_paged++;
+			}
+			paged_id = r.id;
+		}
+		head += r.len;
+		n++;
+	}
+	if (!n) return;
+
+	forget_cancelled();
+	if (head == tail) {      // Drained: start the file over
+		head = tail = sizeof(struct ovf_hdr);
+		n_cancelled = 0;
+		if (ftruncate(fd, tail) < 0) { /* Only space is lost */ }
+	}
+	put_head();
+	if (busy && queued <= low) busy = 0;
+}
+
+void overflow_poll(void) {       // Finished jobs may be due for deletion, making room for those on disk
+	if (!overflow_pending()) return;
+
+	delete_old_jobs();       // Pages jobs in
+	try_dispatch();
+	if (!overflow_pending() || !have_timer) return;
+
+	time_t due = 0;          // Next time a finished job leaves the table
+	JOB_SET done = job_set_of(1u << JOB_FINISHED | 1u << JOB_ABORTED);
+	FOR_EACH_JOB(i, &done)
+		if (!due || jobs[i].finish_time + JOB_RETAIN < due) due = jobs[i].finish_time + JOB_RETAIN;
+	if (!due) return;        // Only running jobs: their exits bring us back
+
+	time_t wait = due - state_now();
+	struct itimerspec t = { {0, 0}, { wait > 0 ? wait : 0, wait > 0 ? 0 : 1000000 } };
+	timer_settime(timer, 0, &t, NULL);
+}
+
+void overflow_stats(struct overflow_stats *s) {
+	s->queued = queued;
+	s->busy = busy;
+	s->high = high;
+	s->low = low;
+	s->spilled = n_spilled;
+	s->paged = n_paged;
+	s->cancelled = n_cancels;
+	s->refused = n_refused;
+	s->file_bytes = overflow_active ? tail : 0;
+	pthread_mutex_lock(&mu);
+	s->syncs = n_syncs;
+	pthread_mutex_unlock(&mu);
+}
@@ -0,0 +1,255 @@
+#define _GNU_SOURCE             // cpu_set_t, sched_setaffinity(), SCHED_BATCH
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include "placement.h"
+
+int placement_active = 0;
+
+static uint64_t orig, spooler_cpus, pool_cpus;
+static int domain[PLACE_MAX_CPUS], l2[PLACE_MAX_CPUS];
+static uint64_t placed[PLACE_MAX_CPUS];
+static uint64_t prev_busy[PLACE_MAX_CPUS], prev_total[PLACE_MAX_CPUS];
+
+static int width[MAX_PRINTERS];      // Cores per pipeline; 0: one per stage
+static int batch[MAX_PRINTERS];
+
+static int get_affinity(uint64_t *mask) {
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) < 0) return -1;
+	*mask = 0;
+	for (int c=0; c<PLACE_MAX_CPUS; c++)
+		if (CPU_ISSET(c, &set)) *mask |= 1ull << c;
+	return 0;
+}
+
+static int set_affinity(pid_t tid, uint64_t mask) {      // 0: the calling thread
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int c=0; c<PLACE_MAX_CPUS; c++)
+		if (mask & (1ull << c)) CPU_SET(c, &set);
+	return sched_setaffinity(tid, sizeof(set), &set) < 0 ? -1 : 0;
+}
+
+static int set_spooler_affinity(uint64_t mask) {      // Every thread already running: launchers, mover, journal writer, ...
+	if (set_affinity(0, mask) < 0) return -1;
+	DIR *d = opendir("/proc/self/task");
+	if (!d) return 0;        // The threads started from now on inherit it at least
+	for (struct dirent *e; (e = readdir(d)); ) {
+		pid_t tid = atoi(e->d_name);
+		if (tid > 0) set_affinity(tid, mask);
+	}
+	closedir(d);
+	return 0;
+}
+
+int cpu_list_parse(const char *s, uint64_t *mask) {
+	*mask = 0;
+	while (*s) {
+		char *end;
+		long a = strtol(s, &end, 10), b = a;
+		if (end == s) return -1;
+		if (*end == '-') {
+			s = end + 1;
+			b = strtol(s, &end, 10);
+			if (end == s) return -1;
+		}
+		if (a < 0 || b < a || b >= PLACE_MAX_CPUS) return -1;
+		for (long c=a; c<=b; c++) *mask |= 1ull << c;
+		if (*end == ',' || *end == '\n') end++;
+		else if (*end) return -1;
+		s = end;
+	}
+	return *mask ? 0 : -1;
+}
+
+char *cpu_list_format(uint64_t mask, char *buf, size_t n) {
+	size_t k = 0;
+	buf[0] = '\0';
+	for (int c=0; c<PLACE_MAX_CPUS && k < n; c++) {
+		if (!(mask & (1ull << c))) continue;
+		int e = c;
+		while (e + 1 < PLACE_MAX_CPUS && (mask & (1ull << (e + 1)))) e++;
+		k += e > c ? snprintf(buf + k, n - k, "%s%d-%d", k ? "," : "", c, e) : snprintf(buf + k, n - k, "%s%d", k ? "," : "", c);
+		c = e;
+	}
+	if (!k) snprintf(buf, n, "-");
+	return buf;
+}
+
+// Topology, from sysfs: the first CPU sharing each CPU's caches
+
+static int cache_group(int cpu, int level) {
+	for (int i=0; i<8; i++) {
+		char path[128], buf[256];
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, i);
+		FILE *f = fopen(path, "r");
+		if (!f) break;
+		int lv = 0;
+		if (fscanf(f, "%d", &lv) != 1) lv = 0;
+		fclose(f);
+		if (lv != level) continue;
+
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, i);
+		if (!(f = fopen(path, "r"))) break;
+		uint64_t m;
+		int ok = fgets(buf, sizeof(buf), f) && cpu_list_parse(buf, &m) == 0;
+		fclose(f);
+		if (ok) return __builtin_ctzll(m);
+	}
+	return -1;
+}
+
+static void read_topology(void) {
+	for (int c=0; c<PLACE_MAX_CPUS; c++) {
+		if (!(orig & (1ull << c))) continue;
+		int g2 = cache_group(c, 2), g3 = cache_group(c, 3);
+		l2[c] = g2 >= 0 ? g2 : c;
+		domain[c] = g3 >= 0 ? g3 : l2[c];
+	}
+}
+
+static void cpu_times(uint64_t busy[PLACE_MAX_CPUS], uint64_t total[PLACE_MAX_CPUS]) {
+	FILE *f = fopen("/proc/stat", "r");
+	if (!f) return;
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		int c;
+		unsigned long long v[8] = {0};
+		if (sscanf(line, "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu", &c, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) < 5
+		    || c < 0 || c >= PLACE_MAX_CPUS)
+			continue;
+		total[c] = 0;
+		for (int i=0; i<8; i++) total[c] += v[i];
+		busy[c] = total[c] - v[3] - v[4];      // Less idle and iowait
+	}
+	fclose(f);
+}
+
+int placement_open(uint64_t spooler, uint64_t pool) {
+	if (!placement_active && get_affinity(&orig) < 0) return -1;
+	if (!spooler || (spooler & ~orig) || (pool & ~orig)) return -1;
+	if (!pool && !(pool = orig & ~spooler)) pool = orig;     // A single CPU is shared
+
+	if (set_spooler_affinity(spooler) < 0) return -1;
+	spooler_cpus = spooler;
+	pool_cpus = pool;
+	read_topology();
+	cpu_times(prev_busy, prev_total);
+	placement_active = 1;
+	return 0;
+}
+
+void placement_close(void) {      // Pipelines already bound stay so
+	if (!placement_active) return;
+	set_spooler_affinity(orig);
+	placement_active = 0;
+}
+
+int placement_set_printer(PRINTER *p, int cores, int bulk) {
+	if (cores < 0 || cores > PLACE_MAX_CPUS) return -1;
+	width[p->id] = cores;
+	batch[p->id] = bulk;
+	return 0;
+}
+
+void placement_printer(PRINTER *p, int *cores, int *bulk) {
+	*cores = width[p->id];
+	*bulk = batch[p->id];
+}
+
+static void bound_load(int load[PLACE_MAX_CPUS]) {      // Running pipelines on each core
+	memset(load, 0, PLACE_MAX_CPUS * sizeof(int));
+	JOB_SET running = job_set_of(1u << JOB_RUNNING | 1u << JOB_PAUSED);
+	FOR_EACH_JOB(i, &running)
+		for (uint64_t m = jobs[i].cpus; m; m &= m - 1)
+			load[__builtin_ctzll(m)]++;
+}
+
+void placement_choose(JOB *j, PRINTER *p, int stages) {
+	j->cpus = 0;
+	if (!placement_active) return;
+
+	int load[PLACE_MAX_CPUS];
+	bound_load(load);
+
+	// The domain with the fewest pipelines per core
+	int best = -1, best_load = 0, best_n = 0;
+	uint64_t seen = 0;
+	for (int c=0; c<PLACE_MAX_CPUS; c++) {
+		if (!(pool_cpus & (1ull << c)) || (seen & (1ull << domain[c]))) continue;
+		int d = domain[c], n = 0, sum = 0;
+		seen |= 1ull << d;
+		for (int k=c; k<PLACE_MAX_CPUS; k++)
+			if ((pool_cpus & (1ull << k)) && domain[k] == d) {
+				n++;
+				sum += load[k];
+			}
+		if (best < 0 || sum * best_n < best_load * n) {
+			best = d;
+			best_load = sum;
+			best_n = n;
+		}
+	}
+	if (best < 0) return;
+
+	int want = width[p->id] ? width[p->id] : stages;
+	if (want < 1) want = 1;
+	for (int got = 0; got < want; got++) {      // Least busy first, then a shared level 2 cache, then the lowest number
+		int pick = -1, pick_near = 0;
+		for (int c=0; c<PLACE_MAX_CPUS; c++) {
+			if (!(pool_cpus & (1ull << c)) || domain[c] != best || (j->cpus & (1ull << c))) continue;
+			int near = 0;
+			for (uint64_t m = j->cpus; m; m &= m - 1)
+				near |= l2[__builtin_ctzll(m)] == l2[c];
+			if (pick < 0 || load[c] < load[pick] || (load[c] == load[pick] && near > pick_near)) {
+				pick = c;
+				pick_near = near;
+			}
+		}
+		if (pick < 0) break;        // The domain is smaller than asked for
+		j->cpus |= 1ull << pick;
+		placed[pick]++;
+	}
+}
+
+void placement_apply(JOB *j, PRINTER *p) {
+	if (j->cpus) set_affinity(0, j->cpus);
+	if (batch[p->id]) {
+		struct sched_param sp = { 0 };
+		sched_setscheduler(0, SCHED_BATCH, &sp);
+		setpriority(PRIO_PROCESS, 0, PLACE_BATCH_NICE);
+	}
+}
+
+int placement_stats(struct cpu_stats cpus[PLACE_MAX_CPUS], uint64_t *spooler, uint64_t *pool) {
+	uint64_t avail = orig;
+	if (!placement_active && get_affinity(&avail) < 0) return 0;
+
+	int load[PLACE_MAX_CPUS];
+	bound_load(load);
+	uint64_t busy[PLACE_MAX_CPUS] = {0}, total[PLACE_MAX_CPUS] = {0};
+	cpu_times(busy, total);
+
+	int n = 0;
+	memset(cpus, 0, PLACE_MAX_CPUS * sizeof(*cpus));
+	for (int c=0; c<PLACE_MAX_CPUS; c++) {
+		if (!(avail & (1ull << c))) continue;
+		n = c + 1;
+		int sp = placement_active && (spooler_cpus & (1ull << c)), pl = placement_active && (pool_cpus & (1ull << c));
+		cpus[c].role = sp && pl ? CPU_SHARED : sp ? CPU_SPOOLER : pl ? CPU_POOL : CPU_UNUSED;
+		cpus[c].domain = placement_active ? domain[c] : c;
+		cpus[c].running = load[c];
+		cpus[c].placed = placed[c];
+		cpus[c].util = total[c] > prev_total[c] ? (double)(busy[c] - prev_busy[c]) / (total[c] - prev_total[c]) : 0;
+		prev_busy[c] = busy[c];
+		prev_total[c] = total[c];
+	}
+	*spooler = placement_active ? spooler_cpus : 0;
+	*pool = placement_active ? pool_cpus : 0;
+	return n;
+}
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "plugins.h"
+
+static struct plugin {
+	char *spec;
+	presi_convert_fn *fn;
+} plugins[MAX_PLUGINS];
+static int n_plugins = 0;
+
+struct plugin_run {          // One plugin stage in a pipeline master
+	pthread_t tid;
+	presi_convert_fn *fn;
+	int in, out;
+	struct presi_convert_state state;
+	int rc;
+};
+
+static struct plugin_run runs[MAX_TYPES];       // A path has fewer stages than there are types
+static int n_runs = 0;
+
+static int is_plugin(const char *cmd) {
+	return !strncmp(cmd, PRESI_PLUGIN_PREFIX, strlen(PRESI_PLUGIN_PREFIX));
+}
+
+static presi_convert_fn *find(const char *spec) {
+	for (int i=0; i<n_plugins; i++)
+		if (!strcmp(plugins[i].spec, spec)) return plugins[i].fn;
+	return NULL;
+}
+
+int plugin_load(const char *spec) {
+	if (!is_plugin(spec)) return 0;
+	if (find(spec)) return 0;
+	if (n_plugins == MAX_PLUGINS) return -1;
+
+	char *lib = strdup(spec + strlen(PRESI_PLUGIN_PREFIX)), *sym = lib ? strrchr(lib, ':') : NULL;
+	if (!sym || sym == lib || !sym[1]) {
+		free(lib);
+		return -1;
+	}
+	*sym++ = '\0';
+
+	void *h = dlopen(lib, RTLD_NOW | RTLD_LOCAL);
+	presi_convert_fn *fn = h ? (presi_convert_fn *)dlsym(h, sym) : NULL;
+	free(lib);
+	if (!fn || !(spec = strdup(spec))) {
+		if (h) dlclose(h);
+		return -1;
+	}
+	plugins[n_plugins++] = (struct plugin){ (char *)spec, fn };      // Kept loaded: jobs may still be running it
+	return 0;
+}
+
+int plugin_stage(CONVERSION *c) {
+	return is_plugin(c->cmd_and_args[0]);
+}
+
+// Pipeline master side
+
+static void *run_stage(void *arg) {
+	struct plugin_run *r = arg;
+	r->rc = r->fn(r->in, r->out, &r->state);
+	close(r->in);            // The next stage sees end of file now, not when the job ends
+	close(r->out);
+	return NULL;
+}
+
+int plugin_stage_start(CONVERSION *c, int in, int out) {
+	presi_convert_fn *fn = find(c->cmd_and_args[0]);
+	if (!fn || n_runs == MAX_TYPES) return -1;
+
+	struct plugin_run *r = &runs[n_runs];
+	r->fn = fn;
+	r->state = (struct presi_convert_state){ c->from->name, c->to->name, c->cmd_and_args + 1, NULL };
+	r->in = fcntl(in, F_DUPFD_CLOEXEC, 0);        // Not inherited by the command stages forked after it
+	r->out = fcntl(out, F_DUPFD_CLOEXEC, 0);
+	if (r->in < 0 || r->out < 0 || pthread_create(&r->tid, NULL, run_stage, r) != 0) {
+		if (r->in >= 0) close(r->in);
+		if (r->out >= 0) close(r->out);
+		return -1;
+	}
+	n_runs++;
+	return 0;
+}
+
+int plugin_stages_wait(void) {
+	int rc = 0;
+	for (int i=0; i<n_runs; i++) {
+		pthread_join(runs[i].tid, NULL);
+		rc |= runs[i].rc != 0;
+	}
+	n_runs = 0;
+	return rc;
+}
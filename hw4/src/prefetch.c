@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "prefetch.h"
+
+int prefetch_active = 0;
+
+enum { HINT_UNTRIED, HINT_DONE, HINT_DEFERRED, HINT_GONE };
+
+struct hint {
+	int id;
+	char *path;
+	size_t size;            // Set by the hinter
+	int result;             // Set by the hinter
+};
+
+struct hint_req {               // The jobs next in line, oldest first
+	size_t used, budget;    // Bytes in flight when it was queued
+	int n;
+	struct hint hint[];
+};
+
+static int depth;
+static size_t budget;
+static uint64_t hinted, hinted_bytes;     // Under mu
+
+static pthread_t hinter;
+static int hinter_running;
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cv = PTHREAD_COND_INITIALIZER;
+static struct hint_req *todo, *done;      // One request at a time
+static int outstanding;                   // Main thread only: a request is out
+
+// Written by the pipeline masters, so it is shared with every child
+static struct ttfb_stats *ttfb;
+
+int prefetch_open(int d, size_t b) {
+	if (d < 0 || b == 0) return -1;
+	if (!ttfb) {
+		void *m = mmap(NULL, TTFB_KINDS * sizeof(*ttfb), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (m == MAP_FAILED) return -1;
+		ttfb = m;
+	}
+	depth = d;
+	budget = b;
+	prefetch_active = 1;
+	prefetch_scan();
+	return 0;
+}
+
+void prefetch_close(void) {     // Counters stay, for comparison with the next run
+	prefetch_active = 0;
+}
+
+static size_t in_flight(void) {      // Hinted bytes of jobs that have not started yet
+	size_t n = 0;
+	FOR_EACH_JOB(i, &jobs_in[JOB_CREATED])
+		if (jobs[i].prefetched) n += jobs[i].prefetch_bytes;
+	return n;
+}
+
+// On the hinter thread: the open(), fstat() and posix_fadvise() calls, which
+// may block on a slow file system, stay off the main thread
+
+static void hint_all(struct hint_req *r) {
+	size_t used = r->used;
+	for (int k=0; k<r->n; k++) {
+		struct hint *h = &r->hint[k];
+		int fd = open(h->path, O_RDONLY);
+		if (fd < 0) {
+			h->result = HINT_GONE;
+			continue;
+		}
+
+		struct stat sb;
+		h->size = fstat(fd, &sb) == 0 ? (size_t)sb.st_size : 0;
+		if (used && used + h->size > r->budget) {      // A file larger than the budget still goes when it is next
+			close(fd);
+			h->result = HINT_DEFERRED;
+			break;
+		}
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);     // Starts the reads and returns
+		close(fd);
+		h->result = HINT_DONE;
+		used += h->size;
+
+		pthread_mutex_lock(&mu);
+		hinted++;
+		hinted_bytes += h->size;
+		pthread_mutex_unlock(&mu);
+	}
+}
+
+static void *hint_loop(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&mu);
+	for (;;) {
+		while (!todo) pthread_cond_wait(&work_cv, &mu);
+		struct hint_req *r = todo;
+		todo = NULL;
+		pthread_mutex_unlock(&mu);
+
+		hint_all(r);
+
+		pthread_mutex_lock(&mu);
+		done = r;
+		kill(getpid(), SIGIO);           // Picked up by prefetch_poll() from sig_hook()
+	}
+	return NULL;
+}
+
+// Main thread side
+
+static void free_req(struct hint_req *r) {
+	for (int k=0; k<r->n; k++) free(r->hint[k].path);
+	free(r);
+}
+
+void prefetch_scan(void) {
+	if (!prefetch_active || sim_mode || depth == 0 || outstanding) return;
+
+	size_t used = in_flight();
+	struct hint_req *r = NULL;
+	int last = -1;
+	for (int n=0; n<depth; n++) {
+		JOB *next = NULL;        // Oldest waiting job after the last one
+		FOR_EACH_JOB(i, &jobs_in[JOB_CREATED]) {
+			JOB *j = &jobs[i];
+			if (j->id > last && (!next || j->id < next->id)) next = j;
+		}
+		if (!next) break;
+		last = next->id;
+
+		if (next->prefetched || next->staging) continue;     // Staged jobs are hinted once their snapshot is in place
+		if (next->prefetch_bytes && used && used + next->prefetch_bytes > budget) break;      // Deferred before, and still too big
+		if (!r && !(r = calloc(1, sizeof(*r) + depth * sizeof(struct hint)))) return;
+		struct hint *h = &r->hint[r->n];
+		if (!(h->path = strdup(next->spool_file ? next->spool_file : next->file_name))) break;
+		h->id = next->id;
+		r->n++;
+	}
+	if (!r) return;
+	if (!r->n) {
+		free_req(r);
+		return;
+	}
+	if (!hinter_running) {
+		if (state_thread(&hinter, hint_loop, NULL) != 0) {
+			free_req(r);
+			return;
+		}
+		hinter_running = 1;
+	}
+	r->used = used;
+	r->budget = budget;
+	outstanding = 1;
+
+	pthread_mutex_lock(&mu);
+	todo = r;
+	pthread_cond_signal(&work_cv);
+	pthread_mutex_unlock(&mu);
+}
+
+void prefetch_poll(void) {
+	if (!hinter_running) return;
+
+	pthread_mutex_lock(&mu);
+	struct hint_req *r = done;
+	done = NULL;
+	pthread_mutex_unlock(&mu);
+	if (!r) return;
+
+	for (int k=0; k<r->n; k++) {
+		struct hint *h = &r->hint[k];
+		JOB *j = lookup_job(h->id);
+		if (!j || h->result == HINT_UNTRIED) continue;
+		j->prefetched = h->result != HINT_DEFERRED;      // A file gone is not tried again; dispatch will report it
+		j->prefetch_bytes = h->result == HINT_GONE ? 0 : h->size;
+	}
+	free_req(r);
+	outstanding = 0;
+	prefetch_scan();         // Jobs that came in line meanwhile
+}
+
+static void ttfb_add(TTFB_KIND kind, uint64_t ns) {
+	struct ttfb_stats *s = &ttfb[kind];
+	__atomic_fetch_add(&s->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->total_ns, ns, __ATOMIC_RELAXED);
+	uint64_t max = __atomic_load_n(&s->max_ns, __ATOMIC_RELAXED);
+	while (ns > max && !__atomic_compare_exchange_n(&s->max_ns, &max, ns, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+void prefetch_first_byte(JOB *j, int fd, uint64_t dispatched_ns) {
+	if (!prefetch_active || !ttfb) return;
+
+	char buf[4096];          // The first stage then finds this block cached
+	if (pread(fd, buf, sizeof(buf), 0) < 0) return;
+	ttfb_add(j->prefetched ? TTFB_PREFETCHED : TTFB_COLD, state_clock_ns() - dispatched_ns);
+}
+
+int prefetch_ttfb_kind(JOB *j) {
+	return prefetch_active && ttfb ? (j->prefetched ? TTFB_PREFETCHED : TTFB_COLD) : -1;
+}
+
+void prefetch_ttfb(int kind, uint64_t ns) {
+	if (kind >= 0 && ttfb) ttfb_add(kind, ns);
+}
+
+void prefetch_stats(struct ttfb_stats out[TTFB_KINDS], uint64_t *n_hinted, uint64_t *n_bytes, size_t *flight) {
+	for (int k=0; k<TTFB_KINDS; k++) {
+		out[k].count = ttfb ? __atomic_load_n(&ttfb[k].count, __ATOMIC_RELAXED) : 0;
+		out[k].total_ns = ttfb ? __atomic_load_n(&ttfb[k].total_ns, __ATOMIC_RELAXED) : 0;
+		out[k].max_ns = ttfb ? __atomic_load_n(&ttfb[k].max_ns, __ATOMIC_RELAXED) : 0;
+	}
+	pthread_mutex_lock(&mu);
+	*n_hinted = hinted;
+	*n_bytes = hinted_bytes;
+	pthread_mutex_unlock(&mu);
+	*flight = in_flight();
+}
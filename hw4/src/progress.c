@@ -0,0 +1,153 @@
+#define _GNU_SOURCE             // splice()
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "progress.h"
+
+int progress_relay_on = 0, progress_stall = PROGRESS_STALL;
+
+static struct shared {          // Counted by pipeline masters and the mover thread (atomic)
+	uint64_t in, out;
+	uint64_t moved_ns;      // When a byte was last counted
+} *shared;                      // MAX_JOBS of them, shared with the masters forked after it is mapped
+
+static struct track {           // Spooler side
+	int started;
+	int id;                 // Job it was started for
+	int fd;                 // Duplicate of its input; -1 once it is done
+	int out_known;
+	uint64_t total;
+	uint64_t start_ns, end_ns;
+	uint64_t in, out, seen_ns;      // As last sampled, and when bytes were last seen moving
+	uint64_t base_ns, base_in, base_out;      // Start of the current rate interval
+	double in_rate, out_rate;
+} track[MAX_JOBS];
+
+void progress_start(JOB *j, int fd_file) {
+	int slot = j - jobs;
+	if (!shared) {
+		void *m = mmap(NULL, MAX_JOBS * sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		shared = m == MAP_FAILED ? NULL : m;
+	}
+	if (shared) {
+		__atomic_store_n(&shared[slot].in, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&shared[slot].out, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&shared[slot].moved_ns, 0, __ATOMIC_RELAXED);
+	}
+
+	struct track *t = &track[slot];
+	if (t->started && t->fd >= 0) close(t->fd);      // Never finished: cannot happen, but do not leak it
+	struct stat sb;
+	uint64_t now = state_clock_ns();
+	*t = (struct track){ .started = 1, .id = j->id, .fd = fcntl(fd_file, F_DUPFD_CLOEXEC, 0), .out_known = progress_relay_on && shared,
+		.total = fstat(fd_file, &sb) == 0 ? sb.st_size : 0, .start_ns = now, .seen_ns = now, .base_ns = now };
+}
+
+static void refresh(struct track *t, int slot, uint64_t now) {
+	uint64_t in = 0, out = 0, moved = 0;
+	if (shared) {
+		in = __atomic_load_n(&shared[slot].in, __ATOMIC_RELAXED);
+		out = __atomic_load_n(&shared[slot].out, __ATOMIC_RELAXED);
+		moved = __atomic_load_n(&shared[slot].moved_ns, __ATOMIC_RELAXED);
+	}
+	off_t pos = t->fd >= 0 ? lseek(t->fd, 0, SEEK_CUR) : -1;      // The mover reads by offset: its count is in shared instead
+	if (pos > 0 && (uint64_t)pos > in) in = pos;
+
+	if (in != t->in) t->seen_ns = now;       // Sometime since the last sample; the output side knows exactly
+	if (moved > t->seen_ns) t->seen_ns = moved;
+	if (out) t->out_known = 1;
+	t->in = in;
+	t->out = out;
+
+	double dt = (now - t->base_ns) / 1e9;
+	if (dt > 0 && (dt >= PROGRESS_RATE_SEC || t->base_ns == t->start_ns)) {      // Until the first interval ends: since the start
+		t->in_rate = (in - t->base_in) / dt;
+		t->out_rate = (out - t->base_out) / dt;
+	}
+	if (dt >= PROGRESS_RATE_SEC) {
+		t->base_ns = now;
+		t->base_in = in;
+		t->base_out = out;
+	}
+}
+
+void progress_job_done(JOB *j) {
+	int slot = j - jobs;
+	struct track *t = &track[slot];
+	if (!t->started || t->id != j->id || t->fd < 0) return;
+
+	uint64_t now = state_clock_ns();
+	refresh(t, slot, now);
+	close(t->fd);
+	t->fd = -1;
+	t->end_ns = now;
+	double secs = (now - t->start_ns) / 1e9;       // Over the whole run, from now on
+	t->in_rate = secs > 0 ? t->in / secs : 0;
+	t->out_rate = secs > 0 ? t->out / secs : 0;
+}
+
+int progress_relay(JOB *j, int in, int out) {
+	struct shared *s = shared ? &shared[j - jobs] : NULL;
+	static char buf[PROGRESS_CHUNK];
+	int use_rw = 0;
+
+	for (;;) {
+		ssize_t n;
+		if (!use_rw) {
+			n = splice(in, NULL, out, NULL, PROGRESS_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (n < 0 && errno == EINVAL) {         // Not a kind of descriptor splice() takes
+				use_rw = 1;
+				continue;
+			}
+		} else {
+			n = read(in, buf, sizeof(buf));
+			for (ssize_t off = 0; n > 0 && off < n; ) {
+				ssize_t w = write(out, buf + off, n - off);
+				if (w < 0 && errno == EINTR) continue;
+				if (w <= 0) return -1;
+				off += w;
+			}
+		}
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return n < 0 ? -1 : 0;
+		if (s) {
+			__atomic_fetch_add(&s->out, n, __ATOMIC_RELAXED);
+			__atomic_store_n(&s->moved_ns, state_clock_ns(), __ATOMIC_RELAXED);
+		}
+	}
+}
+
+void progress_moved(int slot, uint64_t in, uint64_t out) {
+	if (!shared) return;
+	if (in) __atomic_fetch_add(&shared[slot].in, in, __ATOMIC_RELAXED);
+	if (out) __atomic_fetch_add(&shared[slot].out, out, __ATOMIC_RELAXED);
+	__atomic_store_n(&shared[slot].moved_ns, state_clock_ns(), __ATOMIC_RELAXED);
+}
+
+int progress_sample(JOB *j, struct job_progress *p) {
+	int slot = j - jobs;
+	struct track *t = &track[slot];
+	if (!t->started || t->id != j->id) return -1;
+
+	uint64_t now = t->fd >= 0 ? state_clock_ns() : t->end_ns;
+	if (t->fd >= 0) refresh(t, slot, now);
+	*p = (struct job_progress){ t->in, t->total, t->out, t->out_known, t->in_rate, t->out_rate, -1,
+		(now - t->seen_ns) / 1e9, (now - t->start_ns) / 1e9, 0 };
+	if (t->fd < 0) p->eta = 0;
+	else if (t->total && t->in < t->total && t->in_rate > 0) p->eta = (t->total - t->in) / t->in_rate;      // Once read, the rest is conversion and printing
+	p->stalled = j->status == JOB_RUNNING && p->idle >= progress_stall;
+	return 0;
+}
+
+int progress_stalled_jobs(void) {
+	int n = 0;
+	struct job_progress p;
+	JOB_SET running = jobs_in[JOB_RUNNING];
+	FOR_EACH_JOB(i, &running)
+		n += progress_sample(&jobs[i], &p) == 0 && p.stalled;
+	return n;
+}
@@ -3,6 +3,17 @@
 #include <unistd.h>
 #include <time.h>
 #include "state.h"
+#include "events.h"
+#include "trace.h"
+#include "ctl.h"
+#include "stage.h"
+#include "dedup.h"
+#include "prefetch.h"
+#include "mover.h"
+#include "launcher.h"
+#include "overflow.h"
+#include "classes.h"
+#include "workers.h"
 
 
 static void sigchld_hdl(int sig) {
@@ -10,7 +21,17 @@ static void sigchld_hdl(int sig) {
 	sigchld_flag = 1;
 }
 
-// Installing SIGCHLD handler
+static void sigio_hdl(int sig) {
+	(void)sig;
+	sigio_flag = 1;
+}
+
+static void sigalrm_hdl(int sig) {
+	(void)sig;
+	sigalrm_flag = 1;
+}
+
+// Installing SIGCHLD, SIGIO (control socket) and SIGALRM (printer retry) handlers
 
 void install_sig_handlers(void) {
 	struct sigaction sa = {0};
@@ -18,6 +39,41 @@ void install_sig_handlers(void) {
 	sa.sa_flags = SA_RESTART;
 	sigemptyset(&sa.sa_mask);
 	sigaction(SIGCHLD, &sa, NULL);
+	sa.sa_handler = sigio_hdl;
+	sigaction(SIGIO, &sa, NULL);
+	sa.sa_handler = sigalrm_hdl;
+	sigaction(SIGALRM, &sa, NULL);
+}
+
+// Job state transitions for status changes of a job's master process
+
+void job_stopped(JOB *j) {
+	job_set_status(j, JOB_PAUSED);
+	ev_job_status(j, JOB_PAUSED);
+}
+
+void job_continued(JOB *j) {
+	job_set_status(j, JOB_RUNNING);
+	ev_job_status(j, JOB_RUNNING);
+}
+
+void job_exited(JOB *j, int status) {
+	PRINTER *p = j->printer;
+
+	j->finish_time = state_now();
+	printer_release(p, j);
+	worker_job_done(j, WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+		class_job_finished(j);
+		job_set_status(j, JOB_FINISHED);
+		ev_job_status(j, JOB_FINISHED);
+		ev_job_finished(j, status);
+	} else {
+		job_set_status(j, JOB_ABORTED);
+		ev_job_status(j, JOB_ABORTED);
+		ev_job_aborted(j, status);
+	}
 }
 
 static void reap_children(void) {         // Reap all child status changes and update jobs, printers
@@ -29,50 +85,27 @@ static void reap_children(void) {         // Reap all child status changes and u
 	sigprocmask(SIG_BLOCK, &block, &old);
 
 	int status;
-	pid_t pid;
-
-	while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
 
-		for (size_t i = 0; i<n_jobs; i++) {
-			JOB *j = &jobs[i];
-
-			if (getpgid(pid) != j->pgid) continue;
-
-			PRINTER *p = j->printer;
+	// Only the job masters and the worker instances are waited for: a launcher's system() waits for its own child
+	JOB_SET started = job_set_of(1u << JOB_RUNNING | 1u << JOB_PAUSED);
+	FOR_EACH_JOB(i, &started) {
+		JOB *j = &jobs[i];
 
+		while (j->pgid > 0 && (j->status == JOB_RUNNING || j->status == JOB_PAUSED)
+		       && waitpid(j->pgid, &status, WNOHANG | WUNTRACED | WCONTINUED) == j->pgid) {
 			if (WIFSTOPPED(status)) {
-
-				j->status = JOB_PAUSED;
-				sf_job_status(j->id, JOB_PAUSED);
-
+				trace_child('S', j, status);
+				job_stopped(j);
 			} else if (WIFCONTINUED(status)) {
-
-				j->status = JOB_RUNNING;
-				sf_job_status(j->id, JOB_RUNNING);
-
+				trace_child('R', j, status);
+				job_continued(j);
 			} else {
-
-				j->finish_time = time(NULL);
-				p->status = PRINTER_IDLE;
-				sf_printer_status(p->name, PRINTER_IDLE);
-
-				if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-
-					j->status = JOB_FINISHED;
-					sf_job_status (j->id, JOB_FINISHED);
-					sf_job_finished(j->id, status);
-
-
-				} else {
-
-					j->status = JOB_ABORTED;
-					sf_job_status(j->id, JOB_ABORTED);
-					sf_job_aborted(j->id, status);
-
-				}
+				trace_child('X', j, status);
+				job_exited(j, status);
 			}
 		}
 	}
+	workers_reap();
 
 	delete_old_jobs();
 	try_dispatch();
@@ -80,8 +113,24 @@ static void reap_children(void) {         // Reap all child status changes and u
 }
 
 void sig_hook(void) {
-	if (!sigchld_flag) return;
+	if (sigchld_flag) {
+		sigchld_flag = 0;
+		reap_children();
+	}
+	if (sigalrm_flag) {      // A refused printer, or a finished job due to make room for a carried one
+		sigalrm_flag = 0;
+		delete_old_jobs();
+		printers_retry();
+	}
 
-	sigchld_flag = 0;
-	reap_children();
+	// Collect finished snapshots, dedup verdicts, readahead hints, launches and transfers, serve the control socket, and flush any
+	// events the reaping produced for subscribers
+	sigio_flag = 0;
+	stage_poll();
+	dedup_poll();
+	prefetch_poll();
+	launcher_poll();
+	mover_poll();
+	overflow_poll();
+	ctl_poll();
 }
\ No newline at end of file
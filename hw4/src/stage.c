@@ -0,0 +1,220 @@
+#define _GNU_SOURCE             // O_TMPFILE, copy_file_range()
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include "stage.h"
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+struct stage_req {
+	struct stage_req *next;
+	int id;
+	STAGE_METHOD method;
+	char *src, *dst;
+};
+
+int stage_active = 0;
+
+static char stage_dir[4096];
+static pthread_t stager;
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cv = PTHREAD_COND_INITIALIZER;
+static struct stage_req *todo, **todo_tail = &todo, *done;    // done is in reverse order
+static int stager_stop;
+static uint64_t counts[STAGE_METHODS], copied;                   // Under mu
+static int pending;                                              // Main thread only
+
+// Snapshot methods, run on the stager thread
+
+static int copy_fd(int in, int out, uint64_t *bytes) {
+	ssize_t n;
+	while ((n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0)) > 0) *bytes += n;
+	if (n == 0) return 0;
+	if (errno != ENOSYS && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP) return -1;
+
+	char buf[65536];          // No in-kernel copy between these files
+	while ((n = read(in, buf, sizeof(buf))) > 0) {
+		for (ssize_t off = 0, w; off < n; off += w)
+			if ((w = write(out, buf + off, n - off)) < 0) return -1;
+		*bytes += n;
+	}
+	return n < 0 ? -1 : 0;
+}
+
+static int link_fd(int fd, const char *dst) {      // Give an open file (or O_TMPFILE) the name dst
+	char proc[64];
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+	return linkat(AT_FDCWD, proc, AT_FDCWD, dst, AT_SYMLINK_FOLLOW);
+}
+
+static STAGE_METHOD snapshot(const char *src, const char *dst, uint64_t *bytes) {
+	int in = open(src, O_RDONLY);
+	if (in < 0) return STAGE_FAILED;
+	unlink(dst);
+
+	int out = open(dst, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (out >= 0) {
+		int cloned = ioctl(out, FICLONE, in) == 0;
+		close(out);
+		if (cloned) {
+			close(in);
+			return STAGE_CLONE;
+		}
+		unlink(dst);
+	}
+
+	// Link the inode we opened, not whatever the path names by now
+	if (link_fd(in, dst) == 0 || linkat(AT_FDCWD, src, AT_FDCWD, dst, 0) == 0) {
+		close(in);
+		return STAGE_LINK;
+	}
+
+	STAGE_METHOD m = STAGE_FAILED;
+	if ((out = open(stage_dir, O_TMPFILE | O_WRONLY, 0644)) >= 0) {
+		if (copy_fd(in, out, bytes) == 0 && link_fd(out, dst) == 0) m = STAGE_COPY;
+		close(out);
+	} else {
+		char tmp[4200];         // No O_TMPFILE here: copy under a temporary name
+		snprintf(tmp, sizeof(tmp), "%s.tmp", dst);
+		if ((out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+			if (copy_fd(in, out, bytes) == 0 && close(out) == 0 && rename(tmp, dst) == 0) m = STAGE_COPY;
+			else close(out);
+			if (m != STAGE_COPY) unlink(tmp);
+		}
+	}
+	close(in);
+	return m;
+}
+
+static void *stage_loop(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&mu);
+	for (;;) {
+		while (!todo && !stager_stop) pthread_cond_wait(&work_cv, &mu);
+		if (!todo) break;                // Stopping, with the queue drained
+
+		struct stage_req *r = todo;
+		if (!(todo = r->next)) todo_tail = &todo;
+		pthread_mutex_unlock(&mu);
+
+		uint64_t bytes = 0;
+		r->method = snapshot(r->src, r->dst, &bytes);
+
+		pthread_mutex_lock(&mu);
+		counts[r->method]++;
+		copied += bytes;
+		r->next = done;
+		done = r;
+		kill(getpid(), SIGIO);           // Picked up by stage_poll() from sig_hook()
+	}
+	pthread_mutex_unlock(&mu);
+	return NULL;
+}
+
+// Main thread side
+
+int stage_open(const char *dir) {
+	if (stage_active || strlen(dir) >= sizeof(stage_dir)) return -1;
+	mkdir(dir, 0755);
+	struct stat sb;
+	if (stat(dir, &sb) < 0 || !S_ISDIR(sb.st_mode)) return -1;
+	strcpy(stage_dir, dir);
+
+	stager_stop = 0;
+	if (state_thread(&stager, stage_loop, NULL) != 0) return -1;
+
+	stage_active = 1;
+	return 0;
+}
+
+void stage_close(void) {        // Finishes the snapshots already queued
+	if (!stage_active) return;
+	pthread_mutex_lock(&mu);
+	stager_stop = 1;
+	pthread_cond_signal(&work_cv);
+	pthread_mutex_unlock(&mu);
+	pthread_join(stager, NULL);
+
+	stage_poll();
+	stage_active = 0;
+}
+
+void stage_job(JOB *j) {
+	if (!stage_active || sim_mode) return;
+
+	struct stage_req *r = calloc(1, sizeof(*r));
+	const char *base = strrchr(j->file_name, '/');
+	const char *ext = strrchr(base ? base : j->file_name, '.');
+	char dst[4200];
+	snprintf(dst, sizeof(dst), "%s/job%d%s", stage_dir, j->id, ext ? ext : "");
+	if (!r || !(r->src = strdup(j->file_name)) || !(r->dst = strdup(dst))) {
+		if (r) free(r->src);
+		free(r);
+		return;             // The job reads the original
+	}
+	r->id = j->id;
+	j->staging = 1;
+	pending++;
+
+	pthread_mutex_lock(&mu);
+	*todo_tail = r;
+	todo_tail = &r->next;
+	pthread_cond_signal(&work_cv);
+	pthread_mutex_unlock(&mu);
+}
+
+void stage_poll(void) {
+	if (!stage_active) return;
+
+	pthread_mutex_lock(&mu);
+	struct stage_req *r = done;
+	done = NULL;
+	pthread_mutex_unlock(&mu);
+	if (!r) return;
+
+	while (r) {
+		struct stage_req *next = r->next;
+		JOB *j = lookup_job(r->id);
+
+		if (j && j->staging) {
+			j->staging = 0;
+			if (r->method != STAGE_FAILED) {
+				j->spool_file = r->dst;
+				r->dst = NULL;
+			}
+		} else if (r->method != STAGE_FAILED) {
+			unlink(r->dst);         // The job is already gone
+		}
+		pending--;
+		free(r->src);
+		free(r->dst);
+		free(r);
+		r = next;
+	}
+	try_dispatch();
+}
+
+void stage_release(JOB *j) {
+	j->staging = 0;
+	if (!j->spool_file) return;
+	unlink(j->spool_file);
+	free(j->spool_file);
+	j->spool_file = NULL;
+}
+
+void stage_stats(uint64_t count[STAGE_METHODS], uint64_t *bytes_copied, int *queued) {
+	pthread_mutex_lock(&mu);
+	memcpy(count, counts, sizeof(counts));
+	*bytes_copied = copied;
+	pthread_mutex_unlock(&mu);
+	*queued = pending;
+}
@@ -4,22 +4,66 @@
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <time.h>
+#include <signal.h>
+#include <sys/syscall.h>
 #include "state.h"
+#include "events.h"
+#include "trace.h"
+#include "stage.h"
+#include "prefetch.h"
+#include "mover.h"
+#include "launcher.h"
+#include "placement.h"
+#include "overflow.h"
+#include "classes.h"
+#include "deadline.h"
+#include "tenants.h"
+#include "plugins.h"
+#include "workers.h"
+#include "dedup.h"
+#include "progress.h"
+#include "journal.h"
 
 int initialised=0;
 
 size_t n_types;
 FILE_TYPE *types [MAX_TYPES];
+CONVERSION *conversions[MAX_CONVERSIONS];
+size_t n_conversions;
+
+static CONVERSION **path_cache[MAX_TYPES][MAX_TYPES];
+static char path_known[MAX_TYPES][MAX_TYPES];
 PRINTER printers[MAX_PRINTERS];
 size_t n_printers;
 JOB jobs[MAX_JOBS];
 size_t n_jobs;
 int next_job_id;
+JOB_SET jobs_in[JOB_STATUSES];
+static FILE_TYPE *job_type[MAX_JOBS];      // Resolved at submission, so dispatch does not compare names
+static int slot_of[MAX_JOBS];              // Slot of the last job given each id modulo MAX_JOBS
+
+sig_atomic_t sigchld_flag=0, sigalrm_flag=0;
+
+int sim_mode = 0;
+time_t sim_time;
+
+time_t state_now(void) {
+	return sim_mode ? sim_time : time(NULL);
+}
 
-sig_atomic_t sigchld_flag=0;
+uint64_t state_clock_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
 
-static time_t now(void) {
-	return time(NULL);
+int state_thread(pthread_t *t, void *(*fn)(void *), void *arg) {
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int rc = pthread_create(t, NULL, fn, arg);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return rc;
 }
 
 void state_init(void) {
@@ -29,6 +73,8 @@ void state_init(void) {
 	memset(types, 0, sizeof(types));
 	memset(printers, 0, sizeof(printers));
 	memset(jobs, 0, sizeof(jobs));
+	memset(jobs_in, 0, sizeof(jobs_in));
+	memset(slot_of, -1, sizeof(slot_of));
 	next_job_id = 0;
 	initialised = 1;
 }
@@ -60,6 +106,52 @@ PRINTER *lookup_printer(const char *name) {
 	return NULL;
 }
 
+// Conversions are kept here as well as in the library, which cannot list them
+
+static void forget_paths(void) {
+	for (int f=0; f<MAX_TYPES; f++)
+		for (int t=0; t<MAX_TYPES; t++) {
+			free(path_cache[f][t]);
+			path_cache[f][t] = NULL;
+		}
+	memset(path_known, 0, sizeof(path_known));
+}
+
+int add_conversion(const char *from, const char *to, char **cmd_and_args) {
+	if (!lookup_type(from) || !lookup_type(to)) return -1;
+	if (cmd_and_args && cmd_and_args[0] && plugin_load(cmd_and_args[0]) < 0) return -1;      // Loaded here, never in a pipeline master
+	if (worker_define(cmd_and_args) < 0) return -1;
+	CONVERSION *c = define_conversion((char *)from, (char *)to, cmd_and_args);
+	if (!c) return -1;
+
+	size_t i = 0;
+	while (i < n_conversions && conversions[i] != c) i++;      // Redefinition updates the same edge
+	if (i == n_conversions && n_conversions < MAX_CONVERSIONS) conversions[n_conversions++] = c;
+	forget_paths();
+	return 0;
+}
+
+CONVERSION **conversion_path(FILE_TYPE *from, FILE_TYPE *to) {
+	int f = from->index, t = to->index;
+	if (f < 0 || f >= MAX_TYPES || t < 0 || t >= MAX_TYPES) return NULL;
+	if (!path_known[f][t]) {
+		path_cache[f][t] = find_conversion_path(from->name, to->name);
+		path_known[f][t] = 1;
+	}
+	return path_cache[f][t];
+}
+
+void set_conversion_path(FILE_TYPE *from, FILE_TYPE *to, CONVERSION **path) {
+	int f = from->index, t = to->index;
+	if (f < 0 || f >= MAX_TYPES || t < 0 || t >= MAX_TYPES) {
+		free(path);
+		return;
+	}
+	free(path_cache[f][t]);
+	path_cache[f][t] = path;
+	path_known[f][t] = 1;
+}
+
 int add_printer(const char *name, const char *type) {
 	if (lookup_printer(name) || n_printers == MAX_PRINTERS) return -1;
 	PRINTER *p = &printers[n_printers++];
@@ -69,56 +161,200 @@ int add_printer(const char *name, const char *type) {
 	p->name = strdup(name);
 	p->type = strdup(type);
 	p->status = PRINTER_DISABLED;
-	sf_printer_defined(p->name, p->type);
+	p->slots = 1;
+	ev_printer_defined(p);
+	return 0;
+}
+
+int set_printer_slots(PRINTER *p, int slots) {
+	if (slots < 1 || slots > PRINTER_MAX_SLOTS || slots < p->busy + p->launching) return -1;
+	for (int s=slots, free=0; s<p->slots; s++) {      // Jobs still running above the new count move down
+		if (!p->slot[s].job) continue;
+		while (p->slot[free].job) free++;
+		p->slot[free] = p->slot[s];
+		p->slot[s] = (struct printer_slot){ NULL, 0 };
+	}
+	p->slots = slots;
 	return 0;
 }
 
+int printer_free_slots(PRINTER *p) {
+	if (p->status == PRINTER_DISABLED || p->refused) return 0;
+	return p->slots - p->busy - p->launching;
+}
+
+static int printer_take(PRINTER *p, JOB *j, pid_t pgid) {     // -1 if every slot is running a job
+	int s = 0;
+	while (s < p->slots && p->slot[s].job) s++;
+	if (s == p->slots) return -1;
+	p->slot[s] = (struct printer_slot){ j, pgid };
+	if (p->busy++ == 0) {
+		p->status = PRINTER_BUSY;
+		ev_printer_status(p, PRINTER_BUSY);
+	}
+	return 0;
+}
+
+static void printer_refused(PRINTER *p) {
+	if (p->busy + p->launching > 0) {         // It serves fewer connections than it has slots: use fewer
+		set_printer_slots(p, p->busy + p->launching);
+		return;
+	}
+	p->refused = 1;          // Its backlog is still full of connections we are done with
+	alarm(PRINTER_RETRY_SEC);
+}
+
+void printers_retry(void) {
+	for (size_t i=0; i<n_printers; i++) printers[i].refused = 0;
+	try_dispatch();
+}
+
+void printer_release(PRINTER *p, JOB *j) {
+	for (int s=0; s<p->slots; s++) {
+		if (p->slot[s].job != j) continue;
+		p->slot[s] = (struct printer_slot){ NULL, 0 };
+		if (--p->busy == 0) {
+			p->status = PRINTER_IDLE;
+			ev_printer_status(p, PRINTER_IDLE);
+		}
+		return;
+	}
+}
+
+// Per-status job sets
+
+void job_set_status(JOB *j, JOB_STATUS status) {
+	int slot = j - jobs;
+	uint64_t bit = 1ull << (slot % 64);
+	jobs_in[j->status].w[slot / 64] &= ~bit;
+	jobs_in[status].w[slot / 64] |= bit;
+	if (j->klass && status != JOB_CREATED) class_job_left(j);
+	if (j->deadline) deadline_job_status(j, status);
+	if (j->tenant && status != JOB_CREATED) tenant_job_left(j);
+	if (status == JOB_FINISHED || status == JOB_ABORTED) progress_job_done(j);
+	j->status = status;
+}
+
+JOB_SET job_set_of(unsigned mask) {
+	JOB_SET u = {{0}};
+	for (int s=0; s<JOB_STATUSES; s++)
+		if (mask & (1u << s))
+			for (int w=0; w<JOB_SET_WORDS; w++) u.w[w] |= jobs_in[s].w[w];
+	return u;
+}
+
 // Helper functions for getting a free slot, reading/writing into job array
 static int get_free_slot(void) {
-	for (size_t i=0; i<MAX_JOBS; i++) {
-		if (jobs[i].file_name == NULL || jobs[i].status == JOB_DELETED) return (int)i;
+	JOB_SET used = job_set_of(JOB_LIVE);
+	for (int w=0; w<JOB_SET_WORDS; w++) {
+		if (~used.w[w] == 0) continue;
+		int slot = w * 64 + __builtin_ctzll(~used.w[w]);
+		return slot < MAX_JOBS ? slot : -1;
 	}
 
 	return -1;
 }
 
 JOB *lookup_job (int id) {
-	for (size_t i=0; i<n_jobs; i++) {
-		if (jobs[i].id == id && jobs[i].status != JOB_DELETED) return &jobs[i];
+	int hint = slot_of[(unsigned)id % MAX_JOBS];      // Ids are handed out in sequence, so this is nearly always it
+	if (hint >= 0 && jobs[hint].id == id && jobs[hint].file_name && jobs[hint].status != JOB_DELETED) return &jobs[hint];
+
+	JOB_SET live = job_set_of(JOB_LIVE);
+	FOR_EACH_JOB(i, &live) {
+		if (jobs[i].id == id) return &jobs[i];
 	}
 
 	return NULL;
 }
 
-int add_job(const char *file, const char *type, uint32_t eligible) {
-	int slot = get_free_slot();
-	if (slot < 0) return -1;
+void job_attrs_of(JOB *j, struct job_attrs *a) {
+	*a = (struct job_attrs){ j->klass ? j->klass->name : "", j->tenant ? j->tenant->name : "", j->deadline, j->copies };
+}
+
+static void set_job_attrs(JOB *j, const struct job_attrs *a) {      // Before the job is announced, so that the journal has them
+	j->copies = a && a->copies > 0 ? a->copies : 1;
+	if (!a) return;
+	PRINTER_CLASS *c = a->klass && *a->klass ? lookup_class(a->klass) : NULL;
+	if (c) class_add_job(c, j);
+	if (a->deadline) deadline_set(j, a->deadline);
+	if (a->tenant && *a->tenant) tenant_queue_job(tenant_get(a->tenant), j);
+}
+
+int add_job(const char *file, const char *type, uint32_t eligible, const struct job_attrs *a) {
+	int slot = overflow_pending() ? -1 : get_free_slot();      // Nothing overtakes the jobs on disk
+	if (slot < 0) return overflow_spill(file, type, eligible, a);
 	JOB *j = &jobs[slot];
+	job_set_status(j, JOB_CREATED);      // Out of the deleted set first: JOB_CREATED is 0, so it survives the memset
 	memset(j, 0, sizeof(*j));
 
 	j->id = next_job_id++;
 	j->file_name = strdup(file);
 	j->file_type = strdup(type);
 	j->eligible = eligible;
-	j->status = JOB_CREATED;
-	j->creation_time = now();
+	j->creation_time = state_now();
+	job_type[slot] = lookup_type(type);
+	if (n_tenants) tenant_job_queued(j);
+	slot_of[(unsigned)j->id % MAX_JOBS] = slot;
 
 	if ((size_t)(slot+1) > n_jobs) n_jobs = slot+1;
 
-	sf_job_created(j->id, j->file_name, j->file_type);
+	set_job_attrs(j, a);
+	stage_job(j);
+	dedup_job_added(j);
+	ev_job_created(j);
 	return j->id;
 }
 
+int restore_job(int id, const char *file, const char *type, uint32_t eligible, time_t created, const struct job_attrs *a) {     // Requeue a recovered job under its old id
+	if (lookup_job(id)) return -1;
+	int slot = get_free_slot();
+	if (slot < 0) return -1;
+	JOB *j = &jobs[slot];
+	job_set_status(j, JOB_CREATED);      // Out of the deleted set first: JOB_CREATED is 0, so it survives the memset
+	memset(j, 0, sizeof(*j));
+
+	j->id = id;
+	j->file_name = strdup(file);
+	j->file_type = strdup(type);
+	j->eligible = eligible;
+	j->creation_time = created;
+	job_type[slot] = lookup_type(type);
+	slot_of[(unsigned)j->id % MAX_JOBS] = slot;
+	if (id >= next_job_id) next_job_id = id + 1;
+
+	if ((size_t)(slot+1) > n_jobs) n_jobs = slot+1;
+
+	set_job_attrs(j, a);
+	stage_job(j);
+	ev_job_created(j);
+	return id;
+}
+
+int free_job_slots(void) {
+	JOB_SET used = job_set_of(JOB_LIVE);
+	int n = MAX_JOBS;
+	for (int w=0; w<JOB_SET_WORDS; w++) n -= __builtin_popcountll(used.w[w]);
+	return n;
+}
+
 void delete_old_jobs(void) {
-	time_t t = now();
+	time_t t = state_now();
+	JOB_SET done = job_set_of(1u << JOB_FINISHED | 1u << JOB_ABORTED);
 
-	for (size_t i=0; i<n_jobs; i++) {
+	int deleted = 0;
+	FOR_EACH_JOB(i, &done) {
 		JOB *j = &jobs[i];
-		if ((j->status == JOB_FINISHED || j->status == JOB_ABORTED) && t - j->finish_time>=10) {
-			j->status = JOB_DELETED;
-			sf_job_deleted(j->id);
+		if (t - j->finish_time>=JOB_RETAIN) {
+			job_set_status(j, JOB_DELETED);
+			stage_release(j);
+			ev_job_deleted(j);
+			deleted++;
 		}
 	}
+	if (deleted) {           // Room for jobs waiting on disk: recovered ones first, they are older
+		journal_refill();
+		overflow_refill();
+	}
 }
 
 // Helper function to build a command list for a given path of conversion
@@ -143,58 +379,115 @@ static char **build_cmd_list(CONVERSION **path) {
 
 // Using master process for conversion pipeline
 
-static void master_wait_loop(void) {
-	int status, rc = 0;
+static void master_wait_loop(int rc) {
+	int status;
 	while (wait(&status)>0) {  // Reaping all the child processes of multi-step conversion
 		if (WIFSIGNALED(status) || (WIFEXITED(status) && WEXITSTATUS(status) != 0)) rc = 1; // Detect any failure
 	}
+	if (plugin_stages_wait()) rc = 1;
+	if (worker_stages_wait()) rc = 1;
 	_exit(rc);
 }
 
-static void build_and_exec_pipeline(JOB *j, PRINTER *p, CONVERSION **path) {
-	int fd_file = open(j->file_name, O_RDONLY);
-	int fd_prn = presi_connect_to_printer(p->name, p->type, PRINTER_NORMAL);
+static void job_launched(JOB *j, PRINTER *p, CONVERSION **path, pid_t m) {
+	j->pgid = m;
+	j->printer = p;
+	job_set_status(j, JOB_RUNNING);
+	j->start_time = state_now();
+	printer_take(p, j, m);
+	class_job_started(j, p);
+	if (n_tenants) tenant_job_started(j);
+
+	char **cmds = build_cmd_list(path);
+	ev_job_status(j, JOB_RUNNING);
+	ev_job_started(j, p, cmds);
+	trace_dispatch(j, p);
+
+	free(cmds);
+}
+
+static void close_other_fds(int *keep, int n) {     // In a pipeline master: keep stdio and keep[0..n-1], sorted here
+	for (int i=1; i<n; i++)
+		for (int k=i; k>0 && keep[k-1] > keep[k]; k--) {
+			int t = keep[k];
+			keep[k] = keep[k-1];
+			keep[k-1] = t;
+		}
+	unsigned from = 3;
+	for (int k=0; k<=n; k++) {
+		unsigned to = k < n ? (unsigned)keep[k] : ~0u;
+		if (from < to && syscall(SYS_close_range, from, to - 1, 0) < 0) {
+			mover_forked();          // Before Linux 5.9: the mover's at least
+			return;
+		}
+		if (k < n) from = to + 1;
+	}
+}
 
+static void start_pipeline(JOB *j, PRINTER *p, CONVERSION **path, int fd_file, int fd_prn) {
+	uint64_t dispatched = state_clock_ns();
+
+	if (fd_prn == PRINTER_REFUSED || (fd_prn >= 0 && p->busy >= p->slots)) {      // Not an error: the job waits for the printer to take it
+		if (fd_prn >= 0) close(fd_prn);          // Every launch holds a slot, but never run two jobs in one
+		else printer_refused(p);
+		if (fd_file >= 0) close(fd_file);
+		return;
+	}
 	if (fd_file<0 || fd_prn<0) {
 		if (fd_file >= 0) close(fd_file);
 		if (fd_prn >= 0) close(fd_prn);
-		j->status = JOB_ABORTED;
-		j->finish_time = now();
-		sf_job_status(j->id, JOB_ABORTED);
-		sf_job_aborted(j->id, 1);
+		job_set_status(j, JOB_ABORTED);
+		j->finish_time = state_now();
+		ev_job_status(j, JOB_ABORTED);
+		ev_job_aborted(j, 1);
+		return;
+	}
+	progress_start(j, fd_file);
+
+	if (path == NULL && mover_start(j, fd_file, fd_prn, dispatched) == 0) {     // No conversion: no processes either
+		job_launched(j, p, path, 0);
 		return;
 	}
 
 	if (path == NULL) {                // Fastening the process of executing the job when no type conversion is required
-		j->status = JOB_RUNNING;
-		sf_printer_status(p->name, PRINTER_BUSY);
+		job_set_status(j, JOB_RUNNING);
+		printer_take(p, j, 0);
 		char *cmds[] = {"cat", NULL};
-		sf_job_started(j->id, p->name, 0, cmds);
+		ev_job_started(j, p, cmds);
+		trace_dispatch(j, p);
 
+		prefetch_first_byte(j, fd_file, dispatched);
 		char buf[4096];
 		ssize_t n;
 		while ((n = read(fd_file, buf, sizeof(buf))) > 0) {
 			write(fd_prn, buf, n);
+			progress_moved(j - jobs, 0, n);      // The input side is the file offset
 		}
 
 		close(fd_file);
 		close(fd_prn);
 
-		p->status = PRINTER_IDLE;
-		sf_printer_status(p->name, PRINTER_IDLE);
+		printer_release(p, j);
+		trace_child('X', j, 0);          // As a master or the mover would report it, for replay
 
-		j->status = JOB_FINISHED;
-		j->finish_time = now();
-		sf_job_status(j->id, JOB_FINISHED);
-		sf_job_finished(j->id, 0);
+		job_set_status(j, JOB_FINISHED);
+		j->finish_time = state_now();
+		ev_job_status(j, JOB_FINISHED);
+		ev_job_finished(j, 0);
 
 		try_dispatch();
 		return;
 	}
 
+	int stages = 0;
+	while (path[stages]) stages++;
+	placement_choose(j, p, stages);
+	int wfd[MAX_TYPES];
+	int leased = worker_lease(j, path, wfd);
 	pid_t m = fork();
 
 	if (m<0) {
+		worker_job_done(j, 1);
 		close(fd_file);
 		close(fd_prn);
 		return;
@@ -202,7 +495,14 @@ static void build_and_exec_pipeline(JOB *j, PRINTER *p, CONVERSION **path) {
 
 	if (m==0) {
 		setpgid(0,0);
-
+		int keep[MAX_TYPES + 2] = { fd_file, fd_prn }, n_keep = 2;
+		for (int i=0; leased && i<stages; i++)
+			if (wfd[i] >= 0) keep[n_keep++] = wfd[i];
+		close_other_fds(keep, n_keep);       // Other jobs' printers must see end-of-file when their data ends
+		placement_apply(j, p);
+		prefetch_first_byte(j, fd_file, dispatched);
+
+		int relay[2] = {-1, -1};
 		if (!path || !path[0]) {
 			pid_t c = fork();
 			if (c == 0) {
@@ -213,16 +513,24 @@ static void build_and_exec_pipeline(JOB *j, PRINTER *p, CONVERSION **path) {
 			}
 		} else {
 			int in_fd = fd_file;
+			if (progress_relay_on && pipe(relay) == 0) {       // The last stage writes to us, and we count what goes to the printer
+				fcntl(relay[0], F_SETFD, FD_CLOEXEC);
+				fcntl(relay[1], F_SETFD, FD_CLOEXEC);
+			}
+			int to_prn = relay[1] >= 0 ? relay[1] : fd_prn;
 
 			for (size_t idx=0; path[idx]; idx++) {
 				int fds[2] = {-1, -1};
 				int last = path[idx+1] == NULL;
 				if (!last && pipe(fds) == -1) _exit(127);
 
-				pid_t c = fork();
-				if (c==0) {
+				if (plugin_stage(path[idx])) {       // A thread of ours, with its own copies of the two ends
+					if (plugin_stage_start(path[idx], in_fd, last ? to_prn : fds[1]) < 0) _exit(127);
+				} else if (worker_stage(path[idx])) {        // Likewise, pumping through the leased instance
+					if (worker_stage_start(path[idx], wfd[idx], in_fd, last ? to_prn : fds[1]) < 0) _exit(127);
+				} else if (fork() == 0) {
 					dup2(in_fd, STDIN_FILENO);
-					dup2(last ? fd_prn : fds[1], STDOUT_FILENO);
+					dup2(last ? to_prn : fds[1], STDOUT_FILENO);
 					if (in_fd != fd_file) close(in_fd);
 					if (!last) {
 						close(fds[0]);
@@ -236,55 +544,173 @@ static void build_and_exec_pipeline(JOB *j, PRINTER *p, CONVERSION **path) {
 				in_fd = last ? -1 : fds[0];
 			}
 			if (in_fd != -1 && in_fd != fd_file) close(in_fd);
+			if (relay[1] >= 0) close(relay[1]);
 		}
 
 		close(fd_file);
+		int rc = relay[0] >= 0 && progress_relay(j, relay[0], fd_prn) < 0;
+		if (relay[0] >= 0) close(relay[0]);      // A stage still writing gets SIGPIPE
 		close(fd_prn);
-		master_wait_loop();
+		master_wait_loop(rc);
 	}
 
+	close(fd_file);    // The master and its stages hold their own copies; keeping ours
+	close(fd_prn);     // would stop the printer from ever seeing end-of-file
 	setpgid(m, m);
-	j->pgid = m;
-	j->printer = p;
-	j->status = JOB_RUNNING;
-	j->start_time = now();
+	job_launched(j, p, path, m);
+}
+
+static void build_and_exec_pipeline(JOB *j, PRINTER *p, CONVERSION **path) {
+	if (sim_mode) {                    // Replaying a trace: no files, printers or processes
+		job_launched(j, p, path, 0);
+		sim_launched(j);
+		return;
+	}
+	if (launch_job(j, p) == 0) return;      // Opened and connected by a launcher, then start_job()
 
-	p->status = PRINTER_BUSY;
-	p->pgid = m;
-	sf_printer_status(p->name, PRINTER_BUSY);
+	int fd_file = open(j->spool_file ? j->spool_file : j->file_name, O_RDONLY);
+	int fd_prn = fd_file < 0 ? -1 : printer_connect(p->name, p->type, PRINTER_NORMAL, 0);      // Never sleeps: a printer still starting refuses, and is retried
+	start_pipeline(j, p, path, fd_file, fd_prn);
+}
 
-	char **cmds = build_cmd_list(path);
-	sf_job_status (j->id, JOB_RUNNING);
-	sf_job_started(j->id, p->name, (int)m, cmds);
+void start_job(JOB *j, PRINTER *p, int fd_file, int fd_prn) {
+	FILE_TYPE *from = job_type[j - jobs] ? job_type[j - jobs] : lookup_type(j->file_type), *to = lookup_type(p->type);
+	CONVERSION **path = NULL;      // Looked up again: a conversion defined meanwhile frees the cached path
 
-	free(cmds);
+	if (j->status != JOB_CREATED || !from || !to || (from != to && !(path = conversion_path(from, to)))) {
+		if (fd_file >= 0) close(fd_file);      // Cancelled, or no longer reachable: it waits for another printer
+		if (fd_prn >= 0) close(fd_prn);
+		return;
+	}
+	start_pipeline(j, p, path, fd_file, fd_prn);
+}
+
+int job_signal(JOB *j, int sig) {      // Signal a job's process group, or its simulation
+	if (sim_mode) return sim_signal(j, sig);
+	if (j->moving) return mover_signal(j, sig);
+	return killpg(j->pgid, sig);
+}
+
+// Job control requests, shared by the command line and the control socket
+
+int job_pause(JOB *j) {
+	if (j->status != JOB_RUNNING) return -1;
+	return job_signal(j, SIGSTOP);
+}
+
+int job_resume(JOB *j) {
+	if (j->status != JOB_PAUSED) return -1;
+	return job_signal(j, SIGCONT);
+}
+
+int job_cancel(JOB *j) {
+
+	if (j->status == JOB_CREATED) {
+		job_set_status(j, JOB_ABORTED);
+		j->finish_time = state_now();
+		ev_job_status(j, JOB_ABORTED);
+		ev_job_aborted(j, 0);
+		return 0;
+	}
+
+	if (j->status == JOB_RUNNING || j->status == JOB_PAUSED) {
+		job_signal(j, SIGTERM);
+		if (j->status == JOB_PAUSED) job_signal(j, SIGCONT);
+		return 0;
+	}
+	return -1;
 }
 
-void try_dispatch(void) {
-	for (size_t ji=0; ji<n_jobs; ji++) {
-		JOB *j = &jobs[ji];
+static int dispatch_job(int ji, uint32_t *idle, FILE_TYPE *to[]) {     // Start a waiting job if a printer it can use has a free slot; 1 if started
+	JOB *j = &jobs[ji];
 
-		if (j->status != JOB_CREATED) continue;
+	if (j->status != JOB_CREATED || j->staging || j->launching || j->deduping) return 0;
+	FILE_TYPE *from = job_type[ji] ? job_type[ji] : lookup_type(j->file_type);
+	if (!from) return 0;
 
-		for (size_t pi=0; pi<n_printers; pi++) {
-			PRINTER *p = &printers[pi];
+	uint32_t ok = 0;         // Printers that can take it; without a class, the first one will do
+	for (uint32_t can = (j->klass ? j->klass->members : j->eligible) & *idle; can; can &= can - 1) {
+		int pi = __builtin_ctz(can);
 
-			if (p->status != PRINTER_IDLE) continue;
-			if (!(j->eligible & (1u<<p->id))) continue;
+		if (printer_free_slots(&printers[pi]) <= 0) {       // Taken by a pass started from the one below
+			*idle &= ~(1u << pi);
+			continue;
+		}
+		if (from != to[pi] && !conversion_path(from, to[pi])) continue;
+		ok |= 1u << pi;
+		if (!j->klass && !(j->deadline && deadline_edf)) break;
+	}
+	if (!ok) return 0;
 
-			FILE_TYPE *from = lookup_type(j->file_type);
-			FILE_TYPE *to = lookup_type(p->type);
-			if (!from || !to) continue;
+	int pi = j->deadline && deadline_edf ? deadline_pick(j, ok, from, to) : j->klass ? class_pick(j->klass, ok) : __builtin_ctz(ok);
+	PRINTER *p = &printers[pi];
+	build_and_exec_pipeline(j, p, from != to[pi] ? conversion_path(from, to[pi]) : NULL);
+	if (printer_free_slots(p) <= 0) *idle &= ~(1u << pi);
+	return 1;
+}
 
-			CONVERSION **path = NULL;
-			if (strcmp(j->file_type, p->type) != 0) {
-				path = find_conversion_path(j->file_type, p->type);
-				if (!path) continue;
+static void fair_dispatch(uint32_t *idle, FILE_TYPE *to[], const JOB_SET *skip) {     // Deficit round robin over the tenants' queues
+	JOB_SET queue[MAX_TENANTS];
+	int in_flight[MAX_TENANTS];
+	tenant_queues(queue, in_flight, skip);
+
+	for (size_t idle_turns = 0; *idle && idle_turns < n_tenants; ) {
+		size_t k = tenant_turn % n_tenants;
+		TENANT *t = &tenants[k];
+		int started = 0;
+
+		if (t->deficit < 1) t->deficit = t->weight;      // Its turn starts
+		FOR_EACH_JOB(ji, &queue[k]) {
+			if (t->deficit < 1 || !*idle || (t->cap && in_flight[k] >= t->cap)) break;
+			queue[k].w[ji / 64] &= ~(1ull << (ji % 64));      // Tried once per pass
+			if (dispatch_job(ji, idle, to)) {
+				t->deficit--;
+				in_flight[k]++;
+				started++;
 			}
+		}
+		if (t->deficit >= 1 && !*idle && job_set_next(&queue[k], 0) >= 0) break;      // Keeps the turn for the next pass
+		t->deficit = 0;          // The turn passes on; no credit is saved up
+		tenant_turn = k + 1;
+		idle_turns = started ? 0 : idle_turns + 1;
+	}
+}
 
-			build_and_exec_pipeline(j, p, path);
-			if (path) free(path);
-			return;
+void try_dispatch(void) {     // One pass: each waiting job takes the first printer with a free slot it can use, or its class's pick; with tenants, in their turns
+	uint32_t idle = 0;             // Printers of a known type with a free slot, by id
+	FILE_TYPE *to[MAX_PRINTERS];
+	for (size_t pi=0; pi<n_printers; pi++)
+		if (printer_free_slots(&printers[pi]) > 0 && (to[pi] = lookup_type(printers[pi].type)))
+			idle |= 1u << pi;
+
+	int order[MAX_JOBS], n_late = 0, n_timed = 0;
+	if (job_set_next(&deadline_waiting, 0) >= 0)
+		n_timed = deadline_order(order, &n_late);      // Also flags the jobs that cannot make it
+	for (int i=0; i<n_timed && idle && deadline_edf; i++)
+		dispatch_job(order[i], &idle, to);
+
+	if (n_tenants) {
+		JOB_SET skip = {{0}};
+		if (deadline_edf) skip = deadline_waiting;
+		fair_dispatch(&idle, to, &skip);
+	} else {
+		JOB_SET waiting = jobs_in[JOB_CREATED];     // Plain and class jobs alike, under EDF those with no deadline
+		if (deadline_edf)
+			for (int w=0; w<JOB_SET_WORDS; w++) waiting.w[w] &= ~deadline_waiting.w[w];
+		int fifo[MAX_JOBS], n = 0;
+		FOR_EACH_JOB(ji, &waiting) {      // In submission order, so neither kind starves the other
+			int k = n++;
+			for (; k > 0 && jobs[fifo[k-1]].id > jobs[ji].id; k--) fifo[k] = fifo[k-1];
+			fifo[k] = ji;
+		}
+		for (int i=0; i<n && idle; i++) {
+			PRINTER_CLASS *c = jobs[fifo[i]].klass;
+			if (c && !(c->members & idle)) continue;      // No member free
+			dispatch_job(fifo[i], &idle, to);
 		}
 	}
-}
\ No newline at end of file
+
+	for (int i=n_timed; i<n_timed+n_late && idle && deadline_edf; i++)      // Late jobs last
+		dispatch_job(order[i], &idle, to);
+	prefetch_scan();         // Whatever is still waiting is next in line
+}
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tenants.h"
+
+TENANT tenants[MAX_TENANTS];
+size_t n_tenants = 0;
+JOB_SET tenant_waiting;
+size_t tenant_turn = 0;
+
+static uint64_t queued_ns[MAX_JOBS];             // By job slot; 0 if queued before there were tenants
+static float waits[MAX_TENANTS][TENANT_SAMPLES];  // Milliseconds, a ring per tenant
+
+static TENANT *new_tenant(const char *name) {
+	if (n_tenants == MAX_TENANTS || !(name = strdup(name))) return NULL;
+	TENANT *t = &tenants[n_tenants++];
+	memset(t, 0, sizeof(*t));
+	t->name = (char *)name;
+	t->weight = 1;
+	return t;
+}
+
+TENANT *lookup_tenant(const char *name) {
+	for (size_t i=0; i<n_tenants; i++)
+		if (!strcmp(tenants[i].name, name)) return &tenants[i];
+	return NULL;
+}
+
+TENANT *tenant_get(const char *name) {
+	if (!*name || strlen(name) > TENANT_NAME_MAX) return NULL;
+	if (!n_tenants && !new_tenant("default")) return NULL;
+	TENANT *t = lookup_tenant(name);
+	return t ? t : new_tenant(name);
+}
+
+int set_tenant(TENANT *t, int weight, int cap, int queue) {
+	if (weight < 1 || weight > TENANT_WEIGHT_MAX || cap < 0 || queue < 0) return -1;
+	t->weight = weight;
+	t->cap = cap;
+	t->queue = queue;
+	if (t->deficit > weight) t->deficit = weight;
+	try_dispatch();          // A raised cap may let waiting jobs go
+	return 0;
+}
+
+// Queues
+
+static int index_of(JOB *j) {      // Of the job's tenant
+	return j->tenant ? j->tenant - tenants : 0;
+}
+
+int tenant_full(TENANT *t) {
+	if (!n_tenants) return 0;
+	if (!t) t = &tenants[0];
+	if (!t->queue) return 0;
+
+	int held = 0;
+	JOB_SET live = job_set_of((1u << JOB_CREATED) | (1u << JOB_RUNNING) | (1u << JOB_PAUSED));
+	FOR_EACH_JOB(i, &live)
+		held += &tenants[index_of(&jobs[i])] == t;
+	if (held < t->queue) return 0;
+	t->refused++;
+	return 1;
+}
+
+void tenant_submitted(TENANT *t) {
+	if (!n_tenants) return;
+	(t ? t : &tenants[0])->submitted++;
+}
+
+void tenant_queue_job(TENANT *t, JOB *j) {
+	if (!t || j->status != JOB_CREATED || t == &tenants[0]) return;      // "default" holds whatever no other tenant does
+	int slot = j - jobs;
+	j->tenant = t;
+	t->waiting.w[slot / 64] |= 1ull << (slot % 64);
+	tenant_waiting.w[slot / 64] |= 1ull << (slot % 64);
+}
+
+void tenant_job_left(JOB *j) {
+	int slot = j - jobs;
+	uint64_t bit = 1ull << (slot % 64);
+	j->tenant->waiting.w[slot / 64] &= ~bit;
+	tenant_waiting.w[slot / 64] &= ~bit;
+}
+
+void tenant_job_queued(JOB *j) {
+	queued_ns[j - jobs] = state_clock_ns();
+}
+
+void tenant_job_started(JOB *j) {
+	int slot = j - jobs;
+	TENANT *t = &tenants[index_of(j)];
+	double ms = queued_ns[slot] ? (state_clock_ns() - queued_ns[slot]) / 1e6 : (state_now() - j->creation_time) * 1e3;
+	waits[t - tenants][t->started++ % TENANT_SAMPLES] = ms;
+	queued_ns[slot] = 0;
+}
+
+void tenant_queues(JOB_SET queue[MAX_TENANTS], int in_flight[MAX_TENANTS], const JOB_SET *skip) {
+	for (size_t t=0; t<n_tenants; t++) {
+		queue[t] = tenants[t].waiting;
+		in_flight[t] = 0;
+	}
+	for (int w=0; w<JOB_SET_WORDS; w++) {
+		queue[0].w[w] = jobs_in[JOB_CREATED].w[w] & ~tenant_waiting.w[w];
+		for (size_t t=0; t<n_tenants; t++) queue[t].w[w] &= ~skip->w[w];
+	}
+
+	JOB_SET live = job_set_of((1u << JOB_CREATED) | (1u << JOB_RUNNING) | (1u << JOB_PAUSED));
+	FOR_EACH_JOB(i, &live)
+		if (jobs[i].status != JOB_CREATED || jobs[i].launching) in_flight[index_of(&jobs[i])]++;
+}
+
+// Reporting
+
+static int cmp_float(const void *a, const void *b) {
+	float x = *(const float *)a, y = *(const float *)b;
+	return (x > y) - (x < y);
+}
+
+void tenant_stats(TENANT *t, struct tenant_stats *s) {
+	int k = t - tenants;
+	JOB_SET queue[MAX_TENANTS], none = {{0}};
+	int in_flight[MAX_TENANTS];
+	tenant_queues(queue, in_flight, &none);
+	s->waiting = 0;
+	for (int w=0; w<JOB_SET_WORDS; w++) s->waiting += __builtin_popcountll(queue[k].w[w]);
+	s->in_flight = in_flight[k];
+
+	int n = t->started < TENANT_SAMPLES ? (int)t->started : TENANT_SAMPLES;
+	float v[TENANT_SAMPLES];
+	memcpy(v, waits[k], n * sizeof(*v));
+	qsort(v, n, sizeof(*v), cmp_float);
+	s->wait_p50 = n ? v[(n-1)/2] : 0;
+	s->wait_p99 = n ? v[(int)((n-1)*0.99)] : 0;
+	s->wait_max = n ? v[n-1] : 0;
+}
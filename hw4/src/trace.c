@@ -0,0 +1,318 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "trace.h"
+#include "cli.h"
+
+static FILE *trace_file;
+static struct timeval trace_t0;
+
+// Recording
+
+static long long trace_us(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec - trace_t0.tv_sec) * 1000000LL + (tv.tv_usec - trace_t0.tv_usec);
+}
+
+int trace_open(const char *path) {
+	if (sim_mode) return -1;
+	trace_close();
+	if (!(trace_file = fopen(path, "w"))) return -1;
+	setvbuf(trace_file, NULL, _IOLBF, 0);    // Keep the trace useful after a crash
+	gettimeofday(&trace_t0, NULL);
+	fprintf(trace_file, "# presi trace 1\n");
+	return 0;
+}
+
+void trace_close(void) {
+	if (!trace_file) return;
+	fclose(trace_file);
+	trace_file = NULL;
+}
+
+static char *untraced[] = { "trace", "replay", "control", "watch", "journal", "save-config", NULL };     // Not replayable
+
+void trace_command(const char *line) {
+	if (!trace_file) return;
+	line += strspn(line, " \t");
+	size_t w = strcspn(line, " \t");
+	if (w == 0) return;
+	for (char **c = untraced; *c; c++)
+		if (strlen(*c) == w && !strncmp(line, *c, w)) return;
+	fprintf(trace_file, "C %lld %s\n", trace_us(), line);
+}
+
+void trace_dispatch(JOB *j, PRINTER *p) {
+	if (!trace_file) return;
+	fprintf(trace_file, "D %lld %d %s\n", trace_us(), j->id, p->name);
+}
+
+void trace_child(char kind, JOB *j, int status) {
+	if (!trace_file) return;
+	if (kind == 'X') fprintf(trace_file, "X %lld %d %d\n", trace_us(), j->id, status);
+	else fprintf(trace_file, "%c %lld %d\n", kind, trace_us(), j->id);
+}
+
+// Replay
+
+struct trace_cmd {
+	long long t;
+	char *line;
+};
+
+struct trace_job {            // What the trace says about one job id, and what replay did with it
+	long long dispatched, exited, stopped, paused;
+	int status;
+	char printer[32];
+	long long run;            // Active run time, or -1 if it never ended on its own
+	long long created_r, started_r, finished_r;
+	char printer_r[32];
+};
+
+static struct trace_cmd *cmds;
+static size_t n_cmds;
+static struct trace_job *tjobs;
+static int n_tjobs;
+
+static long long sim_now;                   // Virtual time, us since the start of the replay
+static time_t sim_base;
+static long long sim_done_at[MAX_JOBS];     // Virtual completion time per slot, -1 if none
+static long long sim_left[MAX_JOBS];        // Remaining run time of a paused job, -1 if unbounded
+static int sim_reap;                        // A simulated child changed state
+static FILE *sim_report;
+
+static struct trace_job *tjob(int id) {
+	if (id < 0) return NULL;
+	if (id >= n_tjobs) {
+		int n = n_tjobs ? n_tjobs : 64;
+		while (n <= id) n *= 2;
+		tjobs = realloc(tjobs, n * sizeof(*tjobs));
+		for (int i=n_tjobs; i<n; i++) {
+			memset(&tjobs[i], 0, sizeof(tjobs[i]));
+			tjobs[i].dispatched = tjobs[i].exited = tjobs[i].stopped = -1;
+			tjobs[i].created_r = tjobs[i].started_r = tjobs[i].finished_r = -1;
+		}
+		n_tjobs = n;
+	}
+	return &tjobs[id];
+}
+
+static int load_trace(const char *path) {
+	FILE *f = fopen(path, "r");
+	if (!f) return -1;
+
+	char *line = NULL;
+	size_t cap = 0, cmd_cap = 0;
+	ssize_t len;
+	while ((len = getline(&line, &cap, f)) >= 0) {
+		if (len > 0 && line[len-1] == '\n') line[len-1] = '\0';
+		char kind;
+		long long t;
+		int id, status, off;
+		if (sscanf(line, "%c %lld %n", &kind, &t, &off) < 2) continue;
+
+		struct trace_job *tj;
+		if (kind == 'C') {
+			if (n_cmds == cmd_cap) {
+				cmd_cap = cmd_cap ? 2*cmd_cap : 256;
+				cmds = realloc(cmds, cmd_cap * sizeof(*cmds));
+			}
+			cmds[n_cmds].t = t;
+			cmds[n_cmds++].line = strdup(line + off);
+		} else if (kind == 'D' && sscanf(line + off, "%d", &id) == 1 && (tj = tjob(id))) {
+			tj->dispatched = t;
+			sscanf(line + off, "%*d %31s", tj->printer);
+		} else if (kind == 'S' && sscanf(line + off, "%d", &id) == 1 && (tj = tjob(id))) {
+			tj->stopped = t;
+		} else if (kind == 'R' && sscanf(line + off, "%d", &id) == 1 && (tj = tjob(id))) {
+			if (tj->stopped >= 0) tj->paused += t - tj->stopped;
+			tj->stopped = -1;
+		} else if (kind == 'X' && sscanf(line + off, "%d %d", &id, &status) == 2 && (tj = tjob(id))) {
+			tj->exited = t;
+			tj->status = status;
+		}
+	}
+	free(line);
+	fclose(f);
+
+	for (int i=0; i<n_tjobs; i++) {            // Jobs cancelled in the trace have no natural end
+		struct trace_job *tj = &tjobs[i];
+		int cancelled = WIFSIGNALED(tj->status) && WTERMSIG(tj->status) == SIGTERM;
+		tj->run = (tj->dispatched >= 0 && tj->exited >= 0 && !cancelled)
+			? tj->exited - tj->dispatched - tj->paused : -1;
+	}
+	return 0;
+}
+
+static void free_trace(void) {
+	for (size_t i=0; i<n_cmds; i++) free(cmds[i].line);
+	free(cmds);
+	free(tjobs);
+	cmds = NULL;
+	tjobs = NULL;
+	n_cmds = 0;
+	n_tjobs = 0;
+}
+
+void sim_launched(JOB *j) {
+	int slot = j - jobs;
+	struct trace_job *tj = tjob(j->id);
+	long long run = tj ? tj->run : -1;
+
+	sim_done_at[slot] = run >= 0 ? sim_now + run : -1;
+	if (tj) {
+		tj->started_r = sim_now;
+		snprintf(tj->printer_r, sizeof(tj->printer_r), "%s", j->printer->name);
+	}
+	fprintf(sim_report, "DISPATCH %10.3f job %d -> %s%s\n", sim_now / 1e3, j->id, j->printer->name,
+		tj && tj->printer[0] && strcmp(tj->printer, j->printer->name) ? " (traced elsewhere)" : "");
+}
+
+int sim_signal(JOB *j, int sig) {
+	int slot = j - jobs;
+
+	if (sig == SIGSTOP && j->status == JOB_RUNNING) {
+		sim_left[slot] = sim_done_at[slot] >= 0 ? sim_done_at[slot] - sim_now : -1;
+		sim_done_at[slot] = -1;
+		job_stopped(j);
+	} else if (sig == SIGCONT && j->status == JOB_PAUSED) {
+		sim_done_at[slot] = sim_left[slot] >= 0 ? sim_now + sim_left[slot] : -1;
+		job_continued(j);
+	} else if (sig == SIGTERM && (j->status == JOB_RUNNING || j->status == JOB_PAUSED)) {
+		sim_done_at[slot] = -1;
+		struct trace_job *tj = tjob(j->id);
+		if (tj) tj->finished_r = sim_now;
+		job_exited(j, SIGTERM);
+		sim_reap = 1;
+	}
+	return 0;
+}
+
+static void sim_advance(long long t, int realtime) {
+	if (realtime && t > sim_now) {
+		struct timespec ts = { (t - sim_now) / 1000000, (t - sim_now) % 1000000 * 1000 };
+		nanosleep(&ts, NULL);
+	}
+	sim_now = t;
+	sim_time = sim_base + t / 1000000;
+}
+
+static int cmp_ll(const void *a, const void *b) {
+	long long x = *(const long long *)a, y = *(const long long *)b;
+	return (x > y) - (x < y);
+}
+
+static void report_latency(char *what, long long *v, int n) {
+	qsort(v, n, sizeof(*v), cmp_ll);
+	if (n == 0) {
+		fprintf(sim_report, "%-10s n=0\n", what);
+		return;
+	}
+	fprintf(sim_report, "%-10s n=%d p50=%.3fms p99=%.3fms max=%.3fms\n", what, n,
+		v[(n-1)/2] / 1e3, v[(int)((n-1)*0.99)] / 1e3, v[n-1] / 1e3);
+}
+
+static void replay_report(struct timespec *wall0) {
+	long long *wait = malloc((n_tjobs + 1) * sizeof(long long));
+	long long *turn = malloc((n_tjobs + 1) * sizeof(long long));
+	int nw = 0, nt = 0, created = 0, moved = 0;
+	long long makespan = 0;
+
+	for (int i=0; i<n_tjobs; i++) {
+		struct trace_job *tj = &tjobs[i];
+		if (tj->created_r < 0) continue;
+		created++;
+		if (tj->started_r >= 0) wait[nw++] = tj->started_r - tj->created_r;
+		if (tj->finished_r >= 0) {
+			turn[nt++] = tj->finished_r - tj->created_r;
+			if (tj->finished_r > makespan) makespan = tj->finished_r;
+		}
+		if (tj->printer[0] && tj->printer_r[0] && strcmp(tj->printer, tj->printer_r)) moved++;
+	}
+
+	struct timespec wall1;
+	clock_gettime(CLOCK_MONOTONIC, &wall1);
+	double wall = (wall1.tv_sec - wall0->tv_sec) + (wall1.tv_nsec - wall0->tv_nsec) / 1e9;
+
+	fprintf(sim_report, "REPLAY commands=%zu jobs=%d dispatched=%d finished=%d moved=%d\n",
+		n_cmds, created, nw, nt, moved);
+	report_latency("wait", wait, nw);
+	report_latency("turnaround", turn, nt);
+	fprintf(sim_report, "makespan=%.3fs replayed in %.3fs\n", makespan / 1e6, wall);
+	free(wait);
+	free(turn);
+}
+
+int replay_trace(const char *path, int realtime, const char *report, FILE *out) {
+	if (sim_mode || trace_file) return -1;
+	if (load_trace(path) < 0) return -1;
+	sim_report = report ? fopen(report, "w") : out;
+	if (!sim_report) {
+		free_trace();
+		return -1;
+	}
+
+	struct timespec wall0;
+	clock_gettime(CLOCK_MONOTONIC, &wall0);
+	for (int i=0; i<MAX_JOBS; i++) sim_done_at[i] = -1;
+	sim_base = time(NULL);
+	sim_now = 0;
+	sim_time = sim_base;
+	sim_mode = 1;
+
+	size_t ci = 0;
+	for (;;) {
+		long long tc = LLONG_MAX;
+		int slot = -1;
+		FOR_EACH_JOB(i, &jobs_in[JOB_RUNNING]) {
+			if (sim_done_at[i] >= 0 && sim_done_at[i] < tc) {
+				tc = sim_done_at[i];
+				slot = i;
+			}
+		}
+		long long tcmd = ci < n_cmds ? cmds[ci].t : LLONG_MAX;
+		if (slot < 0 && ci == n_cmds) break;
+
+		if (slot >= 0 && tc <= tcmd) {           // A simulated child exits
+			JOB *j = &jobs[slot];
+			struct trace_job *tj = tjob(j->id);
+			sim_advance(tc, realtime);
+			sim_done_at[slot] = -1;
+			if (tj) tj->finished_r = sim_now;
+			job_exited(j, tj ? tj->status : 0);
+			sim_reap = 1;
+		} else {                                 // The next recorded command
+			char *line = cmds[ci++].line;
+			size_t w = strcspn(line, " \t");
+			sim_advance(tcmd, realtime);
+			if (w == 4 && !strncmp(line, "quit", 4)) continue;
+
+			int first = next_job_id;
+			char *copy = strdup(line);
+			cli_exec(copy, out);
+			free(copy);
+			for (int id=first; id<next_job_id; id++) {
+				struct trace_job *tj = tjob(id);
+				if (tj) tj->created_r = sim_now;
+			}
+		}
+
+		if (sim_reap) {
+			sim_reap = 0;
+			delete_old_jobs();
+			try_dispatch();
+		}
+	}
+
+	sim_mode = 0;
+	replay_report(&wall0);
+	if (report) fclose(sim_report);
+	sim_report = NULL;
+	free_trace();
+	return 0;
+}
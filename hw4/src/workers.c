@@ -0,0 +1,337 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "workers.h"
+
+#define MAX_POOLS    32
+#define POOL_ENTRIES (2 * WORKER_MAX_LIMIT)      // Live instances, and stopped ones not reaped yet
+
+int worker_max = WORKER_MAX, worker_recycle = WORKER_RECYCLE;
+
+struct worker {
+	pid_t pid;              // 0: free entry
+	int fd;                 // Our end of its socket; -1 once stopped
+	int job;                // Slot of the job it is leased to, or -1
+	int jobs;               // Served so far
+};
+
+static struct pool {
+	char **cmd;             // As in the conversion, "worker:" included
+	char **argv;            // To exec: cmd with the prefix stripped
+	struct worker w[POOL_ENTRIES];
+	uint64_t spawned, leases, cold, recycled, failed;
+} pools[MAX_POOLS];
+static int n_pools = 0;
+
+static JOB_SET leasing;         // Jobs holding instances
+
+static int is_worker(const char *cmd) {
+	return !strncmp(cmd, PRESI_WORKER_PREFIX, strlen(PRESI_WORKER_PREFIX));
+}
+
+static struct pool *find_pool(char **cmd) {
+	for (int i=0; i<n_pools; i++) {
+		char **a = pools[i].cmd, **b = cmd;
+		while (*a && *b && !strcmp(*a, *b)) a++, b++;
+		if (!*a && !*b) return &pools[i];
+	}
+	return NULL;
+}
+
+static void exec_worker(char **argv, int sock) {      // In a new child: the socket as stdin and stdout, nothing else
+	dup2(sock, STDIN_FILENO);
+	dup2(sock, STDOUT_FILENO);
+	syscall(SYS_close_range, 3, ~0u, 0);
+	execvp(argv[0], argv);
+	_exit(127);
+}
+
+// Pools, in the spooler
+
+static int live(struct pool *p, int idle_only) {
+	int n = 0;
+	for (int i=0; i<POOL_ENTRIES; i++)
+		n += p->w[i].pid && p->w[i].fd >= 0 && (!idle_only || p->w[i].job < 0);
+	return n;
+}
+
+static struct worker *spawn(struct pool *p) {
+	struct worker *w = NULL;
+	for (int i=0; i<POOL_ENTRIES && !w; i++)
+		if (!p->w[i].pid) w = &p->w[i];
+	int sv[2];
+	if (!w || socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) return NULL;
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		setpgid(0, 0);           // Out of the spooler's group: terminal signals are not for it
+		exec_worker(p->argv, sv[1]);
+	}
+	close(sv[1]);
+	if (pid < 0) {
+		close(sv[0]);
+		return NULL;
+	}
+	fcntl(sv[0], F_SETFD, FD_CLOEXEC);       // Kept by a pipeline master that leases it, but never by its commands
+	*w = (struct worker){ pid, sv[0], -1, 0 };
+	p->spawned++;
+	return w;
+}
+
+static void stop(struct worker *w) {      // Reaped later by workers_reap()
+	kill(w->pid, SIGTERM);
+	close(w->fd);
+	w->fd = -1;
+}
+
+int worker_define(char **cmd_and_args) {
+	if (!cmd_and_args || !cmd_and_args[0] || !is_worker(cmd_and_args[0])) return 0;
+	if (find_pool(cmd_and_args)) return 0;
+	if (n_pools == MAX_POOLS || !cmd_and_args[0][strlen(PRESI_WORKER_PREFIX)]) return -1;
+
+	int argc = 0;
+	while (cmd_and_args[argc]) argc++;
+	struct pool *p = &pools[n_pools];
+	memset(p, 0, sizeof(*p));
+	p->cmd = calloc(argc + 1, sizeof(char *));
+	p->argv = calloc(argc + 1, sizeof(char *));
+	if (!p->cmd || !p->argv) {
+		free(p->cmd);
+		free(p->argv);
+		return -1;
+	}
+	for (int i=0; i<argc; i++) {
+		p->cmd[i] = strdup(cmd_and_args[i]);
+		p->argv[i] = i ? p->cmd[i] : p->cmd[0] + strlen(PRESI_WORKER_PREFIX);
+	}
+	n_pools++;
+	spawn(p);                // One warm from the start
+	return 0;
+}
+
+int worker_stage(CONVERSION *c) {
+	return is_worker(c->cmd_and_args[0]);
+}
+
+static int waiting_jobs(void) {
+	int n = 0;
+	for (int w=0; w<JOB_SET_WORDS; w++) n += __builtin_popcountll(jobs_in[JOB_CREATED].w[w]);
+	return n;
+}
+
+int worker_lease(JOB *j, CONVERSION **path, int fd[]) {
+	int slot = j - jobs, n = 0;
+
+	for (int i=0; path[i]; i++) {
+		fd[i] = -1;
+		struct pool *p = worker_stage(path[i]) ? find_pool(path[i]->cmd_and_args) : NULL;
+		if (!p) continue;
+
+		struct worker *w = NULL;
+		for (int k=0; k<POOL_ENTRIES && !w; k++)
+			if (p->w[k].pid && p->w[k].fd >= 0 && p->w[k].job < 0) w = &p->w[k];
+		if (!w && live(p, 0) < worker_max) w = spawn(p);
+		if (!w) {                // The master starts one of its own
+			p->cold++;
+			continue;
+		}
+		w->job = slot;
+		fd[i] = w->fd;
+		p->leases++;
+		n++;
+		if (!live(p, 1) && waiting_jobs() > 1 && live(p, 0) < worker_max) spawn(p);      // A spare for the jobs behind this one
+	}
+	if (n) leasing.w[slot / 64] |= 1ull << (slot % 64);
+	return n;
+}
+
+void worker_job_done(JOB *j, int ok) {
+	int slot = j - jobs;
+	uint64_t bit = 1ull << (slot % 64);
+	if (!(leasing.w[slot / 64] & bit)) return;
+	leasing.w[slot / 64] &= ~bit;
+
+	int waiting = waiting_jobs();
+	for (int i=0; i<n_pools; i++) {
+		struct pool *p = &pools[i];
+		for (int k=0; k<POOL_ENTRIES; k++) {
+			struct worker *w = &p->w[k];
+			if (!w->pid || w->fd < 0 || w->job != slot) continue;
+			w->job = -1;
+			w->jobs++;
+			if (!ok) {               // Its stream may be anywhere: start afresh
+				stop(w);
+				p->failed++;
+			} else if (w->jobs >= worker_recycle) {
+				stop(w);
+				p->recycled++;
+			} else if (live(p, 1) > waiting && live(p, 0) > 1) {     // More idle than there is work for
+				stop(w);
+			}
+		}
+	}
+}
+
+void workers_reap(void) {
+	int status;
+	for (int i=0; i<n_pools; i++)
+		for (int k=0; k<POOL_ENTRIES; k++) {
+			struct worker *w = &pools[i].w[k];
+			while (w->pid && waitpid(w->pid, &status, WNOHANG | WUNTRACED | WCONTINUED) == w->pid) {
+				if (WIFSTOPPED(status) || WIFCONTINUED(status)) continue;
+				if (w->fd >= 0) {        // Died on its own: a leased one fails its job
+					close(w->fd);
+					pools[i].failed++;
+				}
+				*w = (struct worker){ 0, -1, -1, 0 };
+			}
+		}
+}
+
+void workers_close(void) {
+	for (int i=0; i<n_pools; i++)
+		for (int k=0; k<POOL_ENTRIES; k++)
+			if (pools[i].w[k].pid && pools[i].w[k].fd >= 0) stop(&pools[i].w[k]);
+}
+
+int worker_stats(struct worker_pool_stats *s, int max) {
+	for (int i=0; i<n_pools && i<max; i++) {
+		struct pool *p = &pools[i];
+		s[i] = (struct worker_pool_stats){ p->argv[0], live(p, 0), live(p, 1), p->spawned, p->leases, p->cold, p->recycled, p->failed };
+	}
+	return n_pools;
+}
+
+// Stages, in a pipeline master
+
+struct worker_run {
+	pthread_t tid, sender;
+	int fd, in, out;
+	int own;                // Instance started for this stage alone
+	int rc, send_rc;
+};
+
+static struct worker_run runs[MAX_TYPES];
+static int n_runs = 0;
+
+static int send_all(int fd, const void *buf, size_t n) {
+	while (n) {
+		ssize_t k = send(fd, buf, n, MSG_NOSIGNAL);
+		if (k < 0 && errno == EINTR) continue;
+		if (k <= 0) return -1;
+		buf = (const char *)buf + k;
+		n -= k;
+	}
+	return 0;
+}
+
+static int read_all(int fd, void *buf, size_t n) {
+	while (n) {
+		ssize_t k = read(fd, buf, n);
+		if (k < 0 && errno == EINTR) continue;
+		if (k <= 0) return -1;
+		buf = (char *)buf + k;
+		n -= k;
+	}
+	return 0;
+}
+
+static void *send_input(void *arg) {       // The stage's input, framed, then PRESI_WF_END
+	struct worker_run *r = arg;
+	char *buf = malloc(sizeof(struct presi_wframe) + PRESI_WF_MAX);
+	ssize_t n;
+
+	r->send_rc = !buf;
+	while (buf && (n = read(r->in, buf + sizeof(struct presi_wframe), PRESI_WF_MAX)) != 0) {
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) {
+			r->send_rc = 1;
+			break;
+		}
+		struct presi_wframe h = { PRESI_WF_DATA, n };
+		memcpy(buf, &h, sizeof(h));
+		if (send_all(r->fd, buf, sizeof(h) + n) < 0) {
+			r->send_rc = 1;
+			break;
+		}
+	}
+	struct presi_wframe end = { PRESI_WF_END, 0 };
+	if (!r->send_rc && send_all(r->fd, &end, sizeof(end)) < 0) r->send_rc = 1;
+	free(buf);
+	close(r->in);
+	return NULL;
+}
+
+static void *run_stage(void *arg) {        // Sends on a second thread, so that neither side can block the other
+	struct worker_run *r = arg;
+	char *buf = malloc(PRESI_WF_MAX);
+	struct presi_wframe h;
+
+	int sending = buf && pthread_create(&r->sender, NULL, send_input, r) == 0;
+	r->rc = !sending;
+	while (!r->rc) {
+		if (read_all(r->fd, &h, sizeof(h)) < 0 || h.len > PRESI_WF_MAX || read_all(r->fd, buf, h.len) < 0) r->rc = 1;
+		else if (h.type == PRESI_WF_END) break;
+		else if (h.type != PRESI_WF_DATA) r->rc = 1;
+		else {
+			for (size_t off = 0; off < h.len && !r->rc; ) {
+				ssize_t k = write(r->out, buf + off, h.len - off);
+				if (k < 0 && errno == EINTR) continue;
+				if (k <= 0) r->rc = 1;
+				else off += k;
+			}
+		}
+	}
+	close(r->out);           // The next stage sees end of file now
+	if (r->rc) shutdown(r->fd, SHUT_RDWR);      // Unblocks the sender; the instance is stopped anyway
+	if (sending) pthread_join(r->sender, NULL);
+	r->rc |= r->send_rc;
+	free(buf);
+	if (r->own) close(r->fd);        // End of file: it exits
+	return NULL;
+}
+
+int worker_stage_start(CONVERSION *c, int fd, int in, int out) {
+	struct pool *p = find_pool(c->cmd_and_args);
+	if (!p || n_runs == MAX_TYPES) return -1;
+
+	struct worker_run *r = &runs[n_runs];
+	memset(r, 0, sizeof(*r));
+	if (fd < 0) {
+		int sv[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) return -1;
+		if (fork() == 0) exec_worker(p->argv, sv[0]);      // Reaped by master_wait_loop() with the command stages
+		close(sv[0]);
+		fcntl(sv[1], F_SETFD, FD_CLOEXEC);
+		fd = sv[1];
+		r->own = 1;
+	}
+	r->fd = fd;
+	r->in = fcntl(in, F_DUPFD_CLOEXEC, 0);        // Its own, as for plugin stages
+	r->out = fcntl(out, F_DUPFD_CLOEXEC, 0);
+	if (r->in < 0 || r->out < 0 || pthread_create(&r->tid, NULL, run_stage, r) != 0) {
+		if (r->in >= 0) close(r->in);
+		if (r->out >= 0) close(r->out);
+		if (r->own) close(fd);
+		return -1;
+	}
+	n_runs++;
+	return 0;
+}
+
+int worker_stages_wait(void) {
+	int rc = 0;
+	for (int i=0; i<n_runs; i++) {
+		pthread_join(runs[i].tid, NULL);
+		rc |= runs[i].rc != 0;
+	}
+	n_runs = 0;
+	return rc;
+}
@@ -0,0 +1,109 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "driver.h"
+#include "__helper.h"
+#include "config.h"
+#include "crc32.h"
+
+#define QUOTE1(x) #x
+#define QUOTE(x) QUOTE1(x)
+#define SCRIPT1(x) x##_script
+#define SCRIPT(x) SCRIPT1(x)
+
+#define SUITE config_suite
+
+#define CONFIG_FILE "spool/config_test.cfg"
+
+/* The event tracker remembers every type and printer it has seen defined: the run
+   that defines them before they are loaded again is made in a child */
+static void run_first(char *name, char *argv[], COMMAND *script) {
+    fflush(NULL);
+    pid_t pid = fork();
+    cr_assert(pid >= 0, "fork failed");
+    if (pid == 0) {
+        int status, err = run_test(name, argv[0], argv, script, &status);
+        _exit(err == 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1);
+    }
+    int status;
+    cr_assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0,
+        "the run before the restart failed");
+}
+
+/* Copy the saved snapshot to path with the last occurrence of from (a string in it)
+   replaced by to, of the same length, and the CRC made right again */
+static void patch_config(const char *path, const char *from, const char *to) {
+    static char buf[1 << 16];
+    int fd = open(CONFIG_FILE, O_RDONLY);
+    cr_assert(fd >= 0, "cannot open " CONFIG_FILE);
+    ssize_t size = read(fd, buf, sizeof(buf));
+    close(fd);
+    cr_assert(size >= (ssize_t)sizeof(struct config_hdr), "short snapshot");
+
+    size_t n = strlen(from) + 1;
+    char *last = NULL;
+    for (char *p = buf + sizeof(struct config_hdr); p + n <= buf + size; p++)
+        if (!memcmp(p, from, n) && (p == buf || p[-1] == '\0')) last = p;
+    cr_assert(last, "no string %s in the snapshot", from);
+    memcpy(last, to, n);
+    struct config_hdr *h = (struct config_hdr *)buf;
+    h->crc = crc32(buf + sizeof(*h), size - sizeof(*h));
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    cr_assert(fd >= 0 && write(fd, buf, size) == size, "cannot write %s", path);
+    close(fd);
+}
+
+/*---------------------------test config rejects inconsistent tables------------------*/
+/* A snapshot whose CRC is right but which names a printer type that it does not
+   define, or two printers alike, is refused without defining anything: the good
+   snapshot still loads afterwards
+*/
+#define TEST_NAME config_reject_test
+#define BAD_TYPE "spool/config_test_type.cfg"
+#define BAD_NAME "spool/config_test_name.cfg"
+static COMMAND save_script[] = {
+    // send,                                expect,                 modifiers,            timeout,  before,    after
+    {  NULL,                                INIT_EVENT,             0,                    HND_MSEC,   NULL,      NULL },
+    {  "type aaa",                          TYPE_DEFINED_EVENT,     0,                    HND_MSEC,   NULL,      NULL },
+    {  "type bbb",                          TYPE_DEFINED_EVENT,     EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "printer Cfg1 aaa",                  PRINTER_DEFINED_EVENT,  EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "printer Cfg2 bbb --slots 2",        PRINTER_DEFINED_EVENT,  EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "save-config " CONFIG_FILE,          CMD_OK_EVENT,           EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "quit",                              FINI_EVENT,             EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                                EOF_EVENT,              0,                    TEN_MSEC,   NULL,      NULL }
+};
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    {  NULL,                                INIT_EVENT,             0,                    HND_MSEC,   NULL,      NULL },
+    {  "load-config " BAD_TYPE,             CMD_ERROR_EVENT,        0,                    HND_MSEC,   NULL,      NULL },
+    {  "load-config " BAD_NAME,             CMD_ERROR_EVENT,        0,                    HND_MSEC,   NULL,      NULL },
+    {  "load-config " CONFIG_FILE,          PRINTER_DEFINED_EVENT,  EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                                PRINTER_DEFINED_EVENT,  EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                                CMD_OK_EVENT,           EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "quit",                              FINI_EVENT,             EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                                EOF_EVENT,              0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    int err, status;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    unlink(CONFIG_FILE);
+    run_first(name, argv, save_script);
+    patch_config(BAD_TYPE, "bbb", "ccc");       // Cfg2's type; the type name comes before it
+    patch_config(BAD_NAME, "Cfg2", "Cfg1");
+
+    err = run_test(name, argv[0], argv, SCRIPT(TEST_NAME), &status);
+    assert_proper_exit_status(err, status);
+}
+#undef BAD_TYPE
+#undef BAD_NAME
+#undef TEST_NAME
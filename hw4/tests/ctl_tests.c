@@ -0,0 +1,72 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "driver.h"
+#include "__helper.h"
+#include "presi_ctl.h"
+
+#define QUOTE1(x) #x
+#define QUOTE(x) QUOTE1(x)
+#define SCRIPT1(x) x##_script
+#define SCRIPT(x) SCRIPT1(x)
+
+#define SUITE ctl_suite
+
+/* Pipeline a few thousand queries, then reset the connection before reading a reply */
+static void hang_up_client(EVENT *ep, int *env, void *args) {
+    (void)ep;
+    (void)env;
+    (void)args;
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", CTL_SOCKET);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    cr_assert(fd >= 0 && connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0, "cannot connect to " CTL_SOCKET ": %s", strerror(errno));
+
+    static char buf[3000 * (sizeof(struct ctl_hdr) + sizeof(int32_t))];
+    char *p = buf;
+    for (uint32_t tag=0; tag<3000; tag++) {
+        struct ctl_hdr h = { sizeof(h) + sizeof(int32_t), CTL_QUERY, 0, tag };
+        int32_t all = -1;
+        memcpy(p, &h, sizeof(h));
+        memcpy(p + sizeof(h), &all, sizeof(all));
+        p += sizeof(h) + sizeof(all);
+    }
+    cr_assert(write(fd, buf, p - buf) == p - buf, "cannot send the queries");
+    struct linger reset = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    close(fd);
+}
+
+/*---------------------------test control client hanging up---------------------------*/
+/* A control client that goes away while its replies are queued costs the spooler
+   that connection, not its life
+*/
+#define TEST_NAME ctl_hangup_test
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                                    expect,                 modifiers,            timeout,  before,    after
+    {  NULL,                                    INIT_EVENT,             0,                    HND_MSEC,   NULL,      NULL },
+    {  "type aaa",                              TYPE_DEFINED_EVENT,     0,                    HND_MSEC,   NULL,      NULL },
+    {  "print test_scripts/testfile.aaa",       JOB_CREATED_EVENT,      EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "control",                               CMD_OK_EVENT,           EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "type bbb",                              TYPE_DEFINED_EVENT,     EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      hang_up_client },      // The socket is open by now
+    {  "type ccc",                              TYPE_DEFINED_EVENT,     EXPECT_SKIP_OTHER,    ONE_SEC,    NULL,      NULL },
+    {  "quit",                                  FINI_EVENT,             EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                                    EOF_EVENT,              0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    int err, status;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    err = run_test(name, argv[0], argv, SCRIPT(TEST_NAME), &status);
+    assert_proper_exit_status(err, status);
+}
+#undef TEST_NAME
@@ -41,3 +41,62 @@ Test(SUITE, TEST_NAME, .init=test_setup, .fini = test_teardown, .timeout = 5)
 #undef cancel_cmd
 #undef TEST_NAME
 
+/*---------------------------test bulk print and cancel all--------------------------*/
+#define TEST_NAME bulk_print_cancel_all_test
+#define type_cmd "type aaa"
+#define print_cmd "print test_scripts"
+#define cancel_cmd "cancel all"
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                expect,                     modifiers,          timeout,    before,    after
+    {  NULL,                INIT_EVENT,                 0,                  HND_MSEC,   NULL,      NULL },
+    {  type_cmd,            TYPE_DEFINED_EVENT,         EXPECT_SKIP_OTHER,  HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,  HND_MSEC,   NULL,      NULL },
+    {  NULL,                CMD_OK_EVENT,               EXPECT_SKIP_OTHER,  HND_MSEC,   NULL,      NULL },
+    {  cancel_cmd,          JOB_ABORTED_EVENT,          EXPECT_SKIP_OTHER,  HND_MSEC,   NULL,      NULL },
+    {  NULL,                CMD_OK_EVENT,               EXPECT_SKIP_OTHER,  HND_MSEC,   NULL,      NULL },
+    {  "quit",              FINI_EVENT,                 EXPECT_SKIP_OTHER,  HND_MSEC,   NULL,      NULL },
+    {  NULL,                EOF_EVENT,                  0,                  TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init=test_setup, .fini = test_teardown, .timeout = 5)
+{
+    int err, status;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    err = run_test(name, argv[0], argv, SCRIPT(TEST_NAME), &status);
+    assert_proper_exit_status(err, status);
+}
+#undef type_cmd
+#undef print_cmd
+#undef cancel_cmd
+#undef TEST_NAME
+
+/*---------------------------test cancel range---------------------------------------*/
+#define TEST_NAME cancel_range_test
+#define type_cmd "type aaa"
+#define print_cmd "print test_scripts/testfile.aaa"
+#define cancel_cmd "cancel 0-1"
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                expect,                     modifiers,          timeout,    before,    after
+    {  NULL,                INIT_EVENT,                 0,                  HND_MSEC,   NULL,      NULL },
+    {  type_cmd,            TYPE_DEFINED_EVENT,         EXPECT_SKIP_OTHER,  HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,  HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,  HND_MSEC,   NULL,      NULL },
+    {  cancel_cmd,          JOB_ABORTED_EVENT,          EXPECT_SKIP_OTHER,  HND_MSEC,   NULL,      NULL },
+    {  NULL,                JOB_ABORTED_EVENT,          EXPECT_SKIP_OTHER,  HND_MSEC,   NULL,      NULL },
+    {  "quit",              FINI_EVENT,                 EXPECT_SKIP_OTHER,  HND_MSEC,   NULL,      NULL },
+    {  NULL,                EOF_EVENT,                  0,                  TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init=test_setup, .fini = test_teardown, .timeout = 5)
+{
+    int err, status;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    err = run_test(name, argv[0], argv, SCRIPT(TEST_NAME), &status);
+    assert_proper_exit_status(err, status);
+}
+#undef type_cmd
+#undef print_cmd
+#undef cancel_cmd
+#undef TEST_NAME
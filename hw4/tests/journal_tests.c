@@ -0,0 +1,463 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "driver.h"
+#include "__helper.h"
+#include "journal.h"
+#include "crc32.h"
+
+#define QUOTE1(x) #x
+#define QUOTE(x) QUOTE1(x)
+#define SCRIPT1(x) x##_script
+#define SCRIPT(x) SCRIPT1(x)
+
+#define SUITE journal_suite
+
+#define JOURNAL_DIR "spool/journal_test"
+
+static void fresh_journal_dir(void) {
+    if (system("rm -rf " JOURNAL_DIR) != 0) env_error_abort_test("cannot remove " JOURNAL_DIR);
+}
+
+/* The event tracker remembers every job id it has seen: a spooler that is to recover
+   them has to be driven by a fresh one, so the run before it is made in a child */
+static void run_first(char *name, char *argv[], COMMAND *script) {
+    fflush(NULL);
+    pid_t pid = fork();
+    cr_assert(pid >= 0, "fork failed");
+    if (pid == 0) {
+        int status, err = run_test(name, argv[0], argv, script, &status);
+        _exit(err == 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1);
+    }
+    int status;
+    cr_assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0,
+        "the run before the restart failed");
+}
+
+/* Count the intact JR_CREATE records in a journal file, and the distinct ids among them */
+static int count_creates(const char *path, int *distinct) {
+    static char buf[1 << 20];
+    int fd = open(path, O_RDONLY);
+    cr_assert(fd >= 0, "cannot open %s", path);
+    ssize_t size = read(fd, buf, sizeof(buf));
+    close(fd);
+
+    int n = 0;
+    static char seen[1 << 16];
+    memset(seen, 0, sizeof(seen));
+    *distinct = 0;
+    for (size_t off = sizeof(struct journal_file_hdr); off + sizeof(struct journal_rec) <= (size_t)size; ) {
+        struct journal_rec r;
+        memcpy(&r, buf + off, sizeof(r));
+        if (r.len < sizeof(r) || off + r.len > (size_t)size || crc32(buf + off + sizeof(r.crc), r.len - sizeof(r.crc)) != r.crc)
+            break;
+        if (r.kind == JR_CREATE) {
+            n++;
+            if (r.id >= 0 && r.id < (int)sizeof(seen) && !seen[r.id]++) (*distinct)++;
+        }
+        off += r.len;
+    }
+    return n;
+}
+
+/* The class, tenant, deadline and copy count of the job journaled last */
+static void last_attrs(const char *path, char *klass, char *tenant, int64_t *deadline, int *copies) {
+    static char buf[1 << 20];
+    int fd = open(path, O_RDONLY);
+    cr_assert(fd >= 0, "cannot open %s", path);
+    ssize_t size = read(fd, buf, sizeof(buf));
+    close(fd);
+
+    int found = 0;
+    for (size_t off = sizeof(struct journal_file_hdr); off + sizeof(struct journal_rec) <= (size_t)size; ) {
+        struct journal_rec r;
+        memcpy(&r, buf + off, sizeof(r));
+        if (r.len < sizeof(r) || off + r.len > (size_t)size) break;
+        if (r.kind == JR_CREATE) {
+            const char *s = buf + off + sizeof(r);
+            s += strlen(s) + 1;
+            s += strlen(s) + 1;
+            strcpy(klass, s);
+            strcpy(tenant, s + strlen(s) + 1);
+            *deadline = r.deadline;
+            *copies = r.copies;
+            found = 1;
+        }
+        off += r.len;
+    }
+    cr_assert(found, "no job in %s", path);
+}
+
+/*---------------------------scripts shared by the tests below-----------------------*/
+#define type_cmd    "type aaa"
+#define print_cmd   "print test_scripts/testfile.aaa"
+#define journal_cmd "journal " JOURNAL_DIR
+
+/* Submit three jobs with the journal open, and quit before any printer exists */
+static COMMAND submit_three_script[] = {
+    // send,                expect,                     modifiers,            timeout,  before,    after
+    {  NULL,                INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,            TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL },
+    {  journal_cmd,         CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "quit",              FINI_EVENT,                 EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+/* Reopen it: the jobs come back before the command completes, and no more than that */
+static COMMAND recover_three_script[] = {
+    {  NULL,                INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,            TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL },
+    {  journal_cmd,         JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                CMD_OK_EVENT,               0,                    HND_MSEC,   NULL,      NULL },
+    {  "quit",              FINI_EVENT,                 EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+static COMMAND recover_two_script[] = {
+    {  NULL,                INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,            TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL },
+    {  journal_cmd,         JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                CMD_OK_EVENT,               0,                    HND_MSEC,   NULL,      NULL },
+    {  "quit",              FINI_EVENT,                 EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+/*---------------------------test recovery after a restart---------------------------*/
+/* Jobs submitted with the journal open are queued again, under their old ids, by the
+   next spooler that opens it
+*/
+#define TEST_NAME journal_recover_test
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    int err, status;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    fresh_journal_dir();
+    run_first(name, argv, submit_three_script);
+    err = run_test(name, argv[0], argv, recover_three_script, &status);
+    assert_proper_exit_status(err, status);
+}
+#undef TEST_NAME
+
+/*---------------------------test torn log tail---------------------------------------*/
+/* A record cut short by a crash fails its CRC: replay stops there and everything
+   before it stands
+*/
+#define TEST_NAME journal_torn_tail_test
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    int err, status;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    fresh_journal_dir();
+    run_first(name, argv, submit_three_script);
+
+    struct stat sb;
+    cr_assert(stat(JOURNAL_DIR "/journal.log", &sb) == 0, "no journal.log");
+    cr_assert(truncate(JOURNAL_DIR "/journal.log", sb.st_size - 3) == 0);
+
+    err = run_test(name, argv[0], argv, recover_two_script, &status);
+    assert_proper_exit_status(err, status);
+}
+#undef TEST_NAME
+
+/*---------------------------test compaction------------------------------------------*/
+/* A compacted journal holds only the live jobs: the cancelled one is not recovered */
+#define TEST_NAME journal_compact_test
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                expect,                     modifiers,            timeout,  before,    after
+    {  NULL,                INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,            TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL },
+    {  journal_cmd,         CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "cancel 0",          JOB_ABORTED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "journal compact",   CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "quit",              FINI_EVENT,                 EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    int err, status, distinct;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    fresh_journal_dir();
+    run_first(name, argv, SCRIPT(TEST_NAME));
+    cr_assert_eq(count_creates(JOURNAL_DIR "/journal.snap", &distinct), 2, "the snapshot should hold the two live jobs");
+
+    err = run_test(name, argv[0], argv, recover_two_script, &status);
+    assert_proper_exit_status(err, status);
+}
+#undef TEST_NAME
+
+/*---------------------------test more jobs than slots--------------------------------*/
+/* A journal with more live jobs than the table holds: those without a slot are kept
+   in the new snapshot rather than dropped
+*/
+#define TEST_NAME journal_carry_test
+#define CARRY_JOBS 70
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                expect,                     modifiers,            timeout,  before,    after
+    {  NULL,                INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,            TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL },
+    {  journal_cmd,         JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    ONE_SEC,    NULL,      NULL },
+    {  "journal",           CMD_OK_EVENT,               0,                    HND_MSEC,   NULL,      NULL },
+    {  "quit",              FINI_EVENT,                 EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    int err, status, distinct;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    fresh_journal_dir();
+    cr_assert(mkdir(JOURNAL_DIR, 0755) == 0);
+
+    FILE *f = fopen(JOURNAL_DIR "/journal.snap", "w");
+    cr_assert(f != NULL);
+    struct journal_file_hdr h = { JOURNAL_SNAP_MAGIC, JOURNAL_VERSION, 1 };
+    fwrite(&h, sizeof(h), 1, f);
+    for (int i=0; i<CARRY_JOBS; i++) {
+        char rec[256];
+        const char names[] = "test_scripts/testfile.aaa\0aaa\0\0";
+        struct journal_rec r = { 0, sizeof(r) + sizeof(names), JR_CREATE, 0, i, UINT32_MAX, time(NULL) };
+        memcpy(rec, &r, sizeof(r));
+        memcpy(rec + sizeof(r), names, sizeof(names));
+        r.crc = crc32(rec + sizeof(r.crc), r.len - sizeof(r.crc));
+        memcpy(rec, &r.crc, sizeof(r.crc));
+        fwrite(rec, r.len, 1, f);
+    }
+    fclose(f);
+
+    err = run_test(name, argv[0], argv, SCRIPT(TEST_NAME), &status);
+    assert_proper_exit_status(err, status);
+    cr_assert_eq(count_creates(JOURNAL_DIR "/journal.snap", &distinct), CARRY_JOBS, "jobs without a slot were dropped");
+    cr_assert_eq(distinct, CARRY_JOBS);
+}
+#undef CARRY_JOBS
+#undef TEST_NAME
+
+/*---------------------------test class, tenant and deadline kept---------------------*/
+/* A recovered job keeps the class, tenant and deadline it was submitted with */
+#define setup_cmds \
+    {  "printer P aaa",     PRINTER_DEFINED_EVENT,      EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL }, \
+    {  "class cls P",       CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL }
+#define attrs_print_cmd "print --deadline +3600 test_scripts/testfile.aaa @cls"
+
+#define TEST_NAME journal_attrs_test
+static COMMAND submit_attrs_script[] = {
+    // send,                expect,                     modifiers,            timeout,  before,    after
+    {  NULL,                INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,            TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL },
+    setup_cmds,
+    {  "tenant use acme",   CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  journal_cmd,         CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  attrs_print_cmd,     JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "quit",              FINI_EVENT,                 EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    {  NULL,                INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,            TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL },
+    setup_cmds,
+    {  journal_cmd,         JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                CMD_OK_EVENT,               0,                    HND_MSEC,   NULL,      NULL },
+    {  "quit",              FINI_EVENT,                 EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    int err, status;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    char klass[64], tenant[64];
+    int64_t deadline;
+    int copies;
+    fresh_journal_dir();
+    run_first(name, argv, submit_attrs_script);
+
+    err = run_test(name, argv[0], argv, SCRIPT(TEST_NAME), &status);
+    assert_proper_exit_status(err, status);
+    last_attrs(JOURNAL_DIR "/journal.snap", klass, tenant, &deadline, &copies);      // Written from the restored job
+    cr_assert(!strcmp(klass, "cls"), "class lost: \"%s\"", klass);
+    cr_assert(!strcmp(tenant, "acme"), "tenant lost: \"%s\"", tenant);
+    cr_assert(deadline > time(NULL) + 3000, "deadline lost");
+}
+#undef TEST_NAME
+
+/*---------------------------test overflow queue keeps them too-----------------------*/
+/* A job spilled to the overflow queue is paged in with its class, tenant and deadline */
+#define TEST_NAME overflow_attrs_test
+#define OVERFLOW_DIR_T "spool/overflow_test"
+#define FILES_DIR      "spool/overflow_test_files"
+static COMMAND spill_attrs_script[] = {
+    // send,                                    expect,                 modifiers,            timeout,  before,    after
+    {  NULL,                                    INIT_EVENT,             0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,                                TYPE_DEFINED_EVENT,     0,                    HND_MSEC,   NULL,      NULL },
+    setup_cmds,
+    {  "overflow on " OVERFLOW_DIR_T,           CMD_OK_EVENT,           EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "print " FILES_DIR,                      CMD_OK_EVENT,           EXPECT_SKIP_OTHER,    ONE_SEC,    NULL,      NULL },
+    {  "tenant use acme",                       CMD_OK_EVENT,           EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  attrs_print_cmd,                         CMD_OK_EVENT,           EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "quit",                                  FINI_EVENT,             EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                                    EOF_EVENT,              0,                    TEN_MSEC,   NULL,      NULL }
+};
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    {  NULL,                                    INIT_EVENT,             0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,                                TYPE_DEFINED_EVENT,     0,                    HND_MSEC,   NULL,      NULL },
+    setup_cmds,
+    {  "overflow on " OVERFLOW_DIR_T,           JOB_CREATED_EVENT,      EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                                    CMD_OK_EVENT,           0,                    HND_MSEC,   NULL,      NULL },
+    {  journal_cmd,                             CMD_OK_EVENT,           EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "quit",                                  FINI_EVENT,             EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                                    EOF_EVENT,              0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    int err, status;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    char klass[64], tenant[64];
+    int64_t deadline;
+    int copies;
+    fresh_journal_dir();
+    if (system("rm -rf " OVERFLOW_DIR_T " " FILES_DIR " && mkdir -p " FILES_DIR " && for i in $(seq 10 73); do"
+        " cp test_scripts/testfile.aaa " FILES_DIR "/f$i.aaa; done") != 0)
+        env_error_abort_test("cannot make " FILES_DIR);
+    run_first(name, argv, spill_attrs_script);      // Fills the table, then spills the last job
+
+    err = run_test(name, argv[0], argv, SCRIPT(TEST_NAME), &status);
+    assert_proper_exit_status(err, status);
+    last_attrs(JOURNAL_DIR "/journal.snap", klass, tenant, &deadline, &copies);
+    cr_assert(!strcmp(klass, "cls"), "class lost: \"%s\"", klass);
+    cr_assert(!strcmp(tenant, "acme"), "tenant lost: \"%s\"", tenant);
+    cr_assert(deadline > time(NULL) + 3000, "deadline lost");
+}
+#undef OVERFLOW_DIR_T
+#undef FILES_DIR
+#undef TEST_NAME
+
+/*---------------------------test dedup merge------------------------------------------*/
+/* An identical file submitted again is folded into the waiting job: the new job is
+   aborted, and the copy count the earlier one gets is journaled
+*/
+#define TEST_NAME dedup_merge_test
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                expect,                     modifiers,            timeout,  before,    after
+    {  NULL,                INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,            TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL },
+    {  journal_cmd,         CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "dedup merge",       CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                JOB_ABORTED_EVENT,          EXPECT_SKIP_OTHER,    ONE_SEC,    NULL,      NULL },
+    {  "quit",              FINI_EVENT,                 EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+static COMMAND recover_one_script[] = {
+    {  NULL,                INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,            TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL },
+    {  journal_cmd,         JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                CMD_OK_EVENT,               0,                    HND_MSEC,   NULL,      NULL },
+    {  "quit",              FINI_EVENT,                 EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    int err, status, copies;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    char klass[64], tenant[64];
+    int64_t deadline;
+    fresh_journal_dir();
+    run_first(name, argv, SCRIPT(TEST_NAME));
+
+    err = run_test(name, argv[0], argv, recover_one_script, &status);
+    assert_proper_exit_status(err, status);
+    last_attrs(JOURNAL_DIR "/journal.snap", klass, tenant, &deadline, &copies);
+    cr_assert_eq(copies, 2, "copy count lost: %d", copies);
+}
+#undef TEST_NAME
+
+/*---------------------------test dedup keeps different jobs---------------------------*/
+/* Neither a file of the same size and hash-unrelated content, nor the same file with a
+   deadline, is merged into a waiting job
+*/
+#define TEST_NAME dedup_distinct_test
+#define FILE_A "spool/dedup_test_a.aaa"
+#define FILE_B "spool/dedup_test_b.aaa"
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                                    expect,                 modifiers,            timeout,  before,    after
+    {  NULL,                                    INIT_EVENT,             0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,                                TYPE_DEFINED_EVENT,     0,                    HND_MSEC,   NULL,      NULL },
+    {  journal_cmd,                             CMD_OK_EVENT,           EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "dedup merge",                           CMD_OK_EVENT,           EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "print " FILE_A,                         JOB_CREATED_EVENT,      EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "print " FILE_B,                         JOB_CREATED_EVENT,      EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "print --deadline +3600 " FILE_A,        JOB_CREATED_EVENT,      EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "quit",                                  FINI_EVENT,             EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                                    EOF_EVENT,              0,                    TEN_MSEC,   NULL,      NULL }
+};
+static COMMAND recover_three_again_script[] = {
+    {  NULL,                INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,            TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL },
+    {  journal_cmd,         JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                CMD_OK_EVENT,               0,                    HND_MSEC,   NULL,      NULL },
+    {  "quit",              FINI_EVENT,                 EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    int err, status;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    fresh_journal_dir();
+    FILE *a = fopen(FILE_A, "w"), *b = fopen(FILE_B, "w");
+    cr_assert(a && b);
+    for (int i=0; i<100000; i++) {       // Same size, one byte apart at the very end
+        fputc('x', a);
+        fputc(i == 99999 ? 'y' : 'x', b);
+    }
+    fclose(a);
+    fclose(b);
+    run_first(name, argv, SCRIPT(TEST_NAME));      // Quitting waits for the verdicts
+
+    err = run_test(name, argv[0], argv, recover_three_again_script, &status);
+    assert_proper_exit_status(err, status);
+}
+#undef FILE_A
+#undef FILE_B
+#undef TEST_NAME
+
+#undef setup_cmds
+#undef attrs_print_cmd
+#undef type_cmd
+#undef print_cmd
+#undef journal_cmd
@@ -0,0 +1,152 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "driver.h"
+#include "__helper.h"
+
+#define QUOTE1(x) #x
+#define QUOTE(x) QUOTE1(x)
+#define SCRIPT1(x) x##_script
+#define SCRIPT(x) SCRIPT1(x)
+
+#define SUITE pipeline_suite
+
+#define setup_cmds  "type aaa"
+#define print_cmd   "print test_scripts/testfile.aaa"
+
+/* A conversion from aaa to bbb through <conv>, to a bbb printer */
+#define CONVERTING(conv) \
+    {  NULL,                            INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL }, \
+    {  setup_cmds,                      TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL }, \
+    {  "type bbb",                      TYPE_DEFINED_EVENT,         EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL }, \
+    {  "printer Pipe1 bbb",             PRINTER_DEFINED_EVENT,      EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL }, \
+    {  "conversion aaa bbb " conv,      CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL }
+
+static void run_script(char *name, COMMAND *script) {
+    int err, status;
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    err = run_test(name, argv[0], argv, script, &status);
+    assert_proper_exit_status(err, status);
+}
+
+/*---------------------------test worker stage------------------------------------------*/
+/* A job whose conversion runs on a worker instance leased from its pool finishes */
+#define TEST_NAME worker_stage_test
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                            expect,                     modifiers,            timeout,  before,    after
+    CONVERTING("worker:bin/presi_wcat"),
+    {  print_cmd,                       JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "enable Pipe1",                  JOB_FINISHED_EVENT,         EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  "quit",                          FINI_EVENT,                 EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  NULL,                            EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    run_script(QUOTE(SUITE)"/"QUOTE(TEST_NAME), SCRIPT(TEST_NAME));
+}
+#undef TEST_NAME
+
+/*---------------------------test worker recycle----------------------------------------*/
+/* With one instance at most, recycled after every job, the next job gets a fresh one */
+#define TEST_NAME worker_recycle_test
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                            expect,                     modifiers,            timeout,  before,    after
+    CONVERTING("worker:bin/presi_wcat"),
+    {  "workers 1 1",                   CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,                       JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,                       JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "enable Pipe1",                  JOB_FINISHED_EVENT,         EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  NULL,                            JOB_FINISHED_EVENT,         EXPECT_SKIP_OTHER,    TEN_SEC,    NULL,      NULL },
+    {  "quit",                          FINI_EVENT,                 EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  NULL,                            EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 20)
+{
+    run_script(QUOTE(SUITE)"/"QUOTE(TEST_NAME), SCRIPT(TEST_NAME));
+}
+#undef TEST_NAME
+
+/*---------------------------test failing worker----------------------------------------*/
+/* A worker that exits instead of converting aborts the job, and the spooler carries on */
+#define TEST_NAME worker_failure_test
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                            expect,                     modifiers,            timeout,  before,    after
+    CONVERTING("worker:/bin/false"),
+    {  print_cmd,                       JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "enable Pipe1",                  JOB_ABORTED_EVENT,          EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  "type ccc",                      TYPE_DEFINED_EVENT,         EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "quit",                          FINI_EVENT,                 EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  NULL,                            EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    run_script(QUOTE(SUITE)"/"QUOTE(TEST_NAME), SCRIPT(TEST_NAME));
+}
+#undef TEST_NAME
+
+/*---------------------------test plugin stage------------------------------------------*/
+/* A job whose conversion is a function in a shared library finishes */
+#define TEST_NAME plugin_stage_test
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                            expect,                     modifiers,            timeout,  before,    after
+    CONVERTING("plugin:bin/presi_copy.so:presi_copy"),
+    {  print_cmd,                       JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "enable Pipe1",                  JOB_FINISHED_EVENT,         EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  "quit",                          FINI_EVENT,                 EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  NULL,                            EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    run_script(QUOTE(SUITE)"/"QUOTE(TEST_NAME), SCRIPT(TEST_NAME));
+}
+#undef TEST_NAME
+
+/*---------------------------test progress relay----------------------------------------*/
+/* With the relay on, the master counts the last stage's output on its way to the printer */
+#define TEST_NAME progress_relay_test
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                            expect,                     modifiers,            timeout,  before,    after
+    CONVERTING("worker:bin/presi_wcat"),
+    {  "progress on",                   CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,                       JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "enable Pipe1",                  JOB_FINISHED_EVENT,         EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  "quit",                          FINI_EVENT,                 EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  NULL,                            EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    run_script(QUOTE(SUITE)"/"QUOTE(TEST_NAME), SCRIPT(TEST_NAME));
+}
+#undef TEST_NAME
+
+/*---------------------------test data mover--------------------------------------------*/
+/* A job that needs no conversion is copied by the mover's splice backend and finishes */
+#define TEST_NAME mover_splice_test
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                            expect,                     modifiers,            timeout,  before,    after
+    {  NULL,                            INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  setup_cmds,                      TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL },
+    {  "printer Move1 aaa",             PRINTER_DEFINED_EVENT,      EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "mover splice",                  CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,                       JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "enable Move1",                  JOB_FINISHED_EVENT,         EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  "quit",                          FINI_EVENT,                 EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  NULL,                            EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    run_script(QUOTE(SUITE)"/"QUOTE(TEST_NAME), SCRIPT(TEST_NAME));
+}
+#undef TEST_NAME
+
+#undef CONVERTING
+#undef setup_cmds
+#undef print_cmd
@@ -58,3 +58,79 @@ Test(SUITE, TEST_NAME, .init = test_delay_setup, .fini = test_teardown, .timeout
 #undef enable_cmd 
 #undef TEST_NAME
 
+
+/*---------------------------test printer with more slots than it serves--------------*/
+/* util/printer takes one connection at a time, plus one in its backlog. A printer
+   defined with four slots must still print every job, on the slots it really has
+*/
+#define TEST_NAME print_multi_slot_fallback
+#define type_cmd    "type aaa"
+#define print_cmd   "print test_scripts/testfile.aaa"
+#define printer_cmd "printer Slots1 aaa --slots 4"
+#define enable_cmd  "enable Slots1"
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                expect,                     modifiers,            timeout,  before,    after
+    {  NULL,                INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,            TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL },
+    {  printer_cmd,         PRINTER_DEFINED_EVENT,      EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  enable_cmd,          JOB_FINISHED_EVENT,         EXPECT_SKIP_OTHER,    ZERO_SEC,   NULL,      NULL },
+    {  NULL,                JOB_FINISHED_EVENT,         EXPECT_SKIP_OTHER,    ZERO_SEC,   NULL,      NULL },
+    {  NULL,                JOB_FINISHED_EVENT,         EXPECT_SKIP_OTHER,    ZERO_SEC,   NULL,      NULL },
+    {  "quit",              FINI_EVENT,                 EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 15)
+{
+    int err, status;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    err = run_test(name, argv[0], argv, SCRIPT(TEST_NAME), &status);
+    assert_proper_exit_status(err, status);
+}
+#undef type_cmd
+#undef print_cmd
+#undef printer_cmd
+#undef enable_cmd
+#undef TEST_NAME
+
+/*---------------------------test quit while connecting inline------------------------*/
+/* Without launchers the spooler connects on its own thread. Jobs the printer cannot
+   take yet must wait for it without blocking the command loop
+*/
+#define TEST_NAME quit_with_inline_connects
+#define type_cmd    "type aaa"
+#define print_cmd   "print test_scripts/testfile.aaa"
+#define printer_cmd "printer Slots2 aaa --slots 4"
+#define enable_cmd  "enable Slots2"
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                expect,                     modifiers,            timeout,  before,    after
+    {  NULL,                INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  "launchers 0",       CMD_OK_EVENT,               0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,            TYPE_DEFINED_EVENT,         EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  printer_cmd,         PRINTER_DEFINED_EVENT,      EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,           JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  enable_cmd,          JOB_FINISHED_EVENT,         EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  "quit",              FINI_EVENT,                 EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 5)
+{
+    int err, status;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    err = run_test(name, argv[0], argv, SCRIPT(TEST_NAME), &status);
+    assert_proper_exit_status(err, status);
+}
+#undef type_cmd
+#undef print_cmd
+#undef printer_cmd
+#undef enable_cmd
+#undef TEST_NAME
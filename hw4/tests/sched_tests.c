@@ -0,0 +1,184 @@
+#include <criterion/criterion.h>
+#include <criterion/logging.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "driver.h"
+#include "__helper.h"
+
+#define QUOTE1(x) #x
+#define QUOTE(x) QUOTE1(x)
+#define SCRIPT1(x) x##_script
+#define SCRIPT(x) SCRIPT1(x)
+
+#define SUITE sched_suite
+
+/* Jobs in the order they started, and where */
+static int started[16], n_started;
+static char started_on[16][32];
+
+static void note_start(EVENT *ep, int *env, void *args) {
+    (void)env;
+    (void)args;
+    if (n_started == 16) return;
+    started[n_started] = ep->jobid;
+    snprintf(started_on[n_started], sizeof(started_on[0]), "%s", ep->printer_name);
+    n_started++;
+}
+
+#define type_cmd    "type aaa"
+#define print_cmd   "print test_scripts/testfile.aaa"
+
+/*---------------------------test class members only----------------------------------*/
+/* Jobs submitted to a class start only on its members, however many other
+   printers are free; a job with no class still takes any printer
+*/
+#define TEST_NAME class_members_test
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                            expect,                     modifiers,            timeout,  before,    after
+    {  NULL,                            INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,                        TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL },
+    {  "printer Cls1 aaa",              PRINTER_DEFINED_EVENT,      EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "printer Cls2 aaa",              PRINTER_DEFINED_EVENT,      EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "printer Cls3 aaa",              PRINTER_DEFINED_EVENT,      EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "class pool Cls2 Cls3",          CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd " @pool",              JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd " @pool",              JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,                       JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "enable Cls1",                   CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "enable Cls2",                   CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "enable Cls3",                   CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  NULL,                            JOB_STARTED_EVENT,          EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      note_start },
+    {  NULL,                            JOB_STARTED_EVENT,          EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      note_start },
+    {  NULL,                            JOB_STARTED_EVENT,          EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      note_start },
+    {  "quit",                          FINI_EVENT,                 EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  NULL,                            EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    int err, status;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    n_started = 0;
+    err = run_test(name, argv[0], argv, SCRIPT(TEST_NAME), &status);
+    assert_proper_exit_status(err, status);
+
+    char *pool_on[2] = {NULL, NULL};
+    for (int i=0; i<n_started; i++) {
+        if (started[i] < 2) pool_on[started[i]] = started_on[i];
+        else cr_assert(started[i] == 2, "unexpected job %d", started[i]);
+    }
+    cr_assert(pool_on[0] && pool_on[1], "a class job did not start");
+    for (int k=0; k<2; k++)
+        cr_assert(!strcmp(pool_on[k], "Cls2") || !strcmp(pool_on[k], "Cls3"), "class job %d started on %s", k, pool_on[k]);
+}
+#undef TEST_NAME
+
+/*---------------------------test class and plain jobs in order-------------------------*/
+/* On a printer shared by a class and plain jobs, a class job submitted first
+   starts first: plain jobs do not jump the class queue
+*/
+#define TEST_NAME class_fifo_test
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                            expect,                     modifiers,            timeout,  before,    after
+    {  NULL,                            INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,                        TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL },
+    {  "printer Fifo1 aaa",             PRINTER_DEFINED_EVENT,      EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "class solo Fifo1",              CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd " @solo",              JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,                       JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "enable Fifo1",                  JOB_STARTED_EVENT,          EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      note_start },
+    {  "quit",                          FINI_EVENT,                 EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  NULL,                            EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 10)
+{
+    int err, status;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    n_started = 0;
+    err = run_test(name, argv[0], argv, SCRIPT(TEST_NAME), &status);
+    assert_proper_exit_status(err, status);
+    cr_assert(n_started == 1 && started[0] == 0, "job %d started ahead of the class job", n_started ? started[0] : -1);
+}
+#undef TEST_NAME
+
+/*---------------------------test earliest deadline first-----------------------------*/
+/* Under "deadline edf" the waiting deadline jobs start earliest deadline first,
+   ahead of a best-effort job submitted before them
+*/
+#define TEST_NAME deadline_edf_test
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                            expect,                     modifiers,            timeout,  before,    after
+    {  NULL,                            INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,                        TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL },
+    {  "printer Edf1 aaa",              PRINTER_DEFINED_EVENT,      EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "deadline edf",                  CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,                       JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "print --deadline +3600 test_scripts/testfile.aaa",
+                                        JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "print --deadline +600 test_scripts/testfile.aaa",
+                                        JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "enable Edf1",                   JOB_STARTED_EVENT,          EXPECT_SKIP_OTHER,    TEN_SEC,    NULL,      note_start },
+    {  NULL,                            JOB_STARTED_EVENT,          EXPECT_SKIP_OTHER,    TEN_SEC,    NULL,      note_start },
+    {  NULL,                            JOB_STARTED_EVENT,          EXPECT_SKIP_OTHER,    TEN_SEC,    NULL,      note_start },
+    {  "quit",                          FINI_EVENT,                 EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  NULL,                            EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 30)
+{
+    int err, status;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    n_started = 0;
+    err = run_test(name, argv[0], argv, SCRIPT(TEST_NAME), &status);
+    assert_proper_exit_status(err, status);
+
+    cr_assert_eq(n_started, 3);
+    cr_assert(started[0] == 2 && started[1] == 1 && started[2] == 0, "started in the order %d, %d, %d",
+        started[0], started[1], started[2]);
+}
+#undef TEST_NAME
+
+/*---------------------------test tenants take turns----------------------------------*/
+/* A tenant with one job queued behind another tenant's batch starts it within the
+   first round of deficit round robin, not after the batch
+*/
+#define TEST_NAME tenant_drr_test
+static COMMAND SCRIPT(TEST_NAME)[] = {
+    // send,                            expect,                     modifiers,            timeout,  before,    after
+    {  NULL,                            INIT_EVENT,                 0,                    HND_MSEC,   NULL,      NULL },
+    {  type_cmd,                        TYPE_DEFINED_EVENT,         0,                    HND_MSEC,   NULL,      NULL },
+    {  "printer Drr1 aaa",              PRINTER_DEFINED_EVENT,      EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "tenant use bulk",               CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,                       JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,                       JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,                       JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "tenant use solo",               CMD_OK_EVENT,               EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  print_cmd,                       JOB_CREATED_EVENT,          EXPECT_SKIP_OTHER,    HND_MSEC,   NULL,      NULL },
+    {  "enable Drr1",                   JOB_STARTED_EVENT,          EXPECT_SKIP_OTHER,    TEN_SEC,    NULL,      note_start },
+    {  NULL,                            JOB_STARTED_EVENT,          EXPECT_SKIP_OTHER,    TEN_SEC,    NULL,      note_start },
+    {  "quit",                          FINI_EVENT,                 EXPECT_SKIP_OTHER,    THR_SEC,    NULL,      NULL },
+    {  NULL,                            EOF_EVENT,                  0,                    TEN_MSEC,   NULL,      NULL }
+};
+
+Test(SUITE, TEST_NAME, .init = test_setup, .fini = test_teardown, .timeout = 30)
+{
+    int err, status;
+    char *name = QUOTE(SUITE)"/"QUOTE(TEST_NAME);
+    char *argv[] = {TEST_EXECUTABLE, NULL};
+    n_started = 0;
+    err = run_test(name, argv[0], argv, SCRIPT(TEST_NAME), &status);
+    assert_proper_exit_status(err, status);
+
+    cr_assert_eq(n_started, 2);
+    cr_assert(started[0] == 3 || started[1] == 3, "solo's job waited behind the batch: started %d, %d", started[0], started[1]);
+}
+#undef TEST_NAME
+
+#undef type_cmd
+#undef print_cmd
@@ -0,0 +1,222 @@
+/*
+ * Presi: control socket client library
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "presi_client.h"
+
+struct presi_client {
+	int fd;
+	uint32_t next_tag;
+	char in[CTL_FRAME_MAX];
+	size_t in_off, in_len;
+	struct evring_rec *events;      // Events that arrived while waiting for a reply
+	size_t ev_head, ev_len, ev_cap;
+};
+
+PRESI_CLIENT *presi_client_open(const char *path) {
+	struct sockaddr_un sa = {0};
+	if (strlen(path) >= sizeof(sa.sun_path)) return NULL;
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+
+	PRESI_CLIENT *c = calloc(1, sizeof(*c));
+	if (!c) return NULL;
+	if ((c->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(c->fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		if (c->fd >= 0) close(c->fd);
+		free(c);
+		return NULL;
+	}
+	return c;
+}
+
+void presi_client_close(PRESI_CLIENT *c) {
+	if (!c) return;
+	close(c->fd);
+	free(c->events);
+	free(c);
+}
+
+int presi_client_fd(PRESI_CLIENT *c) {
+	return c->fd;
+}
+
+static int write_all(int fd, const char *buf, size_t n) {
+	while (n) {
+		ssize_t w = write(fd, buf, n);
+		if (w < 0 && errno == EINTR) continue;
+		if (w <= 0) return -1;
+		buf += w;
+		n -= w;
+	}
+	return 0;
+}
+
+int presi_send(PRESI_CLIENT *c, int op, uint32_t tag, const void *payload, size_t n) {
+	char frame[CTL_FRAME_MAX];
+	struct ctl_hdr h = { sizeof(h) + n, op, 0, tag };
+	if (h.len > sizeof(frame)) return -1;
+	memcpy(frame, &h, sizeof(h));
+	if (n) memcpy(frame + sizeof(h), payload, n);
+	return write_all(c->fd, frame, h.len);
+}
+
+static int submit_payload(char *payload, const char *file, uint32_t eligible) {     // Returns the length, or -1
+	size_t len = strlen(file) + 1;
+	if (sizeof(eligible) + len > CTL_FRAME_MAX - sizeof(struct ctl_hdr)) return -1;
+	memcpy(payload, &eligible, sizeof(eligible));
+	memcpy(payload + sizeof(eligible), file, len);
+	return sizeof(eligible) + len;
+}
+
+int presi_send_submit(PRESI_CLIENT *c, uint32_t tag, const char *file, uint32_t eligible) {
+	char payload[CTL_FRAME_MAX];
+	int n = submit_payload(payload, file, eligible);
+	return n < 0 ? -1 : presi_send(c, CTL_SUBMIT, tag, payload, n);
+}
+
+static int fill(PRESI_CLIENT *c, size_t need) {     // Buffer at least need bytes
+	if (c->in_len - c->in_off >= need) return 0;
+	memmove(c->in, c->in + c->in_off, c->in_len - c->in_off);
+	c->in_len -= c->in_off;
+	c->in_off = 0;
+	while (c->in_len < need) {
+		ssize_t n = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		c->in_len += n;
+	}
+	return 0;
+}
+
+int presi_recv(PRESI_CLIENT *c, struct ctl_hdr *h, void *buf, size_t cap) {
+	if (fill(c, sizeof(*h)) < 0) return -1;
+	memcpy(h, c->in + c->in_off, sizeof(*h));
+	if (h->len < sizeof(*h) || h->len > CTL_FRAME_MAX || fill(c, h->len) < 0) return -1;
+
+	size_t n = h->len - sizeof(*h);
+	memcpy(buf, c->in + c->in_off + sizeof(*h), n < cap ? n : cap);
+	c->in_off += h->len;
+	return n;
+}
+
+static int keep_event(PRESI_CLIENT *c, const struct evring_rec *ev) {
+	if (c->ev_len == c->ev_cap) {
+		size_t cap = c->ev_cap ? 2 * c->ev_cap : 64;
+		struct evring_rec *e = malloc(cap * sizeof(*e));
+		if (!e) return -1;
+		for (size_t i=0; i<c->ev_len; i++) e[i] = c->events[(c->ev_head + i) % c->ev_cap];
+		free(c->events);
+		c->events = e;
+		c->ev_cap = cap;
+		c->ev_head = 0;
+	}
+	c->events[(c->ev_head + c->ev_len++) % c->ev_cap] = *ev;
+	return 0;
+}
+
+static int as_event(struct ctl_hdr *h, char *buf, int len, struct evring_rec *ev) {    // Events and resync markers
+	if (h->op == CTL_EVENT && len == sizeof(*ev)) {
+		memcpy(ev, buf, sizeof(*ev));
+		return 1;
+	}
+	if (h->op == CTL_RESYNC && len == sizeof(uint64_t)) {
+		memset(ev, 0, sizeof(*ev));
+		memcpy(&ev->time_ns, buf, sizeof(uint64_t));
+		return 1;
+	}
+	return 0;
+}
+
+// Blocking request: send, then wait for the reply with the same tag
+
+static int call(PRESI_CLIENT *c, int op, const void *payload, size_t n, void *reply, size_t cap, int *reply_len) {
+	uint32_t tag = ++c->next_tag;
+	if (presi_send(c, op, tag, payload, n) < 0) return -1;
+
+	for (;;) {
+		struct ctl_hdr h;
+		char buf[CTL_FRAME_MAX];
+		int len = presi_recv(c, &h, buf, sizeof(buf));
+		if (len < 0) return -1;
+		if (h.op == CTL_EVENT || h.op == CTL_RESYNC) {
+			struct evring_rec ev;
+			if (as_event(&h, buf, len, &ev) && keep_event(c, &ev) < 0) return -1;
+			continue;
+		}
+		if (h.tag != tag) continue;
+		if (reply) memcpy(reply, buf, (size_t)len < cap ? (size_t)len : cap);
+		if (reply_len) *reply_len = len;
+		return h.status;
+	}
+}
+
+int presi_submit(PRESI_CLIENT *c, const char *file, uint32_t eligible, int *status) {
+	char payload[CTL_FRAME_MAX];
+	int n = submit_payload(payload, file, eligible);
+	if (n < 0) return -1;
+
+	int32_t id = -1;
+	int rc = call(c, CTL_SUBMIT, payload, n, &id, sizeof(id), NULL);
+	if (status) *status = rc;
+	return rc == CTL_OK ? id : -1;
+}
+
+static int job_call(PRESI_CLIENT *c, int op, int id) {
+	int32_t v = id;
+	return call(c, op, &v, sizeof(v), NULL, 0, NULL);
+}
+
+int presi_cancel(PRESI_CLIENT *c, int id) { return job_call(c, CTL_CANCEL, id); }
+int presi_pause(PRESI_CLIENT *c, int id) { return job_call(c, CTL_PAUSE, id); }
+int presi_resume(PRESI_CLIENT *c, int id) { return job_call(c, CTL_RESUME, id); }
+
+int presi_query(PRESI_CLIENT *c, int id, struct ctl_job_info *out, int max) {
+	int32_t v = id;
+	int len;
+	int rc = call(c, CTL_QUERY, &v, sizeof(v), out, max * sizeof(*out), &len);
+	if (rc == CTL_ENOENT) return 0;
+	if (rc != CTL_OK) return -1;
+	len /= sizeof(*out);
+	return len < max ? len : max;
+}
+
+int presi_printers(PRESI_CLIENT *c, struct ctl_printer_info *out, int max) {
+	int len;
+	if (call(c, CTL_PRINTERS, NULL, 0, out, max * sizeof(*out), &len) != CTL_OK) return -1;
+	len /= sizeof(*out);
+	return len < max ? len : max;
+}
+
+int presi_tenant(PRESI_CLIENT *c, const char *name) {
+	return call(c, CTL_TENANT, name, strlen(name) + 1, NULL, 0, NULL);
+}
+
+int presi_subscribe(PRESI_CLIENT *c, const struct ctl_filter *f) {
+	return call(c, CTL_SUBSCRIBE, f, f ? sizeof(*f) : 0, NULL, 0, NULL);
+}
+
+int presi_unsubscribe(PRESI_CLIENT *c) {
+	return call(c, CTL_UNSUBSCRIBE, NULL, 0, NULL, 0, NULL);
+}
+
+int presi_next_event(PRESI_CLIENT *c, struct evring_rec *ev) {
+	if (c->ev_len) {
+		*ev = c->events[c->ev_head];
+		c->ev_head = (c->ev_head + 1) % c->ev_cap;
+		c->ev_len--;
+		return ev->type == 0;
+	}
+	for (;;) {
+		struct ctl_hdr h;
+		char buf[CTL_FRAME_MAX];
+		int len = presi_recv(c, &h, buf, sizeof(buf));
+		if (len < 0) return -1;
+		if (as_event(&h, buf, len, ev)) return ev->type == 0;
+	}
+}
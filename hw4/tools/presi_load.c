@@ -0,0 +1,171 @@
+/*
+ * Presi: load generator for the control socket
+ *
+ * Opens a number of client connections, one thread each, and keeps a window
+ * of pipelined requests outstanding on every connection.  Reports the request
+ * rate and the reply latency distribution; submissions rejected because the
+ * job table is full, or because the overflow queue or the tenant's queue is
+ * busy, are counted separately.  With -t, every connection submits as that
+ * tenant.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "presi_client.h"
+
+struct load_cfg {
+	char *socket;
+	int clients, requests, window;
+	int query;              // Query requests instead of submissions
+	char *file;
+	uint32_t eligible;
+	char *tenant;
+};
+
+struct load_thread {
+	pthread_t tid;
+	struct load_cfg *cfg;
+	double *lat;            // Reply latencies, seconds
+	int ok, full, busy, failed;
+	int error;
+};
+
+static double now_sec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(char *prog) {
+	fprintf(stderr, "Usage: %s [-s socket] [-c clients] [-n requests] [-w window] [-q] [-e mask] [-t tenant] file\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+static int send_one(PRESI_CLIENT *pc, struct load_cfg *cfg, uint32_t tag) {
+	if (cfg->query) {
+		int32_t all = -1;
+		return presi_send(pc, CTL_QUERY, tag, &all, sizeof(all));
+	}
+	return presi_send_submit(pc, tag, cfg->file, cfg->eligible);
+}
+
+static void *run_client(void *arg) {
+	struct load_thread *t = arg;
+	struct load_cfg *cfg = t->cfg;
+	PRESI_CLIENT *pc = presi_client_open(cfg->socket);
+	double *sent = calloc(cfg->window, sizeof(double));
+	char buf[CTL_FRAME_MAX];
+
+	if (!pc || !sent || (cfg->tenant && presi_tenant(pc, cfg->tenant) != CTL_OK)) {
+		t->error = 1;
+		free(sent);
+		presi_client_close(pc);
+		return NULL;
+	}
+
+	// Replies come back in order, so the send times form a FIFO of window entries
+	int issued = 0, done = 0;
+	while (done < cfg->requests) {
+		while (issued < cfg->requests && issued - done < cfg->window) {
+			sent[issued % cfg->window] = now_sec();
+			if (send_one(pc, cfg, issued) < 0) goto fail;
+			issued++;
+		}
+
+		struct ctl_hdr h;
+		if (presi_recv(pc, &h, buf, sizeof(buf)) < 0) goto fail;
+		if (h.op == CTL_EVENT) continue;
+		t->lat[done] = now_sec() - sent[done % cfg->window];
+		done++;
+		if (h.status == CTL_OK) t->ok++;
+		else if (h.status == CTL_EFULL) t->full++;
+		else if (h.status == CTL_EBUSY) t->busy++;
+		else t->failed++;
+	}
+	free(sent);
+	presi_client_close(pc);
+	return NULL;
+
+fail:
+	t->error = 1;
+	free(sent);
+	presi_client_close(pc);
+	return NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile(double *v, size_t n, double p) {
+	if (n == 0) return 0;
+	size_t i = (size_t)(p * (n - 1) + 0.5);
+	return v[i];
+}
+
+int main(int argc, char *argv[])
+{
+	struct load_cfg cfg = { CTL_SOCKET, 4, 10000, 32, 0, NULL, 0, NULL };
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:c:n:w:qe:t:")) != -1) {
+		switch (opt) {
+		case 's': cfg.socket = optarg; break;
+		case 'c': cfg.clients = atoi(optarg); break;
+		case 'n': cfg.requests = atoi(optarg); break;
+		case 'w': cfg.window = atoi(optarg); break;
+		case 'q': cfg.query = 1; break;
+		case 'e': cfg.eligible = strtoul(optarg, NULL, 0); break;
+		case 't': cfg.tenant = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind < argc) cfg.file = argv[optind];
+	if (cfg.clients < 1 || cfg.requests < 1 || cfg.window < 1 || (!cfg.query && !cfg.file))
+		usage(argv[0]);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	struct load_thread *th = calloc(cfg.clients, sizeof(*th));
+	double start = now_sec();
+	for (int i=0; i<cfg.clients; i++) {
+		th[i].cfg = &cfg;
+		th[i].lat = calloc(cfg.requests, sizeof(double));
+		pthread_create(&th[i].tid, NULL, run_client, &th[i]);
+	}
+
+	size_t n = 0;
+	int ok = 0, full = 0, busy = 0, failed = 0, errors = 0;
+	double *lat = malloc((size_t)cfg.clients * cfg.requests * sizeof(double));
+	for (int i=0; i<cfg.clients; i++) {
+		pthread_join(th[i].tid, NULL);
+		int got = th[i].ok + th[i].full + th[i].busy + th[i].failed;
+		memcpy(lat + n, th[i].lat, got * sizeof(double));
+		n += got;
+		ok += th[i].ok;
+		full += th[i].full;
+		busy += th[i].busy;
+		failed += th[i].failed;
+		errors += th[i].error;
+		free(th[i].lat);
+	}
+	double elapsed = now_sec() - start;
+	qsort(lat, n, sizeof(double), cmp_double);
+
+	printf("%zu %s requests over %d connections (window %d) in %.3fs: %.0f req/s\n",
+		n, cfg.query ? "query" : "submit", cfg.clients, cfg.window, elapsed, elapsed > 0 ? n / elapsed : 0);
+	printf("ok %d, full %d, busy %d, failed %d, connection errors %d\n", ok, full, busy, failed, errors);
+	printf("latency p50 %.1fus, p99 %.1fus, max %.1fus\n",
+		percentile(lat, n, 0.50) * 1e6, percentile(lat, n, 0.99) * 1e6, n ? lat[n-1] * 1e6 : 0);
+
+	free(lat);
+	free(th);
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
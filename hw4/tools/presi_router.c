@@ -0,0 +1,1138 @@
+/*
+ * Presi: sharded spooler front-end
+ *
+ * Starts a number of presi instances ("shards"), gives each a share of the
+ * printers in a command file, and serves the control protocol (presi_ctl.h)
+ * on their behalf, so that existing clients need not know about the shards.
+ * A submission goes to the shard with the fewest outstanding jobs per printer
+ * among those owning an eligible printer that the file can be converted for;
+ * job requests go to the shard that owns the job, and job queries, printer
+ * lists and events are merged.
+ *
+ * Ids seen by clients are global: printer ids follow the order of the command
+ * file, and job <id> lives on shard id % shards as job id / shards there.
+ * Each shard keeps its control socket and other state in spool/shard<k>/.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "presi_ctl.h"
+#include "evring.h"
+
+#define MAX_SHARDS      16
+#define SHARD_PRINTERS  32          // MAX_PRINTERS of one spooler
+#define MAX_RPRINTERS   (MAX_SHARDS * SHARD_PRINTERS)
+#define MAX_RTYPES      32
+#define MAX_RCLIENTS    64
+#define SUB_BUFFER      65536       // As CTL_SUB_BUFFER in the spooler
+#define JOB_BUCKETS     1024
+#define TENANT_NAME_MAX 31          // As in the spooler
+
+static char *job_states[] = { "created", "running", "paused", "finished", "aborted", "deleted" };
+static char *printer_states[] = { "disabled", "idle", "busy" };
+static char *status_names[] = { "ok", "bad request", "no such job", "wrong state", "unknown type", "full", "shard down", "busy", "duplicate" };
+
+// Output buffers, for clients and for shards alike
+
+struct obuf {
+	char *data;
+	size_t off, len, cap;
+};
+
+static int obuf_put(struct obuf *b, const void *p, size_t n) {
+	if (b->len + n > b->cap) {
+		size_t cap = b->cap ? b->cap : 4096;
+		while (cap < b->len + n) cap *= 2;
+		char *d = realloc(b->data, cap);
+		if (!d) return -1;
+		b->data = d;
+		b->cap = cap;
+	}
+	memcpy(b->data + b->len, p, n);
+	b->len += n;
+	return 0;
+}
+
+static int obuf_frame(struct obuf *b, int op, int status, uint32_t tag, const void *payload, size_t n) {
+	struct ctl_hdr h = { sizeof(h) + n, op, status, tag };
+	if (obuf_put(b, &h, sizeof(h)) < 0) return -1;
+	return n ? obuf_put(b, payload, n) : 0;
+}
+
+static int obuf_flush(struct obuf *b, int fd) {      // As far as the socket takes it
+	while (b->off < b->len) {
+		ssize_t n = write(fd, b->data + b->off, b->len - b->off);
+		if (n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+		b->off += n;
+	}
+	b->off = b->len = 0;
+	return 0;
+}
+
+static size_t obuf_backlog(struct obuf *b) {
+	return b->len - b->off;
+}
+
+// Configuration
+
+struct rprinter {
+	char *name;
+	int type;
+	int shard, local;       // local is -1 until the shard has confirmed it
+	uint16_t status;
+	uint16_t slots, busy;
+};
+
+static char *type_names[MAX_RTYPES];
+static int n_types;
+static uint32_t type_reach[MAX_RTYPES];     // Types each type can be converted to, itself included
+static struct rprinter printers[MAX_RPRINTERS];
+static int n_printers;
+
+// Shards, and the replies each still owes us, in order
+
+struct slot;
+
+typedef enum { FWD_REPLY, FWD_PRINTERS, FWD_SUBSCRIBE, FWD_RECOUNT } FWD_KIND;
+
+struct fwd {
+	struct fwd *next;
+	FWD_KIND kind;
+	struct slot *slot;      // FWD_REPLY
+};
+
+struct shard {
+	pid_t pid;
+	int fd;                 // Control connection, -1 while down
+	int cmd_fd;             // Its standard input
+	int ready;              // Printers mapped and events subscribed
+	char dir[64];
+	FILE *init;
+	int16_t global[SHARD_PRINTERS];      // Local printer id -> global
+	uint32_t all;                        // Local printers we know of
+	uint32_t reach[MAX_RTYPES];          // Local printers that can take each type
+	int load;               // Jobs routed here and not finished yet
+	uint64_t routed;
+	char in[2 * CTL_FRAME_MAX];
+	size_t in_len;
+	struct obuf out;
+	struct fwd *head, **tail;
+};
+
+static struct shard shards[MAX_SHARDS];
+static int n_shards = 2;
+
+// Clients.  The terminal is a client of its own, whose replies are printed.
+
+struct slot {                // A reply owed to a client, sent once complete and at the head of its queue
+	struct slot *next;
+	struct client *c;        // NULL once the client has gone
+	uint16_t op, status;
+	uint32_t tag;
+	int parts;               // Shard replies still to come
+	int shard;               // -1 for a query merged from every shard
+	uint32_t eligible;       // Of a submission
+	struct obuf data;
+};
+
+struct client {
+	int fd;                  // -1 when the slot is free
+	int term;
+	int subscribed;
+	struct ctl_filter filter;
+	uint64_t dropped;
+	char tenant[TENANT_NAME_MAX + 1];      // CTL_TENANT, passed on with each of its submissions
+	char in[CTL_FRAME_MAX];
+	size_t in_len;
+	struct obuf out;
+	struct slot *head, **tail;
+};
+
+static struct client clients[MAX_RCLIENTS];
+static struct client term = { .fd = -1, .term = 1 };
+static int n_subscribers;
+static int listen_fd = -1;
+static volatile sig_atomic_t stop;
+
+// Jobs, for filtering events by printer
+
+struct rjob {
+	struct rjob *next;
+	int32_t id;
+	int16_t printer;
+	uint32_t eligible;
+};
+
+static struct rjob *job_map[JOB_BUCKETS];
+
+static struct rjob **job_find(int32_t id) {
+	struct rjob **jp = &job_map[(uint32_t)id % JOB_BUCKETS];
+	while (*jp && (*jp)->id != id) jp = &(*jp)->next;
+	return jp;
+}
+
+static void job_forget(int32_t id) {
+	struct rjob **jp = job_find(id), *j = *jp;
+	if (!j) return;
+	*jp = j->next;
+	free(j);
+}
+
+static int type_index(const char *name) {
+	for (int i=0; i<n_types; i++)
+		if (!strcmp(type_names[i], name)) return i;
+	return -1;
+}
+
+static int infer_type(const char *file) {     // By extension, as the spooler does
+	const char *base = strrchr(file, '/');
+	const char *ext = strrchr(base ? base : file, '.');
+	return ext ? type_index(ext + 1) : -1;
+}
+
+static int printer_index(const char *name) {
+	for (int i=0; i<n_printers; i++)
+		if (!strcmp(printers[i].name, name)) return i;
+	return -1;
+}
+
+static int32_t global_job(int shard, int32_t local) {
+	return local * n_shards + shard;
+}
+
+static uint32_t global_mask(struct shard *s, uint32_t local) {     // Eligible sets: only the first 32 printers have a bit
+	if (local == UINT32_MAX) return UINT32_MAX;
+	uint32_t m = 0;
+	for (int l=0; l<SHARD_PRINTERS; l++)
+		if ((local & (1u << l)) && s->global[l] >= 0 && s->global[l] < 32) m |= 1u << s->global[l];
+	return m;
+}
+
+static uint32_t local_mask(int k, uint32_t eligible) {     // 0 is any printer
+	uint32_t m = 0;
+	for (int g=0; g<32 && g<n_printers; g++)
+		if ((eligible & (1u << g)) && printers[g].shard == k && printers[g].local >= 0) m |= 1u << printers[g].local;
+	return m;
+}
+
+// Replies to clients
+
+static void slot_free(struct slot *sl) {
+	free(sl->data.data);
+	free(sl);
+}
+
+static void print_reply(struct slot *sl) {     // The terminal's replies
+	if (sl->status != CTL_OK) {
+		printf("ERROR %s\n", sl->status < sizeof(status_names) / sizeof(*status_names) ? status_names[sl->status] : "?");
+	} else if (sl->op == CTL_SUBMIT) {
+		int32_t id;
+		memcpy(&id, sl->data.data, sizeof(id));
+		printf("JOB %d shard=%d\n", id, id % n_shards);
+	} else if (sl->op == CTL_QUERY) {
+		struct ctl_job_info *info = (struct ctl_job_info *)sl->data.data;
+		for (size_t i=0; i<sl->data.len / sizeof(*info); i++) {
+			printf("JOB[%d]: shard=%d, status=%s, printer=%s, eligible=", info[i].id, info[i].id % n_shards,
+				info[i].status < 6 ? job_states[info[i].status] : "?",
+				info[i].printer >= 0 ? printers[info[i].printer].name : "-");
+			if (info[i].eligible == UINT32_MAX) printf("any");
+			for (int g=0; g<32 && info[i].eligible != UINT32_MAX; g++)
+				if (info[i].eligible & (1u << g)) printf("%s%s", g < n_printers ? printers[g].name : "?", info[i].eligible >> g > 1 ? "," : "");
+			printf("\n");
+		}
+	} else {
+		printf("OK\n");
+	}
+	fflush(stdout);
+}
+
+static void deliver(struct client *c) {      // Send the completed replies at the head of the queue
+	struct slot *sl;
+	while ((sl = c->head) && sl->parts == 0) {
+		if (c->term) print_reply(sl);
+		else obuf_frame(&c->out, sl->op, sl->status, sl->tag, sl->data.data, sl->data.len);
+		if (!(c->head = sl->next)) c->tail = &c->head;
+		slot_free(sl);
+	}
+}
+
+static struct slot *slot_new(struct client *c, struct ctl_hdr *h) {
+	struct slot *sl = calloc(1, sizeof(*sl));
+	if (!sl) return NULL;
+	sl->c = c;
+	sl->op = h->op;
+	sl->tag = h->tag;
+	sl->shard = -1;
+	*c->tail = sl;
+	c->tail = &sl->next;
+	return sl;
+}
+
+static void reply(struct client *c, struct ctl_hdr *h, int status, const void *payload, size_t n) {
+	struct slot *sl = slot_new(c, h);
+	if (!sl) return;
+	sl->status = status;
+	if (n) obuf_put(&sl->data, payload, n);
+	deliver(c);
+}
+
+static void part_done(struct slot *sl) {
+	if (--sl->parts > 0) return;
+	if (sl->c) deliver(sl->c);
+	else slot_free(sl);
+}
+
+// Talking to shards
+
+static void shard_down(struct shard *s) {
+	if (s->fd < 0) return;
+	fprintf(stderr, "presi_router: shard %d (%s) is down\n", (int)(s - shards), s->dir);
+	close(s->fd);
+	s->fd = -1;
+	s->ready = 0;
+	free(s->out.data);
+	s->out = (struct obuf){0};
+
+	struct fwd *f;
+	while ((f = s->head)) {      // Whatever it still owed is not coming
+		s->head = f->next;
+		if (f->kind == FWD_REPLY) {
+			if (f->slot->shard >= 0) f->slot->status = CTL_EDOWN;
+			part_done(f->slot);
+		}
+		free(f);
+	}
+	s->tail = &s->head;
+}
+
+static int shard_send(struct shard *s, int op, const void *payload, size_t n, FWD_KIND kind, struct slot *sl) {
+	struct fwd *f = calloc(1, sizeof(*f));
+	if (s->fd < 0 || !f || obuf_frame(&s->out, op, 0, 0, payload, n) < 0) {
+		free(f);
+		return -1;
+	}
+	f->kind = kind;
+	f->slot = sl;
+	*s->tail = f;
+	s->tail = &f->next;
+	if (obuf_flush(&s->out, s->fd) < 0) shard_down(s);     // Completes the slot
+	return 0;
+}
+
+static void forward(struct shard *s, struct slot *sl, int op, const void *payload, size_t n) {
+	sl->parts++;
+	if (shard_send(s, op, payload, n, FWD_REPLY, sl) < 0) {
+		if (sl->shard >= 0) sl->status = CTL_EDOWN;
+		part_done(sl);
+	}
+}
+
+// Events: translated to global ids, then filtered per subscriber as the spooler does
+
+static int filter_match(const struct ctl_filter *f, struct evring_rec *r, int printer, uint32_t eligible) {
+	int printer_ev = r->type == EVR_PRINTER_DEFINED || r->type == EVR_PRINTER_STATUS;
+
+	uint32_t kinds = f->kinds;
+	if (!kinds) kinds = (f->job >= 0 || f->status_mask) ? CTL_WATCH_JOBS : CTL_WATCH_JOBS | CTL_WATCH_PRINTERS;
+	if (!(kinds & (printer_ev ? CTL_WATCH_PRINTERS : CTL_WATCH_JOBS))) return 0;
+	if (printer_ev) return f->printer < 0 || f->printer == r->id;
+
+	if (f->job >= 0 && f->job != r->id) return 0;
+	if (f->status_mask && !(f->status_mask & (1u << r->status))) return 0;
+	if (f->printer >= 0) {
+		if (printer >= 0) return printer == f->printer;
+		return f->printer < 32 && (eligible & (1u << f->printer)) != 0;
+	}
+	return 1;
+}
+
+static void publish(struct evring_rec *r, int printer, uint32_t eligible) {
+	for (int i=0; i<MAX_RCLIENTS && n_subscribers; i++) {
+		struct client *c = &clients[i];
+		if (c->fd < 0 || !c->subscribed || !filter_match(&c->filter, r, printer, eligible)) continue;
+		if (c->dropped || obuf_backlog(&c->out) + sizeof(struct ctl_hdr) + sizeof(*r) > SUB_BUFFER) {
+			c->dropped++;
+			continue;
+		}
+		obuf_frame(&c->out, CTL_EVENT, CTL_OK, 0, r, sizeof(*r));
+	}
+}
+
+static void on_event(struct shard *s, struct evring_rec *r) {
+	int k = s - shards;
+
+	if (r->type == EVR_PRINTER_DEFINED || r->type == EVR_PRINTER_STATUS) {
+		if (r->id < 0 || r->id >= SHARD_PRINTERS || s->global[r->id] < 0) return;     // Not one of ours
+		r->id = s->global[r->id];
+		printers[r->id].status = r->status;
+		publish(r, r->id, 0);
+		return;
+	}
+
+	r->id = global_job(k, r->id);
+	struct rjob **jp = job_find(r->id), *j = *jp;
+	if (r->type == EVR_JOB_CREATED && !j && (j = calloc(1, sizeof(*j)))) {
+		// Created while serving the request at the head of our queue, if we sent it
+		struct slot *sl = s->head && s->head->kind == FWD_REPLY ? s->head->slot : NULL;
+		j->id = r->id;
+		j->printer = -1;
+		j->eligible = sl && sl->op == CTL_SUBMIT && sl->eligible ? sl->eligible : UINT32_MAX;
+		*jp = j;
+	}
+	if (r->type == EVR_JOB_STARTED) {
+		r->aux = r->aux >= 0 && r->aux < SHARD_PRINTERS ? s->global[r->aux] : -1;
+		if (j) j->printer = r->aux;
+		if (r->aux >= 0) printers[r->aux].busy++;
+	}
+	if (r->type == EVR_JOB_FINISHED || r->type == EVR_JOB_ABORTED) {
+		if (s->load > 0) s->load--;
+		if (j && j->printer >= 0 && printers[j->printer].busy > 0) printers[j->printer].busy--;
+	}
+
+	publish(r, j ? j->printer : -1, j ? j->eligible : UINT32_MAX);
+	if (r->type == EVR_JOB_DELETED) job_forget(r->id);
+}
+
+static void map_printers(struct shard *s, struct ctl_printer_info *info, size_t n) {
+	int k = s - shards;
+	for (int l=0; l<SHARD_PRINTERS; l++) s->global[l] = -1;
+	s->all = 0;
+	for (size_t i=0; i<n; i++) {
+		int g = printer_index(info[i].name);
+		if (g < 0 || printers[g].shard != k || info[i].id < 0 || info[i].id >= SHARD_PRINTERS) continue;
+		printers[g].local = info[i].id;
+		printers[g].status = info[i].status;
+		printers[g].slots = info[i].slots ? info[i].slots : 1;
+		printers[g].busy = info[i].busy;
+		s->global[info[i].id] = g;
+		s->all |= 1u << info[i].id;
+	}
+	for (int t=0; t<n_types; t++) {
+		s->reach[t] = 0;
+		for (int l=0; l<SHARD_PRINTERS; l++)
+			if (s->global[l] >= 0 && (type_reach[t] & (1u << printers[s->global[l]].type))) s->reach[t] |= 1u << l;
+	}
+}
+
+static void on_reply(struct shard *s, struct ctl_hdr *h, char *payload, size_t n) {
+	struct fwd *f = s->head;
+	if (!f) return;
+	if (!(s->head = f->next)) s->tail = &s->head;
+
+	if (f->kind == FWD_PRINTERS) {
+		map_printers(s, (struct ctl_printer_info *)payload, n / sizeof(struct ctl_printer_info));
+	} else if (f->kind == FWD_SUBSCRIBE) {
+		s->ready = h->status == CTL_OK;
+	} else if (f->kind == FWD_RECOUNT) {       // After lost events: count what is still outstanding
+		struct ctl_job_info *info = (struct ctl_job_info *)payload;
+		s->load = 0;
+		for (size_t i=0; i<n / sizeof(*info); i++)
+			if (info[i].status <= 2) s->load++;
+	} else {
+		struct slot *sl = f->slot;
+		int k = s - shards;
+		if (sl->shard >= 0) sl->status = h->status;
+		if (sl->op == CTL_SUBMIT) {
+			if (h->status == CTL_OK && n == sizeof(int32_t)) {
+				int32_t id;
+				memcpy(&id, payload, sizeof(id));
+				id = global_job(k, id);
+				obuf_put(&sl->data, &id, sizeof(id));
+			} else if (s->load > 0) {
+				s->load--;
+			}
+		} else if (sl->op == CTL_QUERY) {
+			struct ctl_job_info *info = (struct ctl_job_info *)payload;
+			for (size_t i=0; i<n / sizeof(*info); i++) {
+				info[i].id = global_job(k, info[i].id);
+				info[i].printer = info[i].printer >= 0 && info[i].printer < SHARD_PRINTERS ? s->global[info[i].printer] : -1;
+				info[i].eligible = global_mask(s, info[i].eligible);
+				if (sl->data.len + sizeof(*info) <= CTL_FRAME_MAX - sizeof(struct ctl_hdr))
+					obuf_put(&sl->data, &info[i], sizeof(*info));
+			}
+		}
+		part_done(sl);
+	}
+	free(f);
+}
+
+static void read_shard(struct shard *s) {
+	ssize_t n = read(s->fd, s->in + s->in_len, sizeof(s->in) - s->in_len);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+	if (n <= 0) {
+		shard_down(s);
+		return;
+	}
+	s->in_len += n;
+
+	size_t off = 0;
+	while (s->in_len - off >= sizeof(struct ctl_hdr)) {
+		struct ctl_hdr h;
+		memcpy(&h, s->in + off, sizeof(h));
+		if (h.len < sizeof(h) || h.len > CTL_FRAME_MAX) {
+			shard_down(s);
+			return;
+		}
+		if (s->in_len - off < h.len) break;
+
+		char *payload = s->in + off + sizeof(h);
+		size_t len = h.len - sizeof(h);
+		if (h.op == CTL_EVENT && len == sizeof(struct evring_rec)) {
+			struct evring_rec r;
+			memcpy(&r, payload, sizeof(r));
+			on_event(s, &r);
+		} else if (h.op == CTL_RESYNC && len == sizeof(uint64_t)) {
+			uint64_t lost;
+			memcpy(&lost, payload, sizeof(lost));
+			for (int i=0; i<MAX_RCLIENTS; i++)
+				if (clients[i].fd >= 0 && clients[i].subscribed) clients[i].dropped += lost;
+			int32_t all = -1;
+			shard_send(s, CTL_QUERY, &all, sizeof(all), FWD_RECOUNT, NULL);
+		} else {
+			on_reply(s, &h, payload, len);
+		}
+		if (s->fd < 0) return;
+		off += h.len;
+	}
+	memmove(s->in, s->in + off, s->in_len - off);
+	s->in_len -= off;
+}
+
+// Requests
+
+static int capacity(struct shard *s, uint32_t local) {       // Printer slots in a local mask
+	int n = 0;
+	for (; local; local &= local - 1)
+		n += printers[s->global[__builtin_ctz(local)]].slots;
+	return n;
+}
+
+static int route(uint32_t eligible, int type, uint32_t *local) {     // Returns the shard, or -1
+	int best = -1, best_n = 0, fallback = -1, fallback_n = 0;
+
+	for (int k=0; k<n_shards; k++) {
+		struct shard *s = &shards[k];
+		if (!s->ready) continue;
+		uint32_t mine = eligible ? local_mask(k, eligible) : s->all;
+		int n = capacity(s, mine & s->reach[type]);
+		if (n && (best < 0 || s->load * best_n < shards[best].load * n)) {      // Fewest outstanding jobs per printer slot
+			best = k;
+			best_n = n;
+		}
+		n = capacity(s, mine);
+		if (n && (fallback < 0 || s->load * fallback_n < shards[fallback].load * n)) {
+			fallback = k;
+			fallback_n = n;
+		}
+	}
+	if (best < 0) best = fallback;       // Nothing can print it yet: it waits, as on a single spooler
+	if (best >= 0) *local = eligible ? local_mask(best, eligible) : 0;
+	return best;
+}
+
+static void submit(struct client *c, struct ctl_hdr *h, char *payload, size_t n) {
+	uint32_t eligible, local;
+	if (n < sizeof(eligible) + 2 || payload[n-1] != '\0') {
+		reply(c, h, CTL_EBADREQ, NULL, 0);
+		return;
+	}
+	memcpy(&eligible, payload, sizeof(eligible));
+	char *file = payload + sizeof(eligible), buf[CTL_FRAME_MAX];
+	if (c->tenant[0] && file + strlen(file) + 1 == payload + n) {      // Name the connection's tenant to the shard
+		size_t t = strlen(c->tenant) + 1;
+		if (sizeof(struct ctl_hdr) + n + t > CTL_FRAME_MAX) {
+			reply(c, h, CTL_EBADREQ, NULL, 0);
+			return;
+		}
+		memcpy(buf, payload, n);
+		memcpy(buf + n, c->tenant, t);
+		payload = buf;
+		n += t;
+	}
+	int type = infer_type(payload + sizeof(eligible));
+	if (type < 0) {
+		reply(c, h, CTL_ETYPE, NULL, 0);
+		return;
+	}
+
+	int k = route(eligible, type, &local);
+	if (k < 0) {
+		int any = 0;
+		for (int i=0; i<n_shards; i++) any |= shards[i].ready;
+		reply(c, h, any ? CTL_EBADREQ : CTL_EDOWN, NULL, 0);      // No such printer, or nowhere to send it
+		return;
+	}
+
+	struct slot *sl = slot_new(c, h);
+	if (!sl) return;
+	sl->shard = k;
+	sl->eligible = eligible;
+	memcpy(payload, &local, sizeof(local));
+	shards[k].load++;
+	shards[k].routed++;
+	forward(&shards[k], sl, CTL_SUBMIT, payload, n);
+}
+
+static void job_request(struct client *c, struct ctl_hdr *h, char *payload, size_t n) {
+	int32_t id;
+	if (n != sizeof(id)) {
+		reply(c, h, CTL_EBADREQ, NULL, 0);
+		return;
+	}
+	memcpy(&id, payload, sizeof(id));
+
+	if (h->op == CTL_QUERY && id < 0) {        // Merged from every shard
+		struct slot *sl = slot_new(c, h);
+		if (!sl) return;
+		sl->parts = 1;           // Held until every shard has been asked
+		for (int k=0; k<n_shards; k++)
+			if (shards[k].ready) forward(&shards[k], sl, CTL_QUERY, &id, sizeof(id));
+		part_done(sl);
+		return;
+	}
+	if (id < 0) {
+		reply(c, h, CTL_ENOENT, NULL, 0);
+		return;
+	}
+
+	int k = id % n_shards;
+	int32_t local = id / n_shards;
+	if (!shards[k].ready) {
+		reply(c, h, CTL_EDOWN, NULL, 0);
+		return;
+	}
+	struct slot *sl = slot_new(c, h);
+	if (!sl) return;
+	sl->shard = k;
+	forward(&shards[k], sl, h->op, &local, sizeof(local));
+}
+
+static void list_printers(struct client *c, struct ctl_hdr *h) {
+	struct ctl_printer_info info[(CTL_FRAME_MAX - sizeof(struct ctl_hdr)) / sizeof(struct ctl_printer_info)];
+	size_t k = 0;
+
+	for (int g=0; g<n_printers && k < sizeof(info) / sizeof(*info); g++) {
+		if (printers[g].local < 0) continue;
+		memset(&info[k], 0, sizeof(info[k]));
+		info[k].id = g;
+		info[k].status = shards[printers[g].shard].ready ? printers[g].status : 0;
+		info[k].slots = printers[g].slots;
+		info[k].busy = printers[g].busy;
+		strncpy(info[k].name, printers[g].name, sizeof(info[k].name) - 1);
+		strncpy(info[k].type, type_names[printers[g].type], sizeof(info[k].type) - 1);
+		k++;
+	}
+	reply(c, h, CTL_OK, info, k * sizeof(info[0]));
+}
+
+static void request(struct client *c, struct ctl_hdr *h, char *payload, size_t n) {
+	switch (h->op) {
+	case CTL_SUBMIT:
+		submit(c, h, payload, n);
+		break;
+	case CTL_CANCEL:
+	case CTL_PAUSE:
+	case CTL_RESUME:
+	case CTL_QUERY:
+		job_request(c, h, payload, n);
+		break;
+	case CTL_PRINTERS:
+		list_printers(c, h);
+		break;
+	case CTL_SUBSCRIBE:
+		if (n != 0 && n != sizeof(c->filter)) {
+			reply(c, h, CTL_EBADREQ, NULL, 0);
+			break;
+		}
+		if (n) memcpy(&c->filter, payload, n);
+		else c->filter = (struct ctl_filter){ -1, -1, 0, 0 };
+		if (!c->subscribed) n_subscribers++;
+		c->subscribed = 1;
+		reply(c, h, CTL_OK, NULL, 0);
+		break;
+	case CTL_UNSUBSCRIBE:
+		if (c->subscribed) n_subscribers--;
+		c->subscribed = 0;
+		reply(c, h, CTL_OK, NULL, 0);
+		break;
+	case CTL_TENANT:          // Kept here: the shards learn of it with each submission
+		if (n == 0 || n > sizeof(c->tenant) || payload[n-1] != '\0') {
+			reply(c, h, CTL_EBADREQ, NULL, 0);
+			break;
+		}
+		memcpy(c->tenant, payload, n);
+		reply(c, h, CTL_OK, NULL, 0);
+		break;
+	default:
+		reply(c, h, CTL_EBADREQ, NULL, 0);
+	}
+}
+
+// Clients
+
+static void drop_client(struct client *c) {
+	close(c->fd);
+	c->fd = -1;
+	if (c->subscribed) n_subscribers--;
+	c->subscribed = 0;
+	c->dropped = 0;
+	c->tenant[0] = '\0';
+	free(c->out.data);
+	c->out = (struct obuf){0};
+	c->in_len = 0;
+
+	struct slot *sl;
+	while ((sl = c->head)) {      // Replies still owed by a shard are dropped when they come
+		c->head = sl->next;
+		if (sl->parts) sl->c = NULL;
+		else slot_free(sl);
+	}
+	c->tail = &c->head;
+}
+
+static int read_client(struct client *c) {      // -1 if the client is gone or misbehaving
+	ssize_t n = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+	if (n == 0) return -1;
+	if (n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+	c->in_len += n;
+
+	size_t off = 0;
+	while (c->in_len - off >= sizeof(struct ctl_hdr)) {
+		struct ctl_hdr h;
+		memcpy(&h, c->in + off, sizeof(h));
+		if (h.len < sizeof(h) || h.len > CTL_FRAME_MAX) return -1;
+		if (c->in_len - off < h.len) break;
+		request(c, &h, c->in + off + sizeof(h), h.len - sizeof(h));
+		off += h.len;
+	}
+	memmove(c->in, c->in + off, c->in_len - off);
+	c->in_len -= off;
+	return 0;
+}
+
+static int flush_client(struct client *c) {
+	if (obuf_flush(&c->out, c->fd) < 0) return -1;
+	if (c->dropped && obuf_backlog(&c->out) == 0) {      // Caught up: tell the subscriber what it missed
+		obuf_frame(&c->out, CTL_RESYNC, CTL_OK, 0, &c->dropped, sizeof(c->dropped));
+		c->dropped = 0;
+		return obuf_flush(&c->out, c->fd);
+	}
+	return 0;
+}
+
+static void accept_clients(void) {
+	int fd;
+	while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+		int i = 0;
+		while (i < MAX_RCLIENTS && clients[i].fd >= 0) i++;
+		if (i == MAX_RCLIENTS || fcntl(fd, F_SETFL, O_NONBLOCK) < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+			close(fd);
+			continue;
+		}
+		clients[i].fd = fd;
+		clients[i].head = NULL;
+		clients[i].tail = &clients[i].head;
+	}
+}
+
+static int open_listener(const char *path) {
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(sa.sun_path)) return -1;
+	strcpy(sa.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(fd, 64) < 0
+	    || fcntl(fd, F_SETFL, O_NONBLOCK) < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// The terminal: a few commands, answered from the merged view
+
+static void show_shards(void) {
+	for (int k=0; k<n_shards; k++) {
+		struct shard *s = &shards[k];
+		int n = 0;
+		for (int l=0; l<SHARD_PRINTERS; l++) n += s->global[l] >= 0;
+		printf("SHARD[%d]: pid=%d, dir=%s, status=%s, printers=%d, outstanding=%d, routed=%llu\n",
+			k, (int)s->pid, s->dir, s->ready ? "up" : "down", n, s->load, (unsigned long long)s->routed);
+	}
+}
+
+static void show_printers(void) {
+	for (int g=0; g<n_printers; g++) {
+		if (printers[g].local < 0) continue;
+		int st = shards[printers[g].shard].ready ? printers[g].status : 0;
+		printf("PRINTER: id=%d, name=%s, type=%s, status=%s, slots=%d/%d, shard=%d\n", g, printers[g].name,
+			type_names[printers[g].type], st < 3 ? printer_states[st] : "?", printers[g].busy, printers[g].slots, printers[g].shard);
+	}
+}
+
+static void term_request(int op, const void *payload, size_t n) {
+	struct ctl_hdr h = { sizeof(h) + n, op, 0, 0 };
+	char buf[CTL_FRAME_MAX];
+	memcpy(buf, payload, n);
+	request(&term, &h, buf, n);
+}
+
+static int term_command(char *line) {      // Returns 1 on "quit"
+	char *argv[34];
+	int argc = 0;
+	for (char *tok = strtok(line, " \t\n"); tok && argc < 33; tok = strtok(NULL, " \t\n"))
+		argv[argc++] = tok;
+	if (argc == 0) return 0;
+
+	if (!strcmp(argv[0], "quit")) return 1;
+	if (!strcmp(argv[0], "help")) {
+		printf("Commands:\nhelp quit\nshards printers jobs\nprint <file> [printers...]\npause resume cancel <id>\n");
+	} else if (!strcmp(argv[0], "shards")) {
+		show_shards();
+	} else if (!strcmp(argv[0], "printers")) {
+		show_printers();
+	} else if (!strcmp(argv[0], "jobs")) {
+		int32_t all = -1;
+		term_request(CTL_QUERY, &all, sizeof(all));
+	} else if (!strcmp(argv[0], "print") && argc >= 2) {
+		char payload[CTL_FRAME_MAX];
+		uint32_t eligible = 0;
+		size_t len = strlen(argv[1]) + 1;
+		for (int i=2; i<argc; i++) {
+			int g = printer_index(argv[i]);
+			if (g < 0 || g >= 32) {
+				printf("ERROR %s: %s\n", argv[i], g < 0 ? "no such printer" : "only the first 32 printers can be named");
+				return 0;
+			}
+			eligible |= 1u << g;
+		}
+		if (sizeof(eligible) + len > sizeof(payload) - sizeof(struct ctl_hdr)) return 0;
+		memcpy(payload, &eligible, sizeof(eligible));
+		memcpy(payload + sizeof(eligible), argv[1], len);
+		term_request(CTL_SUBMIT, payload, sizeof(eligible) + len);
+	} else if ((!strcmp(argv[0], "cancel") || !strcmp(argv[0], "pause") || !strcmp(argv[0], "resume")) && argc == 2) {
+		int32_t id = atoi(argv[1]);
+		term_request(!strcmp(argv[0], "cancel") ? CTL_CANCEL : !strcmp(argv[0], "pause") ? CTL_PAUSE : CTL_RESUME, &id, sizeof(id));
+	} else {
+		printf("ERROR bad command\n");
+	}
+	fflush(stdout);
+	return 0;
+}
+
+static int read_term(void) {       // Returns 1 on "quit", -1 at the end of input
+	static char buf[4096];
+	static size_t len;
+
+	ssize_t n = read(STDIN_FILENO, buf + len, sizeof(buf) - 1 - len);
+	if (n < 0) return errno == EINTR ? 0 : -1;
+	if (n == 0) return -1;
+	len += n;
+
+	char *nl;
+	while ((nl = memchr(buf, '\n', len))) {
+		*nl = '\0';
+		int quit = term_command(buf);
+		len -= nl + 1 - buf;
+		memmove(buf, nl + 1, len);
+		if (quit) return 1;
+	}
+	if (len == sizeof(buf) - 1) len = 0;      // Overlong line
+	return 0;
+}
+
+// Setting up: split the command file between the shards and start them
+
+static void add_reach(int from, int to) {
+	type_reach[from] |= 1u << to;
+	for (int changed = 1; changed; ) {       // Transitive closure; the type graph is small
+		changed = 0;
+		for (int a=0; a<n_types; a++)
+			for (int b=0; b<n_types; b++)
+				if ((type_reach[a] & (1u << b)) && (type_reach[a] | type_reach[b]) != type_reach[a]) {
+					type_reach[a] |= type_reach[b];
+					changed = 1;
+				}
+	}
+}
+
+static void put_line(int k, const char *line) {     // "{shard}" becomes the shard's directory
+	const char *p = line, *m;
+	while ((m = strstr(p, "{shard}"))) {
+		fwrite(p, 1, m - p, shards[k].init);
+		fputs(shards[k].dir, shards[k].init);
+		p = m + strlen("{shard}");
+	}
+	fputs(p, shards[k].init);
+	fputc('\n', shards[k].init);
+}
+
+static void put_class(char *line) {      // Each shard gets the class with the members it owns, if any
+	char *argv[MAX_RPRINTERS + 4];
+	int argc = 0;
+	for (char *tok = strtok(line, " \t"); tok && argc < (int)(sizeof(argv) / sizeof(*argv)); tok = strtok(NULL, " \t"))
+		argv[argc++] = tok;
+	int members = argc >= 4 && !strcmp(argv[argc-2], "--policy") ? argc - 2 : argc;
+
+	for (int k=0; k<n_shards; k++) {
+		int n = 0;
+		for (int i=2; i<members; i++) {
+			int g = printer_index(argv[i]);
+			if (g < 0 || printers[g].shard != k) continue;
+			if (!n++) fprintf(shards[k].init, "class %s", argv[1]);
+			fprintf(shards[k].init, " %s", argv[i]);
+		}
+		if (!n) continue;
+		if (members < argc) fprintf(shards[k].init, " --policy %s", argv[argc-1]);
+		fputc('\n', shards[k].init);
+	}
+}
+
+static int split_config(const char *path) {
+	FILE *in = fopen(path, "r");
+	if (!in) return -1;
+
+	char *line = NULL, *copy = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	while ((len = getline(&line, &cap, in)) >= 0) {
+		if (len && line[len-1] == '\n') line[--len] = '\0';
+		free(copy);
+		if (!(copy = strdup(line))) break;
+		char *argv[5];
+		int argc = 0;
+		for (char *tok = strtok(copy, " \t"); tok && argc < 5; tok = strtok(NULL, " \t"))
+			argv[argc++] = tok;
+
+		int owner = -1;          // Lines about one printer go to its shard only
+		if (argc >= 3 && !strcmp(argv[0], "class")) {
+			put_class(line);
+			continue;
+		}
+		if (argc >= 2 && !strcmp(argv[0], "type") && n_types < MAX_RTYPES && type_index(argv[1]) < 0) {
+			type_names[n_types] = strdup(argv[1]);
+			type_reach[n_types] = 1u << n_types;
+			n_types++;
+		} else if (argc >= 4 && !strcmp(argv[0], "conversion") && type_index(argv[1]) >= 0 && type_index(argv[2]) >= 0) {
+			add_reach(type_index(argv[1]), type_index(argv[2]));
+		} else if ((argc == 3 || (argc == 5 && !strcmp(argv[3], "--slots"))) && !strcmp(argv[0], "printer")) {
+			int k = n_printers % n_shards;
+			if (n_printers == MAX_RPRINTERS || n_printers / n_shards >= SHARD_PRINTERS || type_index(argv[2]) < 0
+			    || printer_index(argv[1]) >= 0) {
+				fprintf(stderr, "presi_router: %s: printer not added\n", line);
+				continue;
+			}
+			printers[n_printers] = (struct rprinter){ strdup(argv[1]), type_index(argv[2]), k, -1, 0, argc == 5 ? atoi(argv[4]) : 1, 0 };
+			n_printers++;
+			owner = k;
+		} else if (argc == 2 && (!strcmp(argv[0], "enable") || !strcmp(argv[0], "disable")) && printer_index(argv[1]) >= 0) {
+			owner = printers[printer_index(argv[1])].shard;
+		}
+
+		for (int k=0; k<n_shards; k++)
+			if (owner < 0 || owner == k) put_line(k, line);
+	}
+	free(line);
+	free(copy);
+	fclose(in);
+	return 0;
+}
+
+static int start_shard(int k, const char *presi) {
+	struct shard *s = &shards[k];
+	char init[128];
+	snprintf(init, sizeof(init), "%s/init", s->dir);
+
+	int in[2];
+	if (pipe(in) < 0) return -1;
+	pid_t pid = fork();
+	if (pid < 0) return -1;
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		dup2(in[0], STDIN_FILENO);
+		dup2(null, STDOUT_FILENO);
+		close(in[0]); close(in[1]); close(null);
+		execl(presi, presi, "-q", "-i", init, (char *)NULL);
+		_exit(127);
+	}
+	close(in[0]);
+	fcntl(in[1], F_SETFD, FD_CLOEXEC);        // Later shards must not hold it, or this one never sees EOF
+	s->pid = pid;
+	s->cmd_fd = in[1];
+	return 0;
+}
+
+static int connect_shard(struct shard *s) {      // Waits for it to finish its command file
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	snprintf(sa.sun_path, sizeof(sa.sun_path), "%s/presi.ctl", s->dir);
+
+	for (int tries = 0; tries < 100; tries++) {
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0) return -1;
+		if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0) {
+			fcntl(fd, F_SETFL, O_NONBLOCK);
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+			s->fd = fd;
+			shard_send(s, CTL_PRINTERS, NULL, 0, FWD_PRINTERS, NULL);
+			shard_send(s, CTL_SUBSCRIBE, NULL, 0, FWD_SUBSCRIBE, NULL);
+			return 0;
+		}
+		close(fd);
+		if (waitpid(s->pid, NULL, WNOHANG) == s->pid) break;
+		usleep(100000);
+	}
+	return -1;
+}
+
+static void stop_shards(void) {
+	for (int k=0; k<n_shards; k++) {
+		struct shard *s = &shards[k];
+		if (s->cmd_fd >= 0 && write(s->cmd_fd, "quit\n", 5) < 0) { /* Already gone */ }
+		if (s->cmd_fd >= 0) close(s->cmd_fd);
+		s->cmd_fd = -1;
+	}
+	for (int k=0; k<n_shards; k++)
+		if (shards[k].pid > 0) waitpid(shards[k].pid, NULL, 0);
+}
+
+static void on_signal(int sig) {
+	(void)sig;
+	stop = 1;
+}
+
+static void usage(char *prog) {
+	fprintf(stderr, "Usage: %s [-n shards] [-s socket] [-x presi] command-file\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	char *path = CTL_SOCKET, *presi = "bin/presi";
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:s:x:")) != -1) {
+		switch (opt) {
+		case 'n': n_shards = atoi(optarg); break;
+		case 's': path = optarg; break;
+		case 'x': presi = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || n_shards < 1 || n_shards > MAX_SHARDS) usage(argv[0]);
+
+	mkdir("spool", 0755);
+	for (int k=0; k<n_shards; k++) {
+		struct shard *s = &shards[k];
+		char init[128];
+		snprintf(s->dir, sizeof(s->dir), "spool/shard%d", k);
+		snprintf(init, sizeof(init), "%s/init", s->dir);
+		mkdir(s->dir, 0755);
+		s->fd = s->cmd_fd = -1;
+		s->tail = &s->head;
+		for (int l=0; l<SHARD_PRINTERS; l++) s->global[l] = -1;
+		if (!(s->init = fopen(init, "w"))) {
+			perror(init);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (split_config(argv[optind]) < 0) {
+		perror(argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+
+	struct sigaction sa = { .sa_handler = on_signal };
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (int k=0; k<n_shards; k++) {
+		fprintf(shards[k].init, "control %s/presi.ctl\n", shards[k].dir);       // Last, so that everything is defined when we connect
+		fclose(shards[k].init);
+		if (start_shard(k, presi) < 0) {
+			perror(presi);
+			stop_shards();
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (int k=0; k<n_shards; k++)
+		if (connect_shard(&shards[k]) < 0) fprintf(stderr, "presi_router: shard %d did not come up\n", k);
+
+	for (int i=0; i<MAX_RCLIENTS; i++) clients[i].fd = -1;
+	term.tail = &term.head;
+	int term_open = 1;
+
+	while (!stop) {
+		int ready = 1;
+		for (int k=0; k<n_shards; k++)
+			if (shards[k].fd >= 0 && !shards[k].ready) ready = 0;     // Still mapping its printers
+
+		if (ready && listen_fd < 0) {
+			if ((listen_fd = open_listener(path)) < 0) {
+				perror(path);
+				break;
+			}
+			printf("ROUTER %d shards, %d printers, socket %s\n", n_shards, n_printers, path);
+			fflush(stdout);
+		}
+
+		struct pollfd pfd[1 + 1 + MAX_SHARDS + MAX_RCLIENTS];
+		int n = 0;
+		pfd[n++] = (struct pollfd){ ready && term_open ? STDIN_FILENO : -1, POLLIN, 0 };
+		pfd[n++] = (struct pollfd){ listen_fd, POLLIN, 0 };
+		for (int k=0; k<n_shards; k++)
+			pfd[n++] = (struct pollfd){ shards[k].fd, POLLIN | (obuf_backlog(&shards[k].out) ? POLLOUT : 0), 0 };
+		for (int i=0; i<MAX_RCLIENTS; i++) {
+			struct client *c = &clients[i];
+			short ev = (obuf_backlog(&c->out) < SUB_BUFFER ? POLLIN : 0) | (obuf_backlog(&c->out) ? POLLOUT : 0);
+			pfd[n++] = (struct pollfd){ c->fd, ev, 0 };      // Not read while its replies back up
+		}
+		if (poll(pfd, n, -1) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		n = 0;
+		if (pfd[n++].revents) {
+			int rc = read_term();
+			if (rc > 0) break;
+			if (rc < 0) term_open = 0;       // Run on until signalled
+		}
+		if (pfd[n++].revents) accept_clients();
+		for (int k=0; k<n_shards; k++, n++) {
+			struct shard *s = &shards[k];
+			if (s->fd < 0 || !pfd[n].revents) continue;
+			if ((pfd[n].revents & POLLOUT) && obuf_flush(&s->out, s->fd) < 0) shard_down(s);
+			if (s->fd >= 0 && (pfd[n].revents & (POLLIN | POLLHUP | POLLERR))) read_shard(s);
+			if (s->fd < 0) waitpid(s->pid, NULL, WNOHANG);
+		}
+		for (int i=0; i<MAX_RCLIENTS; i++, n++) {
+			struct client *c = &clients[i];
+			if (c->fd >= 0 && (pfd[n].revents & (POLLIN | POLLHUP | POLLERR)) && read_client(c) < 0) drop_client(c);
+		}
+		for (int i=0; i<MAX_RCLIENTS; i++)       // Replies and events queued by anything above
+			if (clients[i].fd >= 0 && flush_client(&clients[i]) < 0) drop_client(&clients[i]);
+	}
+
+	if (listen_fd >= 0) {
+		close(listen_fd);
+		unlink(path);
+	}
+	for (int i=0; i<MAX_RCLIENTS; i++)
+		if (clients[i].fd >= 0) drop_client(&clients[i]);
+	stop_shards();
+	return EXIT_SUCCESS;
+}
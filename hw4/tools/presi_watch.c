@@ -0,0 +1,97 @@
+/*
+ * Presi: stream job and printer state changes from the control socket
+ *
+ * Subscribes with a server-side filter and prints each event as it arrives.
+ * After a resync marker (events were dropped because we fell behind) the
+ * current state of the matching jobs is fetched and printed again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "presi_client.h"
+
+static char *job_states[] = { "created", "running", "paused", "finished", "aborted", "deleted" };
+static char *printer_states[] = { "disabled", "idle", "busy" };
+
+static void usage(char *prog) {
+	fprintf(stderr, "Usage: %s [-s socket] [-j job] [-p printer-id] [-S status]... [-J] [-P] [-d delay-us]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+static void print_event(struct evring_rec *r) {
+	int printer_ev = r->type == EVR_PRINTER_DEFINED || r->type == EVR_PRINTER_STATUS;
+	char *st = printer_ev ? (r->status < 3 ? printer_states[r->status] : "?")
+			      : (r->status < 6 ? job_states[r->status] : "?");
+
+	printf("%llu.%06llu %-13s %d %s",
+		(unsigned long long)(r->time_ns / 1000000000u), (unsigned long long)(r->time_ns % 1000000000u / 1000),
+		evring_type_name(r->type), r->id, st);
+	if (r->type == EVR_JOB_STARTED) printf(" printer=%d pgid=%d", r->aux, r->arg);
+	else if (r->type == EVR_JOB_FINISHED || r->type == EVR_JOB_ABORTED) printf(" status=0x%x", r->arg);
+	else if (r->type == EVR_JOB_LATE) printf(" late_by=%ds", r->arg);
+	printf("\n");
+}
+
+static int resync(PRESI_CLIENT *pc, struct ctl_filter *f) {
+	struct ctl_job_info info[64];
+	int n = presi_query(pc, f->job, info, 64);
+	if (n < 0) return -1;
+	for (int i=0; i<n; i++) {
+		if (f->status_mask && !(f->status_mask & (1u << info[i].status))) continue;
+		if (f->printer >= 0 && info[i].printer != f->printer) continue;
+		printf("SNAPSHOT job %d %s printer=%d\n", info[i].id,
+			info[i].status < 6 ? job_states[info[i].status] : "?", info[i].printer);
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct ctl_filter f = { -1, -1, 0, 0 };
+	char *path = CTL_SOCKET;
+	int delay = 0, opt;
+
+	while ((opt = getopt(argc, argv, "s:j:p:S:JPd:")) != -1) {
+		switch (opt) {
+		case 's': path = optarg; break;
+		case 'j': f.job = atoi(optarg); break;
+		case 'p': f.printer = atoi(optarg); break;
+		case 'S': {
+			int st = 0;
+			while (st < 6 && strcmp(optarg, job_states[st])) st++;
+			if (st == 6) usage(argv[0]);
+			f.status_mask |= 1u << st;
+			break;
+		}
+		case 'J': f.kinds |= CTL_WATCH_JOBS; break;
+		case 'P': f.kinds |= CTL_WATCH_PRINTERS; break;
+		case 'd': delay = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+
+	PRESI_CLIENT *pc = presi_client_open(path);
+	if (!pc || presi_subscribe(pc, &f) != CTL_OK) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	struct evring_rec ev;
+	int rc;
+	while ((rc = presi_next_event(pc, &ev)) >= 0) {
+		if (rc == 1) {
+			printf("RESYNC %llu events dropped\n", (unsigned long long)ev.time_ns);
+			if (resync(pc, &f) < 0) break;
+			continue;
+		}
+		print_event(&ev);
+		if (delay) usleep(delay);      // Simulate a slow consumer
+	}
+	presi_client_close(pc);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+/*
+ * Presi: the simplest converter worker (presi_worker.h)
+ *
+ * Copies each job's input to its output, frame by frame.  -d sleeps that many
+ * milliseconds once at startup, standing in for the interpreter, font cache or
+ * library a real converter loads before it can do any work, which is what
+ * keeping instances warm saves.
+ *
+ *   conversion txt pdf worker:bin/presi_wcat -d 200
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "presi_worker.h"
+
+static char buf[PRESI_WF_MAX];
+
+static void usage(char *prog) {
+	fprintf(stderr, "Usage: %s [-d startup-ms]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+static int read_all(void *p, size_t n) {       // 0, or -1 at end of file or on error
+	while (n) {
+		ssize_t k = read(STDIN_FILENO, p, n);
+		if (k < 0 && errno == EINTR) continue;
+		if (k <= 0) return -1;
+		p = (char *)p + k;
+		n -= k;
+	}
+	return 0;
+}
+
+static int write_all(const void *p, size_t n) {
+	while (n) {
+		ssize_t k = write(STDOUT_FILENO, p, n);
+		if (k < 0 && errno == EINTR) continue;
+		if (k <= 0) return -1;
+		p = (const char *)p + k;
+		n -= k;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int opt;
+	long startup_ms = 0;
+	while ((opt = getopt(argc, argv, "d:")) != -1) {
+		if (opt == 'd') startup_ms = atol(optarg);
+		else usage(argv[0]);
+	}
+	if (startup_ms > 0) nanosleep(&(struct timespec){ startup_ms / 1000, startup_ms % 1000 * 1000000 }, NULL);
+
+	struct presi_wframe h;
+	while (read_all(&h, sizeof(h)) == 0) {        // One frame of the current job
+		if (h.len > PRESI_WF_MAX || read_all(buf, h.len) < 0) return EXIT_FAILURE;
+		if (h.type == PRESI_WF_DATA) {
+			if (write_all(&h, sizeof(h)) < 0 || write_all(buf, h.len) < 0) return EXIT_FAILURE;
+		} else if (h.type == PRESI_WF_END) {
+			if (write_all(&h, sizeof(h)) < 0) return EXIT_FAILURE;
+		} else {
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
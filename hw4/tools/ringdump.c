@@ -0,0 +1,122 @@
+/*
+ * Presi: event ring reader
+ *
+ * Drains the binary event ring of a running spooler (see "ring on") and
+ * prints the records, or saves them to a dump file for offline analysis.
+ * Also prints dump files written by "ring dump" or by this tool.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "evring.h"
+
+static char *job_states[] = { "created", "running", "paused", "finished", "aborted", "deleted" };
+static char *printer_states[] = { "disabled", "idle", "busy" };
+
+static void print_rec(struct evring_rec *r) {
+	int printer_ev = r->type == EVR_PRINTER_DEFINED || r->type == EVR_PRINTER_STATUS;
+	char *st = printer_ev ? (r->status < 3 ? printer_states[r->status] : "?")
+			      : (r->status < 6 ? job_states[r->status] : "?");
+
+	printf("%llu.%06llu: %-13s [%d: %s",
+		(unsigned long long)(r->time_ns / 1000000000u),
+		(unsigned long long)(r->time_ns % 1000000000u / 1000), evring_type_name(r->type), r->id, st);
+	if (r->type == EVR_JOB_STARTED) printf(", printer %d, pgid %d", r->aux, r->arg);
+	else if (r->type == EVR_JOB_FINISHED || r->type == EVR_JOB_ABORTED) printf(", 0x%x", r->arg);
+	else if (r->type == EVR_JOB_LATE) printf(", late by %ds", r->arg);
+	printf("]\n");
+}
+
+static int print_dump(int fd) {
+	struct evring_rec r;
+	while (read(fd, &r, sizeof(r)) == sizeof(r))
+		print_rec(&r);
+	return 0;
+}
+
+static int follow_ring(char *path, char *out, int follow) {
+	int fd = open(path, O_RDWR);
+	struct stat sb;
+	if (fd < 0 || fstat(fd, &sb) < 0) return -1;
+	struct evring_hdr *h = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (h == MAP_FAILED) return -1;
+
+	int ofd = -1;
+	if (out) {
+		ofd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		struct evring_hdr d;
+		memset(&d, 0, sizeof(d));
+		d.magic = EVDUMP_MAGIC;
+		d.version = EVRING_VERSION;
+		d.rec_size = sizeof(struct evring_rec);
+		if (ofd < 0 || write(ofd, &d, sizeof(d)) != sizeof(d)) return -1;
+	}
+
+	struct timespec nap = { 0, 1000000 };
+	do {
+		uint64_t n;
+		if (ofd >= 0) {
+			n = evring_drain(h, ofd);
+		} else {                           // Print, then release the slots
+			uint64_t head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+			n = head - h->tail;
+			for (uint64_t s=h->tail; s!=head; s++)
+				print_rec(&EVRING_RECS(h)[s & (h->slots - 1)]);
+			__atomic_store_n(&h->tail, head, __ATOMIC_RELEASE);
+			fflush(stdout);
+		}
+		if (!n) nanosleep(&nap, NULL);
+	} while (follow && __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) == EVRING_MAGIC);
+
+	if (ofd >= 0) close(ofd);
+	munmap(h, sb.st_size);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int follow = 0, opt;
+	char *out = NULL;
+
+	while ((opt = getopt(argc, argv, "fo:")) != -1) {
+		switch (opt) {
+		case 'f': follow = 1; break;
+		case 'o': out = optarg; break;
+		default:
+			fprintf(stderr, "Usage: %s [-f] [-o <dump_file>] <ring_or_dump_file>\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "Usage: %s [-f] [-o <dump_file>] <ring_or_dump_file>\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	int fd = open(argv[optind], O_RDONLY);
+	struct evring_hdr h;
+	if (fd < 0 || read(fd, &h, sizeof(h)) != sizeof(h)) {
+		perror(argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+
+	int rc;
+	if (h.magic == EVDUMP_MAGIC) {
+		rc = print_dump(fd);
+	} else if (h.magic == EVRING_MAGIC && h.rec_size == sizeof(struct evring_rec)) {
+		rc = follow_ring(argv[optind], out, follow);
+	} else {
+		fprintf(stderr, "%s: not an event ring or dump file\n", argv[optind]);
+		rc = -1;
+	}
+	close(fd);
+	exit(rc ? EXIT_FAILURE : EXIT_SUCCESS);
+}